@@ -0,0 +1,112 @@
+#include "activity.h"
+
+#include <algorithm>
+
+void AddressActivity::grow(uint32_t address){
+    if(address < first.size()) return;
+    /* Grown ahead so that a run of new addresses does not resize for each of them */
+    size_t size = std::min<size_t>(std::max<size_t>((size_t) address + 1, first.size() + first.size() / 2), (size_t) UINT32_MAX + 1);
+    first.resize(size, 0);
+    last.resize(size, 0);
+    transactions.resize(size, 0);
+    received.resize(size, 0);
+    sent.resize(size, 0);
+}
+
+void AddressActivity::flowsOf(getrawtransaction_t& transaction, std::vector<walletflow_t>& flows){
+    flows.clear();
+    for(vin_t& in : transaction.vin) if(!in.isCoinbase) flows.push_back({in.scriptSig.address, 0, in.value});
+    for(vout_t& out : transaction.vout) if(!out.unspendable) flows.push_back({out.scriptPubKey.addresses[0], out.value, 0});
+    std::sort(flows.begin(), flows.end(), [](const walletflow_t& a, const walletflow_t& b){ return a.wallet < b.wallet; });
+    size_t kept = 0;
+    for(size_t i = 0; i < flows.size(); i++){
+        if(kept > 0 && flows[kept - 1].wallet == flows[i].wallet){
+            flows[kept - 1].received += flows[i].received;
+            flows[kept - 1].sent += flows[i].sent;
+        }
+        else flows[kept++] = flows[i];
+    }
+    flows.resize(kept);
+}
+
+void AddressActivity::recordTransaction(uint32_t height, const walletflow_t* begin, const walletflow_t* end, EntityStore* store, std::vector<activityundo_t>* undo){
+    uint32_t stored = height + 1;
+    for(const walletflow_t* flow = begin; flow != end; flow++){
+        uint32_t address = flow->wallet;
+        grow(address);
+        if(undo) undo->push_back({address, first[address], last[address], transactions[address], received[address], sent[address]});
+        if(first[address] == 0 || first[address] > stored) first[address] = stored;
+        last[address] = std::max(last[address], stored);
+        transactions[address]++;
+        received[address] += flow->received;
+        sent[address] += flow->sent;
+    }
+    if(store) store->addTransaction(begin, end, height);
+}
+
+void AddressActivity::record(uint32_t height, transactions_t& blockTransactions, EntityStore* store, std::vector<activityundo_t>* undo){
+    for(getrawtransaction_t& transaction : blockTransactions){
+        flowsOf(transaction, flows);
+        recordTransaction(height, flows.data(), flows.data() + flows.size(), store, undo);
+    }
+}
+
+/* Backwards, an address changed twice gets the totals it had before the first change */
+void AddressActivity::undo(const std::vector<activityundo_t>& changes){
+    for(auto it = changes.rbegin(); it != changes.rend(); ++it){
+        first[it->address] = it->firstSeen;
+        last[it->address] = it->lastSeen;
+        transactions[it->address] = it->transactions;
+        received[it->address] = it->received;
+        sent[it->address] = it->sent;
+    }
+}
+
+uint32_t AddressActivity::firstSeen(uint32_t address) const{
+    return address < first.size() && first[address] != 0 ? first[address] - 1 : unseen;
+}
+
+uint32_t AddressActivity::lastSeen(uint32_t address) const{
+    return address < last.size() && last[address] != 0 ? last[address] - 1 : unseen;
+}
+
+valuetotals_t AddressActivity::totals(uint32_t address) const{
+    valuetotals_t totals;
+    if(address >= first.size()) return totals;
+    totals.received = received[address];
+    totals.sent = sent[address];
+    totals.transactions = transactions[address];
+    totals.firstHeight = firstSeen(address);
+    totals.lastHeight = lastSeen(address);
+    return totals;
+}
+
+/* unseen plus one wraps to the 0 of never seen */
+void AddressActivity::set(uint32_t address, const valuetotals_t& totals){
+    grow(address);
+    first[address] = totals.firstHeight + 1;
+    last[address] = totals.lastHeight + 1;
+    transactions[address] = totals.transactions;
+    received[address] = totals.received;
+    sent[address] = totals.sent;
+}
+
+size_t AddressActivity::size() const{
+    return first.size();
+}
+
+void AddressActivity::mapTo(const std::string& directory){
+    first.mapTo(directory, (size_t) UINT32_MAX + 1);
+    last.mapTo(directory, (size_t) UINT32_MAX + 1);
+    transactions.mapTo(directory, (size_t) UINT32_MAX + 1);
+    received.mapTo(directory, (size_t) UINT32_MAX + 1);
+    sent.mapTo(directory, (size_t) UINT32_MAX + 1);
+}
+
+size_t AddressActivity::memoryUsage() const{
+    return first.memoryUsage() + last.memoryUsage() + transactions.memoryUsage() + received.memoryUsage() + sent.memoryUsage() + flows.capacity() * sizeof(walletflow_t);
+}
+
+size_t AddressActivity::mappedBytes() const{
+    return first.mappedBytes() + last.mappedBytes() + transactions.mappedBytes() + received.mappedBytes() + sent.mappedBytes();
+}
@@ -0,0 +1,55 @@
+#ifndef ACTIVITY_H
+#define ACTIVITY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "definition.h"
+#include "entitystore.h"
+#include "mappedcolumn.h"
+
+/* One address whose totals a block changed, with the totals it had before */
+struct activityundo_t{
+    uint32_t address;
+    uint32_t firstSeen;
+    uint32_t lastSeen;
+    uint32_t transactions;
+    int64_t received;
+    int64_t sent;
+};
+
+/* What went through each address, indexed by address ID: the satoshis it received and sent, the transactions it was in and the first and the last height it was seen at, in an input or an output. The heights are kept plus one so that 0 means never seen and a new address needs no fill. Given the store, the same totals are added to the sets of the addresses, see EntityStore::addTransaction */
+class AddressActivity{
+    public:
+    static const uint32_t unseen = valuetotals_t::unseen;
+    /* Adds the transactions of the block at height. With undo the old totals of the addresses it changed are appended there, for undo to put them back, the store keeps its own journal */
+    void record(uint32_t height, transactions_t& transactions, EntityStore* store = nullptr, std::vector<activityundo_t>* undo = nullptr);
+    void recordTransaction(uint32_t height, const walletflow_t* begin, const walletflow_t* end, EntityStore* store = nullptr, std::vector<activityundo_t>* undo = nullptr);
+    /* Sums what the transaction moved for each of its addresses, into flows in address order, the coinbase input has no address */
+    static void flowsOf(getrawtransaction_t& transaction, std::vector<walletflow_t>& flows);
+    void undo(const std::vector<activityundo_t>& changes);
+    /* unseen for an address never seen */
+    uint32_t firstSeen(uint32_t address) const;
+    uint32_t lastSeen(uint32_t address) const;
+    valuetotals_t totals(uint32_t address) const;
+    /* Replaces the totals of the address, for a load */
+    void set(uint32_t address, const valuetotals_t& totals);
+    /* Addresses the columns have room for, past the highest one seen */
+    size_t size() const;
+    void mapTo(const std::string& directory);
+    size_t memoryUsage() const;
+    size_t mappedBytes() const;
+    private:
+    MappedColumn<uint32_t> first;
+    MappedColumn<uint32_t> last;
+    MappedColumn<uint32_t> transactions;
+    MappedColumn<int64_t> received;
+    MappedColumn<int64_t> sent;
+    /* The flows of the transaction being recorded, kept so the memory is reused */
+    std::vector<walletflow_t> flows;
+
+    void grow(uint32_t address);
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "address.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include "hash.h"
+#include "metrics.h"
+
+const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+/* Inputs up to this many bytes are encoded without touching the heap, every address payload fits */
+static const size_t base58StackBytes = 128;
+
+/* The number is read as 32 bit limbs and divided by 58^5 at a time, so every pass over the limbs yields five digits instead of one */
+std::string encodeBase58(const unsigned char *pbegin, const unsigned char *pend)
+{
+    static const uint32_t base58Pow5 = 58u * 58u * 58u * 58u * 58u;
+    size_t zeroes = 0;
+    while (pbegin != pend && *pbegin == 0) {
+        pbegin++;
+        zeroes++;
+    }
+    size_t len = pend - pbegin;
+    size_t limbCount = (len + 3) / 4;
+    size_t digitsMax = len * 138 / 100 + 6;
+
+    uint32_t stackLimbs[base58StackBytes / 4];
+    char stackDigits[base58StackBytes * 138 / 100 + 6];
+    std::vector<uint32_t> heapLimbs;
+    std::vector<char> heapDigits;
+    uint32_t* limbs = stackLimbs;
+    char* digits = stackDigits;
+    if (len > base58StackBytes) {
+        heapLimbs.resize(limbCount);
+        heapDigits.resize(digitsMax);
+        limbs = &heapLimbs[0];
+        digits = &heapDigits[0];
+    }
+
+    /* Big endian limbs, the first one takes the bytes left over */
+    size_t head = len % 4 == 0 ? 4 : len % 4;
+    const unsigned char* p = pbegin;
+    for (size_t i = 0; i < limbCount; i++) {
+        uint32_t limb = 0;
+        for (size_t k = 0; k < (i == 0 ? head : 4); k++) limb = (limb << 8) | *p++;
+        limbs[i] = limb;
+    }
+
+    /* Digits are produced least significant first, from the end of the buffer */
+    size_t pos = digitsMax;
+    size_t first = 0;
+    while (first < limbCount && limbs[first] == 0) first++;
+    while (first < limbCount) {
+        uint64_t rem = 0;
+        for (size_t i = first; i < limbCount; i++) {
+            uint64_t cur = (rem << 32) | limbs[i];
+            limbs[i] = (uint32_t) (cur / base58Pow5);
+            rem = cur % base58Pow5;
+        }
+        while (first < limbCount && limbs[first] == 0) first++;
+        for (int k = 0; k < 5; k++) {
+            digits[--pos] = pszBase58[rem % 58];
+            rem /= 58;
+        }
+    }
+    /* The last group of five may have produced leading zero digits */
+    while (pos < digitsMax && digits[pos] == '1') pos++;
+
+    std::string str;
+    str.reserve(zeroes + (digitsMax - pos));
+    str.assign(zeroes, '1');
+    str.append(digits + pos, digitsMax - pos);
+    return str;
+}
+
+std::string encodeBase58(const std::vector<unsigned char> &vch)
+{
+    return encodeBase58(&vch[0], &vch[0] + vch.size());
+}
+
+void sha256d(const unsigned char *data, size_t len, unsigned char out[32]){
+    unsigned char first[32];
+    Sha256().write(data, len).finalize(first);
+    Sha256().write(first, 32).finalize(out);
+}
+
+void hash160(const unsigned char *data, size_t len, unsigned char out[20]){
+    unsigned char sha[32];
+    Sha256().write(data, len).finalize(sha);
+    ripemd160(sha, 32, out);
+}
+
+std::string toHex(const unsigned char *data, size_t len, bool reversed){
+    static const char hex[] = "0123456789abcdef";
+    std::string str(len * 2, '0');
+    for(size_t i = 0; i < len; i++){
+        unsigned char c = reversed ? data[len - 1 - i] : data[i];
+        str[2 * i] = hex[c >> 4];
+        str[2 * i + 1] = hex[c & 0xF];
+    }
+    return str;
+}
+
+/* Version byte followed by the payload and the first four bytes of its double SHA-256 */
+std::string encodeBase58Check(unsigned char version, const unsigned char *payload, size_t len){
+    unsigned char stackData[64];
+    std::vector<unsigned char> heapData;
+    unsigned char* data = stackData;
+    if(len + 5 > sizeof(stackData)){
+        heapData.resize(len + 5);
+        data = &heapData[0];
+    }
+    data[0] = version;
+    std::memcpy(data + 1, payload, len);
+    unsigned char checksum[32];
+    sha256d(data, len + 1, checksum);
+    std::memcpy(data + len + 1, checksum, 4);
+    return encodeBase58(data, data + len + 5);
+}
+
+/* Bech32 (BIP 173) for witness version 0 and bech32m (BIP 350) for the later versions */
+
+static const char* bech32Charset = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+
+static uint32_t bech32Polymod(uint32_t chk, const unsigned char *values, size_t len){
+    static const uint32_t generator[5] = {0x3b6a57b2, 0x26508e6d, 0x1ea119fa, 0x3d4233dd, 0x2a1462b3};
+    for(size_t j = 0; j < len; j++){
+        uint32_t top = chk >> 25;
+        chk = ((chk & 0x1ffffff) << 5) ^ values[j];
+        for(int i = 0; i < 5; i++) chk ^= -((top >> i) & 1) & generator[i];
+    }
+    return chk;
+}
+
+/* Witness programs are at most 40 bytes, which is 64 five bit groups plus the version, and the prefixes in use are short */
+std::string encodeSegwitAddress(const char* hrp, int witnessVersion, const unsigned char *program, size_t len){
+    size_t hrpLen = std::strlen(hrp);
+    if(len > 40 || hrpLen > 16) return "";
+    unsigned char data[1 + 64];
+    size_t dataLen = 0;
+    data[dataLen++] = witnessVersion;
+    /* Regroup the program from 8 bit bytes into 5 bit groups */
+    uint32_t acc = 0;
+    int bits = 0;
+    for(size_t i = 0; i < len; i++){
+        acc = (acc << 8) | program[i];
+        bits += 8;
+        while(bits >= 5){
+            bits -= 5;
+            data[dataLen++] = (acc >> bits) & 31;
+        }
+    }
+    if(bits > 0) data[dataLen++] = (acc << (5 - bits)) & 31;
+
+    /* The checksum covers the expanded prefix, the data and six zero groups */
+    uint32_t chk = 1;
+    for(size_t i = 0; i < hrpLen; i++){
+        unsigned char high = hrp[i] >> 5;
+        chk = bech32Polymod(chk, &high, 1);
+    }
+    unsigned char zero = 0;
+    chk = bech32Polymod(chk, &zero, 1);
+    for(size_t i = 0; i < hrpLen; i++){
+        unsigned char low = hrp[i] & 31;
+        chk = bech32Polymod(chk, &low, 1);
+    }
+    static const unsigned char zeros[6] = {0};
+    chk = bech32Polymod(chk, data, dataLen);
+    chk = bech32Polymod(chk, zeros, 6);
+    uint32_t constant = witnessVersion == 0 ? 1 : 0x2bc830a3;
+    uint32_t mod = chk ^ constant;
+
+    char out[16 + 1 + sizeof(data) + 6];
+    size_t pos = 0;
+    for(size_t i = 0; i < hrpLen; i++) out[pos++] = hrp[i];
+    out[pos++] = '1';
+    for(size_t i = 0; i < dataLen; i++) out[pos++] = bech32Charset[data[i]];
+    for(int i = 0; i < 6; i++) out[pos++] = bech32Charset[(mod >> (5 * (5 - i))) & 31];
+    return std::string(out, pos);
+}
+
+static const char* scriptTypeNames[scriptTypeCount] = {"pubkey", "pubkeyhash", "scripthash", "witness_v0_keyhash", "witness_v0_scripthash", "witness_v1_taproot", "witness_unknown", "multisig", "nulldata", "nonstandard"};
+
+const char* scriptTypeName(scripttype_t type){
+    return scriptTypeNames[type < scriptTypeCount ? type : scriptNonstandard];
+}
+
+scripttype_t scriptTypeOf(const std::string& name){
+    for(int type = 0; type < scriptTypeCount; type++) if(name == scriptTypeNames[type]) return (scripttype_t) type;
+    return scriptNonstandard;
+}
+
+bool scriptHasAddress(scripttype_t type){
+    return type == scriptP2PKH || type == scriptP2SH || type == scriptP2WPKH || type == scriptP2WSH || type == scriptP2TR || type == scriptWitnessUnknown;
+}
+
+std::string scriptToAddress(const unsigned char *script, size_t len, scripttype_t& type){
+    unsigned char hash[20];
+    /* OP_DUP OP_HASH160 <20> OP_EQUALVERIFY OP_CHECKSIG */
+    if(len == 25 && script[0] == 0x76 && script[1] == 0xa9 && script[2] == 20 && script[23] == 0x88 && script[24] == 0xac){
+        type = scriptP2PKH;
+        return encodeBase58Check(0x00, script + 3, 20);
+    }
+    /* OP_HASH160 <20> OP_EQUAL */
+    if(len == 23 && script[0] == 0xa9 && script[1] == 20 && script[22] == 0x87){
+        type = scriptP2SH;
+        return encodeBase58Check(0x05, script + 2, 20);
+    }
+    /* <33 or 65 byte key> OP_CHECKSIG */
+    if((len == 35 && script[0] == 33) || (len == 67 && script[0] == 65)){
+        if(script[len - 1] == 0xac){
+            type = scriptP2PK;
+            hash160(script + 1, len - 2, hash);
+            return encodeBase58Check(0x00, hash, 20);
+        }
+    }
+    /* OP_0..OP_16 followed by a single push of 2 to 40 bytes */
+    if(len >= 4 && len <= 42 && (script[0] == 0x00 || (script[0] >= 0x51 && script[0] <= 0x60)) && script[1] + 2u == len){
+        int version = script[0] == 0x00 ? 0 : script[0] - 0x50;
+        size_t programLen = script[1];
+        if(version == 0 && programLen == 20) type = scriptP2WPKH;
+        else if(version == 0 && programLen == 32) type = scriptP2WSH;
+        else if(version == 0){
+            type = scriptNonstandard;
+            return "";
+        }
+        else if(version == 1 && programLen == 32) type = scriptP2TR;
+        else type = scriptWitnessUnknown;
+        return encodeSegwitAddress("bc", version, script + 2, programLen);
+    }
+    if(len >= 1 && script[0] == 0x6a){
+        type = scriptNullData;
+        return "";
+    }
+    /* OP_m <keys> OP_n OP_CHECKMULTISIG */
+    if(len >= 3 && script[0] >= 0x51 && script[0] <= 0x60 && script[len - 2] >= 0x51 && script[len - 2] <= 0x60 && script[len - 1] == 0xae){
+        type = scriptMultisig;
+        return "";
+    }
+    type = scriptNonstandard;
+    return "";
+}
+
+std::string scriptToAddress(const unsigned char *script, size_t len, std::string& type){
+    scripttype_t kind;
+    std::string address = scriptToAddress(script, len, kind);
+    type = scriptTypeName(kind);
+    return address;
+}
+
+std::string scriptIdentity(const unsigned char *script, size_t len, scripttype_t& type){
+    std::string address = scriptToAddress(script, len, type);
+    if(!address.empty() || type == scriptNullData) return address;
+    unsigned char hash[20];
+    hash160(script, len, hash);
+    return "script:" + toHex(hash, 20);
+}
+
+static int hexValue(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool fromHex(const std::string& hex, unsigned char *out, size_t maxLen, size_t& len){
+    if(hex.size() % 2 != 0 || hex.size() / 2 > maxLen) return false;
+    len = hex.size() / 2;
+    for(size_t i = 0; i < len; i++){
+        int high = hexValue(hex[2 * i]), low = hexValue(hex[2 * i + 1]);
+        if(high < 0 || low < 0) return false;
+        out[i] = (high << 4) | low;
+    }
+    return true;
+}
+
+/* Every standard script fits, bare multisig with three uncompressed keys being the longest, anything longer has no address and is not decoded */
+static const size_t scriptStackBytes = 512;
+
+std::string scriptHexToAddress(const std::string& hex, std::string& type){
+    unsigned char script[scriptStackBytes];
+    size_t len = 0;
+    if(!fromHex(hex, script, sizeof(script), len)){
+        /* Long data carriers are still recognised by their first opcode */
+        type = hex.compare(0, 2, "6a") == 0 ? "nulldata" : "nonstandard";
+        return "";
+    }
+    return scriptToAddress(script, len, type);
+}
+
+/* Unlike the address, the identity of a script longer than the stack buffer is still needed, it is decoded on the heap */
+std::string scriptHexIdentity(const std::string& hex, scripttype_t& type){
+    unsigned char stackScript[scriptStackBytes];
+    std::vector<unsigned char> heapScript;
+    unsigned char* script = stackScript;
+    if(hex.size() / 2 > sizeof(stackScript)){
+        heapScript.resize(hex.size() / 2);
+        script = heapScript.data();
+    }
+    size_t len = 0;
+    if(!fromHex(hex, script, std::max(sizeof(stackScript), heapScript.size()), len)){
+        /* Not hex at all, the node never sends that, but it is kept apart from the empty identity all the same */
+        type = scriptNonstandard;
+        return "script:" + hex;
+    }
+    return scriptIdentity(script, len, type);
+}
+
+/* Registered on first use, index 0 counts the spent prevouts and 1 the outputs */
+struct scripttypecounters_t{
+    Counter* counters[2][scriptTypeCount];
+    scripttypecounters_t(){
+        for(int type = 0; type < scriptTypeCount; type++){
+            std::string name = scriptTypeNames[type];
+            counters[0][type] = &metrics.counter("script_types_total", "Outputs created and prevouts spent, by script type", "side=\"input\",type=\"" + name + "\"");
+            counters[1][type] = &metrics.counter("script_types_total", "Outputs created and prevouts spent, by script type", "side=\"output\",type=\"" + name + "\"");
+        }
+    }
+};
+
+static scripttypecounters_t& scriptTypeCounters(){
+    static scripttypecounters_t counters;
+    return counters;
+}
+
+void addScriptTypes(const scripttypecounts_t& counts){
+    scripttypecounters_t& counters = scriptTypeCounters();
+    for(int type = 0; type < scriptTypeCount; type++){
+        if(counts.inputs[type]) counters.counters[0][type]->add(counts.inputs[type]);
+        if(counts.outputs[type]) counters.counters[1][type]->add(counts.outputs[type]);
+    }
+}
+
+void printScriptTypes(std::ostream& out){
+    Counter** outputs = scriptTypeCounters().counters[1];
+    out << "Outputs by type:";
+    for(int type = 0; type < scriptTypeCount; type++) if(outputs[type]->get()) out << " " << scriptTypeNames[type] << " " << outputs[type]->get();
+    out << ", " << outputs[scriptNullData]->get() << " unspendable" << std::endl;
+}
@@ -0,0 +1,51 @@
+#ifndef ADDRESS_H
+#define ADDRESS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+/* Derivation of the standard address strings from raw scripts and keys, the same strings bitcoind reports in the address field of a scriptPubKey */
+
+std::string encodeBase58(const unsigned char *pbegin, const unsigned char *pend);
+std::string encodeBase58(const std::vector<unsigned char> &vch);
+std::string encodeBase58Check(unsigned char version, const unsigned char *payload, size_t len);
+std::string encodeSegwitAddress(const char* hrp, int witnessVersion, const unsigned char *program, size_t len);
+
+void sha256d(const unsigned char *data, size_t len, unsigned char out[32]);
+void hash160(const unsigned char *data, size_t len, unsigned char out[20]);
+std::string toHex(const unsigned char *data, size_t len, bool reversed = false);
+
+/* The kinds of scriptPubKey told apart, a witness v0 program of any other length than 20 or 32 is nonstandard as it is for bitcoind */
+enum scripttype_t : uint8_t { scriptP2PK, scriptP2PKH, scriptP2SH, scriptP2WPKH, scriptP2WSH, scriptP2TR, scriptWitnessUnknown, scriptMultisig, scriptNullData, scriptNonstandard, scriptTypeCount };
+
+/* The name bitcoind uses for the type (pubkey, pubkeyhash, witness_v0_keyhash, ...) and back, a name it does not know is nonstandard */
+const char* scriptTypeName(scripttype_t type);
+scripttype_t scriptTypeOf(const std::string& name);
+/* Types that have an address of their own, the node reports it in the address field of the scriptPubKey */
+bool scriptHasAddress(scripttype_t type);
+
+/* Classifies the script and returns its address, or an empty string for scripts that have none. Pay to pubkey scripts are given the P2PKH address of their key */
+std::string scriptToAddress(const unsigned char *script, size_t len, scripttype_t& type);
+/* Same with the bitcoind name of the type */
+std::string scriptToAddress(const unsigned char *script, size_t len, std::string& type);
+/* Same from the hex of the script as found in the hex field of a decoded scriptPubKey, the address does not have to come from the node */
+std::string scriptHexToAddress(const std::string& hex, std::string& type);
+bool fromHex(const std::string& hex, unsigned char *out, size_t maxLen, size_t& len);
+
+/* What the script is clustered as: its address when it has one, "script:" and the hex of the hash160 of the script for bare multisig and nonstandard scripts, so that every such script is a wallet of its own instead of all of them sharing the empty address. Data carriers can never be spent and get an empty string, the decoders keep them in the transaction as unspendable outputs without an address */
+std::string scriptIdentity(const unsigned char *script, size_t len, scripttype_t& type);
+std::string scriptHexIdentity(const std::string& hex, scripttype_t& type);
+
+/* Outputs and spent prevouts of each type, counted by a decoder for one block and then added to the metrics at once */
+struct scripttypecounts_t{
+    uint64_t outputs[scriptTypeCount] = {0};
+    uint64_t inputs[scriptTypeCount] = {0};
+};
+void addScriptTypes(const scripttypecounts_t& counts);
+/* One line with the outputs of every type seen so far, and how many of them were unspendable */
+void printScriptTypes(std::ostream& out);
+
+#endif
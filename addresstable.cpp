@@ -0,0 +1,346 @@
+#include "addresstable.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+AddressTable addressTable;
+
+/* Limits of a mapped table: the slots of one stripe, the bytes of all the names */
+static const size_t maxSlots = (size_t) 1 << 28;
+static const size_t maxPoolBytes = (size_t) 1 << 38;
+static const size_t firstSlots = 1024;
+
+/* Bits set for every address in its word of the filter, with 16 bits of filter per address this lets through well under one new address in a hundred */
+static const int filterBits = 4;
+static const size_t filterBitsPerAddress = 16;
+
+/* The queue of the batch open on the thread, if any */
+static thread_local std::vector<std::string>* batched = nullptr;
+
+AddressTable::AddressTable() : prefilter(false), mapped(false), stripes(new stripe_t[stripeCount]), chunks(new const std::string**[chunkSize]()), count(0) {}
+
+AddressTable::~AddressTable(){
+    for(uint32_t i = 0; i < chunkSize; i++) delete[] chunks[i];
+    delete[] chunks;
+    delete[] stripes;
+}
+
+/* The last characters of an address come from its checksum or its hash and are spread evenly, a mix of the last 16 is enough to pick the stripe and the filter bits without hashing the whole string a second time. The top bits pick the stripe, the low ones the word of the filter */
+static uint64_t addressHash(const std::string& address){
+    uint64_t h = 14695981039346656037ULL;
+    size_t from = address.size() > 16 ? address.size() - 16 : 0;
+    for(size_t i = from; i < address.size(); i++) h = (h ^ (unsigned char) address[i]) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* The bits of the address within its word, taken six at a time from another mix of the hash */
+static uint64_t filterMask(uint64_t hash){
+    uint64_t g = hash * 0x9e3779b97f4a7c15ULL, mask = 0;
+    for(int i = 0; i < filterBits; i++, g <<= 6) mask |= 1ULL << (g >> 58);
+    return mask;
+}
+
+/* Addresses of the stripe, a mapped table counts its slots */
+static size_t addressesOf(const std::unordered_map<std::string,uint32_t>& ids, size_t used){
+    return ids.size() + used;
+}
+
+/* Called with the lock of the stripe held */
+bool AddressTable::mayContain(const stripe_t& stripe, uint64_t hash){
+    if(stripe.filter.empty()) return addressesOf(stripe.ids, stripe.used) > 0;
+    uint64_t mask = filterMask(hash);
+    return (stripe.filter[hash & (stripe.filter.size() - 1)] & mask) == mask;
+}
+
+void AddressTable::remember(stripe_t& stripe, uint64_t hash){
+    size_t addresses = addressesOf(stripe.ids, stripe.used);
+    if(addresses > stripe.filterCapacity) resizeFilter(stripe, std::max<size_t>(1024, addresses * 2));
+    else stripe.filter[hash & (stripe.filter.size() - 1)] |= filterMask(hash);
+}
+
+/* Sizes the filter for capacity addresses, a power of two words, and sets the bits of every address of the stripe again */
+void AddressTable::resizeFilter(stripe_t& stripe, size_t capacity){
+    size_t words = 1;
+    while(words * 64 < capacity * filterBitsPerAddress) words *= 2;
+    stripe.filter.assign(words, 0);
+    stripe.filterCapacity = capacity;
+    for(auto& a : stripe.ids){
+        uint64_t hash = addressHash(a.first);
+        stripe.filter[hash & (words - 1)] |= filterMask(hash);
+    }
+    for(const slot_t& slot : stripe.slots){
+        if(slot.id != 0) stripe.filter[slot.hash & (words - 1)] |= filterMask(slot.hash);
+    }
+}
+
+/* Called with the lock of the stripe held. Finds the slot of the address, or the free slot it would go in */
+bool AddressTable::probe(stripe_t& stripe, uint64_t hash, const std::string& address, size_t& slot){
+    size_t mask = stripe.slots.size() - 1;
+    for(slot = hash & mask; stripe.slots[slot].id != 0; slot = (slot + 1) & mask){
+        if(stripe.slots[slot].hash != hash) continue;
+        uint32_t id = stripe.slots[slot].id - 1;
+        if(offsets[id + 1] - offsets[id] == address.size() && std::memcmp(&pool[offsets[id]], address.data(), address.size()) == 0) return true;
+    }
+    return false;
+}
+
+/* Moves the slots of the stripe to a new column of slotCount slots, a power of two. The hashes are in the slots, the names are not read again */
+void AddressTable::resizeSlots(stripe_t& stripe, size_t slotCount){
+    MappedColumn<slot_t> resized;
+    resized.mapTo(directory, maxSlots);
+    resized.adviseRandom();
+    resized.resize(slotCount, slot_t());
+    size_t mask = slotCount - 1;
+    for(const slot_t& slot : stripe.slots){
+        if(slot.id == 0) continue;
+        size_t i = slot.hash & mask;
+        while(resized[i].id != 0) i = (i + 1) & mask;
+        resized[i] = slot;
+    }
+    stripe.slots = std::move(resized);
+}
+
+/* Called with the ID lock held, the caller publishes the count once the name is in place, which makes the name visible to the readers */
+uint32_t AddressTable::nextId(){
+    uint32_t id = count.load(std::memory_order_relaxed);
+    if(id == UINT32_MAX) throw std::runtime_error("AddressTable: out of address IDs");
+    return id;
+}
+
+/* Returns the ID of the address, assigning the next free one if the address has not been seen yet. An address the filter does not know goes straight to the insert */
+uint32_t AddressTable::intern(const std::string& address){
+    if(batched){
+        batched->push_back(address);
+        return batched->size() - 1;
+    }
+    uint64_t hash = addressHash(address);
+    stripe_t& stripe = stripes[hash >> (64 - stripeBits)];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    stripe.stats.lookups++;
+    if(mapped){
+        size_t slot;
+        if(!prefilter || mayContain(stripe, hash)){
+            if(probe(stripe, hash, address, slot)) return stripe.slots[slot].id - 1;
+            if(prefilter) stripe.stats.falsePositives++;
+        }
+        else{
+            stripe.stats.skipped++;
+            size_t mask = stripe.slots.size() - 1;
+            for(slot = hash & mask; stripe.slots[slot].id != 0; slot = (slot + 1) & mask);
+        }
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> idGuard(idLock);
+            id = nextId();
+            uint64_t end = offsets[id];
+            pool.resize(end + address.size());
+            std::memcpy(&pool[end], address.data(), address.size());
+            offsets.push_back(end + address.size());
+            count.store(id + 1, std::memory_order_release);
+        }
+        stripe.slots[slot].hash = hash;
+        stripe.slots[slot].id = id + 1;
+        if(++stripe.used * 4 > stripe.slots.size() * 3) resizeSlots(stripe, stripe.slots.size() * 2);
+        if(prefilter) remember(stripe, hash);
+        return id;
+    }
+    if(!prefilter || mayContain(stripe, hash)){
+        auto it = stripe.ids.find(address);
+        if(it != stripe.ids.end()) return it->second;
+        if(prefilter) stripe.stats.falsePositives++;
+    }
+    else stripe.stats.skipped++;
+    /* The node is inserted before the ID is taken so that only the name is placed under the ID lock, the stripe lock hides the entry until it has its ID */
+    auto it = stripe.ids.insert({address, 0}).first;
+    std::lock_guard<std::mutex> idGuard(idLock);
+    uint32_t id;
+    try{
+        id = nextId();
+    }
+    catch(...){
+        stripe.ids.erase(it);
+        throw;
+    }
+    it->second = id;
+    uint32_t chunk = id >> chunkBits;
+    if(!chunks[chunk]) chunks[chunk] = new const std::string*[chunkSize];
+    chunks[chunk][id & (chunkSize - 1)] = &it->first;
+    count.store(id + 1, std::memory_order_release);
+    if(prefilter) remember(stripe, hash);
+    return id;
+}
+
+bool AddressTable::find(const std::string& address, uint32_t& id){
+    uint64_t hash = addressHash(address);
+    stripe_t& stripe = stripes[hash >> (64 - stripeBits)];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    stripe.stats.lookups++;
+    if(prefilter && !mayContain(stripe, hash)){
+        stripe.stats.skipped++;
+        return false;
+    }
+    if(mapped){
+        size_t slot;
+        if(!probe(stripe, hash, address, slot)){
+            if(prefilter) stripe.stats.falsePositives++;
+            return false;
+        }
+        id = stripe.slots[slot].id - 1;
+        return true;
+    }
+    auto it = stripe.ids.find(address);
+    if(it == stripe.ids.end()){
+        if(prefilter) stripe.stats.falsePositives++;
+        return false;
+    }
+    id = it->second;
+    return true;
+}
+
+/* Used before a bulk load so that the hash tables are sized once, the addresses spread evenly over the stripes */
+void AddressTable::reserve(size_t count){
+    for(uint32_t i = 0; i < stripeCount; i++){
+        std::lock_guard<std::mutex> guard(stripes[i].lock);
+        if(mapped){
+            size_t slotCount = stripes[i].slots.size();
+            while(slotCount * 3 < (count / stripeCount + 1) * 4) slotCount *= 2;
+            if(slotCount > stripes[i].slots.size()) resizeSlots(stripes[i], slotCount);
+        }
+        else stripes[i].ids.reserve(count / stripeCount + 1);
+        if(prefilter && count / stripeCount + 1 > stripes[i].filterCapacity) resizeFilter(stripes[i], count / stripeCount + 1);
+    }
+}
+
+void AddressTable::enablePrefilter(){
+    for(uint32_t i = 0; i < stripeCount; i++){
+        std::lock_guard<std::mutex> guard(stripes[i].lock);
+        resizeFilter(stripes[i], std::max<size_t>(1024, addressesOf(stripes[i].ids, stripes[i].used) * 2));
+    }
+    prefilter = true;
+}
+
+void AddressTable::mapTo(const std::string& directory){
+    if(size() > 0) throw std::runtime_error("AddressTable: cannot map a table that is in use");
+    this->directory = directory;
+    pool.mapTo(directory, maxPoolBytes);
+    offsets.mapTo(directory, (size_t) UINT32_MAX + 1);
+    offsets.push_back(0);
+    for(uint32_t i = 0; i < stripeCount; i++){
+        std::lock_guard<std::mutex> guard(stripes[i].lock);
+        stripes[i].slots.mapTo(directory, maxSlots);
+        stripes[i].slots.adviseRandom();
+        stripes[i].slots.resize(firstSlots, slot_t());
+    }
+    mapped = true;
+}
+
+bool AddressTable::isMapped() const{
+    return mapped;
+}
+
+/* The addresses are grouped by stripe and each group is sorted by slot under the lock of its stripe, the addresses found get their ID there. The new ones are then interned in their order in the batch, so that they get the IDs they would have got one by one */
+void AddressTable::internAll(const std::vector<std::string>& addresses, std::vector<uint32_t>& ids){
+    ids.assign(addresses.size(), UINT32_MAX);
+    if(mapped){
+        std::vector<std::pair<uint64_t,uint32_t> > order;
+        order.reserve(addresses.size());
+        for(uint32_t i = 0; i < addresses.size(); i++) order.push_back({addressHash(addresses[i]), i});
+        std::sort(order.begin(), order.end(), [](const std::pair<uint64_t,uint32_t>& a, const std::pair<uint64_t,uint32_t>& b){ return (a.first >> (64 - stripeBits)) < (b.first >> (64 - stripeBits)); });
+        for(size_t begin = 0, end; begin < order.size(); begin = end){
+            uint32_t stripeIndex = order[begin].first >> (64 - stripeBits);
+            for(end = begin; end < order.size() && (order[end].first >> (64 - stripeBits)) == stripeIndex; end++);
+            stripe_t& stripe = stripes[stripeIndex];
+            std::lock_guard<std::mutex> guard(stripe.lock);
+            size_t mask = stripe.slots.size() - 1;
+            std::sort(order.begin() + begin, order.begin() + end, [mask](const std::pair<uint64_t,uint32_t>& a, const std::pair<uint64_t,uint32_t>& b){ return (a.first & mask) < (b.first & mask); });
+            for(size_t i = begin; i < end; i++){
+                size_t slot;
+                uint64_t hash = order[i].first;
+                if(prefilter && !mayContain(stripe, hash)) continue;
+                if(probe(stripe, hash, addresses[order[i].second], slot)) ids[order[i].second] = stripe.slots[slot].id - 1;
+            }
+        }
+    }
+    for(size_t i = 0; i < addresses.size(); i++){
+        if(ids[i] == UINT32_MAX) ids[i] = intern(addresses[i]);
+    }
+}
+
+addressfilterstats_t AddressTable::getFilterStats(){
+    addressfilterstats_t total;
+    for(uint32_t i = 0; i < stripeCount; i++){
+        std::lock_guard<std::mutex> guard(stripes[i].lock);
+        total.lookups += stripes[i].stats.lookups;
+        total.skipped += stripes[i].stats.skipped;
+        total.falsePositives += stripes[i].stats.falsePositives;
+        total.bytes += stripes[i].filter.capacity() * sizeof(uint64_t);
+    }
+    return total;
+}
+
+std::string AddressTable::name(uint32_t id) const{
+    if(mapped) return std::string(&pool[offsets[id]], offsets[id + 1] - offsets[id]);
+    return *chunks[id >> chunkBits][id & (chunkSize - 1)];
+}
+
+bool AddressTable::nameLess(uint32_t a, uint32_t b) const{
+    if(!mapped) return *chunks[a >> chunkBits][a & (chunkSize - 1)] < *chunks[b >> chunkBits][b & (chunkSize - 1)];
+    size_t sizeA = offsets[a + 1] - offsets[a], sizeB = offsets[b + 1] - offsets[b];
+    int order = std::memcmp(&pool[offsets[a]], &pool[offsets[b]], std::min(sizeA, sizeB));
+    return order < 0 || (order == 0 && sizeA < sizeB);
+}
+
+uint32_t AddressTable::size() const{
+    return count.load(std::memory_order_acquire);
+}
+
+/* Estimate of the bytes held by the table: the strings and their hash nodes, the buckets and the name chunks. The files of a mapped table are in mappedBytes */
+size_t AddressTable::memoryUsage(){
+    size_t bytes = stripeCount * sizeof(stripe_t);
+    for(uint32_t i = 0; i < stripeCount; i++){
+        std::lock_guard<std::mutex> guard(stripes[i].lock);
+        bytes += stripes[i].ids.bucket_count() * sizeof(void*) + stripes[i].filter.capacity() * sizeof(uint64_t);
+        for(auto& a : stripes[i].ids){
+            bytes += sizeof(a) + 2 * sizeof(void*);
+            if(a.first.capacity() > 15) bytes += a.first.capacity() + 1;
+        }
+    }
+    if(!mapped) bytes += chunkSize * sizeof(void*) + ((count + chunkSize - 1) / chunkSize) * chunkSize * sizeof(void*);
+    return bytes;
+}
+
+size_t AddressTable::mappedBytes(){
+    size_t bytes = pool.mappedBytes() + offsets.mappedBytes();
+    for(uint32_t i = 0; i < stripeCount; i++){
+        std::lock_guard<std::mutex> guard(stripes[i].lock);
+        bytes += stripes[i].slots.mappedBytes();
+    }
+    return bytes;
+}
+
+AddressBatch::AddressBatch() : open(addressTable.isMapped() && !batched)
+{
+    if(open) batched = &addresses;
+}
+
+AddressBatch::~AddressBatch(){
+    if(open) batched = nullptr;
+}
+
+void AddressBatch::resolve(transactions_t& transactions){
+    if(!open) return;
+    batched = nullptr;
+    open = false;
+    std::vector<uint32_t> ids;
+    addressTable.internAll(addresses, ids);
+    for(getrawtransaction_t& transaction : transactions){
+        for(vin_t& input : transaction.vin) input.scriptSig.address = ids[input.scriptSig.address];
+        for(vout_t& output : transaction.vout){
+            for(uint32_t& address : output.scriptPubKey.addresses) address = ids[address];
+        }
+    }
+}
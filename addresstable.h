@@ -0,0 +1,101 @@
+#ifndef ADDRESSTABLE_H
+#define ADDRESSTABLE_H
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "definition.h"
+#include "mappedcolumn.h"
+
+/* How often the membership filter of the table spared a lookup in the maps, skipped are the addresses it knew were new and falsePositives the ones it let through that were new anyway */
+struct addressfilterstats_t{
+    uint64_t lookups = 0;
+    uint64_t skipped = 0;
+    uint64_t falsePositives = 0;
+    size_t bytes = 0;
+};
+
+/* Gives every address a dense 32 bit ID the first time it is decoded, everything after the decoding works on the IDs and the strings are kept only once, here. Interning is safe from several threads, and the name of an ID that has been handed out can be read without locking. The addresses are spread over stripes by their hash, each with its own lock, map and filter, so the fetchers and the shards decoding at the same time only meet when they look up addresses of the same stripe. Handing out a new ID takes one more short lock so that the IDs stay dense and size() never covers a name that is not in place yet */
+class AddressTable{
+    public:
+    AddressTable();
+    ~AddressTable();
+    /* Puts a membership filter in front of the maps, built from the addresses already there. A lookup the filter knows to be new skips the map, which pays when a miss is dear, but in memory the insert that follows probes the map again and the filter costs more than it saves, see the prefilter benchmark. Must be called before the lookups start */
+    void enablePrefilter();
+    /* Keeps the addresses in scratch files of directory instead of the heap: an open addressing table of slots per stripe and the names back to back in a pool, see MappedColumn. Called before the first lookup */
+    void mapTo(const std::string& directory);
+    bool isMapped() const;
+    uint32_t intern(const std::string& address);
+    /* The same as interning the addresses one after the other, the IDs handed out are the same. A mapped table first looks them all up in the order of their slots, so the pages of the slots are read once and in order, and the inserts that follow find them in memory */
+    void internAll(const std::vector<std::string>& addresses, std::vector<uint32_t>& ids);
+    bool find(const std::string& address, uint32_t& id);
+    std::string name(uint32_t id) const;
+    /* Compares the names of two IDs without copying them */
+    bool nameLess(uint32_t a, uint32_t b) const;
+    uint32_t size() const;
+    void reserve(size_t count);
+    size_t memoryUsage();
+    size_t mappedBytes();
+    addressfilterstats_t getFilterStats();
+    private:
+    static const uint32_t chunkBits = 16;
+    static const uint32_t chunkSize = 1u << chunkBits;
+    static const uint32_t stripeBits = 6;
+    static const uint32_t stripeCount = 1u << stripeBits;
+    /* Most addresses of a block are new, and a miss in a large map costs a cache miss or two for nothing. With the prefilter every stripe keeps a blocked Bloom filter of its addresses, the bits of an address all in one 64 bit word and about two bytes per address, which turns most of the misses into a single word read. It is rebuilt twice as large from the map when the stripe outgrows it */
+    /* ID + 1 of the address with its hash, 0 for a free slot */
+    struct slot_t{
+        uint64_t hash;
+        uint32_t id;
+        uint32_t unused;
+    };
+    struct stripe_t{
+        std::mutex lock;
+        std::unordered_map<std::string,uint32_t> ids;
+        /* A mapped table has its addresses here instead of in ids, with linear probing and at most three slots out of four used */
+        MappedColumn<slot_t> slots;
+        size_t used = 0;
+        std::vector<uint64_t> filter;
+        size_t filterCapacity = 0;
+        addressfilterstats_t stats;
+    };
+    bool prefilter;
+    bool mapped;
+    std::string directory;
+    stripe_t* stripes;
+    std::mutex idLock;
+    /* The names are kept in fixed size chunks that never move, so that readers do not race with the table growing */
+    const std::string*** chunks;
+    /* The names of a mapped table, the name of ID i is from offset i to offset i + 1 of the pool. Mapped columns never move either */
+    MappedColumn<char> pool;
+    MappedColumn<uint64_t> offsets;
+    std::atomic<uint32_t> count;
+
+    uint32_t nextId();
+    bool probe(stripe_t& stripe, uint64_t hash, const std::string& address, size_t& slot);
+    void resizeSlots(stripe_t& stripe, size_t slotCount);
+    bool mayContain(const stripe_t& stripe, uint64_t hash);
+    void remember(stripe_t& stripe, uint64_t hash);
+    void resizeFilter(stripe_t& stripe, size_t capacity);
+};
+
+extern AddressTable addressTable;
+
+/* Interns the addresses of a block at once with internAll when the table is mapped. While the batch is open intern only queues the addresses of the thread and hands out their place in the queue, resolve then puts the IDs in the place of the positions in every input and output of the block. The decoders open one around a block, a table in memory leaves it closed */
+class AddressBatch{
+    public:
+    AddressBatch();
+    ~AddressBatch();
+    AddressBatch(const AddressBatch&) = delete;
+    AddressBatch& operator=(const AddressBatch&) = delete;
+    void resolve(transactions_t& transactions);
+    private:
+    bool open;
+    std::vector<std::string> addresses;
+};
+
+#endif
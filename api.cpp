@@ -1,105 +1,73 @@
 #include "api.h"
+#include "address.h"
+#include "addresstable.h"
+#include "blockparser.h"
+#include "metrics.h"
 #include <string>
-#include <openssl/evp.h>
-#include <openssl/sha.h>
-#include <openssl/crypto.h>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
 
-/* THe following functions are for converting the public Key into the BTC address format*/
+/* Decodes one verbose transaction object, the addresses are interned here so that only their IDs go further. This is the same layout returned by getrawtransaction with verbosity 2 and by each entry of getblock with verbosity 3, both carry the prevout of every input */
 
-const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+/* The address is taken from the node for the types that have one, pay to pubkey, bare multisig and nonstandard scripts get the identity of their script */
+static std::string scriptIdentity(Value& scriptPubKey, scripttype_t& type) {
+    type = scriptTypeOf(scriptPubKey["type"].asString());
+    if(scriptHasAddress(type) && scriptPubKey["address"].isString()) return scriptPubKey["address"].asString();
+    return scriptHexIdentity(scriptPubKey["hex"].asString(), type);
+}
 
-std::string encodeBase58(const unsigned char *pbegin, const unsigned char *pend)
-{
-    int zeroes = 0;
-    int length = 0;
-    while (pbegin != pend && *pbegin == 0) {
-        pbegin++;
-        zeroes++;
-    }
-    int size = (pend - pbegin) * 138 / 100 + 1; 
-    std::vector<unsigned char> b58(size);
-    while (pbegin != pend) {
-        int carry = *pbegin;
-        int i = 0;
-        for (auto it = b58.rbegin(); (carry != 0 || i < length) && (it != b58.rend()); it++, i++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
-            carry /= 58;
+static getrawtransaction_t decodetransaction(Value& result) {
+	getrawtransaction_t res;
+	scripttypecounts_t counts;
+	scripttype_t type;
+	res.txid = result["txid"].asString().c_str();
+    for (ValueIterator it = result["vin"].begin(); it != result["vin"].end();
+            it++) {
+        Value val = (*it);
+        vin_t input;
+        if(val["coinbase"]) input.isCoinbase = true;
+        else input.isCoinbase = false;
+        input.txid = val["txid"].asString().c_str();
+        input.scriptSig.assembly = val["scriptSig"]["asm"].asString().c_str();
+        input.scriptSig.hex = val["scriptSig"]["hex"].asString().c_str();
+        input.value = std::llround(val["prevout"]["value"].asDouble() * 1e8);
+        /* Sometimes the transaction may not have the standard BTC Address but rather the public key or a bare multisig script, those are clustered by the identity of their script */
+        if(input.isCoinbase) input.scriptSig.address = addressTable.intern("");
+        else{
+            input.scriptSig.address = addressTable.intern(scriptIdentity(val["prevout"]["scriptPubKey"], type));
+            counts.inputs[type]++;
         }
-        length = i;
-        pbegin++;
-    }
-    auto it = b58.begin() + (size - length);
-    while (it != b58.end() && *it == 0)
-        it++;
-    std::string str;
-    str.reserve(zeroes + (b58.end() - it));
-    str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
-    return str;
-}
-
-std::string encodeBase58(const std::vector<unsigned char> &vch)
-{
-    return encodeBase58(&vch[0], &vch[0] + vch.size());
-}
-
-std::string getsha256(std::string& address){
-    long len = 0;
-    unsigned char *bin = OPENSSL_hexstr2buf(address.c_str(), &len);
-    const EVP_MD *md_algo = EVP_sha256();
-    unsigned int md_len = EVP_MD_size(md_algo);
-    std::vector<unsigned char> md( md_len );
-    EVP_Digest(bin, len, md.data(), &md_len, md_algo, nullptr);
-    OPENSSL_free(bin);
-    std::string sha256;
-    static const char hex[] = "0123456789abcdef";
-    for(char c : md){
-        sha256 += hex[(c >> 4) & 0xF];
-        sha256 += hex[c & 0xF];
-    }
-    return sha256;
-}
-
-std::string getripemd(std::string& address){
-    long len = 0;
-    unsigned char *bin = OPENSSL_hexstr2buf(address.c_str(), &len);
-    const EVP_MD *md_algo = EVP_ripemd160();
-    unsigned int md_len = EVP_MD_size(md_algo);
-    std::vector<unsigned char> md( md_len );
-    EVP_Digest(bin, len, md.data(), &md_len, md_algo, nullptr);
-    OPENSSL_free(bin);
-    std::string ripemd;
-    static const char hex[] = "0123456789abcdef";
-    for(char c : md){
-        ripemd += hex[(c >> 4) & 0xF];
-        ripemd += hex[c & 0xF];
+        res.vin.push_back(input);
     }
-    return ripemd; 
-}
-
-std::string decodeaddress(std::string& address){
-    std::string sha = getsha256(address);
-    std::string r = getripemd(sha);
-    std::string extendedPublicKey = "00" + r;
-    std::string sha1 = getsha256(extendedPublicKey);
-    std::string sha2 = getsha256(sha1);
-    std::string checksum = sha2.substr(0,8);
-    std::string address_in_hex = extendedPublicKey + checksum;
-    std::vector<unsigned char> address_in_hex_v;
-    for (size_t i = 0; i < address_in_hex.length(); i += 2) {
-        std::string byteString = address_in_hex.substr(i, 2);
-        unsigned char byte = (unsigned char) strtol(byteString.c_str(), nullptr, 16);
-        address_in_hex_v.push_back(byte);
+
+    for (ValueIterator it = result["vout"].begin(); it != result["vout"].end();
+            it++) {
+        Value val = (*it);
+        vout_t output;
+        std::string identity = scriptIdentity(val["scriptPubKey"], type);
+        counts.outputs[type]++;
+
+        output.value = std::llround(val["value"].asDouble() * 1e8);
+        output.scriptPubKey.assembly = val["scriptPubKey"]["asm"].asString().c_str();
+        output.scriptPubKey.hex = val["scriptPubKey"]["hex"].asString().c_str();
+        output.scriptPubKey.type = val["scriptPubKey"]["type"].asString().c_str();
+        /* Data carriers can never be spent, they stay in the transaction without an address */
+        output.unspendable = type == scriptNullData;
+        if(!output.unspendable) output.scriptPubKey.addresses.push_back(addressTable.intern(identity));
+
+        res.vout.push_back(output);
     }
-    std::string wallet = encodeBase58(address_in_hex_v);
-    return wallet;
+    addScriptTypes(counts);
+
+	return res;
 }
 
 API::API(std::string& user, std::string& password, std::string& host, int port, int timeout)
 : httpClient(new HttpClient("http://" + user + ":" + password + "@" + host + ":" + std::to_string(port))),
-  client(new Client(*httpClient, JSONRPC_CLIENT_V1))
+  client(new Client(*httpClient, JSONRPC_CLIENT_V1)),
+  requestCount(0),
+  fullTransactions(false)
 {
     httpClient->SetTimeout(timeout);
 }
@@ -110,64 +78,94 @@ API::~API()
     delete httpClient;
 }
 
+/* Latency and failures of the calls to the daemon by method, a batch counts once under the method of its calls */
+static Histogram& rpcLatency(const std::string& method){
+    return metrics.histogram("rpc_latency_seconds", "Round trip of the calls to the daemon", "method=\"" + method + "\"");
+}
+
+static Counter& rpcErrors(const std::string& method){
+    return metrics.counter("rpc_errors_total", "Calls to the daemon that failed", "method=\"" + method + "\"");
+}
+
 Json::Value API::request(std::string &command, Json::Value &params)
 {
     Value result;
-	result = client->CallMethod(command, params);
+    requestCount++;
+    StageTimer timer(rpcLatency(command), command.c_str());
+    try{
+	    result = client->CallMethod(command, params);
+    }
+    catch(...){
+        rpcErrors(command).add();
+        throw;
+    }
 	return result;
 }
 
+/* Sends all the calls as a single JSON-RPC batch, that is one HTTP round trip, and returns the results in the same order as the calls. The client library only deals with single calls so the batch is built and parsed here */
+
+std::vector<Json::Value> API::batchRequest(std::vector<std::pair<std::string, Json::Value> >& calls)
+{
+    std::vector<Value> results(calls.size());
+    if(calls.empty()) return results;
+    Value batch(Json::arrayValue);
+    for(size_t i = 0; i < calls.size(); i++){
+        Value call;
+        call["jsonrpc"] = "1.0";
+        call["id"] = (Json::UInt64) i;
+        call["method"] = calls[i].first;
+        call["params"] = calls[i].second;
+        batch.append(call);
+    }
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    std::string response;
+    requestCount++;
+    try{
+        StageTimer timer(rpcLatency(calls[0].first), "batch");
+        httpClient->SendRPCMessage(Json::writeString(writer, batch), response);
+    }
+    catch(...){
+        rpcErrors(calls[0].first).add();
+        throw;
+    }
+
+    Value reply;
+    Json::CharReaderBuilder reader;
+    std::string errors;
+    std::istringstream stream(response);
+    if(!Json::parseFromStream(reader, stream, &reply, &errors) || !reply.isArray())
+        throw JsonRpcException(-32700, "Invalid batch response: " + errors);
+    /* The server is free to answer a batch in any order, the id is used to put each result back in place */
+    for(ValueIterator it = reply.begin(); it != reply.end(); it++){
+        Value& val = (*it);
+        uint64_t id = val["id"].asUInt64();
+        if(id >= results.size()) throw JsonRpcException(-32603, "Unexpected id in batch response");
+        if(!val["error"].isNull()) throw JsonRpcException(val["error"]["code"].asInt(), val["error"]["message"].asString());
+        results[id] = val["result"];
+    }
+    return results;
+}
+
+uint64_t API::getRequestCount()
+{
+    return requestCount;
+}
+
+void API::setFullTransactions(bool full)
+{
+    fullTransactions = full;
+}
+
 /* This gets the transaction in raw hex format and decodes it*/
 
 getrawtransaction_t API::getrawtransaction(std::string& txid) {
 	std::string command = "getrawtransaction";
 	Value params, result;
-	getrawtransaction_t res;
 	params.append(txid);
 	params.append(2);
 	result = request(command, params);
-	res.txid = result["txid"].asString();
-    for (ValueIterator it = result["vin"].begin(); it != result["vin"].end();
-            it++) {
-        Value val = (*it);
-        vin_t input;
-        if(val["coinbase"]) input.isCoinbase = true;
-        else input.isCoinbase = false;
-        input.txid = val["txid"].asString();
-        input.scriptSig.assembly = val["scriptSig"]["asm"].asString();
-        input.scriptSig.hex = val["scriptSig"]["hex"].asString();
-        input.value = val["prevout"]["value"].asDouble();
-        std::string address = val["prevout"]["scriptPubKey"]["type"].asString();
-        /* Sometimes the transaction may not have the standard BTC Address but rather the public key, this has to be decoded*/
-        if(address == "pubkey"){
-                std::string pubkey;
-                for(char c :address) pubkey += c;
-                input.scriptSig.address = decodeaddress(pubkey);
-        }
-        else input.scriptSig.address = val["prevout"]["scriptPubKey"]["address"].asString();
-        res.vin.push_back(input);
-    }
-
-    for (ValueIterator it = result["vout"].begin(); it != result["vout"].end();
-            it++) {
-        Value val = (*it);
-        vout_t output;
-
-        output.value = val["value"].asDouble();
-        output.scriptPubKey.assembly = val["scriptPubKey"]["asm"].asString();
-        output.scriptPubKey.hex = val["scriptPubKey"]["hex"].asString();
-        output.scriptPubKey.type = val["scriptPubKey"]["type"].asString();
-        if(output.scriptPubKey.type == "pubkey"){
-            std::string pubkey;
-            for(char c : val["scriptPubKey"]["address"].asString()) pubkey += c;
-            output.scriptPubKey.addresses.push_back(decodeaddress(pubkey));
-        }
-        else output.scriptPubKey.addresses.push_back(val["scriptPubKey"]["address"].asString());
-
-        res.vout.push_back(output);
-    }
-
-	return res;
+	return decodetransaction(result);
 }
 
 /* Get the block data and decodes it */
@@ -192,4 +190,67 @@ std::string API::getblockhash(int blocknumber) {
 	params.append(blocknumber);
 	result = request(command, params);
 	return result.asString();
-}
\ No newline at end of file
+}
+
+/* Height of the tip of the daemon's best chain */
+
+int API::getblockcount() {
+	std::string command = "getblockcount";
+	Value params(Json::arrayValue), result;
+	result = request(command, params);
+	return result.asInt();
+}
+
+blockheader_t API::getblockheader(std::string& blockhash) {
+	std::string command = "getblockheader";
+	Value params, result;
+	blockheader_t ret;
+	params.append(blockhash);
+	result = request(command, params);
+	ret.hash = result["hash"].asString();
+	ret.previousblockhash = result["previousblockhash"].asString();
+	ret.height = result["height"].asUInt();
+	ret.time = result["time"].asUInt64();
+	return ret;
+}
+
+/* Gets the hashes of all the blocks in [startblock, endblock], the calls are sent in batches so that a range costs one round trip per batchSize blocks instead of one per block */
+
+std::vector<std::string> API::getblockhashes(int startblock, int endblock, int batchSize) {
+    std::vector<std::string> hashes;
+    if(endblock < startblock) return hashes;
+    hashes.reserve(endblock - startblock + 1);
+    for(int first = startblock; first <= endblock; first += batchSize){
+        int last = std::min(endblock, first + batchSize - 1);
+        std::vector<std::pair<std::string, Value> > calls;
+        for(int i = first; i <= last; i++){
+            Value params;
+            params.append(i);
+            calls.push_back(std::make_pair(std::string("getblockhash"), params));
+        }
+        std::vector<Value> results = batchRequest(calls);
+        for(Value& result : results) hashes.push_back(result.asString());
+    }
+    return hashes;
+}
+
+/* Gets the whole block with every transaction and the prevout of every input (getblock verbosity 3) in a single call, this replaces one getrawtransaction call per txid. The response is decoded as it is read instead of going through a jsoncpp tree, a block can be several megabytes of JSON */
+
+void API::getblocktransactions(std::string& blockhash, transactions_t& transactions) {
+	static Histogram& getblockLatency = rpcLatency("getblock");
+	static Histogram& decodeSeconds = metrics.histogram("decode_seconds", "Decoding of a getblock response");
+	static Counter& responseBytes = metrics.counter("rpc_response_bytes_total", "Bytes of the getblock responses");
+	std::string response;
+	requestCount++;
+	try{
+	    StageTimer timer(getblockLatency, "getblock");
+	    httpClient->SendRPCMessage("{\"jsonrpc\":\"1.0\",\"id\":0,\"method\":\"getblock\",\"params\":[\"" + blockhash + "\",3]}", response);
+	}
+	catch(...){
+	    rpcErrors("getblock").add();
+	    throw;
+	}
+	responseBytes.add(response.size());
+	StageTimer timer(decodeSeconds, "decode");
+	parseBlockResponse(response.data(), response.size(), blockhash, transactions, fullTransactions);
+}
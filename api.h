@@ -20,14 +20,25 @@ class API
 private:
     jsonrpc::HttpClient * httpClient;
     jsonrpc::Client * client;
+    /* Number of HTTP round trips made to the daemon, a batch counts as one */
+    uint64_t requestCount;
+    /* Keep the asm and hex of the scripts and the raw transactions, only useful for debugging */
+    bool fullTransactions;
 
 public:
     API(std::string& user, std::string& password, std::string& host, int port, int timeout);
     ~API();
     Json::Value request(std::string& command, Json::Value& params);
+    std::vector<Json::Value> batchRequest(std::vector<std::pair<std::string, Json::Value> >& calls);
+    uint64_t getRequestCount();
+    void setFullTransactions(bool full);
     getrawtransaction_t getrawtransaction(std::string& txid);
     std::string getblockhash(int blocknumber);
+    int getblockcount();
+    blockheader_t getblockheader(std::string& blockhash);
     blockinfo_t getblock(std::string& blockhash);
+    std::vector<std::string> getblockhashes(int startblock, int endblock, int batchSize = 1000);
+    void getblocktransactions(std::string& blockhash, transactions_t& transactions);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "arena.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+ArenaPool arenaPool;
+
+const size_t Arena::firstChunkSize;
+const size_t Arena::largestChunkSize;
+
+static uint64_t elapsedNanos(std::chrono::steady_clock::time_point since){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+Arena::Arena() : current(0), next(nullptr), limit(nullptr)
+{
+    std::memset(&stats, 0, sizeof(stats));
+}
+
+Arena::~Arena(){
+    for(chunk_t& chunk : chunks) std::free(chunk.data);
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment){
+    stats.allocations++;
+    stats.bytes += bytes;
+    if(next != nullptr){
+        char* p = (char*) (((uintptr_t) next + alignment - 1) & ~(uintptr_t) (alignment - 1));
+        if(p + bytes <= limit){
+            next = p + bytes;
+            return p;
+        }
+    }
+    return allocateSlow(bytes, alignment);
+}
+
+/* Moves on to the next chunk that is big enough, the chunks kept from before the last reset are tried first and a new one is only taken from the heap when they run out */
+void* Arena::allocateSlow(size_t bytes, size_t alignment){
+    size_t needed = bytes + alignment;
+    size_t from = next == nullptr ? 0 : current + 1;
+    for(size_t i = from; i < chunks.size(); i++){
+        if(chunks[i].size < needed) continue;
+        /* A kept chunk that is too small is skipped for this round, it is used again after the next reset */
+        current = i;
+        next = chunks[i].data;
+        limit = next + chunks[i].size;
+        char* p = (char*) (((uintptr_t) next + alignment - 1) & ~(uintptr_t) (alignment - 1));
+        next = p + bytes;
+        return p;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t size = chunks.empty() ? firstChunkSize : std::min(chunks.back().size * 2, largestChunkSize);
+    if(size < needed) size = needed;
+    chunk_t chunk;
+    chunk.data = (char*) std::malloc(size);
+    if(!chunk.data) throw std::bad_alloc();
+    chunk.size = size;
+    chunks.push_back(chunk);
+    stats.chunkAllocations++;
+    stats.allocatorNanos += elapsedNanos(start);
+    current = chunks.size() - 1;
+    next = chunk.data;
+    limit = next + size;
+    char* p = (char*) (((uintptr_t) next + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    next = p + bytes;
+    return p;
+}
+
+/* Nothing is destroyed here, the containers that used the arena must be gone before it is reset */
+void Arena::reset(){
+    current = 0;
+    next = chunks.empty() ? nullptr : chunks[0].data;
+    limit = chunks.empty() ? nullptr : chunks[0].data + chunks[0].size;
+    std::memset(&stats, 0, sizeof(stats));
+}
+
+const arenastats_t& Arena::getStats(){
+    return stats;
+}
+
+size_t Arena::capacity(){
+    size_t total = 0;
+    for(chunk_t& chunk : chunks) total += chunk.size;
+    return total;
+}
+
+ArenaPool::ArenaPool(size_t maxIdle) : maxIdle(maxIdle)
+{
+}
+
+ArenaPool::~ArenaPool(){
+    for(Arena* arena : idle) delete arena;
+}
+
+std::shared_ptr<Arena> ArenaPool::acquire(){
+    Arena* arena = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(!idle.empty()){
+            arena = idle.back();
+            idle.pop_back();
+        }
+    }
+    if(!arena) arena = new Arena();
+    return std::shared_ptr<Arena>(arena, [this](Arena* done){ release(done); });
+}
+
+void ArenaPool::setHook(std::function<void(const arenastats_t&)> hook){
+    std::lock_guard<std::mutex> guard(lock);
+    this->hook = hook;
+}
+
+void ArenaPool::release(Arena* arena){
+    std::function<void(const arenastats_t&)> report;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        report = hook;
+    }
+    if(report) report(arena->getStats());
+    arena->reset();
+    std::lock_guard<std::mutex> guard(lock);
+    if(idle.size() < maxIdle) idle.push_back(arena);
+    else delete arena;
+}
@@ -0,0 +1,101 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/* What one arena did while it held a block, handed to the instrumentation hook when the arena goes back to the pool */
+struct arenastats_t{
+    /* Allocations served and bytes handed out */
+    uint64_t allocations;
+    uint64_t bytes;
+    /* Times the arena had to get a new chunk from the heap and the time spent getting them, the allocations served from a chunk are a pointer bump and are not timed */
+    uint64_t chunkAllocations;
+    uint64_t allocatorNanos;
+};
+
+/* Monotonic allocator for everything decoded from one block: allocations bump a pointer through large chunks and nothing is freed one by one. reset() rewinds to the first chunk in constant time and keeps the chunks, so a recycled arena usually does not touch the heap at all. An arena is filled by a single thread at a time */
+class Arena{
+    public:
+    Arena();
+    ~Arena();
+    void* allocate(size_t bytes, size_t alignment);
+    void reset();
+    const arenastats_t& getStats();
+    size_t capacity();
+    private:
+    static const size_t firstChunkSize = 64 * 1024;
+    static const size_t largestChunkSize = 8 * 1024 * 1024;
+    struct chunk_t{
+        char* data;
+        size_t size;
+    };
+    std::vector<chunk_t> chunks;
+    size_t current;
+    char* next;
+    char* limit;
+    arenastats_t stats;
+
+    void* allocateSlow(size_t bytes, size_t alignment);
+};
+
+/* Standard allocator over an arena, the containers of a block use it so that all their storage comes from the block's arena. Without an arena it falls back to the heap, so the same types can be used outside of a block */
+template<class T> class ArenaAllocator{
+    public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(Arena* arena = nullptr) : arena(arena) {}
+    template<class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.getArena()) {}
+
+    T* allocate(size_t n){
+        if(!arena) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t){
+        if(!arena) ::operator delete(p);
+    }
+    Arena* getArena() const{
+        return arena;
+    }
+    private:
+    Arena* arena;
+};
+
+template<class T, class U> bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b){
+    return a.getArena() == b.getArena();
+}
+
+template<class T, class U> bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b){
+    return a.getArena() != b.getArena();
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > arena_string;
+template<class T> using arena_vector = std::vector<T, ArenaAllocator<T> >;
+
+/* Keeps the arenas of the blocks that are done so the next blocks reuse their chunks. acquire() hands out an arena that goes back to the pool, reset, once the last shared_ptr to it is gone. The hook is called with the stats of every arena coming back, from the thread that let go of it */
+class ArenaPool{
+    public:
+    ArenaPool(size_t maxIdle = 64);
+    ~ArenaPool();
+    std::shared_ptr<Arena> acquire();
+    void setHook(std::function<void(const arenastats_t&)> hook);
+    private:
+    std::mutex lock;
+    std::vector<Arena*> idle;
+    size_t maxIdle;
+    std::function<void(const arenastats_t&)> hook;
+
+    void release(Arena* arena);
+};
+
+extern ArenaPool arenaPool;
+
+#endif
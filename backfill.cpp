@@ -0,0 +1,242 @@
+#include "backfill.h"
+#include "metrics.h"
+#include "addresstable.h"
+#include "reusecounters.h"
+
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include <algorithm>
+
+/* Pieces per shard, a few so that the shards that got the light early blocks take more pieces than the others */
+static const uint32_t piecesPerShard = 4;
+uint32_t PartialClustering::node(uint32_t address){
+    auto it = local.insert({address, (uint32_t) parent.size()});
+    if(it.second){
+        parent.push_back(it.first->second);
+        size.push_back(1);
+        ensured.push_back(0);
+    }
+    return it.first->second;
+}
+
+/* Path halving like the store */
+uint32_t PartialClustering::find(uint32_t node){
+    while(parent[node] != node){
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+void PartialClustering::add(const proposal_t& proposal){
+    uint32_t root1 = find(node(proposal.wallet1));
+    if(proposal.wallet2 == proposal_t::ensureOnly){
+        if(ensured[root1]){
+            dropped++;
+            return;
+        }
+        ensured[root1] = 1;
+    }
+    else{
+        uint32_t root2 = find(node(proposal.wallet2));
+        if(root1 == root2){
+            dropped++;
+            return;
+        }
+        if(size[root1] < size[root2]) std::swap(root1, root2);
+        parent[root2] = root1;
+        size[root1] += size[root2];
+        ensured[root1] |= ensured[root2];
+    }
+    proposals.push_back(proposal);
+}
+
+void PartialClustering::record(uint32_t height, transactions_t& transactions){
+    std::vector<walletflow_t> transactionFlows;
+    for(getrawtransaction_t& transaction : transactions){
+        AddressActivity::flowsOf(transaction, transactionFlows);
+        flows.insert(flows.end(), transactionFlows.begin(), transactionFlows.end());
+        transactionEnds.push_back(flows.size());
+    }
+    blocks.push_back({height, proposals.size(), transactionEnds.size()});
+}
+
+void PartialClustering::mergeInto(EntityStore& store, Heuristics& heuristics, AddressActivity& activity) const{
+    size_t proposal = 0, transaction = 0, flow = 0;
+    for(const blockmark_t& block : blocks){
+        heuristics.applyProposals(store, proposals.data() + proposal, proposals.data() + block.proposalsEnd);
+        proposal = block.proposalsEnd;
+        for(; transaction < block.transactionsEnd; transaction++){
+            activity.recordTransaction(block.height, flows.data() + flow, flows.data() + transactionEnds[transaction], &store);
+            flow = transactionEnds[transaction];
+        }
+    }
+}
+
+const std::vector<proposal_t>& PartialClustering::getProposals() const{
+    return proposals;
+}
+
+uint64_t PartialClustering::getDropped() const{
+    return dropped;
+}
+
+size_t PartialClustering::memoryUsage() const{
+    return local.bucket_count() * sizeof(void*) + local.size() * (sizeof(std::pair<uint32_t,uint32_t>) + 2 * sizeof(void*))
+        + parent.capacity() * sizeof(uint32_t) + size.capacity() * sizeof(uint32_t) + ensured.capacity() + proposals.capacity() * sizeof(proposal_t)
+        + flows.capacity() * sizeof(walletflow_t) + transactionEnds.capacity() * sizeof(size_t) + blocks.capacity() * sizeof(blockmark_t);
+}
+
+ShardedBackfill::ShardedBackfill(int shards, uint32_t startBlock, uint32_t endBlock, SourceFactory openSource)
+: shards(std::max(shards, 1)), startBlock(startBlock), endBlock(endBlock), openSource(openSource), nextPiece(0), mergedPieces(0)
+{
+    if(endBlock < startBlock) return;
+    uint64_t blocks = (uint64_t) endBlock - startBlock + 1;
+    uint64_t count = std::min<uint64_t>(blocks, (uint64_t) this->shards * piecesPerShard);
+    for(uint64_t i = 0; i < count; i++){
+        piece_t piece;
+        piece.first = startBlock + blocks * i / count;
+        piece.last = startBlock + blocks * (i + 1) / count - 1;
+        piece.done = false;
+        pieces.push_back(std::move(piece));
+    }
+}
+
+/* Hands out the pieces in height order. While clustering a shard may only be a few pieces ahead of the merge, this bounds the partial clusterings held in memory */
+bool ShardedBackfill::claim(size_t& piece, bool bounded){
+    std::unique_lock<std::mutex> guard(lock);
+    pieceMerged.wait(guard, [&]{ return error || nextPiece >= pieces.size() || !bounded || nextPiece < mergedPieces + 2 * (size_t) shards; });
+    if(error || nextPiece >= pieces.size()) return false;
+    piece = nextPiece++;
+    return true;
+}
+
+/* Keeps the first error of a shard and stops the others */
+void ShardedBackfill::fail(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(!error) error = std::current_exception();
+    }
+    pieceDone.notify_all();
+    pieceMerged.notify_all();
+}
+
+/* Runs work on every shard while the calling thread runs meanwhile, then rethrows the first error of either */
+void ShardedBackfill::runShards(std::function<void(int)> work, std::function<void()> meanwhile){
+    nextPiece = 0;
+    mergedPieces = 0;
+    std::vector<std::thread> threads;
+    for(int shard = 0; shard < shards; shard++){
+        threads.push_back(std::thread([this, shard, &work](){
+            try{
+                work(shard);
+            }
+            catch(...){
+                fail();
+            }
+        }));
+    }
+    try{
+        meanwhile();
+    }
+    catch(...){
+        fail();
+    }
+    for(std::thread& thread : threads) thread.join();
+    if(error) std::rethrow_exception(error);
+}
+
+void ShardedBackfill::countReuse(MappedColumn<int>& reuseFrequency, ReuseIndex& reuseIndex, std::vector<uint32_t>& counted){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ReuseCounters counts;
+    runShards([&](int){
+        size_t i;
+        while(claim(i, false)){
+            std::unique_ptr<BlockSource> source = openSource(pieces[i].first, pieces[i].last);
+            fetchedblock_t block;
+            while(source->next(block)){
+                for(getrawtransaction_t& transaction : block.transactions){
+                    for(vout_t& out : transaction.vout) if(!out.unspendable) counts.add(out.scriptPubKey.addresses[0]);
+                }
+            }
+        }
+    }, [](){});
+    /* Counts are additive, the order the shards added them in does not matter */
+    counts.addTo(reuseFrequency, counted);
+    if(reuseFrequency.size() < addressTable.size()) reuseFrequency.resize(addressTable.size(), 0);
+    reuseIndex.addCounts(reuseFrequency);
+    countSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ShardedBackfill::cluster(EntityStore& store, Heuristics& heuristics, MappedColumn<int>& reuseFrequency, const ReuseIndex& reuseIndex, AddressActivity& activity, uint64_t& lastHeight, std::string& lastHash, std::function<void(uint32_t)> merged){
+    static Histogram& pieceSeconds = metrics.histogram("backfill_piece_seconds", "Clustering of one piece of a sharded backfill by its shard");
+    static Counter& dropped = metrics.counter("backfill_dropped_proposals_total", "Proposals a shard found redundant and left out of the merge");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    runShards([&](int){
+        /* The shards already run in parallel, each evaluates its blocks on its own thread */
+        Heuristics local(1);
+        local.useSetOf(heuristics);
+        local.setReuseIndex(&reuseIndex);
+        std::vector<proposal_t> proposals;
+        size_t i;
+        while(claim(i, true)){
+            piece_t& piece = pieces[i];
+            {
+                StageTimer timer(pieceSeconds, "piece", piece.first);
+                std::unique_ptr<BlockSource> source = openSource(piece.first, piece.last);
+                fetchedblock_t block;
+                while(source->next(block)){
+                    proposals.clear();
+                    local.proposeBlock(block.transactions, reuseFrequency, proposals);
+                    for(proposal_t& proposal : proposals) piece.clustering.add(proposal);
+                    piece.clustering.record(block.height, block.transactions);
+                    piece.lastHash = block.hash;
+                }
+            }
+            dropped.add(piece.clustering.getDropped());
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                piece.done = true;
+            }
+            pieceDone.notify_all();
+        }
+    }, [&](){
+        for(size_t i = 0; i < pieces.size(); i++){
+            piece_t& piece = pieces[i];
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                pieceDone.wait(guard, [&]{ return error || piece.done; });
+                if(error) return;
+            }
+            std::chrono::steady_clock::time_point mergeStart = std::chrono::steady_clock::now();
+            piece.clustering.mergeInto(store, heuristics, activity);
+            keptProposals += piece.clustering.getProposals().size();
+            droppedProposals += piece.clustering.getDropped();
+            piece.clustering = PartialClustering();
+            mergeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - mergeStart).count();
+            lastHeight = piece.last;
+            lastHash = piece.lastHash;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                mergedPieces++;
+            }
+            pieceMerged.notify_all();
+            merged(piece.last - piece.first + 1);
+        }
+    });
+    clusterSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* The merge is the part that does not scale with the shards, it is shown apart from the clustering it overlaps with */
+void ShardedBackfill::printThroughput(std::ostream& out){
+    uint64_t blocks = endBlock >= startBlock ? (uint64_t) endBlock - startBlock + 1 : 0;
+    uint64_t proposals = keptProposals + droppedProposals;
+    out << std::fixed << std::setprecision(2)
+        << "Backfill: " << shards << " shards, " << pieces.size() << " pieces, "
+        << "reuse count " << (countSeconds > 0 ? blocks / countSeconds : 0) << " blocks/s, "
+        << "clustering " << (clusterSeconds > 0 ? blocks / clusterSeconds : 0) << " blocks/s, "
+        << "merge " << mergeSeconds << " s, "
+        << (proposals > 0 ? 100.0 * droppedProposals / proposals : 0) << "% of the proposals dropped by the shards" << std::endl;
+    out.unsetf(std::ios_base::floatfield);
+}
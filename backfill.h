@@ -0,0 +1,90 @@
+#ifndef BACKFILL_H
+#define BACKFILL_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "activity.h"
+#include "heuristics.h"
+#include "reuseindex.h"
+#include "blocksource.h"
+
+/* The clustering of one piece of the range, kept as the proposals that may still change the global store. A local union-find over the addresses of the piece drops the merge of two addresses the piece already joined and the entity of a set the piece already gave one. Every set of the global store is a union of the sets of the piece once the proposals before it are applied, so a dropped proposal would have changed nothing there either and replaying what is kept in order leaves the store exactly as the sequential run does */
+class PartialClustering{
+    public:
+    void add(const proposal_t& proposal);
+    /* Keeps what the transactions of a block moved for each address, after the proposals of the block */
+    void record(uint32_t height, transactions_t& transactions);
+    /* Applies the proposals and records the transactions block after block, the totals of a set go to its root at the time of the transaction like in the sequential run */
+    void mergeInto(EntityStore& store, Heuristics& heuristics, AddressActivity& activity) const;
+    const std::vector<proposal_t>& getProposals() const;
+    uint64_t getDropped() const;
+    size_t memoryUsage() const;
+    private:
+    std::unordered_map<uint32_t,uint32_t> local;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> size;
+    std::vector<uint8_t> ensured;
+    std::vector<proposal_t> proposals;
+    struct blockmark_t{
+        uint32_t height;
+        size_t proposalsEnd;
+        size_t transactionsEnd;
+    };
+    /* The flows of every transaction back to back, transactionEnds has where each one ends and blocks where each block ends in both */
+    std::vector<walletflow_t> flows;
+    std::vector<size_t> transactionEnds;
+    std::vector<blockmark_t> blocks;
+    uint64_t dropped = 0;
+
+    uint32_t node(uint32_t address);
+    uint32_t find(uint32_t node);
+};
+
+/* Backfills a range with several shards at once. The range is cut into a few pieces per shard and every shard thread reads its pieces from a source of its own. The reuse is counted first, every shard adding the outputs of its pieces to shared atomic counters, so the change heuristic sees the counts of the whole range like with the reuse prepass. The pieces are then clustered into partial clusterings that are merged into the store on the calling thread in height order, while the shards go on with the next pieces. The result is the clustering of a sequential run with the reuse prepass, entity IDs included */
+class ShardedBackfill{
+    public:
+    typedef std::function<std::unique_ptr<BlockSource>(uint32_t first, uint32_t last)> SourceFactory;
+    ShardedBackfill(int shards, uint32_t startBlock, uint32_t endBlock, SourceFactory openSource);
+    /* Adds the outputs of the range to reuseFrequency and fills the index from the totals, the addresses whose count moved are appended to counted */
+    void countReuse(MappedColumn<int>& reuseFrequency, ReuseIndex& reuseIndex, std::vector<uint32_t>& counted);
+    /* Clusters the range into the store and the totals of the addresses into activity, merged is called on this thread after every piece with its number of blocks and lastHeight and lastHash at its last block */
+    void cluster(EntityStore& store, Heuristics& heuristics, MappedColumn<int>& reuseFrequency, const ReuseIndex& reuseIndex, AddressActivity& activity, uint64_t& lastHeight, std::string& lastHash, std::function<void(uint32_t)> merged);
+    void printThroughput(std::ostream& out);
+    private:
+    struct piece_t{
+        uint32_t first;
+        uint32_t last;
+        std::string lastHash;
+        bool done;
+        PartialClustering clustering;
+    };
+    int shards;
+    uint32_t startBlock;
+    uint32_t endBlock;
+    SourceFactory openSource;
+    std::vector<piece_t> pieces;
+    std::mutex lock;
+    std::condition_variable pieceDone, pieceMerged;
+    size_t nextPiece;
+    size_t mergedPieces;
+    std::exception_ptr error;
+    double countSeconds = 0;
+    double clusterSeconds = 0;
+    double mergeSeconds = 0;
+    uint64_t keptProposals = 0;
+    uint64_t droppedProposals = 0;
+
+    bool claim(size_t& piece, bool bounded);
+    void fail();
+    void runShards(std::function<void(int)> work, std::function<void()> meanwhile);
+};
+
+#endif
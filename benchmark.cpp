@@ -0,0 +1,1809 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#include <jsoncpp/json/json.h>
+
+#include "address.h"
+#include "addresstable.h"
+#include "blockparser.h"
+#include "blockfile.h"
+#include "blocksource.h"
+#include "entitystore.h"
+#include "entityindex.h"
+#include "queryservice.h"
+#include "heuristics.h"
+#include "snapshot.h"
+#include "synthchain.h"
+#include "backfill.h"
+#include "reusecounters.h"
+#include "columnexport.h"
+#include "mergelog.h"
+
+/* Microbenchmarks of the hot paths, every case checks its result against a reference before it is timed. None of them needs a node or a database, the blocks come from a synthetic chain or from recorded responses.
+     benchmark.out [--json report.json] [--only group,...] [--blocks N] [--state-dir DIR] [iterations] [fixture.json ...]
+   The groups are addresses, decoding, blockfile, heuristics, backfill, contention, prefilter, outofcore, persistence, recovery, follow, export and queries. The outofcore group puts its files in --state-dir, /tmp by default, run under a memory limit (systemd-run --scope -p MemoryMax=...) it shows the throughput once the state no longer fits. A fixture is a recorded response to getblock with verbosity 3 or to getrawtransaction with verbosity 2, see benchmarkDecoding. With --json every figure printed is also written to the report, to compare runs against each other */
+
+/* The public key to address conversion as it was done before address.cpp, through hex strings at every step. Kept only as the baseline to compare against */
+namespace legacy{
+
+std::string encodeBase58(const std::vector<unsigned char> &vch){
+    static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+    const unsigned char* pbegin = &vch[0];
+    const unsigned char* pend = pbegin + vch.size();
+    int zeroes = 0;
+    int length = 0;
+    while (pbegin != pend && *pbegin == 0) {
+        pbegin++;
+        zeroes++;
+    }
+    int size = (pend - pbegin) * 138 / 100 + 1;
+    std::vector<unsigned char> b58(size);
+    while (pbegin != pend) {
+        int carry = *pbegin;
+        int i = 0;
+        for (auto it = b58.rbegin(); (carry != 0 || i < length) && (it != b58.rend()); it++, i++) {
+            carry += 256 * (*it);
+            *it = carry % 58;
+            carry /= 58;
+        }
+        length = i;
+        pbegin++;
+    }
+    auto it = b58.begin() + (size - length);
+    while (it != b58.end() && *it == 0)
+        it++;
+    std::string str;
+    str.reserve(zeroes + (b58.end() - it));
+    str.assign(zeroes, '1');
+    while (it != b58.end())
+        str += pszBase58[*(it++)];
+    return str;
+}
+
+std::string hexDigest(const EVP_MD *md_algo, std::string& address){
+    long len = 0;
+    unsigned char *bin = OPENSSL_hexstr2buf(address.c_str(), &len);
+    unsigned int md_len = EVP_MD_size(md_algo);
+    std::vector<unsigned char> md( md_len );
+    EVP_Digest(bin, len, md.data(), &md_len, md_algo, nullptr);
+    OPENSSL_free(bin);
+    std::string hexString;
+    static const char hex[] = "0123456789abcdef";
+    for(char c : md){
+        hexString += hex[(c >> 4) & 0xF];
+        hexString += hex[c & 0xF];
+    }
+    return hexString;
+}
+
+std::string decodeaddress(std::string& address){
+    std::string sha = hexDigest(EVP_sha256(), address);
+    std::string r = hexDigest(EVP_ripemd160(), sha);
+    std::string extendedPublicKey = "00" + r;
+    std::string sha1 = hexDigest(EVP_sha256(), extendedPublicKey);
+    std::string sha2 = hexDigest(EVP_sha256(), sha1);
+    std::string checksum = sha2.substr(0,8);
+    std::string address_in_hex = extendedPublicKey + checksum;
+    std::vector<unsigned char> address_in_hex_v;
+    for (size_t i = 0; i < address_in_hex.length(); i += 2) {
+        std::string byteString = address_in_hex.substr(i, 2);
+        unsigned char byte = (unsigned char) strtol(byteString.c_str(), nullptr, 16);
+        address_in_hex_v.push_back(byte);
+    }
+    return encodeBase58(address_in_hex_v);
+}
+
+/* The address table as it was before the stripes, every lookup takes the one lock */
+class MutexAddressTable{
+    public:
+    uint32_t intern(const std::string& address){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = ids.find(address);
+        if(it != ids.end()) return it->second;
+        uint32_t id = names.size();
+        names.push_back(&ids.insert({address, id}).first->first);
+        return id;
+    }
+    bool find(const std::string& address, uint32_t& id){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = ids.find(address);
+        if(it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+    uint32_t size(){
+        std::lock_guard<std::mutex> guard(lock);
+        return ids.size();
+    }
+    private:
+    std::mutex lock;
+    std::unordered_map<std::string,uint32_t> ids;
+    std::vector<const std::string*> names;
+};
+
+/* Reuse counts shared by several writers behind one lock */
+class MutexReuseCounters{
+    public:
+    void add(uint32_t address){
+        std::lock_guard<std::mutex> guard(lock);
+        if(address >= counts.size()) counts.resize(address + 1, 0);
+        counts[address]++;
+    }
+    uint32_t get(uint32_t address){
+        return address < counts.size() ? counts[address] : 0;
+    }
+    private:
+    std::mutex lock;
+    std::vector<int> counts;
+};
+
+}
+
+static bool failed = false;
+
+/* Every figure printed, with the group of the case it comes from */
+struct result_t{
+    std::string group;
+    std::string name;
+    double value;
+    std::string unit;
+};
+static std::vector<result_t> results;
+static std::string currentGroup;
+
+static void record(const std::string& name, double value, const std::string& unit){
+    results.push_back({currentGroup, name, value, unit});
+}
+
+static void check(const std::string& name, const std::string& got, const std::string& expected){
+    if(got == expected) return;
+    std::cerr << name << ": got " << got << " expected " << expected << std::endl;
+    failed = true;
+}
+
+static std::string totalsText(const valuetotals_t& totals){
+    return std::to_string(totals.received) + " received " + std::to_string(totals.sent) + " sent " + std::to_string(totals.transactions) + " transactions "
+        + std::to_string(totals.firstHeight) + "-" + std::to_string(totals.lastHeight);
+}
+
+/* Runs the case over the inputs until iterations calls are done and reports the calls per second */
+static double measure(const std::string& name, size_t iterations, size_t inputs, std::function<size_t(size_t)> run){
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < iterations; i++) sink += run(i % inputs);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = iterations / seconds;
+    std::printf("%-28s %12.0f addresses/s  (%zu)\n", name.c_str(), rate, sink % 10);
+    record(name, rate, "addresses/s");
+    return rate;
+}
+
+/* Deterministic pseudo random bytes so that every run times the same inputs */
+static std::vector<unsigned char> randomBytes(uint64_t& seed, size_t len){
+    std::vector<unsigned char> bytes(len);
+    for(unsigned char& b : bytes){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        b = seed >> 56;
+    }
+    return bytes;
+}
+
+static void benchmarkAddresses(size_t iterations){
+    std::string type;
+
+    /* Known addresses: the genesis coinbase key, the BIP 173 examples and the first BIP 86 taproot address */
+    std::string genesisKey = "04678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5f";
+    check("genesis legacy", legacy::decodeaddress(genesisKey), "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa");
+    check("genesis", scriptHexToAddress("41" + genesisKey + "ac", type), "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa");
+    check("p2wpkh", scriptHexToAddress("0014751e76e8199196d454941c45d1b3a323f1433bd6", type), "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4");
+    check("p2wsh", scriptHexToAddress("00201863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262", type), "bc1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3qccfmv3");
+    check("p2tr", scriptHexToAddress("512079be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798", type), "bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0");
+
+    /* Random compressed and uncompressed keys, both paths must agree on every one of them */
+    uint64_t seed = 42;
+    std::vector<std::string> keys, scripts;
+    for(int i = 0; i < 1024; i++){
+        std::vector<unsigned char> key = randomBytes(seed, i % 2 ? 33 : 65);
+        key[0] = i % 2 ? 0x02 + (key[1] & 1) : 0x04;
+        keys.push_back(toHex(&key[0], key.size()));
+        scripts.push_back((i % 2 ? "21" : "41") + keys.back() + "ac");
+        check("pubkey " + std::to_string(i), scriptHexToAddress(scripts.back(), type), legacy::decodeaddress(keys.back()));
+    }
+    std::vector<std::vector<unsigned char> > hashes, programs;
+    for(int i = 0; i < 1024; i++){
+        hashes.push_back(randomBytes(seed, 20));
+        programs.push_back(randomBytes(seed, 32));
+    }
+    if(failed) return;
+
+    std::cout << "Address derivation, " << iterations << " iterations" << std::endl;
+    double before = measure("pubkey legacy", iterations, keys.size(), [&](size_t i){ return legacy::decodeaddress(keys[i]).size(); });
+    double after = measure("pubkey", iterations, scripts.size(), [&](size_t i){ return scriptHexToAddress(scripts[i], type).size(); });
+    /* The encoding alone, on the 25 bytes of a P2PKH address */
+    std::vector<std::vector<unsigned char> > payloads;
+    for(std::vector<unsigned char>& hash : hashes){
+        payloads.push_back(hash);
+        payloads.back().insert(payloads.back().begin(), 0);
+        payloads.back().insert(payloads.back().end(), 4, 0xff);
+        check("base58 " + std::to_string(payloads.size()), encodeBase58(payloads.back()), legacy::encodeBase58(payloads.back()));
+    }
+    measure("base58 legacy", iterations, payloads.size(), [&](size_t i){ return legacy::encodeBase58(payloads[i]).size(); });
+    measure("base58", iterations, payloads.size(), [&](size_t i){ return encodeBase58(payloads[i]).size(); });
+    measure("base58check p2pkh", iterations, hashes.size(), [&](size_t i){ return encodeBase58Check(0x00, &hashes[i][0], 20).size(); });
+    measure("bech32 p2wpkh", iterations, hashes.size(), [&](size_t i){ return encodeSegwitAddress("bc", 0, &hashes[i][0], 20).size(); });
+    measure("bech32m p2tr", iterations, programs.size(), [&](size_t i){ return encodeSegwitAddress("bc", 1, &programs[i][0], 32).size(); });
+    std::printf("pubkey speedup %.1fx\n", after / before);
+    record("pubkey speedup", after / before, "x");
+}
+
+static Json::Value parseJson(const std::string& text){
+    Json::Value value;
+    Json::CharReaderBuilder reader;
+    std::string errors;
+    std::istringstream stream(text);
+    if(!Json::parseFromStream(reader, stream, &value, &errors)) throw std::runtime_error(errors);
+    return value;
+}
+
+/* The decoding of a verbose transaction as it was done with jsoncpp, every vin and vout is copied out of the tree */
+static void decodeTransactionJson(Json::Value& result, getrawtransaction_t& res){
+    res.txid = result["txid"].asString().c_str();
+    res.hex = result["hex"].asString().c_str();
+    for(Json::ValueIterator in = result["vin"].begin(); in != result["vin"].end(); in++){
+        Json::Value val = (*in);
+        vin_t input;
+        input.isCoinbase = !val["coinbase"].isNull();
+        input.txid = val["txid"].asString().c_str();
+        input.scriptSig.assembly = val["scriptSig"]["asm"].asString().c_str();
+        input.scriptSig.hex = val["scriptSig"]["hex"].asString().c_str();
+        input.value = std::llround(val["prevout"]["value"].asDouble() * 1e8);
+        input.scriptSig.address = addressTable.intern(val["prevout"]["scriptPubKey"]["address"].asString());
+        res.vin.push_back(input);
+    }
+    for(Json::ValueIterator out = result["vout"].begin(); out != result["vout"].end(); out++){
+        Json::Value val = (*out);
+        vout_t output;
+        output.value = std::llround(val["value"].asDouble() * 1e8);
+        output.scriptPubKey.assembly = val["scriptPubKey"]["asm"].asString().c_str();
+        output.scriptPubKey.hex = val["scriptPubKey"]["hex"].asString().c_str();
+        output.scriptPubKey.type = val["scriptPubKey"]["type"].asString().c_str();
+        /* Data carriers are kept without an address the same as the decoders do, so that both give the same outputs */
+        output.unspendable = output.scriptPubKey.type == "nulldata";
+        if(!output.unspendable) output.scriptPubKey.addresses.push_back(addressTable.intern(val["scriptPubKey"]["address"].asString()));
+        res.vout.push_back(output);
+    }
+}
+
+/* The decoding of getblock verbosity 3 as it was done with jsoncpp: the whole response is parsed into a tree and every transaction is copied out of it */
+static size_t decodeWithJsoncpp(const std::string& response){
+    Json::Value reply = parseJson(response);
+    transactions_t transactions;
+    Json::Value& tx = reply["result"]["tx"];
+    for(Json::ValueIterator it = tx.begin(); it != tx.end(); it++){
+        getrawtransaction_t res;
+        decodeTransactionJson(*it, res);
+        transactions.push_back(res);
+    }
+    return transactions.size();
+}
+
+static size_t decodeTransactionWithJsoncpp(const std::string& response){
+    Json::Value reply = parseJson(response);
+    getrawtransaction_t transaction;
+    decodeTransactionJson(reply["result"], transaction);
+    return transaction.vin.size() + transaction.vout.size();
+}
+
+/* Throughput of each decoder over the same responses, in MB of JSON per second */
+struct decoder_t{
+    const char* name;
+    std::function<size_t(const std::string&)> decode;
+};
+
+static void timeDecoders(std::vector<std::string>& responses, size_t rounds, std::vector<decoder_t>& decoders){
+    size_t bytes = 0;
+    for(std::string& response : responses) bytes += response.size();
+    for(decoder_t& decoder : decoders){
+        size_t sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(size_t r = 0; r < rounds; r++){
+            for(std::string& response : responses) sink += decoder.decode(response);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-28s %12.1f MB/s  (%zu)\n", decoder.name, bytes * rounds / seconds / 1e6, sink % 10);
+        record(decoder.name, bytes * rounds / seconds / 1e6, "MB/s");
+    }
+}
+
+/* Decoding of getblock and getrawtransaction responses. Recorded responses are given on the command line, for instance saved with
+     curl --user user:password --data '{"method":"getblock","params":["<hash>",3]}' http://127.0.0.1:8332/ > block.json
+     curl --user user:password --data '{"method":"getrawtransaction","params":["<txid>",2]}' http://127.0.0.1:8332/ > transaction.json
+   without any the responses come from the synthetic chain */
+static std::string scriptJson(const std::string& hex, const std::string& type, const std::string& address){
+    return "{\"hex\":\"" + hex + "\",\"type\":\"" + type + "\"" + (address.empty() ? "" : ",\"address\":\"" + address + "\"") + "}";
+}
+
+/* The shape the heuristics see is the one of the real transaction: a payment with a data carrier has two outputs so H4 leaves the payee alone, and a payment, a change and a data carrier has three so H2 and H3 leave them alone too. Only the inputs of each transaction end up together */
+static void checkDataCarrierShapes(const std::string& nulldata){
+    auto payTo = [](const std::string& name, const std::string& value){
+        return "{\"value\":" + value + ",\"scriptPubKey\":" + scriptJson("0014" + std::string(40, name[0]), "witness_v0_keyhash", "carrier-" + name) + "}";
+    };
+    auto spend = [](const std::string& name, const std::string& value){
+        return "{\"txid\":\"" + std::string(64, 'f') + "\",\"vout\":0,\"prevout\":{\"value\":" + value + ",\"scriptPubKey\":" + scriptJson("0014" + std::string(40, name[0]), "witness_v0_keyhash", "carrier-" + name) + "}}";
+    };
+    std::string carrier = "{\"value\":0,\"scriptPubKey\":" + scriptJson(nulldata, "nulldata", "") + "}";
+    std::string block = "{\"result\":{\"tx\":["
+        "{\"txid\":\"" + std::string(64, '1') + "\",\"vin\":[" + spend("a", "1") + "],\"vout\":[" + payTo("b", "0.9") + "," + carrier + "]},"
+        "{\"txid\":\"" + std::string(64, '2') + "\",\"vin\":[" + spend("c", "1") + "," + spend("d", "0.1") + "],\"vout\":[" + payTo("e", "1") + "," + payTo("f", "0.05") + "," + carrier + "]}"
+        "]},\"error\":null,\"id\":1}";
+    transactions_t parsed;
+    parseBlockResponse(block.data(), block.size(), "", parsed);
+    EntityStore store;
+    MappedColumn<int> reuse;
+    Heuristics heuristics(1);
+    heuristics.runHeuristics(store, parsed, reuse);
+    auto together = [&](const std::string& a, const std::string& b){
+        uint64_t entityA = store.getEntity(addressTable.intern("carrier-" + a)), entityB = store.getEntity(addressTable.intern("carrier-" + b));
+        return entityA != 0 && entityA == entityB ? "together" : "apart";
+    };
+    check("data carrier shapes", std::string(together("a", "b")) + " " + together("c", "d") + " " + together("c", "e") + " " + together("c", "f"), "apart together apart apart");
+}
+
+/* A block with a coinbase paying to a key and a witness commitment, and a transaction spending a bare multisig output into another multisig, a nonstandard script, a data carrier and a P2WPKH. The data carriers stay as unspendable outputs without an address, every other script has an identity of its own and the multisig input is the same wallet as the multisig output that created it */
+static void checkScriptTypes(){
+    std::string key = "02" + std::string(64, '1');
+    std::string pubkey = "21" + key + "ac", multisig = "5121" + key + "51ae", otherMultisig = "5121" + std::string(2, '0') + std::string(64, '2') + "51ae";
+    std::string nonstandard = "7551", nulldata = "6a0b68656c6c6f20776f726c64", p2wpkh = "0014751e76e8199196d454941c45d1b3a323f1433bd6";
+    scripttype_t type;
+    std::string types;
+    for(const std::string& hex : {pubkey, multisig, nonstandard, nulldata, p2wpkh}){
+        std::string identity = scriptHexIdentity(hex, type);
+        types += std::string(types.empty() ? "" : " ") + scriptTypeName(type) + (identity.empty() ? "" : "+");
+    }
+    check("script types", types, "pubkey+ multisig+ nonstandard+ nulldata witness_v0_keyhash+");
+    check("multisig identity", scriptHexIdentity(multisig, type) == scriptHexIdentity(otherMultisig, type) ? "shared" : "own", "own");
+    std::string longScript = "6e" + std::string(2 * 600, 'a');
+    std::string longIdentity = scriptHexIdentity(longScript, type);
+    check("long script identity", longIdentity.substr(0, 7) + " " + scriptTypeName(type), "script: nonstandard");
+
+    std::string block = "{\"result\":{\"tx\":["
+        "{\"txid\":\"" + std::string(64, 'c') + "\",\"vin\":[{\"coinbase\":\"03\"}],\"vout\":["
+            "{\"value\":50,\"scriptPubKey\":" + scriptJson(pubkey, "pubkey", "") + "},"
+            "{\"value\":0,\"scriptPubKey\":" + scriptJson(nulldata, "nulldata", "") + "}]},"
+        "{\"txid\":\"" + std::string(64, 'd') + "\",\"vin\":[{\"txid\":\"" + std::string(64, 'e') + "\",\"vout\":0,\"prevout\":{\"value\":1,\"scriptPubKey\":" + scriptJson(multisig, "multisig", "") + "}}],\"vout\":["
+            "{\"value\":0.25,\"scriptPubKey\":" + scriptJson(otherMultisig, "multisig", "") + "},"
+            "{\"value\":0.25,\"scriptPubKey\":" + scriptJson(nonstandard, "nonstandard", "") + "},"
+            "{\"value\":0,\"scriptPubKey\":" + scriptJson(nulldata, "nulldata", "") + "},"
+            "{\"value\":0.5,\"scriptPubKey\":" + scriptJson(p2wpkh, "witness_v0_keyhash", "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4") + "}]}"
+        "]},\"error\":null,\"id\":1}";
+    Counter& nulldataOutputs = metrics.counter("script_types_total", "", "side=\"output\",type=\"nulldata\"");
+    Counter& multisigInputs = metrics.counter("script_types_total", "", "side=\"input\",type=\"multisig\"");
+    uint64_t nulldataBefore = nulldataOutputs.get(), multisigBefore = multisigInputs.get();
+    transactions_t parsed;
+    parseBlockResponse(block.data(), block.size(), "", parsed);
+    check("script type outputs", std::to_string(parsed.size()) + " " + std::to_string(parsed[0].vout.size()) + " " + std::to_string(parsed[1].vout.size()), "2 2 4");
+    if(failed) return;
+    check("data carriers", std::string(parsed[0].vout[1].unspendable ? "unspendable" : "spendable") + " " + std::to_string(parsed[0].vout[1].scriptPubKey.addresses.size())
+        + " " + (parsed[1].vout[2].unspendable ? "unspendable" : "spendable") + " " + (parsed[1].vout[3].unspendable ? "unspendable" : "spendable"), "unspendable 0 unspendable spendable");
+    check("pubkey output", addressTable.name(parsed[0].vout[0].scriptPubKey.addresses[0]), scriptHexToAddress(pubkey, types));
+    check("multisig input", addressTable.name(parsed[1].vin[0].scriptSig.address), scriptHexIdentity(multisig, type));
+    check("multisig output", addressTable.name(parsed[1].vout[0].scriptPubKey.addresses[0]), scriptHexIdentity(otherMultisig, type));
+    check("nonstandard output", addressTable.name(parsed[1].vout[1].scriptPubKey.addresses[0]), scriptHexIdentity(nonstandard, type));
+    check("p2wpkh output", addressTable.name(parsed[1].vout[3].scriptPubKey.addresses[0]), "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4");
+    check("script type counts", std::to_string(nulldataOutputs.get() - nulldataBefore) + " " + std::to_string(multisigInputs.get() - multisigBefore), "2 1");
+    checkDataCarrierShapes(nulldata);
+}
+
+static void benchmarkDecoding(size_t rounds, std::vector<std::string> blockResponses, std::vector<std::string> transactionResponses){
+    checkScriptTypes();
+    if(failed) return;
+    if(blockResponses.empty() || transactionResponses.empty()){
+        synthshape_t shape;
+        shape.transactionsPerBlock = 3000;
+        SyntheticChain chain(shape);
+        std::vector<synthtransaction_t> block;
+        while(chain.getHeight() <= shape.earlyBlocks) chain.nextBlock(block);
+        if(blockResponses.empty()){
+            blockResponses.push_back(chain.blockResponse(block, chain.getHeight() - 1));
+            /* What the parser makes of the JSON must be what the generator decodes directly, the clustering cases use the latter */
+            transactions_t parsed, decoded;
+            parseBlockResponse(blockResponses[0].data(), blockResponses[0].size(), "", parsed);
+            chain.decode(block, decoded);
+            check("synthetic transactions", std::to_string(parsed.size()), std::to_string(decoded.size()));
+            for(size_t t = 0; t < parsed.size() && !failed; t++){
+                for(size_t i = 0; i < parsed[t].vin.size() && i < decoded[t].vin.size(); i++){
+                    check("synthetic input of " + std::to_string(t), addressTable.name(parsed[t].vin[i].scriptSig.address) + " " + std::to_string(parsed[t].vin[i].value),
+                          addressTable.name(decoded[t].vin[i].scriptSig.address) + " " + std::to_string(decoded[t].vin[i].value));
+                }
+                for(size_t o = 0; o < parsed[t].vout.size() && o < decoded[t].vout.size(); o++){
+                    check("synthetic output of " + std::to_string(t), addressTable.name(parsed[t].vout[o].scriptPubKey.addresses[0]) + " " + std::to_string(parsed[t].vout[o].value),
+                          addressTable.name(decoded[t].vout[o].scriptPubKey.addresses[0]) + " " + std::to_string(decoded[t].vout[o].value));
+                }
+                check("synthetic shape of " + std::to_string(t), std::to_string(parsed[t].vin.size()) + " " + std::to_string(parsed[t].vout.size()),
+                      std::to_string(decoded[t].vin.size()) + " " + std::to_string(decoded[t].vout.size()));
+            }
+            if(failed) return;
+        }
+        if(transactionResponses.empty()){
+            for(synthtransaction_t& transaction : block) transactionResponses.push_back(chain.transactionResponse(transaction));
+        }
+    }
+    size_t blockBytes = 0, transactionBytes = 0;
+    for(std::string& response : blockResponses){
+        blockBytes += response.size();
+        transactions_t lean, full;
+        parseBlockResponse(response.data(), response.size(), "", lean);
+        parseBlockResponse(response.data(), response.size(), "", full, true);
+        if(lean.size() != decodeWithJsoncpp(response) || full.size() != lean.size()){
+            std::cerr << "The parsers disagree on the number of transactions" << std::endl;
+            failed = true;
+            return;
+        }
+    }
+    for(std::string& response : transactionResponses){
+        transactionBytes += response.size();
+        getrawtransaction_t transaction;
+        parseTransactionResponse(response.data(), response.size(), transaction);
+        if(transaction.vin.size() + transaction.vout.size() != decodeTransactionWithJsoncpp(response)){
+            std::cerr << "The parsers disagree on the number of inputs and outputs" << std::endl;
+            failed = true;
+            return;
+        }
+    }
+
+    std::cout << "Block response decoding, " << blockResponses.size() << " responses, " << blockBytes / 1e6 << " MB, " << rounds << " rounds" << std::endl;
+    std::vector<decoder_t> blockDecoders = {
+        {"jsoncpp", [](const std::string& response){ return decodeWithJsoncpp(response); }},
+        {"streaming full", [](const std::string& response){
+            transactions_t transactions;
+            parseBlockResponse(response.data(), response.size(), "", transactions, true);
+            return transactions.size();
+        }},
+        {"streaming", [](const std::string& response){
+            transactions_t transactions;
+            parseBlockResponse(response.data(), response.size(), "", transactions);
+            return transactions.size();
+        }},
+        /* The way the pipeline does it, into the arena of the block, recycled through the pool */
+        {"streaming arena", [](const std::string& response){
+            fetchedblock_t block;
+            block.reset();
+            parseBlockResponse(response.data(), response.size(), "", block.transactions);
+            return block.transactions.size();
+        }}
+    };
+    timeDecoders(blockResponses, rounds, blockDecoders);
+
+    std::cout << "Transaction response decoding, " << transactionResponses.size() << " responses, " << transactionBytes / 1e6 << " MB, " << rounds << " rounds" << std::endl;
+    std::vector<decoder_t> transactionDecoders = {
+        {"transaction jsoncpp", [](const std::string& response){ return decodeTransactionWithJsoncpp(response); }},
+        {"transaction streaming", [](const std::string& response){
+            getrawtransaction_t transaction;
+            parseTransactionResponse(response.data(), response.size(), transaction);
+            return transaction.vin.size() + transaction.vout.size();
+        }}
+    };
+    timeDecoders(transactionResponses, rounds, transactionDecoders);
+}
+
+/* Little endian integers, compact sizes and hex as the block files serialize them */
+static void putBytes(std::string& out, uint64_t value, size_t bytes){
+    for(size_t i = 0; i < bytes; i++) out.push_back((char) (value >> (8 * i)));
+}
+
+static void putVarint(std::string& out, uint64_t value){
+    if(value < 0xfd) putBytes(out, value, 1);
+    else if(value <= 0xffff) out.push_back((char) 0xfd), putBytes(out, value, 2);
+    else out.push_back((char) 0xfe), putBytes(out, value, 4);
+}
+
+static void putHex(std::string& out, const std::string& hex, bool reversed, bool withSize){
+    std::vector<unsigned char> bytes(hex.size() / 2);
+    size_t len = 0;
+    if(!bytes.empty() && !fromHex(hex, bytes.data(), bytes.size(), len)) throw std::runtime_error("Bad hex in a synthetic block");
+    if(reversed) std::reverse(bytes.begin(), bytes.end());
+    if(withSize) putVarint(out, bytes.size());
+    out.append((const char*) bytes.data(), bytes.size());
+}
+
+/* Serializes the getblock response of a synthetic block the way a node stores it. The generator's txids are random, the serialized transactions get their real ones and txids maps the former to the latter so the spends of later blocks find their outputs. A transaction with a witness on any input gets the segwit marker */
+static std::string serializeBlock(const std::string& response, const std::string& previous, uint32_t height, std::unordered_map<std::string, std::string>& txids, size_t& segwitTransactions){
+    Json::Value result = parseJson(response)["result"];
+    std::string block;
+    putBytes(block, 0x20000000, 4);
+    putHex(block, previous, true, false);
+    block.append(32, '\0');
+    putBytes(block, 1231006505 + height * 600, 4);
+    putBytes(block, 0x1d00ffff, 4);
+    putBytes(block, height, 4);
+    putVarint(block, result["tx"].size());
+    for(const Json::Value& tx : result["tx"]){
+        bool segwit = false;
+        for(const Json::Value& in : tx["vin"]) segwit = segwit || in.isMember("txinwitness");
+        std::string body;
+        putVarint(body, tx["vin"].size());
+        for(const Json::Value& in : tx["vin"]){
+            if(in.isMember("coinbase")){
+                body.append(32, '\0');
+                putBytes(body, 0xffffffff, 4);
+                putHex(body, in["coinbase"].asString(), false, true);
+            }
+            else{
+                putHex(body, txids.at(in["txid"].asString()), true, false);
+                putBytes(body, in["vout"].asUInt(), 4);
+                putHex(body, in["scriptSig"]["hex"].asString(), false, true);
+            }
+            putBytes(body, in["sequence"].asUInt(), 4);
+        }
+        putVarint(body, tx["vout"].size());
+        for(const Json::Value& out : tx["vout"]){
+            putBytes(body, (uint64_t) std::llround(out["value"].asDouble() * 1e8), 8);
+            putHex(body, out["scriptPubKey"]["hex"].asString(), false, true);
+        }
+        std::string stripped, version, lockTime;
+        putBytes(version, 2, 4);
+        putBytes(lockTime, 0, 4);
+        stripped = version + body + lockTime;
+        unsigned char txid[32];
+        sha256d((const unsigned char*) stripped.data(), stripped.size(), txid);
+        txids[tx["txid"].asString()] = toHex(txid, 32, true);
+        if(!segwit){
+            block += stripped;
+            continue;
+        }
+        segwitTransactions++;
+        block += version + std::string("\x00\x01", 2) + body;
+        for(const Json::Value& in : tx["vin"]){
+            putVarint(block, in["txinwitness"].size());
+            for(const Json::Value& item : in["txinwitness"]) putHex(block, item.asString(), false, true);
+        }
+        block += lockTime;
+    }
+    return block;
+}
+
+/* What the clustering reads of a transaction, the txids of the decoded response are mapped to the real ones */
+static std::string describeTransaction(const getrawtransaction_t& tx, const std::unordered_map<std::string, std::string>* txids){
+    auto txid = [&](const arena_string& id){
+        std::string text(id.data(), id.size());
+        return txids && txids->count(text) ? txids->at(text) : text;
+    };
+    std::string text = txid(tx.txid) + " <-";
+    for(const vin_t& in : tx.vin) text += " " + (in.isCoinbase ? std::string("coinbase") : txid(in.txid)) + ":" + std::to_string(in.value) + ":" + addressTable.name(in.scriptSig.address);
+    text += " ->";
+    for(const vout_t& out : tx.vout){
+        text += " " + std::to_string(out.value) + ":" + std::string(out.scriptPubKey.type.data(), out.scriptPubKey.type.size()) + (out.unspendable ? ":unspendable" : "");
+        for(uint32_t address : out.scriptPubKey.addresses) text += ":" + addressTable.name(address);
+    }
+    return text;
+}
+
+/* A few blocks of the synthetic chain serialized into blk00000.dat, once as they are and once obfuscated with a key in xor.dat. The reader must give every transaction the inputs and outputs the JSON decoder gives the getblock response of the same block, with segwit transactions and spends of an output made earlier in the same block among them */
+static void benchmarkBlockFile(){
+    synthshape_t shape;
+    shape.earlyBlocks = 2;
+    shape.transactionsPerBlock = 40;
+    SyntheticChain chain(shape, 5);
+    std::vector<std::string> responses;
+    std::string blocks, previous(64, '0');
+    std::unordered_map<std::string, std::string> txids;
+    size_t segwitTransactions = 0, sameBlockSpends = 0;
+    std::vector<synthtransaction_t> block;
+    while(chain.getHeight() < 8){
+        uint32_t height = chain.getHeight();
+        chain.nextBlock(block);
+        for(const synthtransaction_t& transaction : block){
+            for(const synthinput_t& input : transaction.inputs) if(input.height == height) sameBlockSpends++;
+        }
+        responses.push_back(chain.blockResponse(block, height));
+        std::string serialized = serializeBlock(responses.back(), previous, height, txids, segwitTransactions);
+        unsigned char hash[32];
+        sha256d((const unsigned char*) serialized.data(), 80, hash);
+        previous = toHex(hash, 32, true);
+        putBytes(blocks, 0xd9b4bef9, 4);
+        putBytes(blocks, serialized.size(), 4);
+        blocks += serialized;
+    }
+    check("synthetic block file shapes", std::string(segwitTransactions > 0 ? "segwit" : "no segwit") + " " + (sameBlockSpends > 0 ? "same block spends" : "no same block spend"), "segwit same block spends");
+    if(failed) return;
+
+    char directory[] = "/tmp/benchmark-blockfile-XXXXXX";
+    if(!mkdtemp(directory)){
+        std::cerr << "Cannot create a temporary directory" << std::endl;
+        failed = true;
+        return;
+    }
+    std::string base = directory;
+    const unsigned char key[8] = {0x3c, 0x00, 0xa5, 0x17, 0xff, 0x42, 0x81, 0x09};
+    for(bool obfuscated : {false, true}){
+        std::string written = blocks;
+        if(obfuscated){
+            for(size_t i = 0; i < written.size(); i++) written[i] ^= key[i % 8];
+            std::ofstream((base + "/xor.dat").c_str(), std::ios::binary).write((const char*) key, sizeof(key));
+        }
+        std::ofstream((base + "/blk00000.dat").c_str(), std::ios::binary).write(written.data(), written.size());
+        std::string variant = obfuscated ? "obfuscated " : "";
+        BlockFileReader reader(base, 0, UINT32_MAX);
+        check(variant + "block file blocks", std::to_string(reader.getBlockCount()), std::to_string(responses.size()));
+        fetchedblock_t read;
+        for(size_t height = 0; height < responses.size() && !failed && reader.next(read); height++){
+            transactions_t parsed;
+            parseBlockResponse(responses[height].data(), responses[height].size(), "", parsed);
+            check(variant + "block file transactions at " + std::to_string(height), std::to_string(read.transactions.size()), std::to_string(parsed.size()));
+            for(size_t t = 0; t < parsed.size() && !failed; t++){
+                check(variant + "block file transaction " + std::to_string(t) + " at " + std::to_string(height), describeTransaction(read.transactions[t], nullptr), describeTransaction(parsed[t], &txids));
+            }
+        }
+    }
+    unlink((base + "/blk00000.dat").c_str());
+    unlink((base + "/xor.dat").c_str());
+    rmdir(directory);
+    if(!failed) std::cout << "Block files, " << responses.size() << " synthetic blocks, " << segwitTransactions << " segwit transactions and " << sameBlockSpends << " spends within a block read the same as their JSON, plain and obfuscated" << std::endl;
+}
+
+/* H2 on a transaction of two inputs and two outputs for every pair of reuse counts: only an output seen once next to a reused one is the change, two reused outputs or two new ones give no proposal. Then a set without H1 must still give its merges an entity */
+static void checkChangeHeuristic(){
+    const uint8_t many = ReuseIndex::many;
+    uint32_t inputs[2] = {10, 11}, outputs[2] = {20, 21};
+    int64_t inputValues[2] = {5, 5}, outputValues[2] = {3, 6};
+    uint8_t pairs[4][2] = {{1, many}, {many, 1}, {many, many}, {1, 1}};
+    std::string got;
+    for(uint8_t* reuse : pairs){
+        txfeatures_t tx = {false, 2, 2, inputs, outputs, inputValues, outputValues, reuse};
+        std::vector<proposal_t> proposals;
+        ChangeAddressHeuristic::propose(tx, proposals);
+        got += std::string(got.empty() ? "" : " ") + (proposals.empty() ? "none" : std::to_string(proposals[0].wallet1) + "-" + std::to_string(proposals[0].wallet2));
+    }
+    check("change address by reuse", got, "10-20 10-21 none none");
+
+    /* Without H1 nothing else gives the inputs an entity, the set H4 merged must still have one */
+    transactions_t transactions(1);
+    transactions[0].vin.push_back(vin_t());
+    transactions[0].vin[0].scriptSig.address = addressTable.intern("single-output-input");
+    transactions[0].vout.push_back(vout_t());
+    transactions[0].vout[0].scriptPubKey.addresses.push_back(addressTable.intern("single-output-payee"));
+    EntityStore store;
+    MappedColumn<int> reuse;
+    Heuristics heuristics(1);
+    heuristics.setEnabled(1u << SingleOutputHeuristic::id, true);
+    heuristics.runHeuristics(store, transactions, reuse);
+    uint64_t inputEntity = store.getEntity(transactions[0].vin[0].scriptSig.address), payeeEntity = store.getEntity(transactions[0].vout[0].scriptPubKey.addresses[0]);
+    check("entity of a set without H1", inputEntity != 0 && inputEntity == payeeEntity ? "one entity" : std::to_string(inputEntity) + " " + std::to_string(payeeEntity), "one entity");
+}
+
+/* The clustering of a synthetic chain, and of the recorded blocks when there are some. Every case starts from an empty store and goes over the same decoded blocks, the store of the first run is kept for the persistence cases. The evaluation of the heuristics is also timed alone, the fastest of a few passes, for the compiled set, the runtime set and every heuristic on its own. Without timed only that store is made */
+static void benchmarkHeuristics(size_t fullBlocks, std::vector<std::string>& blockResponses, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, bool timed){
+    synthshape_t shape;
+    SyntheticChain chain(shape);
+    std::vector<synthtransaction_t> block;
+    std::vector<transactions_t> blocks;
+    size_t transactionCount = 0, inputCount = 0;
+    while(chain.getHeight() < shape.earlyBlocks + fullBlocks){
+        chain.nextBlock(block);
+        blocks.push_back(transactions_t());
+        chain.decode(block, blocks.back());
+        transactionCount += block.size();
+        for(synthtransaction_t& transaction : block) inputCount += transaction.inputs.size();
+    }
+    if(timed) checkChangeHeuristic();
+    if(!timed){
+        Heuristics heuristics(1);
+        for(size_t height = 0; height < blocks.size(); height++){
+            heuristics.runHeuristics(store, blocks[height], reuseFrequency);
+            activity.record(height, blocks[height], &store);
+        }
+        return;
+    }
+
+    /* The entities must not depend on the number of workers. The IDs come from one counter for every store, so it is the grouping that is compared */
+    unsigned workers = std::max(2u, std::thread::hardware_concurrency());
+    EntityStore parallelStore;
+    MappedColumn<int> parallelReuse;
+    Heuristics serial(1), parallel(workers);
+    for(size_t height = 0; height < blocks.size(); height++){
+        serial.runHeuristics(store, blocks[height], reuseFrequency);
+        activity.record(height, blocks[height], &store);
+        parallel.runHeuristics(parallelStore, blocks[height], parallelReuse);
+    }
+    check("entities with " + std::to_string(workers) + " workers", std::to_string(parallelStore.entityCount()), std::to_string(store.entityCount()));
+    std::unordered_map<uint64_t,uint64_t> sameEntity;
+    for(uint32_t wallet = 0; wallet < addressTable.size() && !failed; wallet++){
+        uint64_t entityId = store.getEntity(wallet), parallelId = parallelStore.getEntity(wallet);
+        if(entityId == 0) check("entity of " + addressTable.name(wallet), std::to_string(parallelId), "0");
+        else check("entity of " + addressTable.name(wallet), std::to_string(parallelId), std::to_string(sameEntity.insert(std::make_pair(entityId, parallelId)).first->second));
+    }
+    if(failed) return;
+
+    std::cout << "Clustering, " << blocks.size() << " synthetic blocks, " << transactionCount << " transactions, " << inputCount << " inputs, "
+              << chain.addressCount() << " addresses, " << store.entityCount() << " entities" << std::endl;
+    auto timeHeuristics = [&](const std::string& name, std::vector<transactions_t>& over, unsigned threads){
+        EntityStore scratch;
+        MappedColumn<int> reuse;
+        Heuristics heuristics(threads);
+        size_t transactions = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(transactions_t& transactionList : over){
+            heuristics.runHeuristics(scratch, transactionList, reuse);
+            transactions += transactionList.size();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-28s %12.0f transactions/s  %8.1f blocks/s\n", name.c_str(), transactions / seconds, over.size() / seconds);
+        record(name, transactions / seconds, "transactions/s");
+    };
+    timeHeuristics("runHeuristics", blocks, 1);
+    timeHeuristics("runHeuristics " + std::to_string(workers) + " workers", blocks, workers);
+
+    /* The evaluation alone, over reuse counts of the whole chain. The runtime set with all five must propose exactly what the compiled one does, then every heuristic is timed on its own */
+    {
+        MappedColumn<int> reuse;
+        reuse.resize(addressTable.size(), 0);
+        for(transactions_t& transactionList : blocks){
+            for(getrawtransaction_t& transaction : transactionList) for(vout_t& out : transaction.vout) if(!out.unspendable) reuse[out.scriptPubKey.addresses[0]]++;
+        }
+        /* A pass over the blocks takes a few milliseconds, a single one is at the mercy of the scheduler and of the clock speed. Every set is run once untimed so that its memory is already grown, then the fastest of evaluationRounds passes is kept */
+        const int evaluationRounds = 7;
+        auto evaluatePass = [&](Heuristics& heuristics, std::vector<proposal_t>& proposals){
+            proposals.clear();
+            auto start = std::chrono::steady_clock::now();
+            for(transactions_t& transactionList : blocks) heuristics.proposeBlock(transactionList, reuse, proposals);
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+        auto printSet = [&](const std::string& name, double seconds, std::vector<proposal_t>& proposals){
+            std::printf("%-28s %12.0f transactions/s  %8zu proposals\n", name.c_str(), transactionCount / seconds, proposals.size());
+            record(name, transactionCount / seconds, "transactions/s");
+        };
+        auto timeSet = [&](const std::string& name, Heuristics& heuristics, std::vector<proposal_t>& proposals){
+            evaluatePass(heuristics, proposals);
+            double seconds = evaluatePass(heuristics, proposals);
+            for(int round = 1; round < evaluationRounds; round++) seconds = std::min(seconds, evaluatePass(heuristics, proposals));
+            printSet(name, seconds, proposals);
+        };
+        std::vector<proposal_t> compiledProposals, runtimeProposals, proposals;
+        Heuristics compiled(1), runtime(1);
+        runtime.setEnabled(DefaultHeuristics::mask, false);
+        /* The two sets are compared against each other, their passes take turns so that neither gets the quieter moments */
+        evaluatePass(compiled, compiledProposals);
+        evaluatePass(runtime, runtimeProposals);
+        double compiledSeconds = evaluatePass(compiled, compiledProposals), runtimeSeconds = evaluatePass(runtime, runtimeProposals);
+        for(int round = 1; round < evaluationRounds; round++){
+            compiledSeconds = std::min(compiledSeconds, evaluatePass(compiled, compiledProposals));
+            runtimeSeconds = std::min(runtimeSeconds, evaluatePass(runtime, runtimeProposals));
+        }
+        printSet("evaluate compiled set", compiledSeconds, compiledProposals);
+        printSet("evaluate runtime set", runtimeSeconds, runtimeProposals);
+        check("runtime set proposals", std::to_string(runtimeProposals.size()), std::to_string(compiledProposals.size()));
+        for(size_t i = 0; i < compiledProposals.size() && !failed; i++){
+            const proposal_t& a = compiledProposals[i];
+            const proposal_t& b = runtimeProposals[i];
+            check("runtime set proposal " + std::to_string(i), std::to_string(b.wallet1) + " " + std::to_string(b.wallet2) + " H" + std::to_string(b.heuristic),
+                  std::to_string(a.wallet1) + " " + std::to_string(a.wallet2) + " H" + std::to_string(a.heuristic));
+        }
+        Heuristics alone(1);
+        alone.compose<CommonInputHeuristic>();
+        timeSet("evaluate H1 common input", alone, proposals);
+        alone.compose<ChangeAddressHeuristic>();
+        timeSet("evaluate H2 change address", alone, proposals);
+        alone.compose<ScriptChainHeuristic>();
+        timeSet("evaluate H3 script chain", alone, proposals);
+        alone.compose<SingleOutputHeuristic>();
+        timeSet("evaluate H4 single output", alone, proposals);
+        alone.compose<CoinbaseHeuristic>();
+        timeSet("evaluate H5 coinbase", alone, proposals);
+        /* A set without the change heuristic skips the reuse lookups */
+        alone.compose<CoinbaseHeuristic, CommonInputHeuristic, SingleOutputHeuristic, ScriptChainHeuristic>();
+        timeSet("evaluate without H2", alone, proposals);
+    }
+
+    /* The merges the common input heuristic proposes, applied to the store alone */
+    {
+        EntityStore scratch;
+        size_t merges = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(transactions_t& transactions : blocks){
+            for(getrawtransaction_t& transaction : transactions){
+                if(transaction.vin[0].isCoinbase) continue;
+                uint32_t first = transaction.vin[0].scriptSig.address;
+                for(vin_t& in : transaction.vin) scratch.unite(first, in.scriptSig.address);
+                scratch.ensureEntity(first);
+                merges += transaction.vin.size();
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-28s %12.0f merges/s  (%zu entities)\n", "common input merges", merges / seconds, scratch.entityCount());
+        record("common input merges", merges / seconds, "merges/s");
+    }
+
+    if(blockResponses.empty()) return;
+    std::vector<transactions_t> recorded(blockResponses.size());
+    for(size_t i = 0; i < blockResponses.size(); i++) parseBlockResponse(blockResponses[i].data(), blockResponses[i].size(), "", recorded[i]);
+    timeHeuristics("runHeuristics fixtures", recorded, 1);
+}
+
+/* Hands out blocks decoded beforehand, a copy each time like a fetch would give a new block. The txid of the coinbase stands in for the hash of the block */
+class MemorySource : public BlockSource{
+    public:
+    MemorySource(std::vector<transactions_t>& blocks, uint32_t first, uint32_t last) : blocks(blocks), height(first), last(last) {}
+    bool next(fetchedblock_t& block){
+        if(height > last) return false;
+        block.height = height;
+        block.hash.assign(blocks[height][0].txid.data(), blocks[height][0].txid.size());
+        block.transactions = blocks[height++];
+        return true;
+    }
+    void printThroughput(std::ostream&){}
+    private:
+    std::vector<transactions_t>& blocks;
+    uint32_t height;
+    uint32_t last;
+};
+
+/* A sharded backfill of the synthetic chain must give the clustering of a sequential run with the reuse prepass, the grouping and the reuse counts are compared before the shards are timed */
+static void benchmarkBackfill(size_t fullBlocks){
+    synthshape_t shape;
+    SyntheticChain chain(shape, 2);
+    std::vector<synthtransaction_t> block;
+    std::vector<transactions_t> blocks;
+    size_t transactionCount = 0;
+    while(chain.getHeight() < shape.earlyBlocks + fullBlocks){
+        chain.nextBlock(block);
+        blocks.push_back(transactions_t());
+        chain.decode(block, blocks.back());
+        transactionCount += block.size();
+    }
+    uint32_t last = blocks.size() - 1;
+    ShardedBackfill::SourceFactory openSource = [&](uint32_t first, uint32_t end){ return std::unique_ptr<BlockSource>(new MemorySource(blocks, first, end)); };
+
+    EntityStore store;
+    MappedColumn<int> reuseFrequency;
+    AddressActivity activity;
+    auto start = std::chrono::steady_clock::now();
+    {
+        ReuseIndex reuseIndex;
+        MemorySource source(blocks, 0, last);
+        reuseIndex.build(source, reuseFrequency);
+        Heuristics heuristics(1);
+        heuristics.setReuseIndex(&reuseIndex);
+        MemorySource again(blocks, 0, last);
+        fetchedblock_t fetched;
+        while(again.next(fetched)){
+            heuristics.runHeuristics(store, fetched.transactions, reuseFrequency);
+            activity.record(fetched.height, fetched.transactions, &store);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Backfill, " << blocks.size() << " synthetic blocks, " << transactionCount << " transactions, " << store.entityCount() << " entities" << std::endl;
+    std::printf("%-28s %12.0f transactions/s  %8.1f blocks/s\n", "sequential with prepass", transactionCount / seconds, blocks.size() / seconds);
+    record("sequential with prepass", transactionCount / seconds, "transactions/s");
+
+    unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+    for(unsigned shards = 2; shards <= cores; shards *= 2){
+        EntityStore sharded;
+        MappedColumn<int> shardedReuse;
+        AddressActivity shardedActivity;
+        ReuseIndex reuseIndex;
+        std::vector<uint32_t> counted;
+        uint64_t lastHeight = 0;
+        std::string lastHash;
+        Heuristics heuristics(1);
+        ShardedBackfill backfill(shards, 0, last, openSource);
+        start = std::chrono::steady_clock::now();
+        backfill.countReuse(shardedReuse, reuseIndex, counted);
+        backfill.cluster(sharded, heuristics, shardedReuse, reuseIndex, shardedActivity, lastHeight, lastHash, [](uint32_t){});
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::string name = std::to_string(shards) + " shards";
+        check(name + " last height", std::to_string(lastHeight), std::to_string(last));
+        check(name + " last hash", lastHash, std::string(blocks[last][0].txid.data(), blocks[last][0].txid.size()));
+        check(name + " entities", std::to_string(sharded.entityCount()), std::to_string(store.entityCount()));
+        std::unordered_map<uint64_t,uint64_t> sameEntity;
+        for(uint32_t wallet = 0; wallet < addressTable.size() && !failed; wallet++){
+            uint64_t entityId = store.getEntity(wallet), shardedId = sharded.getEntity(wallet);
+            if(entityId == 0) check(name + " entity of " + addressTable.name(wallet), std::to_string(shardedId), "0");
+            else check(name + " entity of " + addressTable.name(wallet), std::to_string(shardedId), std::to_string(sameEntity.insert(std::make_pair(entityId, shardedId)).first->second));
+            int expected = wallet < reuseFrequency.size() ? reuseFrequency[wallet] : 0, got = wallet < shardedReuse.size() ? shardedReuse[wallet] : 0;
+            check(name + " reuse of " + addressTable.name(wallet), std::to_string(got), std::to_string(expected));
+            check(name + " totals of " + addressTable.name(wallet), totalsText(shardedActivity.totals(wallet)), totalsText(activity.totals(wallet)));
+            valuetotals_t expectedTotals, shardedTotals;
+            if(entityId != 0 && store.getTotals(entityId, expectedTotals) && sharded.getTotals(shardedId, shardedTotals)){
+                check(name + " totals of the entity of " + addressTable.name(wallet), totalsText(shardedTotals), totalsText(expectedTotals));
+            }
+        }
+        if(failed) return;
+        std::printf("%-28s %12.0f transactions/s  %8.1f blocks/s\n", ("backfill " + name).c_str(), transactionCount / seconds, blocks.size() / seconds);
+        record("backfill " + name, transactionCount / seconds, "transactions/s");
+        backfill.printThroughput(std::cout);
+    }
+}
+
+/* Runs work on threads threads at once and returns the seconds it took them all */
+static double onThreads(unsigned threads, std::function<void(unsigned)> work){
+    std::vector<std::thread> running;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; t++) running.push_back(std::thread(work, t));
+    for(std::thread& thread : running) thread.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Many writers interning addresses and bumping reuse counts at once, the striped AddressTable and the atomic ReuseCounters against a single lock. The same lookups are made whatever the number of threads, about one in four is an address seen for the first time. Every thread keeps the IDs it was given and every count is checked afterwards, so a lost update fails the run */
+static void benchmarkContention(size_t iterations){
+    const size_t distinct = std::max<size_t>(1024, iterations / 4);
+    const size_t lookups = distinct * 4;
+    uint64_t seed = 7;
+    std::vector<std::string> names(distinct);
+    for(std::string& name : names){
+        std::vector<unsigned char> bytes = randomBytes(seed, 25);
+        name = legacy::encodeBase58(bytes);
+    }
+    std::vector<uint32_t> picks(lookups);
+    std::vector<uint32_t> expected(distinct, 0);
+    for(uint32_t& pick : picks){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        pick = (seed >> 33) % distinct;
+        expected[pick]++;
+    }
+    size_t used = distinct - std::count(expected.begin(), expected.end(), 0u);
+    std::cout << "Contention, " << lookups << " lookups of " << used << " addresses, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+    for(unsigned threads = 1; threads <= 64 && !failed; threads *= 2){
+        std::string suffix = " " + std::to_string(threads) + " threads";
+        /* Thread t makes the lookups t, t + threads, ... and keeps what it got */
+        std::vector<uint32_t> got(lookups);
+        auto timeTable = [&](const std::string& name, std::function<uint32_t(const std::string&)> intern, std::function<bool(const std::string&, uint32_t&)> find){
+            double seconds = onThreads(threads, [&](unsigned t){
+                for(size_t i = t; i < lookups; i += threads) got[i] = intern(names[picks[i]]);
+            });
+            for(size_t i = 0; i < lookups && !failed; i++){
+                uint32_t id;
+                if(!find(names[picks[i]], id)) check(name + " finds " + names[picks[i]], "missing", std::to_string(got[i]));
+                else check(name + " ID of " + names[picks[i]], std::to_string(got[i]), std::to_string(id));
+            }
+            std::printf("%-28s %12.0f lookups/s\n", (name + suffix).c_str(), lookups / seconds);
+            record(name + suffix, lookups / seconds, "lookups/s");
+        };
+        {
+            legacy::MutexAddressTable table;
+            timeTable("mutex table", [&](const std::string& a){ return table.intern(a); }, [&](const std::string& a, uint32_t& id){ return table.find(a, id); });
+            check("mutex table size", std::to_string(table.size()), std::to_string(used));
+        }
+        {
+            AddressTable table;
+            timeTable("striped table", [&](const std::string& a){ return table.intern(a); }, [&](const std::string& a, uint32_t& id){ return table.find(a, id); });
+            check("striped table size", std::to_string(table.size()), std::to_string(used));
+            for(uint32_t id = 0; id < table.size() && !failed; id++){
+                uint32_t found;
+                check("striped table name of " + std::to_string(id), table.find(table.name(id), found) ? std::to_string(found) : "missing", std::to_string(id));
+            }
+        }
+
+        auto timeCounters = [&](const std::string& name, std::function<void(uint32_t)> add, std::function<uint32_t(uint32_t)> get){
+            double seconds = onThreads(threads, [&](unsigned t){
+                for(size_t i = t; i < lookups; i += threads) add(picks[i]);
+            });
+            for(uint32_t address = 0; address < distinct && !failed; address++) check(name + " count of " + std::to_string(address), std::to_string(get(address)), std::to_string(expected[address]));
+            std::printf("%-28s %12.0f increments/s\n", (name + suffix).c_str(), lookups / seconds);
+            record(name + suffix, lookups / seconds, "increments/s");
+        };
+        {
+            legacy::MutexReuseCounters counters;
+            timeCounters("mutex counters", [&](uint32_t a){ counters.add(a); }, [&](uint32_t a){ return counters.get(a); });
+        }
+        {
+            ReuseCounters counters;
+            timeCounters("atomic counters", [&](uint32_t a){ counters.add(a); }, [&](uint32_t a){ return counters.get(a); });
+        }
+    }
+}
+
+/* The addresses of the synthetic chain interned the way the decoder does, inputs and outputs in block order, into a table with and without its prefilter. Most lookups of a block are for an address never seen before, which the filter answers without probing the map. The IDs given must be the same either way, then addresses of another chain are looked up to time the misses alone. In memory the filter only pays on the misses, the intern of a new address probes the map again to insert it */
+static void benchmarkPrefilter(size_t fullBlocks){
+    synthshape_t shape;
+    SyntheticChain chain(shape, 3), other(shape, 4);
+    std::vector<synthtransaction_t> block;
+    std::vector<std::string> stream, unseen;
+    while(chain.getHeight() < shape.earlyBlocks + fullBlocks){
+        chain.nextBlock(block);
+        for(synthtransaction_t& transaction : block){
+            for(synthinput_t& input : transaction.inputs) stream.push_back(chain.addressName(input.address));
+            for(synthoutput_t& output : transaction.outputs) stream.push_back(chain.addressName(output.address));
+        }
+        other.nextBlock(block);
+        for(synthtransaction_t& transaction : block){
+            for(synthoutput_t& output : transaction.outputs) unseen.push_back(other.addressName(output.address));
+        }
+    }
+    std::cout << "Prefilter, " << stream.size() << " lookups of " << chain.addressCount() << " addresses, " << unseen.size() << " lookups of unseen addresses" << std::endl;
+
+    std::vector<uint32_t> expected;
+    for(int filtered = 0; filtered < 2 && !failed; filtered++){
+        std::string name = filtered ? "filtered" : "unfiltered";
+        AddressTable table;
+        if(filtered) table.enablePrefilter();
+        std::vector<uint32_t> ids(stream.size());
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < stream.size(); i++) ids[i] = table.intern(stream[i]);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(expected.empty()) expected = ids;
+        else{
+            for(size_t i = 0; i < stream.size() && !failed; i++) check(name + " ID of " + stream[i], std::to_string(ids[i]), std::to_string(expected[i]));
+        }
+        std::printf("%-28s %12.0f lookups/s\n", (name + " intern").c_str(), stream.size() / seconds);
+        record(name + " intern", stream.size() / seconds, "lookups/s");
+
+        addressfilterstats_t interned = table.getFilterStats();
+        size_t found = 0;
+        uint32_t id;
+        start = std::chrono::steady_clock::now();
+        for(const std::string& address : unseen) found += table.find(address, id);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        check(name + " unseen found", std::to_string(found), "0");
+        std::printf("%-28s %12.0f lookups/s\n", (name + " miss").c_str(), unseen.size() / seconds);
+        record(name + " miss", unseen.size() / seconds, "lookups/s");
+        if(!filtered) continue;
+
+        addressfilterstats_t missed = table.getFilterStats();
+        uint64_t newAddresses = interned.skipped + interned.falsePositives;
+        double missFalsePositives = 100.0 * (missed.falsePositives - interned.falsePositives) / unseen.size();
+        std::printf("filter %.2f MB, %.1f%% of the interns skipped the map, %.2f%% of the new addresses and %.2f%% of the misses were false positives\n",
+            interned.bytes / (1024.0 * 1024.0), 100.0 * interned.skipped / interned.lookups, newAddresses ? 100.0 * interned.falsePositives / newAddresses : 0.0, missFalsePositives);
+        record("intern skipped", 100.0 * interned.skipped / interned.lookups, "%");
+        record("miss false positives", missFalsePositives, "%");
+    }
+}
+
+/* The state of the clustering kept in files with --state-dir against the same state on the heap. The addresses of the synthetic chain are interned block by block into a table in memory, a mapped one one by one and a mapped one a block at a time with internAll, then the decoded blocks are clustered into a store and reuse counts on the heap and mapped ones. The IDs and the grouping must be the same */
+static void benchmarkOutOfCore(size_t fullBlocks, const std::string& stateDir){
+    synthshape_t shape;
+    SyntheticChain chain(shape, 5);
+    std::vector<synthtransaction_t> block;
+    std::vector<std::vector<std::string> > names;
+    std::vector<transactions_t> blocks;
+    size_t lookups = 0, transactionCount = 0;
+    while(chain.getHeight() < shape.earlyBlocks + fullBlocks){
+        chain.nextBlock(block);
+        names.push_back(std::vector<std::string>());
+        for(synthtransaction_t& transaction : block){
+            for(synthinput_t& input : transaction.inputs) names.back().push_back(chain.addressName(input.address));
+            for(synthoutput_t& output : transaction.outputs) names.back().push_back(chain.addressName(output.address));
+        }
+        lookups += names.back().size();
+        blocks.push_back(transactions_t());
+        chain.decode(block, blocks.back());
+        transactionCount += block.size();
+    }
+    std::cout << "Out of core, " << blocks.size() << " synthetic blocks, " << lookups << " lookups of " << chain.addressCount() << " addresses, files in " << stateDir << std::endl;
+
+    std::vector<uint32_t> expected;
+    for(int mode = 0; mode < 3 && !failed; mode++){
+        std::string name = mode == 0 ? "heap table" : (mode == 1 ? "mapped table" : "mapped table batched");
+        AddressTable table;
+        if(mode > 0) table.mapTo(stateDir);
+        std::vector<uint32_t> ids, blockIds;
+        ids.reserve(lookups);
+        auto start = std::chrono::steady_clock::now();
+        for(std::vector<std::string>& blockNames : names){
+            if(mode == 2){
+                table.internAll(blockNames, blockIds);
+                ids.insert(ids.end(), blockIds.begin(), blockIds.end());
+            }
+            else for(std::string& address : blockNames) ids.push_back(table.intern(address));
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(expected.empty()) expected = ids;
+        else{
+            for(size_t i = 0; i < ids.size() && !failed; i++) check(name + " ID " + std::to_string(i), std::to_string(ids[i]), std::to_string(expected[i]));
+        }
+        size_t i = 0;
+        for(std::vector<std::string>& blockNames : names){
+            for(std::string& address : blockNames){
+                if(i % 97 == 0 && !failed) check(name + " name of " + std::to_string(ids[i]), table.name(ids[i]), address);
+                i++;
+            }
+        }
+        std::printf("%-28s %12.0f lookups/s  %8.1f MB heap  %8.1f MB mapped\n", name.c_str(), lookups / seconds, table.memoryUsage() / (1024.0 * 1024.0), table.mappedBytes() / (1024.0 * 1024.0));
+        record(name, lookups / seconds, "lookups/s");
+    }
+
+    EntityStore heapStore, mappedStore;
+    MappedColumn<int> heapReuse, mappedReuse;
+    mappedStore.mapTo(stateDir);
+    mappedReuse.mapTo(stateDir, (size_t) UINT32_MAX + 1);
+    for(int mapped = 0; mapped < 2 && !failed; mapped++){
+        EntityStore& store = mapped ? mappedStore : heapStore;
+        MappedColumn<int>& reuse = mapped ? mappedReuse : heapReuse;
+        Heuristics heuristics(1);
+        auto start = std::chrono::steady_clock::now();
+        for(transactions_t& transactions : blocks) heuristics.runHeuristics(store, transactions, reuse);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::string name = mapped ? "mapped store" : "heap store";
+        std::printf("%-28s %12.0f transactions/s  %8.1f MB heap  %8.1f MB mapped\n", name.c_str(), transactionCount / seconds,
+            (store.memoryUsage() + reuse.memoryUsage()) / (1024.0 * 1024.0), (store.mappedBytes() + reuse.mappedBytes()) / (1024.0 * 1024.0));
+        record(name, transactionCount / seconds, "transactions/s");
+    }
+    check("mapped store entities", std::to_string(mappedStore.entityCount()), std::to_string(heapStore.entityCount()));
+    std::unordered_map<uint64_t,uint64_t> sameEntity;
+    for(uint32_t wallet = 0; wallet < addressTable.size() && !failed; wallet++){
+        uint64_t entityId = heapStore.getEntity(wallet), mappedId = mappedStore.getEntity(wallet);
+        if(entityId == 0) check("mapped entity of " + addressTable.name(wallet), std::to_string(mappedId), "0");
+        else check("mapped entity of " + addressTable.name(wallet), std::to_string(mappedId), std::to_string(sameEntity.insert(std::make_pair(entityId, mappedId)).first->second));
+        int expectedReuse = wallet < heapReuse.size() ? heapReuse[wallet] : 0, got = wallet < mappedReuse.size() ? mappedReuse[wallet] : 0;
+        check("mapped reuse of " + addressTable.name(wallet), std::to_string(got), std::to_string(expectedReuse));
+    }
+}
+
+/* The binary snapshot is the persistence that does not need a server, it is written and loaded back from the clustering of the synthetic chain. MongoDB checkpoints are left out, they need a running server */
+static void benchmarkPersistence(EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity){
+    char path[] = "/tmp/benchmark-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0){
+        std::cerr << "Cannot create a temporary file" << std::endl;
+        failed = true;
+        return;
+    }
+    close(fd);
+    auto start = std::chrono::steady_clock::now();
+    writeSnapshot(path, store, reuseFrequency, activity, 0);
+    double writeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    double megabytes = file.tellg() / 1e6;
+    EntityStore loaded;
+    MappedColumn<int> loadedReuse;
+    AddressActivity loadedActivity;
+    size_t freeIDs = Entity::getFreeIDs().size();
+    start = std::chrono::steady_clock::now();
+    loadSnapshot(path, loaded, loadedReuse, loadedActivity);
+    double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    unlink(path);
+    /* The load queued the free entity IDs a second time behind the ones still there, they are taken off so that the later cases do not hand out an ID twice */
+    size_t queued = Entity::getFreeIDs().size() - freeIDs;
+    for(size_t i = 0; i < queued; i++) Entity::unpushFreeID();
+    check("entities loaded", std::to_string(loaded.entityCount()), std::to_string(store.entityCount()));
+    for(uint32_t wallet = 0; wallet < addressTable.size() && !failed; wallet++){
+        check("entity of " + addressTable.name(wallet), std::to_string(loaded.getEntity(wallet)), std::to_string(store.getEntity(wallet)));
+        check("reuse of " + addressTable.name(wallet), std::to_string(wallet < loadedReuse.size() ? loadedReuse[wallet] : 0), std::to_string(wallet < reuseFrequency.size() ? reuseFrequency[wallet] : 0));
+        check("totals of " + addressTable.name(wallet), totalsText(loadedActivity.totals(wallet)), totalsText(activity.totals(wallet)));
+        valuetotals_t expectedTotals, loadedTotals;
+        uint64_t entityId = store.getEntity(wallet);
+        if(entityId != 0 && store.getTotals(entityId, expectedTotals)){
+            check("totals of entity " + std::to_string(entityId), loaded.getTotals(entityId, loadedTotals) ? totalsText(loadedTotals) : "missing", totalsText(expectedTotals));
+        }
+    }
+    if(failed) return;
+
+    std::cout << "Snapshot, " << store.entityCount() << " entities, " << megabytes << " MB" << std::endl;
+    std::printf("%-28s %12.1f MB/s  %8.3f s\n", "snapshot write", megabytes / writeSeconds, writeSeconds);
+    std::printf("%-28s %12.1f MB/s  %8.3f s\n", "snapshot load", megabytes / loadSeconds, loadSeconds);
+    record("snapshot write", megabytes / writeSeconds, "MB/s");
+    record("snapshot load", megabytes / loadSeconds, "MB/s");
+}
+
+/* What a run of the recovery group is told to do, it stops with SIGKILL either in the middle of block killAt or, with killAfterSnapshot, in the checkpoint of block killAt once the snapshot is written but before the log is started over */
+struct recoveryrun_t{
+    std::string snapshot;
+    uint64_t killAt;
+    bool killAfterSnapshot;
+    std::string dump;
+};
+
+/* One run of the recovery group in a child process, it resumes from the snapshot and its log when there is one and clusters the rest of the chain, checkpointing every interval blocks. The first line of the dump is what the restart found and how long it took to cluster its first block, the clustering follows one address per line with its entity named by the smallest address in it, so that runs whose entity IDs differ can be compared. A restart that replays blocks prints how long the replay took */
+static int recoveryRun(const recoveryrun_t& run, std::vector<std::vector<synthtransaction_t> >& chainBlocks, SyntheticChain& chain, uint64_t interval){
+    auto launched = std::chrono::steady_clock::now();
+    /* The free entity IDs of the groups run before are not those of this store */
+    for(size_t queued = Entity::getFreeIDs().size(); queued > 0; queued--) Entity::unpushFreeID();
+    EntityStore store;
+    MappedColumn<int> reuseFrequency;
+    AddressActivity activity;
+    Heuristics heuristics(1);
+    uint64_t lastHeight = noHeight;
+    std::string lastHash;
+    if(access(run.snapshot.c_str(), F_OK) == 0) lastHeight = loadSnapshot(run.snapshot, store, reuseFrequency, activity, &lastHash);
+    MergeLog log(run.snapshot + ".wal");
+    mergelogreplay_t replayed = log.replay(lastHeight, lastHash, store, heuristics, reuseFrequency, activity);
+    if(replayed.blocks > 0){
+        lastHeight = replayed.lastHeight;
+        lastHash = replayed.lastHash;
+        std::printf("%-28s %12.1f ms  %llu blocks%s\n", "log replay", replayed.seconds * 1000, (unsigned long long) replayed.blocks, replayed.tornTail ? ", torn record cut off" : "");
+        std::fflush(stdout);
+    }
+    double restartSeconds = -1;
+    for(uint64_t height = lastHeight == noHeight ? 0 : lastHeight + 1; height < chainBlocks.size(); height++){
+        transactions_t transactions;
+        chain.decode(chainBlocks[height], transactions);
+        heuristics.runHeuristics(store, transactions, reuseFrequency);
+        if(height == run.killAt && !run.killAfterSnapshot) raise(SIGKILL);
+        activity.record(height, transactions, &store);
+        log.append(height, chainBlocks[height][0].txid, transactions, heuristics);
+        lastHeight = height;
+        lastHash = chainBlocks[height][0].txid;
+        if(restartSeconds < 0) restartSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - launched).count();
+        if((height + 1) % interval == 0){
+            writeSnapshot(run.snapshot, store, reuseFrequency, activity, lastHeight, lastHash);
+            if(height == run.killAt) raise(SIGKILL);
+            log.reset(lastHeight, lastHash);
+        }
+    }
+
+    std::unordered_map<uint64_t,std::string> entityName;
+    for(uint32_t wallet = 0; wallet < addressTable.size(); wallet++){
+        uint64_t entityId = store.getEntity(wallet);
+        if(entityId == 0) continue;
+        auto named = entityName.insert(std::make_pair(entityId, addressTable.name(wallet)));
+        if(addressTable.name(wallet) < named.first->second) named.first->second = addressTable.name(wallet);
+    }
+    std::vector<std::string> lines;
+    for(uint32_t wallet = 0; wallet < addressTable.size(); wallet++){
+        int reuse = wallet < reuseFrequency.size() ? reuseFrequency[wallet] : 0;
+        if(reuse == 0 && store.getEntity(wallet) == 0) continue;
+        std::string line = addressTable.name(wallet) + " reuse " + std::to_string(reuse) + " totals " + totalsText(activity.totals(wallet));
+        uint64_t entityId = store.getEntity(wallet);
+        valuetotals_t totals;
+        if(entityId != 0) line += " entity " + entityName[entityId] + (store.getTotals(entityId, totals) ? " entity totals " + totalsText(totals) : "");
+        lines.push_back(line);
+    }
+    std::sort(lines.begin(), lines.end());
+    std::ofstream out(run.dump.c_str());
+    out << replayed.blocks << " " << replayed.skipped << " " << restartSeconds << "\n";
+    for(std::string& line : lines) out << line << "\n";
+    out.close();
+    return out ? 0 : 1;
+}
+
+/* Runs recoveryRun in a child and returns its status from waitpid */
+static int recoveryChild(const recoveryrun_t& run, std::vector<std::vector<synthtransaction_t> >& chainBlocks, SyntheticChain& chain, uint64_t interval){
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0){
+        int code = 1;
+        try{
+            code = recoveryRun(run, chainBlocks, chain, interval);
+        }
+        catch(std::exception& e){
+            std::cerr << e.what() << std::endl;
+        }
+        _exit(code);
+    }
+    int status = -1;
+    if(pid < 0 || waitpid(pid, &status, 0) != pid) return -1;
+    return status;
+}
+
+/* A log started after block 5 of one branch must not be replayed on a snapshot that ends at block 5 of another, a snapshot with the same hash or with none known still takes it */
+static void checkLogBase(const std::string& base){
+    std::string path = base + "/base.wal", hash(64, 'a'), otherHash(64, 'b');
+    MergeLog(path).reset(5, hash);
+    EntityStore store;
+    MappedColumn<int> reuseFrequency;
+    AddressActivity activity;
+    Heuristics heuristics(1);
+    std::string got;
+    for(const std::string& snapshotHash : {hash, otherHash, std::string()}){
+        try{
+            MergeLog(path).replay(5, snapshotHash, store, heuristics, reuseFrequency, activity);
+            got += " replayed";
+        }
+        catch(std::exception&){
+            got += " refused";
+        }
+    }
+    check("log after another block of the same height", got, " replayed refused replayed");
+    unlink(path.c_str());
+}
+
+/* A run killed twice, once in the middle of a block and once inside a checkpoint between its snapshot and the start of its new log, with a torn record left at the end of the log in between. Every restart loads the snapshot and replays the log, then the clustering it ends with must be the one of a run that was never killed. The runs are child processes so that SIGKILL leaves them no chance to write anything more. The restart is timed from the start of the process to its first block clustered. A log started after another block of the height of the snapshot must be refused */
+static void benchmarkRecovery(size_t fullBlocks){
+    synthshape_t shape;
+    SyntheticChain chain(shape, 9);
+    std::vector<std::vector<synthtransaction_t> > chainBlocks;
+    std::vector<synthtransaction_t> block;
+    while(chain.getHeight() < shape.earlyBlocks + fullBlocks){
+        chain.nextBlock(block);
+        chainBlocks.push_back(block);
+    }
+    uint64_t interval = std::max<uint64_t>(2, chainBlocks.size() / 6);
+    char directory[] = "/tmp/benchmark-recovery-XXXXXX";
+    if(!mkdtemp(directory)){
+        std::cerr << "Cannot create a temporary directory" << std::endl;
+        failed = true;
+        return;
+    }
+    std::string base = directory;
+    recoveryrun_t straight = {base + "/straight.snapshot", noHeight, false, base + "/straight.txt"};
+    recoveryrun_t killedInBlock = {base + "/resumed.snapshot", interval * 2 + interval / 2, false, ""};
+    recoveryrun_t killedInCheckpoint = {base + "/resumed.snapshot", interval * 4 - 1, true, ""};
+    recoveryrun_t resumed = {base + "/resumed.snapshot", noHeight, false, base + "/resumed.txt"};
+    std::cout << "Recovery, " << chainBlocks.size() << " synthetic blocks, a checkpoint every " << interval << ", killed in block " << killedInBlock.killAt << " and in the checkpoint of block " << killedInCheckpoint.killAt << std::endl;
+
+    int status = recoveryChild(straight, chainBlocks, chain, interval);
+    check("run never killed", std::to_string(status), "0");
+    status = recoveryChild(killedInBlock, chainBlocks, chain, interval);
+    check("killed in a block", WIFSIGNALED(status) ? std::string(strsignal(WTERMSIG(status))) : "exit " + std::to_string(status), strsignal(SIGKILL));
+    /* Half the header of a record, as a write cut short would leave it */
+    std::ofstream torn((resumed.snapshot + ".wal").c_str(), std::ios::binary | std::ios::app);
+    torn.write("\x40\x00\x00\x00\x12\x34", 6);
+    torn.close();
+    status = recoveryChild(killedInCheckpoint, chainBlocks, chain, interval);
+    check("killed in a checkpoint", WIFSIGNALED(status) ? std::string(strsignal(WTERMSIG(status))) : "exit " + std::to_string(status), strsignal(SIGKILL));
+    status = recoveryChild(resumed, chainBlocks, chain, interval);
+    check("resumed run", std::to_string(status), "0");
+
+    std::ifstream expectedIn(straight.dump.c_str()), resumedIn(resumed.dump.c_str());
+    std::string expectedLine, resumedLine, restart;
+    std::getline(expectedIn, expectedLine);
+    std::getline(resumedIn, restart);
+    size_t lines = 0;
+    while(!failed){
+        bool more = (bool) std::getline(expectedIn, expectedLine), resumedMore = (bool) std::getline(resumedIn, resumedLine);
+        if(!more && !resumedMore) break;
+        check("resumed line " + std::to_string(lines), resumedMore ? resumedLine : "end of the clustering", more ? expectedLine : "end of the clustering");
+        lines++;
+    }
+    for(const char* file : {"/straight.snapshot", "/straight.snapshot.wal", "/straight.txt", "/resumed.snapshot", "/resumed.snapshot.wal", "/resumed.txt"}) unlink((base + file).c_str());
+    checkLogBase(base);
+    rmdir(directory);
+    if(failed) return;
+
+    /* The last restart came after the kill in the checkpoint, the snapshot was already written so the whole log was behind it */
+    uint64_t replayedBlocks = 0, skipped = 0;
+    double restartSeconds = 0;
+    std::istringstream(restart) >> replayedBlocks >> skipped >> restartSeconds;
+    check("blocks replayed after the kill in the checkpoint", std::to_string(replayedBlocks), "0");
+    check("blocks skipped after the kill in the checkpoint", std::to_string(skipped), std::to_string(interval));
+    std::cout << "Clustering after two kills is the one of a straight run, " << lines << " addresses" << std::endl;
+    std::printf("%-28s %12.1f ms\n", "restart to first block", restartSeconds * 1000);
+    record("restart to first block", restartSeconds, "s");
+}
+
+/* Starts program with its output to the file when there is one, and returns its pid */
+static pid_t spawn(const std::vector<std::string>& arguments, const std::string& output){
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0){
+        int fd = open(output.empty() ? "/dev/null" : output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd >= 0){
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+        std::vector<char*> argv;
+        for(const std::string& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+/* A port nothing listens on, the kernel picks it */
+static int freePort(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    int port = 0;
+    if(fd >= 0 && bind(fd, (sockaddr*) &address, sizeof(address)) == 0 && getsockname(fd, (sockaddr*) &address, &length) == 0) port = ntohs(address.sin_port);
+    if(fd >= 0) close(fd);
+    return port;
+}
+
+/* Follows mockrpc while it grows 6 blocks past 9 and replaces its last reorgDepth blocks when the 4th comes, then stops the follower with SIGTERM once it had the time to reach the tip. Returns what the follower printed */
+static std::string followRun(const std::string& base, uint32_t undoDepth, int reorgDepth){
+    std::string port = std::to_string(freePort()), output = base + "/follow.txt", snapshot = base + "/follow.snapshot";
+    pid_t mock = spawn({"./mockrpc.out", "--port", port, "--blocks", "10", "--txs", "5", "--grow-ms", "300", "--grow-limit", "6", "--reorg-every", "4", "--reorg-depth", std::to_string(reorgDepth)}, "");
+    usleep(500000);
+    pid_t follower = spawn({"./runheuristics.out", "--rpc-port", port, "--mongo", "no", "--snapshot", snapshot, "--start", "0", "--follow", "yes", "--undo-depth", std::to_string(undoDepth), "--poll-interval", "100", "--workers", "1"}, output);
+    int status = -1;
+    auto started = std::chrono::steady_clock::now();
+    while(waitpid(follower, &status, WNOHANG) == 0){
+        if(std::chrono::steady_clock::now() - started > std::chrono::seconds(5)){
+            kill(follower, SIGTERM);
+            waitpid(follower, &status, 0);
+            break;
+        }
+        usleep(50000);
+    }
+    kill(mock, SIGKILL);
+    waitpid(mock, nullptr, 0);
+    std::ifstream in(output.c_str());
+    std::string printed((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    for(const std::string& file : {output, snapshot, snapshot + ".wal"}) unlink(file.c_str());
+    return printed;
+}
+
+/* The follower against mockrpc, a reorg as deep as the undo journal is rolled back and the new branch clustered up to the tip, one block deeper must stop it with the error that the clustering has to be rebuilt instead of going on from a block no longer on the chain. It runs the programs built next to the benchmark, runheuristics.out and mockrpc.out, and is skipped without them */
+static void benchmarkFollow(){
+    if(access("./runheuristics.out", X_OK) != 0 || access("./mockrpc.out", X_OK) != 0){
+        std::cout << "Follow skipped, runheuristics.out and mockrpc.out are not built in the current directory" << std::endl;
+        return;
+    }
+    char directory[] = "/tmp/benchmark-follow-XXXXXX";
+    if(!mkdtemp(directory)){
+        std::cerr << "Cannot create a temporary directory" << std::endl;
+        failed = true;
+        return;
+    }
+    const uint32_t undoDepth = 2;
+    /* mockrpc replaces its last reorgDepth blocks as it adds one, the follower had clustered all but the new one */
+    std::string printed = followRun(directory, undoDepth, undoDepth + 1);
+    check("reorg as deep as the journal", printed.find("1 reorgs (" + std::to_string(undoDepth) + " blocks rolled back)") != std::string::npos && printed.find("Done 15") != std::string::npos ? "followed to the tip" : printed, "followed to the tip");
+    printed = followRun(directory, undoDepth, undoDepth + 2);
+    check("reorg one block deeper than the journal", printed.find("Follow: the chain reorganized below block 10 ") != std::string::npos && printed.find("Done 13") == std::string::npos ? "stopped" : printed, "stopped");
+    rmdir(directory);
+    if(!failed) std::cout << "Follow, a reorg of " << undoDepth << " blocks rolled back and one of " << undoDepth + 1 << " stopped the follower" << std::endl;
+}
+
+/* The column export of the clustering of the synthetic chain, on one thread and on every core. The files are read back and every address row is checked against the store, the values of every entity must add up to those of its addresses, then an export since the middle of the chain must hold exactly the entities active after it */
+static void benchmarkExport(EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity){
+    char directory[] = "/tmp/benchmark-export-XXXXXX";
+    if(!mkdtemp(directory)){
+        std::cerr << "Cannot create a temporary directory" << std::endl;
+        failed = true;
+        return;
+    }
+    std::string dir = directory;
+    auto removeFiles = [&](){
+        for(const char* file : {"/addresses.col", "/entities.col", "/manifest.json"}) unlink((dir + file).c_str());
+        rmdir(directory);
+    };
+    uint32_t height = 0;
+    for(uint32_t wallet = 0; wallet < addressTable.size(); wallet++){
+        if(activity.lastSeen(wallet) != AddressActivity::unseen) height = std::max(height, activity.lastSeen(wallet));
+    }
+
+    /* Reads the addresses back as (entity, reuse, first seen, last seen, received, sent, transactions) by name */
+    auto readAddresses = [&](std::unordered_map<std::string, std::vector<uint64_t> >& rows){
+        ColumnFileReader reader(dir + "/addresses.col");
+        std::vector<std::vector<unsigned char> > columns;
+        uint32_t count;
+        while(reader.next(columns, count)){
+            std::vector<std::string> names = ColumnFileReader::strings(columns[0], count);
+            for(uint32_t row = 0; row < count; row++){
+                rows[names[row]] = {ColumnFileReader::u64At(columns[1], row), ColumnFileReader::u32At(columns[2], row), ColumnFileReader::u32At(columns[3], row), ColumnFileReader::u32At(columns[4], row),
+                                    ColumnFileReader::u64At(columns[5], row), ColumnFileReader::u64At(columns[6], row), ColumnFileReader::u32At(columns[7], row)};
+            }
+        }
+        return reader.getRows();
+    };
+
+    std::cout << "Export, " << store.entityCount() << " entities, " << addressTable.size() << " addresses" << std::endl;
+    unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+    try{
+        for(unsigned threads : {1u, cores}){
+            exportstats_t stats = exportClustering(dir, store, reuseFrequency, activity, height, noHeight, threads);
+            std::string name = "export " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+            std::printf("%-28s %12.0f rows/s  %8.1f MB/s  %5.1fx smaller\n", name.c_str(), (stats.addresses + stats.entities) / stats.seconds, stats.rawBytes / 1e6 / stats.seconds, (double) stats.rawBytes / stats.bytes);
+            record(name, (stats.addresses + stats.entities) / stats.seconds, "rows/s");
+        }
+        std::unordered_map<std::string, std::vector<uint64_t> > rows;
+        check("exported addresses", std::to_string(readAddresses(rows)), std::to_string(addressTable.size()));
+        for(uint32_t wallet = 0; wallet < addressTable.size() && !failed; wallet++){
+            valuetotals_t totals = activity.totals(wallet);
+            std::vector<uint64_t> expected = {store.getEntity(wallet), (uint64_t) (wallet < reuseFrequency.size() ? reuseFrequency[wallet] : 0), totals.firstHeight, totals.lastHeight,
+                                              (uint64_t) totals.received, (uint64_t) totals.sent, totals.transactions};
+            auto row = rows.find(addressTable.name(wallet));
+            auto text = [](const std::vector<uint64_t>& values){
+                std::string out;
+                for(uint64_t value : values) out += std::to_string(value) + " ";
+                return out;
+            };
+            check("export of " + addressTable.name(wallet), row == rows.end() ? "missing" : text(row->second), text(expected));
+        }
+        {
+            /* What an entity received and sent is what its addresses did, a payment between two of them counts on both sides */
+            std::unordered_map<uint64_t, std::pair<uint64_t,uint64_t> > summed;
+            for(auto& row : rows) if(row.second[0] != 0) summed[row.second[0]].first += row.second[4], summed[row.second[0]].second += row.second[5];
+            ColumnFileReader reader(dir + "/entities.col");
+            check("exported entities", std::to_string(reader.getRows()), std::to_string(store.entityCount()));
+            std::vector<std::vector<unsigned char> > columns;
+            uint32_t count;
+            while(reader.next(columns, count) && !failed){
+                for(uint32_t row = 0; row < count; row++){
+                    uint64_t entity = ColumnFileReader::u64At(columns[0], row);
+                    check("received by entity " + std::to_string(entity), std::to_string(ColumnFileReader::u64At(columns[4], row)), std::to_string(summed[entity].first));
+                    check("sent by entity " + std::to_string(entity), std::to_string(ColumnFileReader::u64At(columns[5], row)), std::to_string(summed[entity].second));
+                }
+            }
+        }
+
+        /* The entities with an address seen after since, and the addresses seen after it in no entity */
+        uint32_t since = height / 2;
+        std::unordered_map<uint64_t, uint32_t> lastActivity;
+        uint64_t expectedAddresses = 0;
+        for(uint32_t wallet = 0; wallet < addressTable.size(); wallet++){
+            uint64_t entity = store.getEntity(wallet);
+            if(entity != 0 && activity.lastSeen(wallet) != AddressActivity::unseen) lastActivity[entity] = std::max(lastActivity[entity], activity.lastSeen(wallet) + 1);
+        }
+        uint64_t expectedEntities = 0;
+        for(auto& it : lastActivity) if(it.second > since + 1) expectedEntities++;
+        for(uint32_t wallet = 0; wallet < addressTable.size(); wallet++){
+            uint64_t entity = store.getEntity(wallet);
+            if(entity != 0 ? lastActivity[entity] > since + 1 : activity.lastSeen(wallet) != AddressActivity::unseen && activity.lastSeen(wallet) > since) expectedAddresses++;
+        }
+        exportstats_t stats = exportClustering(dir, store, reuseFrequency, activity, height, since, cores);
+        check("incremental export entities", std::to_string(stats.entities), std::to_string(expectedEntities));
+        check("incremental export addresses", std::to_string(stats.addresses), std::to_string(expectedAddresses));
+        std::string name = "export since " + std::to_string(since);
+        std::printf("%-28s %12.0f rows/s  %8llu rows\n", name.c_str(), (stats.addresses + stats.entities) / stats.seconds, (unsigned long long) (stats.addresses + stats.entities));
+        record("export since the middle", (stats.addresses + stats.entities) / stats.seconds, "rows/s");
+    }
+    catch(const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        failed = true;
+    }
+    removeFiles();
+}
+
+/* Prints the median, the tail and the worst of the latencies in microseconds */
+static void printLatencies(const std::string& name, std::vector<double>& nanos){
+    std::sort(nanos.begin(), nanos.end());
+    auto at = [&](double q){ return nanos[std::min(nanos.size() - 1, (size_t) (q * nanos.size()))] / 1000.0; };
+    std::printf("%-28s p50 %8.2f us  p99 %8.2f us  p99.9 %8.2f us  max %8.2f us  (%zu)\n", name.c_str(), at(0.5), at(0.99), at(0.999), nanos.back() / 1000.0, nanos.size());
+    record(name + " p50", at(0.5), "us");
+    record(name + " p99", at(0.99), "us");
+    record(name + " p99.9", at(0.999), "us");
+}
+
+/* One request on a keep-alive connection, the response is read up to the end of its body */
+static bool httpRoundTrip(int fd, const std::string& request, std::string& response){
+    if(send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t) request.size()) return false;
+    response.clear();
+    char chunk[4096];
+    size_t headerEnd = std::string::npos, length = 0;
+    while(headerEnd == std::string::npos || response.size() < headerEnd + 4 + length){
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0) return false;
+        response.append(chunk, n);
+        if(headerEnd == std::string::npos && (headerEnd = response.find("\r\n\r\n")) != std::string::npos){
+            size_t at = response.find("Content-Length: ");
+            if(at == std::string::npos || at > headerEnd) return false;
+            length = std::strtoul(response.c_str() + at + 16, nullptr, 10);
+        }
+    }
+    return true;
+}
+
+/* Lookups on an index built from a synthetic clustering, in process and through the HTTP service while another thread keeps merging wallets and publishing new indexes the way the checkpoints do */
+static void benchmarkQueries(size_t wallets){
+    uint64_t seed = 7;
+    EntityStore store;
+    std::vector<uint32_t> ids(wallets);
+    for(size_t i = 0; i < wallets; i++){
+        std::vector<unsigned char> hash = randomBytes(seed, 20);
+        ids[i] = addressTable.intern(encodeBase58Check(0x00, &hash[0], 20));
+    }
+    /* Entities of about ten wallets */
+    std::vector<int64_t> firstOfGroup(wallets / 10 + 1, -1);
+    for(size_t i = 0; i < wallets; i++){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t group = (seed >> 33) % firstOfGroup.size();
+        if(firstOfGroup[group] < 0){
+            firstOfGroup[group] = ids[i];
+            store.ensureEntity(ids[i]);
+        }
+        else store.unite(firstOfGroup[group], ids[i]);
+    }
+    /* One payment to every wallet so that the entities have totals to answer with */
+    AddressActivity activity;
+    for(size_t i = 0; i < wallets; i++){
+        walletflow_t flow = {ids[i], (int64_t) i + 1, 0};
+        activity.recordTransaction(i % 1000, &flow, &flow + 1, &store);
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<const EntityIndex> index = std::make_shared<const EntityIndex>(store, activity, 0);
+    double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for(size_t i = 0; i < wallets; i += std::max<size_t>(1, wallets / 1000)){
+        const std::string& name = addressTable.name(ids[i]);
+        uint64_t entityId = store.getEntity(ids[i]);
+        check("entity of " + name, std::to_string(index->entityOf(name)), std::to_string(entityId));
+        std::vector<uint32_t> members = store.getWallets(entityId);
+        check("size of " + std::to_string(entityId), std::to_string(index->entitySize(entityId)), std::to_string(members.size()));
+        int64_t received = 0;
+        for(uint32_t member : members) received += activity.totals(member).received;
+        valuetotals_t totals;
+        check("received by " + std::to_string(entityId), index->entityTotals(entityId, totals) ? std::to_string(totals.received) : "missing", std::to_string(received));
+        check("received by " + name, index->addressTotals(name, totals) ? std::to_string(totals.received) : "missing", std::to_string(i + 1));
+        std::vector<std::string> expected, got;
+        for(uint32_t member : members) expected.push_back(addressTable.name(member));
+        for(uint64_t offset = 0; offset < members.size(); offset += 3){
+            std::vector<std::string> page = index->addressesOf(entityId, offset, 3);
+            got.insert(got.end(), page.begin(), page.end());
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(got.begin(), got.end());
+        check("addresses of " + std::to_string(entityId), std::to_string(got == expected), "1");
+    }
+    check("unknown address", std::to_string(index->entityOf("1BoatSLRHtKNngkdXEeobR76b53LETtpyT")), "0");
+    if(failed) return;
+
+    std::cout << "Entity lookups, " << wallets << " addresses in " << index->entityCount() << " entities, index built in " << buildSeconds << " s, "
+              << index->memoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+    record("index build", buildSeconds, "s");
+    size_t lookups = std::min<size_t>(wallets, 200000);
+    std::vector<double> nanos;
+    nanos.reserve(lookups);
+    size_t sink = 0;
+    for(size_t i = 0; i < lookups; i++){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const std::string& name = addressTable.name(ids[(seed >> 33) % wallets]);
+        auto begin = std::chrono::steady_clock::now();
+        sink += index->entityOf(name);
+        nanos.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+    }
+    printLatencies("address to entity", nanos);
+
+    QueryService service("127.0.0.1", 0);
+    service.publish(index);
+    service.start();
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> published(0);
+    /* The store is only touched by this thread from here on, like the ingestion thread */
+    std::thread ingestion([&](){
+        uint64_t local = 99;
+        while(!done){
+            for(int i = 0; i < 1000; i++){
+                local = local * 6364136223846793005ULL + 1442695040888963407ULL;
+                store.unite(ids[(local >> 33) % wallets], ids[(local >> 13) % wallets]);
+            }
+            service.publish(std::make_shared<const EntityIndex>(store, activity, ++published));
+        }
+    });
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(service.getPort());
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    if(connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0){
+        std::string response;
+        size_t requests = std::min<size_t>(lookups, 20000), ok = 0;
+        nanos.clear();
+        for(size_t i = 0; i < requests; i++){
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            std::string request = "GET /address/" + addressTable.name(ids[(seed >> 33) % wallets]) + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            auto begin = std::chrono::steady_clock::now();
+            if(!httpRoundTrip(fd, request, response)) break;
+            nanos.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+            if(response.compare(0, 12, "HTTP/1.1 200") == 0) ok++;
+        }
+        check("http lookups answered", std::to_string(ok), std::to_string(requests));
+        if(!nanos.empty()) printLatencies("http address to entity", nanos);
+    }
+    close(fd);
+    done = true;
+    ingestion.join();
+    service.stop();
+    std::cout << published << " indexes published during the http lookups (" << sink % 10 << ")" << std::endl;
+}
+
+static std::vector<std::string> onlyGroups;
+
+/* Starts the group when it was asked for, all of them are run when none was named */
+static bool runGroup(const std::string& name){
+    if(failed) return false;
+    if(!onlyGroups.empty() && std::find(onlyGroups.begin(), onlyGroups.end(), name) == onlyGroups.end()) return false;
+    currentGroup = name;
+    return true;
+}
+
+static void writeReport(const std::string& path, size_t iterations, size_t blocks){
+    Json::Value report;
+    report["iterations"] = (Json::UInt64) iterations;
+    report["blocks"] = (Json::UInt64) blocks;
+    report["failed"] = failed;
+    report["results"] = Json::Value(Json::arrayValue);
+    for(result_t& result : results){
+        Json::Value entry;
+        entry["group"] = result.group;
+        entry["name"] = result.name;
+        entry["value"] = result.value;
+        entry["unit"] = result.unit;
+        report["results"].append(entry);
+    }
+    std::ofstream out(path.c_str());
+    out << Json::writeString(Json::StreamWriterBuilder(), report) << std::endl;
+    if(!out) throw std::runtime_error("Cannot write " + path);
+}
+
+int main(int argc, char** argv){
+    size_t iterations = 200000;
+    size_t blocks = 0;
+    std::string reportPath, stateDir = "/tmp";
+    std::vector<std::string> fixtures;
+    bool iterationsGiven = false;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if((arg == "--json" || arg == "--only" || arg == "--blocks" || arg == "--state-dir") && i + 1 == argc){
+            std::cerr << arg << " needs a value" << std::endl;
+            return 1;
+        }
+        if(arg == "--json") reportPath = argv[++i];
+        else if(arg == "--blocks") blocks = std::strtoul(argv[++i], nullptr, 10);
+        else if(arg == "--state-dir") stateDir = argv[++i];
+        else if(arg == "--only"){
+            std::stringstream groups(argv[++i]);
+            std::string group;
+            while(std::getline(groups, group, ',')) onlyGroups.push_back(group);
+        }
+        else if(!iterationsGiven && arg.find_first_not_of("0123456789") == std::string::npos){
+            iterations = std::strtoul(arg.c_str(), nullptr, 10);
+            iterationsGiven = true;
+        }
+        else fixtures.push_back(arg);
+    }
+    if(blocks == 0) blocks = std::max<size_t>(1, iterations / 4000);
+
+    /* The fixtures are sorted by the method they answer, a block response has a list of transactions in its result */
+    std::vector<std::string> blockResponses, transactionResponses;
+    for(std::string& fixture : fixtures){
+        std::ifstream in(fixture.c_str(), std::ios::binary);
+        if(!in){
+            std::cerr << "Cannot read " << fixture << std::endl;
+            return 1;
+        }
+        std::string response((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Json::Value result = parseJson(response)["result"];
+        if(result.isObject() && result["tx"].isArray()) blockResponses.push_back(response);
+        else if(result.isObject() && result["vin"].isArray()) transactionResponses.push_back(response);
+        else{
+            std::cerr << fixture << " is neither a getblock nor a getrawtransaction response" << std::endl;
+            return 1;
+        }
+    }
+
+    EntityStore store;
+    MappedColumn<int> reuseFrequency;
+    AddressActivity activity;
+    if(runGroup("addresses")) benchmarkAddresses(iterations);
+    if(runGroup("decoding")) benchmarkDecoding(std::max<size_t>(1, iterations / 20000), blockResponses, transactionResponses);
+    if(runGroup("blockfile")) benchmarkBlockFile();
+    if(runGroup("heuristics")) benchmarkHeuristics(blocks, blockResponses, store, reuseFrequency, activity, true);
+    if(runGroup("backfill")) benchmarkBackfill(blocks);
+    if(runGroup("contention")) benchmarkContention(iterations);
+    if(runGroup("prefilter")) benchmarkPrefilter(blocks);
+    if(runGroup("outofcore")) benchmarkOutOfCore(blocks, stateDir);
+    if(runGroup("persistence")){
+        if(store.walletCount() == 0) benchmarkHeuristics(blocks, blockResponses, store, reuseFrequency, activity, false);
+        benchmarkPersistence(store, reuseFrequency, activity);
+    }
+    if(runGroup("recovery")) benchmarkRecovery(blocks);
+    if(runGroup("follow")) benchmarkFollow();
+    if(runGroup("export")){
+        if(store.walletCount() == 0) benchmarkHeuristics(blocks, blockResponses, store, reuseFrequency, activity, false);
+        benchmarkExport(store, reuseFrequency, activity);
+    }
+    if(runGroup("queries")) benchmarkQueries(iterations * 5);
+    if(!reportPath.empty()) writeReport(reportPath, iterations, blocks);
+    if(failed){
+        std::cerr << "Reference check failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,393 @@
+#include "blockfile.h"
+#include "address.h"
+#include "addresstable.h"
+#include "metrics.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <iomanip>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+/* Same as toHex, written straight into a string of the block's arena */
+static void assignHex(arena_string& out, const unsigned char* data, size_t len, bool reversed){
+    static const char hex[] = "0123456789abcdef";
+    out.resize(len * 2);
+    for(size_t i = 0; i < len; i++){
+        unsigned char c = reversed ? data[len - 1 - i] : data[i];
+        out[2 * i] = hex[c >> 4];
+        out[2 * i + 1] = hex[c & 0xF];
+    }
+}
+
+/* Bounds checked cursor over the serialized block, all the reads are done in place */
+struct cursor_t{
+    const unsigned char* p;
+    const unsigned char* end;
+
+    void need(size_t n){
+        if((size_t)(end - p) < n) throw std::runtime_error("Truncated block in block file");
+    }
+    const unsigned char* take(size_t n){
+        need(n);
+        const unsigned char* start = p;
+        p += n;
+        return start;
+    }
+    uint32_t u32(){
+        const unsigned char* b = take(4);
+        return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+    }
+    int64_t i64(){
+        uint64_t lo = u32();
+        uint64_t hi = u32();
+        return (int64_t) (lo | (hi << 32));
+    }
+    uint64_t varint(){
+        unsigned char first = *take(1);
+        if(first < 0xfd) return first;
+        if(first == 0xfd){
+            const unsigned char* b = take(2);
+            return (uint64_t) b[0] | ((uint64_t) b[1] << 8);
+        }
+        if(first == 0xfe) return u32();
+        uint64_t lo = u32();
+        uint64_t hi = u32();
+        return lo | (hi << 32);
+    }
+};
+
+bool BlockFileReader::outpoint_t::operator==(const outpoint_t& other) const{
+    return n == other.n && std::memcmp(txid, other.txid, 32) == 0;
+}
+
+/* The txid is already a hash, a slice of it spreads well enough */
+size_t BlockFileReader::outpointhash_t::operator()(const outpoint_t& outpoint) const{
+    uint64_t h;
+    std::memcpy(&h, outpoint.txid, 8);
+    return h ^ ((uint64_t) outpoint.n * 0x9e3779b97f4a7c15ULL);
+}
+
+BlockFileReader::BlockFileReader(const std::string& blocksDir, uint32_t startBlock, uint32_t endBlock, bool fullTransactions)
+: obfuscated(false), startBlock(startBlock), endBlock(endBlock), nextHeight(0), fullTransactions(fullTransactions), bytesRead(0), started(std::chrono::steady_clock::now())
+{
+    std::memset(xorKey, 0, sizeof(xorKey));
+    openFiles(blocksDir);
+    buildChain();
+}
+
+BlockFileReader::~BlockFileReader(){
+    for(blockfile_t& file : files){
+        if(file.data) munmap((void*) file.data, file.size);
+    }
+}
+
+uint32_t BlockFileReader::getBlockCount(){
+    return chain.size();
+}
+
+void BlockFileReader::openFiles(const std::string& blocksDir){
+    /* The key is optional, older nodes do not write it and an all zero key means no obfuscation */
+    FILE* keyFile = std::fopen((blocksDir + "/xor.dat").c_str(), "rb");
+    if(keyFile){
+        if(std::fread(xorKey, 1, sizeof(xorKey), keyFile) != sizeof(xorKey)) std::memset(xorKey, 0, sizeof(xorKey));
+        std::fclose(keyFile);
+        for(unsigned char c : xorKey) if(c) obfuscated = true;
+    }
+
+    std::vector<int> numbers;
+    DIR* dir = opendir(blocksDir.c_str());
+    if(!dir) throw std::runtime_error("Cannot open block directory " + blocksDir);
+    while(dirent* entry = readdir(dir)){
+        std::string name = entry->d_name;
+        if(name.size() == 12 && name.compare(0, 3, "blk") == 0 && name.compare(8, 4, ".dat") == 0){
+            numbers.push_back(std::atoi(name.substr(3, 5).c_str()));
+        }
+    }
+    closedir(dir);
+    std::sort(numbers.begin(), numbers.end());
+    if(numbers.empty()) throw std::runtime_error("No blk*.dat files in " + blocksDir);
+
+    for(int number : numbers){
+        char name[16];
+        std::snprintf(name, sizeof(name), "blk%05d.dat", number);
+        std::string path = blocksDir + "/" + name;
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        fstat(fd, &st);
+        blockfile_t file;
+        file.size = st.st_size;
+        file.data = nullptr;
+        if(file.size > 0){
+            void* mapped = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapped == MAP_FAILED){
+                close(fd);
+                throw std::runtime_error("Cannot map " + path);
+            }
+            /* The files are mostly read front to back */
+            madvise(mapped, file.size, MADV_SEQUENTIAL);
+            file.data = (const unsigned char*) mapped;
+        }
+        close(fd);
+        files.push_back(file);
+    }
+}
+
+/* Reads bytes of a file, undoing the obfuscation if there is any */
+void BlockFileReader::copyBytes(uint32_t file, size_t offset, size_t size, unsigned char* out){
+    if(offset + size > files[file].size) throw std::runtime_error("Read past the end of a block file");
+    std::memcpy(out, files[file].data + offset, size);
+    if(obfuscated){
+        for(size_t i = 0; i < size; i++) out[i] ^= xorKey[(offset + i) % 8];
+    }
+}
+
+/* Every record in a block file is the network magic, the block size and the block. The files are written in download order, so the best chain is found by linking the headers through their previous block hash and taking the highest tip */
+void BlockFileReader::buildChain(){
+    struct header_t{
+        blocklocation_t location;
+        std::string prev;
+    };
+    std::unordered_map<std::string, header_t> headers;
+    std::vector<std::string> order;
+    unsigned char magic[4] = {0, 0, 0, 0};
+    for(uint32_t f = 0; f < files.size(); f++){
+        size_t pos = 0;
+        while(pos + 88 <= files[f].size){
+            unsigned char record[88];
+            copyBytes(f, pos, 88, record);
+            /* Block files are preallocated, zeros mean the end of the written part */
+            if(record[0] == 0 && record[1] == 0 && record[2] == 0 && record[3] == 0) break;
+            if(magic[0] == 0 && magic[1] == 0 && magic[2] == 0 && magic[3] == 0) std::memcpy(magic, record, 4);
+            else if(std::memcmp(magic, record, 4) != 0) throw std::runtime_error("Unexpected network magic in block file");
+            uint32_t size = (uint32_t) record[4] | ((uint32_t) record[5] << 8) | ((uint32_t) record[6] << 16) | ((uint32_t) record[7] << 24);
+            if(size < 80 || pos + 8 + size > files[f].size) break;
+            unsigned char hash[32];
+            sha256d(record + 8, 80, hash);
+            header_t header;
+            header.location.file = f;
+            header.location.offset = pos + 8;
+            header.location.size = size;
+            header.prev.assign((const char*) record + 12, 32);
+            std::string key((const char*) hash, 32);
+            if(headers.insert(std::make_pair(key, header)).second) order.push_back(key);
+            pos += 8 + size;
+        }
+    }
+
+    /* Heights are found by walking back to a block whose height is known, the genesis block has a null previous hash */
+    const std::string null(32, '\0');
+    std::unordered_map<std::string, int64_t> heights;
+    heights[null] = -1;
+    std::string tip;
+    int64_t tipHeight = -1;
+    for(const std::string& key : order){
+        std::vector<std::string> path;
+        std::string current = key;
+        while(!heights.count(current)){
+            std::unordered_map<std::string, header_t>::iterator it = headers.find(current);
+            /* Orphan blocks whose parent is not in the files are left out */
+            if(it == headers.end()) break;
+            path.push_back(current);
+            current = it->second.prev;
+        }
+        if(!heights.count(current)) continue;
+        int64_t height = heights[current];
+        for(std::vector<std::string>::reverse_iterator it = path.rbegin(); it != path.rend(); it++){
+            heights[*it] = ++height;
+            if(height > tipHeight){
+                tipHeight = height;
+                tip = *it;
+            }
+        }
+    }
+
+    chain.resize(tipHeight + 1);
+    for(int64_t height = tipHeight; height >= 0; height--){
+        header_t& header = headers[tip];
+        chain[height] = header.location;
+        tip = header.prev;
+    }
+}
+
+std::string BlockFileReader::prevoutAddress(const prevout_t& prevout, scripttype_t& type){
+    unsigned char stackScript[10000];
+    std::vector<unsigned char> heapScript;
+    unsigned char* script = stackScript;
+    if(prevout.scriptSize > sizeof(stackScript)){
+        heapScript.resize(prevout.scriptSize);
+        script = heapScript.data();
+    }
+    copyBytes(prevout.file, prevout.scriptOffset, prevout.scriptSize, script);
+    return scriptIdentity(script, prevout.scriptSize, type);
+}
+
+/* Parses every transaction of the block, spends its inputs from the outpoint index and adds its outputs to it. The records are only built when transactions is given, blocks before the start of the range just update the index */
+void BlockFileReader::processBlock(uint32_t height, transactions_t* transactions){
+    blocklocation_t& location = chain[height];
+    const unsigned char* block = files[location.file].data + location.offset;
+    if(obfuscated){
+        scratch.resize(location.size);
+        copyBytes(location.file, location.offset, location.size, &scratch[0]);
+        block = &scratch[0];
+    }
+    bytesRead += location.size;
+    unsigned char hash[32];
+    sha256d(block, 80, hash);
+    std::string blockhash = toHex(hash, 32, true);
+
+    cursor_t c;
+    c.p = block + 80;
+    c.end = block + location.size;
+    uint64_t txCount = c.varint();
+    Arena* arena = nullptr;
+    if(transactions){
+        arena = transactions->get_allocator().getArena();
+        transactions->reserve(txCount);
+    }
+
+    AddressBatch batch;
+    scripttypecounts_t counts;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    for(uint64_t t = 0; t < txCount; t++){
+        const unsigned char* txStart = c.p;
+        c.take(4);
+        /* The segwit marker and flag are not part of the serialization the txid is computed on */
+        bool segwit = c.end - c.p >= 2 && c.p[0] == 0 && c.p[1] != 0;
+        if(segwit) c.take(2);
+        const unsigned char* bodyStart = c.p;
+
+        getrawtransaction_t tx(arena);
+        uint64_t inCount = c.varint();
+        if(transactions) tx.vin.reserve(inCount);
+        std::vector<outpoint_t> spent(inCount);
+        for(uint64_t i = 0; i < inCount; i++){
+            const unsigned char* prev = c.take(32);
+            std::memcpy(spent[i].txid, prev, 32);
+            spent[i].n = c.u32();
+            uint64_t scriptLen = c.varint();
+            const unsigned char* script = c.take(scriptLen);
+            c.take(4);
+            if(!transactions) continue;
+            vin_t input(arena);
+            input.isCoinbase = t == 0 && spent[i].n == 0xffffffff;
+            input.value = 0;
+            input.scriptSig.address = addressTable.intern("");
+            if(!input.isCoinbase){
+                assignHex(input.txid, prev, 32, true);
+                if(fullTransactions) assignHex(input.scriptSig.hex, script, scriptLen, false);
+            }
+            tx.vin.push_back(std::move(input));
+        }
+        uint64_t outCount = c.varint();
+        if(transactions) tx.vout.reserve(outCount);
+        std::vector<prevout_t> created(outCount);
+        for(uint64_t i = 0; i < outCount; i++){
+            created[i].value = c.i64();
+            uint64_t scriptLen = c.varint();
+            const unsigned char* script = c.take(scriptLen);
+            created[i].file = location.file;
+            created[i].scriptOffset = location.offset + (script - block);
+            created[i].scriptSize = scriptLen;
+            /* Provably unspendable outputs never enter the index */
+            if(scriptLen > 0 && script[0] == 0x6a) created[i].scriptSize = UINT32_MAX;
+            if(!transactions) continue;
+            scripttype_t type;
+            std::string address = scriptIdentity(script, scriptLen, type);
+            counts.outputs[type]++;
+            vout_t output(arena);
+            output.value = created[i].value;
+            if(fullTransactions) assignHex(output.scriptPubKey.hex, script, scriptLen, false);
+            const char* typeName = scriptTypeName(type);
+            output.scriptPubKey.type.assign(typeName, std::strlen(typeName));
+            output.unspendable = type == scriptNullData;
+            if(!output.unspendable) output.scriptPubKey.addresses.push_back(addressTable.intern(address));
+            tx.vout.push_back(std::move(output));
+        }
+        const unsigned char* bodyEnd = c.p;
+        if(segwit){
+            for(uint64_t i = 0; i < inCount; i++){
+                uint64_t items = c.varint();
+                for(uint64_t j = 0; j < items; j++) c.take(c.varint());
+            }
+        }
+        const unsigned char* lockTime = c.take(4);
+
+        /* txid = SHA256d(version | inputs and outputs | locktime), hashed in pieces straight from the block */
+        unsigned char txid[32];
+        unsigned int mdLen = 0;
+        EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+        EVP_DigestUpdate(ctx, txStart, 4);
+        EVP_DigestUpdate(ctx, bodyStart, bodyEnd - bodyStart);
+        EVP_DigestUpdate(ctx, lockTime, 4);
+        EVP_DigestFinal_ex(ctx, txid, &mdLen);
+        EVP_Digest(txid, 32, txid, &mdLen, EVP_sha256(), nullptr);
+
+        /* Inputs are resolved before the outputs are added, a transaction cannot spend itself but it can spend an earlier one of the same block */
+        for(uint64_t i = 0; i < inCount; i++){
+            if(t == 0) break;
+            std::unordered_map<outpoint_t, prevout_t, outpointhash_t>::iterator it = outpoints.find(spent[i]);
+            if(it == outpoints.end()) throw std::runtime_error("Missing prevout for an input at height " + std::to_string(height));
+            if(transactions){
+                scripttype_t type;
+                tx.vin[i].value = it->second.value;
+                tx.vin[i].scriptSig.address = addressTable.intern(prevoutAddress(it->second, type));
+                counts.inputs[type]++;
+            }
+            outpoints.erase(it);
+        }
+        for(uint64_t i = 0; i < outCount; i++){
+            if(created[i].scriptSize == UINT32_MAX) continue;
+            outpoint_t outpoint;
+            std::memcpy(outpoint.txid, txid, 32);
+            outpoint.n = i;
+            outpoints[outpoint] = created[i];
+        }
+        if(transactions){
+            assignHex(tx.txid, txid, 32, true);
+            tx.blockhash.assign(blockhash.data(), blockhash.size());
+            transactions->push_back(std::move(tx));
+        }
+    }
+    EVP_MD_CTX_free(ctx);
+    if(transactions){
+        batch.resolve(*transactions);
+        addScriptTypes(counts);
+    }
+}
+
+bool BlockFileReader::next(fetchedblock_t& block){
+    uint32_t last = std::min<uint64_t>(endBlock, (uint64_t) chain.size() - 1);
+    if(chain.empty() || nextHeight > last) return false;
+    /* Catch up on the blocks before the range, they are needed for the outpoint index */
+    while(nextHeight < startBlock){
+        processBlock(nextHeight, nullptr);
+        nextHeight++;
+    }
+    static Histogram& readSeconds = metrics.histogram("block_read_seconds", "Reading and decoding of one block from the block files");
+    block.reset();
+    block.height = nextHeight;
+    {
+        StageTimer timer(readSeconds, "read", nextHeight);
+        processBlock(nextHeight, &block.transactions);
+    }
+    block.hash = block.transactions.empty() ? "" : std::string(block.transactions[0].blockhash.data(), block.transactions[0].blockhash.size());
+    nextHeight++;
+    return true;
+}
+
+void BlockFileReader::printThroughput(std::ostream& out){
+    double wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count() / 1e9;
+    out << std::fixed << std::setprecision(2)
+        << "Block files: " << (wall > 0 ? nextHeight / wall : 0) << " blocks/s, "
+        << (wall > 0 ? bytesRead / wall / 1e6 : 0) << " MB/s, "
+        << outpoints.size() << " unspent outputs indexed" << std::endl;
+    out.unsetf(std::ios_base::floatfield);
+}
@@ -0,0 +1,66 @@
+#ifndef BLOCKFILE_H
+#define BLOCKFILE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+
+#include "blocksource.h"
+#include "address.h"
+
+/* Reads the blocks straight from the blk*.dat files of a Bitcoin Core data directory without going through the node. The files are memory mapped and parsed in place, the best chain is rebuilt from the block headers, and the prevouts are resolved through an outpoint index built while the chain is replayed from the genesis block. It works offline and needs the blocks to be processed in height order, blocks before the start of the range are replayed only to fill the index */
+class BlockFileReader : public BlockSource{
+    public:
+    BlockFileReader(const std::string& blocksDir, uint32_t startBlock, uint32_t endBlock, bool fullTransactions = false);
+    ~BlockFileReader();
+    bool next(fetchedblock_t& block);
+    void printThroughput(std::ostream& out);
+    uint32_t getBlockCount();
+    private:
+    struct blockfile_t{
+        const unsigned char* data;
+        size_t size;
+    };
+    struct blocklocation_t{
+        uint32_t file;
+        size_t offset;
+        uint32_t size;
+    };
+    struct outpoint_t{
+        unsigned char txid[32];
+        uint32_t n;
+        bool operator==(const outpoint_t& other) const;
+    };
+    struct outpointhash_t{
+        size_t operator()(const outpoint_t& outpoint) const;
+    };
+    /* An unspent output only points back at its script in the mapped file, the address is derived when it gets spent */
+    struct prevout_t{
+        int64_t value;
+        uint32_t file;
+        uint32_t scriptOffset;
+        uint32_t scriptSize;
+    };
+
+    std::vector<blockfile_t> files;
+    /* Bitcoin Core 28 and later obfuscates the block files with the key in xor.dat, blocks are then decoded into a scratch buffer instead of being read in place */
+    unsigned char xorKey[8];
+    bool obfuscated;
+    std::vector<unsigned char> scratch;
+    std::vector<blocklocation_t> chain;
+    std::unordered_map<outpoint_t, prevout_t, outpointhash_t> outpoints;
+    uint32_t startBlock, endBlock, nextHeight;
+    /* The hex of the scripts is only filled in when this is set */
+    bool fullTransactions;
+    uint64_t bytesRead;
+    std::chrono::steady_clock::time_point started;
+
+    void openFiles(const std::string& blocksDir);
+    void buildChain();
+    void copyBytes(uint32_t file, size_t offset, size_t size, unsigned char* out);
+    void processBlock(uint32_t height, transactions_t* transactions);
+    std::string prevoutAddress(const prevout_t& prevout, scripttype_t& type);
+};
+
+#endif
@@ -0,0 +1,388 @@
+#include "blockparser.h"
+#include "address.h"
+#include "addresstable.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <jsonrpccpp/client.h>
+
+namespace{
+
+/* Walks the text of the response, values that are not needed are skipped without being decoded */
+struct jsoncursor_t{
+    const char* p;
+    const char* end;
+
+    [[noreturn]] void fail(const char* what){
+        throw std::runtime_error(std::string("Block response: ") + what + " at offset " + std::to_string(end - p) + " from the end");
+    }
+    void space(){
+        while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    }
+    char peek(){
+        space();
+        if(p >= end) fail("unexpected end");
+        return *p;
+    }
+    void expect(char c){
+        if(peek() != c) fail("unexpected character");
+        p++;
+    }
+    /* True if the next character is c, which is then consumed */
+    bool accept(char c){
+        if(peek() != c) return false;
+        p++;
+        return true;
+    }
+    /* Reads a string into an arena string, straight from the text when it has no escapes */
+    void string(arena_string& out){
+        const char *begin, *stop;
+        rawString(begin, stop);
+        if(std::memchr(begin, '\\', stop - begin) == nullptr) out.assign(begin, stop);
+        else{
+            p = begin - 1;
+            std::string decoded = string();
+            out.assign(decoded.data(), decoded.size());
+        }
+    }
+    /* Returns the raw bytes of a string without its quotes, escapes are left as they are */
+    void rawString(const char*& begin, const char*& stop){
+        expect('"');
+        begin = p;
+        while(p < end && *p != '"') p += *p == '\\' ? 2 : 1;
+        if(p >= end) fail("unterminated string");
+        stop = p++;
+    }
+    std::string string(){
+        const char *begin, *stop;
+        rawString(begin, stop);
+        if(std::memchr(begin, '\\', stop - begin) == nullptr) return std::string(begin, stop);
+        std::string out;
+        for(const char* q = begin; q < stop; q++){
+            if(*q != '\\'){
+                out += *q;
+                continue;
+            }
+            q++;
+            switch(*q){
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':{
+                    /* Only the code points below 0x800 are expected here, anything in the addresses and scripts is ASCII */
+                    unsigned code = std::strtoul(std::string(q + 1, q + 5).c_str(), nullptr, 16);
+                    q += 4;
+                    if(code < 0x80) out += (char) code;
+                    else{
+                        out += (char) (0xc0 | (code >> 6));
+                        out += (char) (0x80 | (code & 0x3f));
+                    }
+                    break;
+                }
+                default: out += *q;
+            }
+        }
+        return out;
+    }
+    /* The bytes of a number, a literal or a string, for the values read as text */
+    void scalar(const char*& begin, const char*& stop){
+        if(peek() == '"'){
+            rawString(begin, stop);
+            return;
+        }
+        begin = p;
+        while(p < end && std::strchr(",}] \n\r\t", *p) == nullptr) p++;
+        stop = p;
+    }
+    bool isNull(){
+        if(peek() != 'n') return false;
+        if(end - p < 4 || std::memcmp(p, "null", 4) != 0) fail("bad literal");
+        p += 4;
+        return true;
+    }
+    void skip(){
+        char c = peek();
+        if(c == '{' || c == '['){
+            /* Nested containers are skipped by depth, the strings are stepped over so their brackets do not count */
+            int depth = 0;
+            do{
+                space();
+                if(p >= end) fail("unexpected end");
+                if(*p == '"'){
+                    const char *begin, *stop;
+                    rawString(begin, stop);
+                    continue;
+                }
+                if(*p == '{' || *p == '[') depth++;
+                else if(*p == '}' || *p == ']') depth--;
+                p++;
+            } while(depth > 0);
+            return;
+        }
+        const char *begin, *stop;
+        scalar(begin, stop);
+    }
+    /* Reads the key of the next member, returns false at the end of the object. Call after '{' has been consumed */
+    bool member(const char*& key, size_t& keyLen, bool& first){
+        if(accept('}')) return false;
+        if(!first) expect(',');
+        first = false;
+        const char* stop;
+        rawString(key, stop);
+        keyLen = stop - key;
+        expect(':');
+        return true;
+    }
+    /* Same for the elements of an array, call after '[' has been consumed */
+    bool element(bool& first){
+        if(accept(']')) return false;
+        if(!first) expect(',');
+        first = false;
+        return true;
+    }
+};
+
+inline bool is(const char* key, size_t len, const char* name){
+    return std::strlen(name) == len && std::memcmp(key, name, len) == 0;
+}
+
+struct scriptfields_t{
+    std::string assembly;
+    std::string hex;
+    std::string type;
+    std::string address;
+};
+
+void parseScript(jsoncursor_t& c, scriptfields_t& script, bool full){
+    c.expect('{');
+    const char* key;
+    size_t len;
+    bool first = true;
+    while(c.member(key, len, first)){
+        if(is(key, len, "hex")) script.hex = c.string();
+        else if(is(key, len, "type")) script.type = c.string();
+        else if(is(key, len, "address")) script.address = c.string();
+        else if(full && is(key, len, "asm")) script.assembly = c.string();
+        else c.skip();
+    }
+}
+
+/* The address is taken from the node for the types that have one, pay to pubkey, bare multisig and nonstandard scripts get the identity of their script, the same as the jsoncpp decoder */
+std::string scriptIdentity(scriptfields_t& script, scripttype_t& type){
+    type = scriptTypeOf(script.type);
+    if(scriptHasAddress(type) && !script.address.empty()) return script.address;
+    return scriptHexIdentity(script.hex, type);
+}
+
+void parseInput(jsoncursor_t& c, vin_t& input, bool full, scripttypecounts_t& counts){
+    scriptfields_t prevout;
+    c.expect('{');
+    const char* key;
+    size_t len;
+    bool first = true;
+    while(c.member(key, len, first)){
+        if(is(key, len, "coinbase")){
+            input.isCoinbase = true;
+            c.skip();
+        }
+        else if(is(key, len, "txid")) c.string(input.txid);
+        else if(is(key, len, "prevout")){
+            c.expect('{');
+            bool firstInPrevout = true;
+            while(c.member(key, len, firstInPrevout)){
+                if(is(key, len, "value")){
+                    const char *begin, *stop;
+                    c.scalar(begin, stop);
+                    input.value = parseSatoshis(begin, stop);
+                }
+                else if(is(key, len, "scriptPubKey")) parseScript(c, prevout, false);
+                else c.skip();
+            }
+        }
+        else if(full && is(key, len, "scriptSig")){
+            scriptfields_t scriptSig;
+            parseScript(c, scriptSig, true);
+            input.scriptSig.assembly.assign(scriptSig.assembly.data(), scriptSig.assembly.size());
+            input.scriptSig.hex.assign(scriptSig.hex.data(), scriptSig.hex.size());
+        }
+        else c.skip();
+    }
+    if(input.isCoinbase){
+        input.scriptSig.address = addressTable.intern("");
+        return;
+    }
+    scripttype_t type;
+    input.scriptSig.address = addressTable.intern(scriptIdentity(prevout, type));
+    counts.inputs[type]++;
+}
+
+/* An output that can never be spent is marked unspendable and gets no address */
+void parseOutput(jsoncursor_t& c, vout_t& output, bool full, scripttypecounts_t& counts){
+    scriptfields_t script;
+    c.expect('{');
+    const char* key;
+    size_t len;
+    bool first = true;
+    while(c.member(key, len, first)){
+        if(is(key, len, "value")){
+            const char *begin, *stop;
+            c.scalar(begin, stop);
+            output.value = parseSatoshis(begin, stop);
+        }
+        else if(is(key, len, "scriptPubKey")) parseScript(c, script, full);
+        else c.skip();
+    }
+    scripttype_t type;
+    std::string identity = scriptIdentity(script, type);
+    counts.outputs[type]++;
+    output.scriptPubKey.type.assign(script.type.data(), script.type.size());
+    if(full){
+        output.scriptPubKey.assembly.assign(script.assembly.data(), script.assembly.size());
+        output.scriptPubKey.hex.assign(script.hex.data(), script.hex.size());
+    }
+    output.unspendable = type == scriptNullData;
+    if(!output.unspendable) output.scriptPubKey.addresses.push_back(addressTable.intern(identity));
+}
+
+void parseTransaction(jsoncursor_t& c, getrawtransaction_t& transaction, Arena* arena, bool full, scripttypecounts_t& counts){
+    c.expect('{');
+    const char* key;
+    size_t len;
+    bool first = true;
+    while(c.member(key, len, first)){
+        if(is(key, len, "txid")) c.string(transaction.txid);
+        else if(is(key, len, "vin") || is(key, len, "vout")){
+            bool inputs = key[1] == 'i';
+            c.expect('[');
+            bool firstElement = true;
+            while(c.element(firstElement)){
+                if(inputs){
+                    transaction.vin.push_back(vin_t(arena));
+                    parseInput(c, transaction.vin.back(), full, counts);
+                }
+                else{
+                    transaction.vout.push_back(vout_t(arena));
+                    parseOutput(c, transaction.vout.back(), full, counts);
+                }
+            }
+        }
+        else if(full && is(key, len, "hex")) c.string(transaction.hex);
+        else c.skip();
+    }
+}
+
+void parseError(jsoncursor_t& c){
+    int code = 0;
+    std::string message;
+    c.expect('{');
+    const char* key;
+    size_t len;
+    bool first = true;
+    while(c.member(key, len, first)){
+        if(is(key, len, "code")){
+            const char *begin, *stop;
+            c.scalar(begin, stop);
+            code = std::atoi(std::string(begin, stop).c_str());
+        }
+        else if(is(key, len, "message")) message = c.string();
+        else c.skip();
+    }
+    throw jsonrpc::JsonRpcException(code, message);
+}
+
+}
+
+int64_t parseSatoshis(const char* begin, const char* end){
+    const char* p = begin;
+    bool negative = p < end && *p == '-';
+    if(negative) p++;
+    /* The digits are gathered as one integer mantissa with a decimal exponent, then scaled by 10^8 */
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    bool fraction = false;
+    for(; p < end; p++){
+        if(*p >= '0' && *p <= '9'){
+            if(digits < 18){
+                mantissa = mantissa * 10 + (*p - '0');
+                if(mantissa != 0) digits++;
+                if(fraction) exponent--;
+            }
+            else if(!fraction) exponent++;
+        }
+        else if(*p == '.') fraction = true;
+        else if(*p == 'e' || *p == 'E'){
+            exponent += std::atoi(std::string(p + 1, end).c_str());
+            break;
+        }
+        else break;
+    }
+    exponent += 8;
+    for(; exponent > 0; exponent--) mantissa *= 10;
+    /* Anything below a satoshi is rounded off */
+    for(; exponent < 0; exponent++){
+        if(exponent == -1) mantissa = (mantissa + 5) / 10;
+        else mantissa /= 10;
+    }
+    return negative ? -(int64_t) mantissa : (int64_t) mantissa;
+}
+
+void parseBlockResponse(const char* data, size_t len, const std::string& blockhash, transactions_t& transactions, bool full){
+    Arena* arena = transactions.get_allocator().getArena();
+    AddressBatch batch;
+    scripttypecounts_t counts;
+    jsoncursor_t c;
+    c.p = data;
+    c.end = data + len;
+    c.expect('{');
+    const char* key;
+    size_t keyLen;
+    bool first = true;
+    while(c.member(key, keyLen, first)){
+        if(is(key, keyLen, "error")){
+            if(!c.isNull()) parseError(c);
+        }
+        else if(is(key, keyLen, "result")){
+            if(c.isNull()) continue;
+            c.expect('{');
+            bool firstInResult = true;
+            while(c.member(key, keyLen, firstInResult)){
+                if(!is(key, keyLen, "tx")){
+                    c.skip();
+                    continue;
+                }
+                c.expect('[');
+                bool firstElement = true;
+                while(c.element(firstElement)){
+                    transactions.push_back(getrawtransaction_t(arena));
+                    parseTransaction(c, transactions.back(), arena, full, counts);
+                    transactions.back().blockhash.assign(blockhash.data(), blockhash.size());
+                }
+            }
+        }
+        else c.skip();
+    }
+    batch.resolve(transactions);
+    addScriptTypes(counts);
+}
+
+void parseTransactionResponse(const char* data, size_t len, getrawtransaction_t& transaction, bool full){
+    Arena* arena = transaction.vin.get_allocator().getArena();
+    scripttypecounts_t counts;
+    jsoncursor_t c;
+    c.p = data;
+    c.end = data + len;
+    c.expect('{');
+    const char* key;
+    size_t keyLen;
+    bool first = true;
+    while(c.member(key, keyLen, first)){
+        if(is(key, keyLen, "error")){
+            if(!c.isNull()) parseError(c);
+        }
+        else if(is(key, keyLen, "result") && !c.isNull()) parseTransaction(c, transaction, arena, full, counts);
+        else c.skip();
+    }
+    addScriptTypes(counts);
+}
@@ -0,0 +1,19 @@
+#ifndef BLOCKPARSER_H
+#define BLOCKPARSER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "definition.h"
+
+/* Decodes the raw JSON-RPC response to getblock with verbosity 3 straight into the transactions, allocated in the arena of the list, in one pass over the text and without building a jsoncpp tree. Only what the clustering uses is kept: the txid, the coinbase flag, the address IDs, the script types and the values in satoshis. With full set the asm and hex of the scripts are kept too, the same as the jsoncpp decoder. A response carrying an error throws a JsonRpcException, text that is not the expected JSON throws a runtime_error */
+void parseBlockResponse(const char* data, size_t len, const std::string& blockhash, transactions_t& transactions, bool full = false);
+
+/* The same for the response to getrawtransaction with verbosity 2, which is one transaction in the same layout as an entry of the block */
+void parseTransactionResponse(const char* data, size_t len, getrawtransaction_t& transaction, bool full = false);
+
+/* Exact conversion of a JSON number in BTC, with or without exponent, to satoshis */
+int64_t parseSatoshis(const char* begin, const char* end);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef BLOCKSOURCE_H
+#define BLOCKSOURCE_H
+
+#include <memory>
+#include <ostream>
+#include <cstdint>
+
+#include "definition.h"
+
+/* The transactions live in the block's arena, which goes back to the pool once the block is dropped. The arena is declared first so it outlives the transactions, and assigning a block gets rid of the old transactions before the old arena is let go */
+struct fetchedblock_t{
+    uint32_t height;
+    std::string hash;
+    std::shared_ptr<Arena> arena;
+    transactions_t transactions;
+
+    fetchedblock_t() : height(0) {}
+    fetchedblock_t(const fetchedblock_t& other) = default;
+    fetchedblock_t(fetchedblock_t&& other) = default;
+    fetchedblock_t& operator=(const fetchedblock_t& other){
+        fetchedblock_t copy(other);
+        return *this = std::move(copy);
+    }
+    fetchedblock_t& operator=(fetchedblock_t&& other){
+        height = other.height;
+        hash = std::move(other.hash);
+        transactions = std::move(other.transactions);
+        arena = std::move(other.arena);
+        return *this;
+    }
+    /* Empties the block and gives it a fresh arena from the pool */
+    void reset(){
+        transactions = transactions_t();
+        arena = arenaPool.acquire();
+        transactions = transactions_t(ArenaAllocator<getrawtransaction_t>(arena.get()));
+    }
+};
+
+/* Anything that hands out decoded blocks in height order to the clustering, either from the node over RPC or from the block files on disk */
+class BlockSource{
+    public:
+    virtual ~BlockSource(){}
+    virtual bool next(fetchedblock_t& block) = 0;
+    virtual void printThroughput(std::ostream& out) = 0;
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include "columnexport.h"
+#include "addresstable.h"
+#include "workerpool.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <unistd.h>
+#include <zlib.h>
+#include <jsoncpp/json/json.h>
+
+static const char columnMagic[8] = {'C', 'B', 'A', 'C', 'O', 'L', 'S', '\0'};
+static const uint32_t columnVersion = 1;
+static const size_t columnNameBytes = 24;
+
+/* header: magic, version, columnCount, rowCount, groupCount */
+static const size_t headerBytes = 8 + 4 + 4 + 8 + 8;
+
+static void append(std::vector<unsigned char>& out, const void* data, size_t len){
+    const unsigned char* bytes = (const unsigned char*) data;
+    out.insert(out.end(), bytes, bytes + len);
+}
+
+ColumnGroup::ColumnGroup(const std::vector<columnspec_t>& specs) : count(0)
+{
+    for(const columnspec_t& spec : specs){
+        column_t column;
+        column.type = spec.type;
+        column.rawBytes = 0;
+        column.crc = 0;
+        columns.push_back(std::move(column));
+    }
+}
+
+void ColumnGroup::u32(size_t column, uint32_t value){
+    append(columns[column].raw, &value, sizeof(value));
+}
+
+void ColumnGroup::u64(size_t column, uint64_t value){
+    append(columns[column].raw, &value, sizeof(value));
+}
+
+void ColumnGroup::string(size_t column, const std::string& value){
+    uint32_t length = value.size();
+    append(columns[column].raw, &length, sizeof(length));
+    append(columns[column].strings, value.data(), value.size());
+}
+
+void ColumnGroup::endRow(){
+    count++;
+}
+
+uint32_t ColumnGroup::rows() const{
+    return count;
+}
+
+bool ColumnGroup::full() const{
+    return count >= maxRows;
+}
+
+/* The addresses are hashes and barely compress, the fastest level shrinks the files about as much as the default one in half the time. The buffers keep their capacity, the next group of the same thread reuses them */
+void ColumnGroup::compress(){
+    for(column_t& column : columns){
+        if(column.type == columnString) column.raw.insert(column.raw.end(), column.strings.begin(), column.strings.end());
+        column.rawBytes = column.raw.size();
+        column.crc = crc32(crc32(0, Z_NULL, 0), column.raw.data(), column.raw.size());
+        uLongf bound = compressBound(column.raw.size());
+        column.compressed.resize(bound);
+        if(compress2(column.compressed.data(), &bound, column.raw.data(), column.raw.size(), Z_BEST_SPEED) != Z_OK){
+            throw std::runtime_error("ColumnFile: cannot compress a row group");
+        }
+        column.compressed.resize(bound);
+    }
+}
+
+void ColumnGroup::clear(){
+    for(column_t& column : columns){
+        column.raw.clear();
+        column.strings.clear();
+        column.compressed.clear();
+    }
+    count = 0;
+}
+
+ColumnFileWriter::ColumnFileWriter(const std::string& path, const std::vector<columnspec_t>& columns)
+: path(path), file(std::fopen(path.c_str(), "wb")), columnCount(columns.size()), rows(0), groups(0), rawBytes(0), bytes(0)
+{
+    if(!file) throw std::runtime_error("ColumnFile: cannot create " + path);
+    /* The counts of the header are filled in by finish */
+    unsigned char header[headerBytes] = {0};
+    std::memcpy(header, columnMagic, sizeof(columnMagic));
+    std::memcpy(header + 8, &columnVersion, 4);
+    std::memcpy(header + 12, &columnCount, 4);
+    write(header, sizeof(header));
+    for(const columnspec_t& column : columns){
+        char name[columnNameBytes] = {0};
+        std::strncpy(name, column.name.c_str(), columnNameBytes - 1);
+        uint32_t descriptor[2] = {column.type, 0};
+        write(name, sizeof(name));
+        write(descriptor, sizeof(descriptor));
+    }
+}
+
+ColumnFileWriter::~ColumnFileWriter(){
+    if(file) std::fclose(file);
+}
+
+void ColumnFileWriter::write(const void* data, size_t len){
+    if(len > 0 && std::fwrite(data, 1, len, file) != len) throw std::runtime_error("ColumnFile: write to " + path + " failed");
+    bytes += len;
+}
+
+void ColumnFileWriter::append(const ColumnGroup& group){
+    uint32_t head[2] = {group.rows(), 0};
+    write(head, sizeof(head));
+    for(const ColumnGroup::column_t& column : group.columns){
+        uint32_t descriptor[4] = {column.rawBytes, (uint32_t) column.compressed.size(), column.crc, 0};
+        write(descriptor, sizeof(descriptor));
+        write(column.compressed.data(), column.compressed.size());
+        rawBytes += column.rawBytes;
+    }
+    rows += group.rows();
+    groups++;
+}
+
+void ColumnFileWriter::finish(){
+    if(std::fseek(file, 16, SEEK_SET) != 0 || std::fwrite(&rows, 8, 1, file) != 1 || std::fwrite(&groups, 8, 1, file) != 1){
+        throw std::runtime_error("ColumnFile: cannot write the header of " + path);
+    }
+    if(std::fflush(file) != 0 || fsync(fileno(file)) != 0) throw std::runtime_error("ColumnFile: cannot sync " + path);
+    std::fclose(file);
+    file = nullptr;
+}
+
+uint64_t ColumnFileWriter::getRows() const{
+    return rows;
+}
+
+uint64_t ColumnFileWriter::getRawBytes() const{
+    return rawBytes;
+}
+
+uint64_t ColumnFileWriter::getBytes() const{
+    return bytes;
+}
+
+ColumnFileReader::ColumnFileReader(const std::string& path) : path(path), file(std::fopen(path.c_str(), "rb")), groupsRead(0)
+{
+    if(!file) throw std::runtime_error("ColumnFile: cannot open " + path);
+    try{
+        unsigned char header[headerBytes];
+        read(header, sizeof(header));
+        if(std::memcmp(header, columnMagic, sizeof(columnMagic)) != 0) throw std::runtime_error("ColumnFile: " + path + " is not a column file");
+        uint32_t version, columnCount;
+        std::memcpy(&version, header + 8, 4);
+        std::memcpy(&columnCount, header + 12, 4);
+        std::memcpy(&rows, header + 16, 8);
+        std::memcpy(&groups, header + 24, 8);
+        if(version != columnVersion) throw std::runtime_error("ColumnFile: unsupported version " + std::to_string(version));
+        for(uint32_t i = 0; i < columnCount; i++){
+            char name[columnNameBytes];
+            uint32_t descriptor[2];
+            read(name, sizeof(name));
+            read(descriptor, sizeof(descriptor));
+            name[columnNameBytes - 1] = '\0';
+            columns.push_back({name, descriptor[0]});
+        }
+    }
+    catch(...){
+        std::fclose(file);
+        throw;
+    }
+}
+
+ColumnFileReader::~ColumnFileReader(){
+    std::fclose(file);
+}
+
+void ColumnFileReader::read(void* data, size_t len){
+    if(std::fread(data, 1, len, file) != len) throw std::runtime_error("ColumnFile: " + path + " is truncated");
+}
+
+const std::vector<columnspec_t>& ColumnFileReader::getColumns() const{
+    return columns;
+}
+
+uint64_t ColumnFileReader::getRows() const{
+    return rows;
+}
+
+bool ColumnFileReader::next(std::vector<std::vector<unsigned char> >& out, uint32_t& groupRows){
+    if(groupsRead >= groups) return false;
+    uint32_t head[2];
+    read(head, sizeof(head));
+    groupRows = head[0];
+    out.resize(columns.size());
+    std::vector<unsigned char> compressed;
+    for(size_t i = 0; i < columns.size(); i++){
+        uint32_t descriptor[4];
+        read(descriptor, sizeof(descriptor));
+        compressed.resize(descriptor[1]);
+        read(compressed.data(), compressed.size());
+        out[i].resize(descriptor[0]);
+        uLongf length = descriptor[0];
+        if(uncompress(out[i].data(), &length, compressed.data(), compressed.size()) != Z_OK || length != descriptor[0]
+            || crc32(crc32(0, Z_NULL, 0), out[i].data(), out[i].size()) != descriptor[2]){
+            throw std::runtime_error("ColumnFile: column " + columns[i].name + " of group " + std::to_string(groupsRead) + " of " + path + " is corrupt");
+        }
+    }
+    groupsRead++;
+    return true;
+}
+
+uint32_t ColumnFileReader::u32At(const std::vector<unsigned char>& column, size_t row){
+    uint32_t value;
+    std::memcpy(&value, column.data() + row * 4, 4);
+    return value;
+}
+
+uint64_t ColumnFileReader::u64At(const std::vector<unsigned char>& column, size_t row){
+    uint64_t value;
+    std::memcpy(&value, column.data() + row * 8, 8);
+    return value;
+}
+
+std::vector<std::string> ColumnFileReader::strings(const std::vector<unsigned char>& column, uint32_t rows){
+    std::vector<std::string> out;
+    out.reserve(rows);
+    size_t at = (size_t) rows * 4;
+    for(uint32_t row = 0; row < rows; row++){
+        uint32_t length = u32At(column, row);
+        out.push_back(std::string((const char*) column.data() + at, length));
+        at += length;
+    }
+    return out;
+}
+
+/* Calls row for every index up to count, the rows it adds are written to file. A row group per thread is filled on the calling thread, then the groups are compressed together and written in order */
+static void writeTable(ColumnFileWriter& file, const std::vector<columnspec_t>& columns, WorkerPool& pool, uint64_t count, std::function<void(uint64_t, ColumnGroup&)> row){
+    std::vector<ColumnGroup> groups(pool.getThreads(), ColumnGroup(columns));
+    uint64_t next = 0;
+    while(next < count){
+        size_t filled = 0;
+        while(filled < groups.size() && next < count){
+            ColumnGroup& group = groups[filled];
+            while(!group.full() && next < count) row(next++, group);
+            if(group.rows() > 0) filled++;
+        }
+        pool.parallelFor(filled, 1, [&](size_t, size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++) groups[i].compress();
+        });
+        for(size_t i = 0; i < filled; i++){
+            file.append(groups[i]);
+            groups[i].clear();
+        }
+    }
+}
+
+exportstats_t exportClustering(const std::string& directory, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, uint64_t height, uint64_t since, int threads){
+    static Histogram& exportSeconds = metrics.histogram("export_seconds", "Export of the clustering to column files");
+    StageTimer timer(exportSeconds, "export", height == noHeight ? -1 : (int64_t) height);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const uint32_t unseen = AddressActivity::unseen;
+    bool incremental = since != noHeight;
+    auto activeSince = [&](uint32_t lastSeen){
+        return !incremental || (lastSeen != unseen && lastSeen > since);
+    };
+    uint32_t addresses = addressTable.size();
+    /* The manifest of an earlier export in the directory would vouch for the files being rewritten */
+    std::string manifestPath = directory + "/manifest.json";
+    std::remove(manifestPath.c_str());
+
+    /* The totals of the entities are kept up to date by the store, nothing has to be added up here */
+    WorkerPool pool(threads);
+    std::vector<columnspec_t> addressColumns = {{"address", columnString}, {"entity", columnU64}, {"reuse", columnU32}, {"first_seen", columnU32}, {"last_seen", columnU32},
+                                                {"received", columnU64}, {"sent", columnU64}, {"transactions", columnU32}};
+    std::vector<columnspec_t> entityColumns = {{"entity", columnU64}, {"wallets", columnU32}, {"first_activity", columnU32}, {"last_activity", columnU32},
+                                               {"received", columnU64}, {"sent", columnU64}, {"transactions", columnU32}};
+    ColumnFileWriter addressFile(directory + "/addresses.col", addressColumns);
+    writeTable(addressFile, addressColumns, pool, addresses, [&](uint64_t i, ColumnGroup& group){
+        uint32_t id = i;
+        uint64_t entity = store.getEntity(id);
+        valuetotals_t totals = activity.totals(id), entityTotals;
+        if(!activeSince(entity != 0 && store.getTotals(entity, entityTotals) ? entityTotals.lastHeight : totals.lastHeight)) return;
+        group.string(0, addressTable.name(id));
+        group.u64(1, entity);
+        group.u32(2, id < reuseFrequency.size() ? reuseFrequency[id] : 0);
+        group.u32(3, totals.firstHeight);
+        group.u32(4, totals.lastHeight);
+        group.u64(5, totals.received);
+        group.u64(6, totals.sent);
+        group.u32(7, totals.transactions);
+        group.endRow();
+    });
+    addressFile.finish();
+    ColumnFileWriter entityFile(directory + "/entities.col", entityColumns);
+    writeTable(entityFile, entityColumns, pool, Entity::getEntitiesCount(), [&](uint64_t entity, ColumnGroup& group){
+        valuetotals_t totals;
+        if(!store.getTotals(entity, totals) || !activeSince(totals.lastHeight)) return;
+        group.u64(0, entity);
+        group.u32(1, store.walletsIn(entity));
+        group.u32(2, totals.firstHeight);
+        group.u32(3, totals.lastHeight);
+        group.u64(4, totals.received);
+        group.u64(5, totals.sent);
+        group.u32(6, totals.transactions);
+        group.endRow();
+    });
+    entityFile.finish();
+
+    exportstats_t stats;
+    stats.addresses = addressFile.getRows();
+    stats.entities = entityFile.getRows();
+    stats.rawBytes = addressFile.getRawBytes() + entityFile.getRawBytes();
+    stats.bytes = addressFile.getBytes() + entityFile.getBytes();
+
+    /* Written last, an export without its manifest is not complete */
+    Json::Value manifest;
+    manifest["format"] = columnVersion;
+    manifest["height"] = height == noHeight ? Json::Value() : Json::Value((Json::UInt64) height);
+    manifest["since"] = incremental ? Json::Value((Json::UInt64) since) : Json::Value();
+    manifest["addresses"]["file"] = "addresses.col";
+    manifest["addresses"]["rows"] = (Json::UInt64) stats.addresses;
+    manifest["entities"]["file"] = "entities.col";
+    manifest["entities"]["rows"] = (Json::UInt64) stats.entities;
+    for(const columnspec_t& column : addressColumns) manifest["addresses"]["columns"].append(column.name);
+    for(const columnspec_t& column : entityColumns) manifest["entities"]["columns"].append(column.name);
+    std::ofstream out(manifestPath);
+    out << manifest;
+    out.close();
+    if(!out) throw std::runtime_error("ColumnFile: cannot write " + manifestPath);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
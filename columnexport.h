@@ -0,0 +1,125 @@
+#ifndef COLUMNEXPORT_H
+#define COLUMNEXPORT_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+
+#include "activity.h"
+#include "entitystore.h"
+
+/* Export of the clustering to compressed column files, so that the analyses read files instead of pulling the WalletToEntity collection out of MongoDB.
+
+   An export is a directory with addresses.col, entities.col and manifest.json, the manifest is written last, once both files are complete.
+   All integers are little endian. A column file is
+     header     magic "CBACOLS\0", u32 version, u32 columnCount, u64 rowCount, u64 groupCount
+     columns    columnCount times char name[24] padded with zeros, u32 type (0 u32, 1 u64, 2 string), u32 reserved
+     groups     groupCount row groups of up to 65536 rows, a u32 row count and a u32 reserved, then every column in order as
+                u32 rawBytes, u32 compressedBytes, u32 CRC-32 of the raw bytes, u32 reserved and the zlib stream of the raw bytes
+   The raw bytes of a column are its values back to back, a string column is u32 lengths[rows] followed by the strings.
+
+     addresses.col  address, entity u64 (0 when it has none), reuse u32, first_seen u32, last_seen u32, received u64, sent u64, transactions u32, in address ID order
+     entities.col   entity u64, wallets u32, first_activity u32, last_activity u32, received u64, sent u64, transactions u32, in entity ID order
+   The activity of an entity is the first and the last height any of its addresses was seen at, the values are in satoshis and the totals are those of valuetotals_t. Heights are UINT32_MAX where they are unknown, for the addresses loaded from MongoDB or from a snapshot of version 1, the totals are 0 there.
+
+   An export since a height only has the entities with an address seen after it, with every one of their addresses, and the addresses seen after it that are in no entity. Applied over the previous export it gives the current clustering, except that an entity merged into another since then keeps its row there, no address points to it anymore */
+
+enum columntype_t : uint32_t { columnU32 = 0, columnU64 = 1, columnString = 2 };
+
+struct columnspec_t{
+    std::string name;
+    uint32_t type;
+};
+
+/* The rows of one row group, filled one value at a time in column order and compressed by any thread */
+class ColumnGroup{
+    public:
+    static const uint32_t maxRows = 1 << 16;
+    ColumnGroup(const std::vector<columnspec_t>& columns);
+    void u32(size_t column, uint32_t value);
+    void u64(size_t column, uint64_t value);
+    void string(size_t column, const std::string& value);
+    void endRow();
+    uint32_t rows() const;
+    bool full() const;
+    void compress();
+    void clear();
+    private:
+    friend class ColumnFileWriter;
+    struct column_t{
+        uint32_t type;
+        /* The values, for a string column the lengths and the strings apart until compress joins them */
+        std::vector<unsigned char> raw;
+        std::vector<unsigned char> strings;
+        std::vector<unsigned char> compressed;
+        uint32_t rawBytes;
+        uint32_t crc;
+    };
+    std::vector<column_t> columns;
+    uint32_t count;
+};
+
+/* Writes the row groups of a column file in the order they are appended */
+class ColumnFileWriter{
+    public:
+    ColumnFileWriter(const std::string& path, const std::vector<columnspec_t>& columns);
+    ~ColumnFileWriter();
+    ColumnFileWriter(const ColumnFileWriter&) = delete;
+    ColumnFileWriter& operator=(const ColumnFileWriter&) = delete;
+    void append(const ColumnGroup& group);
+    /* Writes the counts in the header and syncs the file */
+    void finish();
+    uint64_t getRows() const;
+    uint64_t getRawBytes() const;
+    uint64_t getBytes() const;
+    private:
+    std::string path;
+    std::FILE* file;
+    uint32_t columnCount;
+    uint64_t rows;
+    uint64_t groups;
+    uint64_t rawBytes;
+    uint64_t bytes;
+
+    void write(const void* data, size_t len);
+};
+
+/* Reads a column file back one row group at a time */
+class ColumnFileReader{
+    public:
+    ColumnFileReader(const std::string& path);
+    ~ColumnFileReader();
+    ColumnFileReader(const ColumnFileReader&) = delete;
+    ColumnFileReader& operator=(const ColumnFileReader&) = delete;
+    const std::vector<columnspec_t>& getColumns() const;
+    uint64_t getRows() const;
+    /* The raw bytes of every column of the next row group, false after the last one */
+    bool next(std::vector<std::vector<unsigned char> >& columns, uint32_t& rows);
+    static uint32_t u32At(const std::vector<unsigned char>& column, size_t row);
+    static uint64_t u64At(const std::vector<unsigned char>& column, size_t row);
+    static std::vector<std::string> strings(const std::vector<unsigned char>& column, uint32_t rows);
+    private:
+    std::string path;
+    std::FILE* file;
+    std::vector<columnspec_t> columns;
+    uint64_t rows;
+    uint64_t groups;
+    uint64_t groupsRead;
+
+    void read(void* data, size_t len);
+};
+
+struct exportstats_t{
+    uint64_t addresses = 0;
+    uint64_t entities = 0;
+    uint64_t rawBytes = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+};
+
+/* Writes the export of the clustering at height to directory, everything when since is noHeight or only what was active after since. The rows are gathered on the calling thread a few row groups at a time and the groups are compressed by threads threads, the memory is a few row groups per thread */
+exportstats_t exportClustering(const std::string& directory, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, uint64_t height, uint64_t since, int threads);
+
+#endif
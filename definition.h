@@ -3,43 +3,68 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+
+#include "arena.h"
 
     struct blockinfo_t{
 		std::string hash;
 		std::vector<std::string> tx;
 	};
 
+	/* What is needed to check that a block extends the chain that was clustered, the first block has no previous hash */
+	struct blockheader_t{
+		std::string hash;
+		std::string previousblockhash;
+		uint32_t height;
+		uint64_t time;
+	};
+
+	/* The decoded transactions keep their strings and lists in the arena of their block, given to the constructors, they are on the heap when there is none */
+
 	struct scriptSig_t{
-		std::string assembly;
-		std::string hex;
-		std::string address;
+		arena_string assembly;
+		arena_string hex;
+		/* ID of the address in the AddressTable */
+		uint32_t address;
+		explicit scriptSig_t(Arena* arena = nullptr) : assembly(arena), hex(arena), address(0) {}
 	};
 
 	struct scriptPubKey_t{
-		std::string assembly;
-		std::string hex;
-		std::string type;
-		std::vector<std::string> addresses;
+		arena_string assembly;
+		arena_string hex;
+		arena_string type;
+		/* IDs of the addresses in the AddressTable */
+		arena_vector<uint32_t> addresses;
+		explicit scriptPubKey_t(Arena* arena = nullptr) : assembly(arena), hex(arena), type(arena), addresses(arena) {}
 	};
 
+	/* Values are in satoshis so that sums and comparisons are exact */
 	struct vin_t{
-        std::string txid;
+        arena_string txid;
 		bool isCoinbase;
-		double value;
+		int64_t value;
 		scriptSig_t scriptSig;
+		explicit vin_t(Arena* arena = nullptr) : txid(arena), isCoinbase(false), value(0), scriptSig(arena) {}
 	};
 
+	/* A data carrier (OP_RETURN) can never be spent, it is kept so that the transaction has all its outputs but it is unspendable and has no address */
 	struct vout_t{
-		double value;
+		int64_t value;
+		bool unspendable;
 		scriptPubKey_t scriptPubKey;
+		explicit vout_t(Arena* arena = nullptr) : value(0), unspendable(false), scriptPubKey(arena) {}
 	};
 
 	struct getrawtransaction_t{
-        std::string txid;
-		std::vector<vin_t> vin;
-		std::vector<vout_t> vout;
-		std::string hex;
-		std::string blockhash;
+        arena_string txid;
+		arena_vector<vin_t> vin;
+		arena_vector<vout_t> vout;
+		arena_string hex;
+		arena_string blockhash;
+		explicit getrawtransaction_t(Arena* arena = nullptr) : txid(arena), vin(arena), vout(arena), hex(arena), blockhash(arena) {}
 	};
 
+	typedef arena_vector<getrawtransaction_t> transactions_t;
+
 #endif
\ No newline at end of file
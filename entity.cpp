@@ -6,7 +6,7 @@ Entity::Entity(){
     /* Else one of the free ID is assigned*/
     else{
         this->id = freeID.front();
-        freeID.pop();
+        freeID.pop_front();
     }
 }
 
@@ -36,9 +36,27 @@ void Entity::setEntitiesCount(uint64_t id)
     entitiescount = id + 1;
 }
 
+uint64_t Entity::getEntitiesCount()
+{
+    return entitiescount;
+}
+
 void Entity::pushToFreeID(uint64_t id){
-    freeID.push(id);
+    freeID.push_back(id);
+}
+
+void Entity::unpopFreeID(uint64_t id){
+    freeID.push_front(id);
+}
+
+void Entity::unpushFreeID(){
+    freeID.pop_back();
+}
+
+/* The free ID's in the order they will be reused, used when saving the state */
+std::vector<uint64_t> Entity::getFreeIDs(){
+    return std::vector<uint64_t>(freeID.begin(), freeID.end());
 }
 
 uint64_t Entity::entitiescount = 1;
-std::queue<uint64_t> Entity::freeID;
\ No newline at end of file
+std::deque<uint64_t> Entity::freeID;
\ No newline at end of file
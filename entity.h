@@ -4,12 +4,13 @@
 #include <string>
 #include <unordered_set>
 #include <iostream>
-#include <queue>
+#include <deque>
+#include <vector>
  
 class Entity{
     private:
     static uint64_t entitiescount;
-    static std::queue<uint64_t> freeID;
+    static std::deque<uint64_t> freeID;
     uint64_t id;
     public:
     std::unordered_set<std::string>wallets;
@@ -19,7 +20,12 @@ class Entity{
     void listWallets();
     uint64_t getId();
     static void setEntitiesCount(uint64_t);
+    static uint64_t getEntitiesCount();
     static void pushToFreeID(uint64_t id);
+    static std::vector<uint64_t> getFreeIDs();
+    /* Put the free IDs back the way they were before a pop or a push, used to undo a block */
+    static void unpopFreeID(uint64_t id);
+    static void unpushFreeID();
 };
 
 #endif
\ No newline at end of file
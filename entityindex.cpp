@@ -0,0 +1,142 @@
+#include "entityindex.h"
+#include "addresstable.h"
+
+#include <cstring>
+#include <algorithm>
+
+/* FNV-1a, the addresses are hashes already so the low bits are well spread */
+static uint64_t hashName(const char* data, size_t len){
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < len; i++){
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+EntityIndex::EntityIndex(EntityStore& store, AddressActivity& activity, uint64_t height) : height(height)
+{
+    /* The wallets are sorted by entity then by address ID, which is the order they got into the table */
+    std::vector<std::pair<uint64_t,uint32_t> > rows;
+    rows.reserve(store.walletCount());
+    store.forEachWallet([&rows](uint32_t wallet, uint64_t entityId){ rows.push_back(std::make_pair(entityId, wallet)); });
+    std::sort(rows.begin(), rows.end());
+
+    size_t bytes = 0;
+    for(auto& row : rows) bytes += addressTable.name(row.second).size();
+    names.reserve(bytes);
+    nameOffsets.reserve(rows.size() + 1);
+    totalsOfRow.reserve(rows.size());
+    for(uint32_t i = 0; i < rows.size(); i++){
+        if(i == 0 || rows[i].first != rows[i - 1].first){
+            entities.push_back(rows[i].first);
+            firstRow.push_back(i);
+            totalsOfEntity.push_back(valuetotals_t());
+            store.getTotals(rows[i].first, totalsOfEntity.back());
+        }
+        nameOffsets.push_back(names.size());
+        names += addressTable.name(rows[i].second);
+        totalsOfRow.push_back(activity.totals(rows[i].second));
+    }
+    nameOffsets.push_back(names.size());
+    firstRow.push_back(rows.size());
+
+    /* At most half full so that a probe is short */
+    uint64_t capacity = 16;
+    while(capacity < rows.size() * 2) capacity *= 2;
+    slots.assign(capacity, 0);
+    slotMask = capacity - 1;
+    for(uint32_t row = 0; row < rows.size(); row++){
+        uint64_t slot = hashName(names.data() + nameOffsets[row], nameOffsets[row + 1] - nameOffsets[row]) & slotMask;
+        while(slots[slot] != 0) slot = (slot + 1) & slotMask;
+        slots[slot] = row + 1;
+    }
+}
+
+uint64_t EntityIndex::getHeight() const{
+    return height;
+}
+
+size_t EntityIndex::addressCount() const{
+    return nameOffsets.size() - 1;
+}
+
+size_t EntityIndex::entityCount() const{
+    return entities.size();
+}
+
+size_t EntityIndex::memoryUsage() const{
+    return entities.capacity() * sizeof(uint64_t) + firstRow.capacity() * sizeof(uint32_t) + nameOffsets.capacity() * sizeof(uint64_t)
+        + names.capacity() + slots.capacity() * sizeof(uint32_t) + (totalsOfEntity.capacity() + totalsOfRow.capacity()) * sizeof(valuetotals_t);
+}
+
+std::string EntityIndex::rowName(uint32_t row) const{
+    return names.substr(nameOffsets[row], nameOffsets[row + 1] - nameOffsets[row]);
+}
+
+bool EntityIndex::rowIs(uint32_t row, const std::string& address) const{
+    size_t len = nameOffsets[row + 1] - nameOffsets[row];
+    return len == address.size() && std::memcmp(names.data() + nameOffsets[row], address.data(), len) == 0;
+}
+
+/* Linear probing until the name or an empty slot, -1 when it is not there */
+int64_t EntityIndex::findRow(const std::string& address) const{
+    uint64_t slot = hashName(address.data(), address.size()) & slotMask;
+    while(slots[slot] != 0){
+        if(rowIs(slots[slot] - 1, address)) return slots[slot] - 1;
+        slot = (slot + 1) & slotMask;
+    }
+    return -1;
+}
+
+int64_t EntityIndex::findEntity(uint64_t entityId) const{
+    auto it = std::lower_bound(entities.begin(), entities.end(), entityId);
+    if(it == entities.end() || *it != entityId) return -1;
+    return it - entities.begin();
+}
+
+uint64_t EntityIndex::entityOf(const std::string& address) const{
+    int64_t row = findRow(address);
+    if(row < 0) return 0;
+    /* The entity of a row is the last one that starts at or before it */
+    size_t entity = std::upper_bound(firstRow.begin(), firstRow.end() - 1, (uint32_t) row) - firstRow.begin() - 1;
+    return entities[entity];
+}
+
+std::vector<uint64_t> EntityIndex::entitiesOf(const std::vector<std::string>& addresses) const{
+    std::vector<uint64_t> found;
+    found.reserve(addresses.size());
+    for(const std::string& address : addresses) found.push_back(entityOf(address));
+    return found;
+}
+
+uint64_t EntityIndex::entitySize(uint64_t entityId) const{
+    int64_t entity = findEntity(entityId);
+    if(entity < 0) return 0;
+    return firstRow[entity + 1] - firstRow[entity];
+}
+
+std::vector<std::string> EntityIndex::addressesOf(uint64_t entityId, uint64_t offset, uint64_t limit) const{
+    std::vector<std::string> found;
+    int64_t entity = findEntity(entityId);
+    if(entity < 0) return found;
+    uint64_t begin = firstRow[entity] + std::min<uint64_t>(offset, firstRow[entity + 1] - firstRow[entity]);
+    uint64_t end = std::min<uint64_t>(firstRow[entity + 1], begin + limit);
+    found.reserve(end - begin);
+    for(uint64_t row = begin; row < end; row++) found.push_back(rowName(row));
+    return found;
+}
+
+bool EntityIndex::addressTotals(const std::string& address, valuetotals_t& totals) const{
+    int64_t row = findRow(address);
+    if(row < 0) return false;
+    totals = totalsOfRow[row];
+    return true;
+}
+
+bool EntityIndex::entityTotals(uint64_t entityId, valuetotals_t& totals) const{
+    int64_t entity = findEntity(entityId);
+    if(entity < 0) return false;
+    totals = totalsOfEntity[entity];
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef ENTITYINDEX_H
+#define ENTITYINDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "activity.h"
+#include "entitystore.h"
+
+/* A read only copy of the clustering laid out for lookups. The wallets that belong to an entity are rows grouped by entity, the entities are in ascending ID with the first row of each, the names of the rows are in one string pool and an open addressing table finds the row of a name. The totals of every row and of every entity are copied next to them. It is built on the ingestion thread and never changes afterwards, so any number of threads can read it without locking while the store moves on */
+class EntityIndex{
+    public:
+    EntityIndex(EntityStore& store, AddressActivity& activity, uint64_t height);
+    /* Last block the index covers */
+    uint64_t getHeight() const;
+    size_t addressCount() const;
+    size_t entityCount() const;
+    size_t memoryUsage() const;
+    /* 0 when the address is not in any entity */
+    uint64_t entityOf(const std::string& address) const;
+    std::vector<uint64_t> entitiesOf(const std::vector<std::string>& addresses) const;
+    /* Number of addresses in the entity, 0 when it does not exist */
+    uint64_t entitySize(uint64_t entityId) const;
+    /* The addresses of the entity from offset on, at most limit of them, in the same order on every call */
+    std::vector<std::string> addressesOf(uint64_t entityId, uint64_t offset, uint64_t limit) const;
+    /* The totals of an address in an entity and of an entity, false when there is no such address or entity */
+    bool addressTotals(const std::string& address, valuetotals_t& totals) const;
+    bool entityTotals(uint64_t entityId, valuetotals_t& totals) const;
+    private:
+    uint64_t height;
+    std::vector<uint64_t> entities;
+    std::vector<uint32_t> firstRow;
+    std::vector<valuetotals_t> totalsOfEntity;
+    std::vector<valuetotals_t> totalsOfRow;
+    std::vector<uint64_t> nameOffsets;
+    std::string names;
+    /* Row + 1 of the name hashed there, 0 for an empty slot */
+    std::vector<uint32_t> slots;
+    uint64_t slotMask;
+
+    std::string rowName(uint32_t row) const;
+    bool rowIs(uint32_t row, const std::string& address) const;
+    int64_t findRow(const std::string& address) const;
+    int64_t findEntity(uint64_t entityId) const;
+};
+
+#endif
@@ -0,0 +1,401 @@
+#include "entitystore.h"
+#include "addresstable.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+/* Address IDs are 32 bit, so are the entity IDs as long as the freed ones are reused */
+static const size_t maxItems = (size_t) 1 << 32;
+
+/* The wallets that have not been seen by the store yet are singleton sets without an entity */
+void EntityStore::grow(uint32_t wallet){
+    if(wallet < parent.size()) return;
+    uint32_t first = parent.size();
+    log(storeundo_t::grown, first, 0);
+    parent.resize(wallet + 1);
+    size.resize(wallet + 1, 1);
+    next.resize(wallet + 1);
+    entityOf.resize(wallet + 1, 0);
+    received.resize(wallet + 1, 0);
+    sent.resize(wallet + 1, 0);
+    transactions.resize(wallet + 1, 0);
+    firstHeight.resize(wallet + 1, 0);
+    lastHeight.resize(wallet + 1, 0);
+    for(uint32_t i = first; i <= wallet; i++) parent[i] = next[i] = i;
+}
+
+/* Path halving, every visited node is pointed at its grandparent */
+uint32_t EntityStore::find(uint32_t node){
+    while(parent[node] != node){
+        setParent(node, parent[parent[node]]);
+        node = parent[node];
+    }
+    return node;
+}
+
+/* Hangs the smaller set under the larger one and returns the new root, the entity with the smaller ID survives */
+uint32_t EntityStore::link(uint32_t root1, uint32_t root2){
+    if(root1 == root2) return root1;
+    if(size[root1] < size[root2]) std::swap(root1, root2);
+    uint64_t entity1 = entityOf[root1], entity2 = entityOf[root2];
+    if(tracking){
+        /* The wallets of a set without an entity are new to the mapping, a merge of two entities changes every wallet of the dropped one and is logged as a single remap */
+        if(entity1 == 0 && entity2 != 0) markSet(root1);
+        else if(entity2 == 0 && entity1 != 0) markSet(root2);
+        else if(entity1 != 0 && entity2 != 0) remaps.push_back({std::max(entity1, entity2), std::min(entity1, entity2)});
+    }
+    if(!journals.empty()){
+        log(storeundo_t::linked, root1, root2);
+        log(storeundo_t::sizeOf, root1, size[root1]);
+        log(storeundo_t::nextOf, root1, next[root1]);
+        log(storeundo_t::nextOf, root2, next[root2]);
+    }
+    setParent(root2, root1);
+    size[root1] += size[root2];
+    largest = std::max(largest, size[root1]);
+    /* Splicing two circular lists is a swap of one successor from each */
+    std::swap(next[root1], next[root2]);
+    /* The totals of the hung set are left on its old root, the undo of the link only has to restore the new root */
+    addTotals(root1, received[root2], sent[root2], transactions[root2], firstHeight[root2], lastHeight[root2]);
+
+    uint64_t kept = entity1 == 0 ? entity2 : (entity2 == 0 ? entity1 : std::min(entity1, entity2));
+    uint64_t dropped = entity1 == 0 || entity2 == 0 ? 0 : std::max(entity1, entity2);
+    if(dropped != 0){
+        /* Push the deleted id's to the freeID vector which is used during creation of newer entity*/
+        Entity::pushToFreeID(dropped);
+        log(storeundo_t::idFreed, 0, dropped);
+        setEntityRoot(dropped, storeundo_t::absent);
+    }
+    setEntityOf(root1, kept);
+    setEntityOf(root2, 0);
+    if(kept != 0) setEntityRoot(kept, root1);
+    return root1;
+}
+
+/* Returns the entity of the wallet, or 0 if it does not belong to any */
+uint64_t EntityStore::getEntity(uint32_t wallet){
+    if(wallet >= parent.size()) return 0;
+    return entityOf[find(wallet)];
+}
+
+bool EntityStore::unite(uint32_t wallet1, uint32_t wallet2){
+    grow(std::max(wallet1, wallet2));
+    uint32_t root1 = find(wallet1), root2 = find(wallet2);
+    link(root1, root2);
+    return root1 != root2;
+}
+
+/* Gives the set of the wallet a new entity if it has none, the ID comes from Entity so that the freed IDs are reused */
+void EntityStore::ensureEntity(uint32_t wallet){
+    grow(wallet);
+    uint32_t root = find(wallet);
+    if(entityOf[root] != 0) return;
+    uint64_t counted = Entity::getEntitiesCount();
+    Entity entity;
+    if(!journals.empty()){
+        log(storeundo_t::ensured, root, 0);
+        log(Entity::getEntitiesCount() != counted ? storeundo_t::idFromCounter : storeundo_t::idFromFree, 0, entity.getId());
+    }
+    setEntityOf(root, entity.getId());
+    setEntityRoot(entity.getId(), root);
+    if(tracking) markSet(root);
+}
+
+/* Puts the wallet in the given entity, used when the clustering is loaded back from the database */
+void EntityStore::assign(uint32_t wallet, uint64_t entityId){
+    grow(wallet);
+    uint32_t root = find(wallet);
+    uint32_t existing = rootOf(entityId);
+    if(existing != storeundo_t::absent){
+        link(find(existing), root);
+        return;
+    }
+    if(entityOf[root] != 0) setEntityRoot(entityOf[root], storeundo_t::absent);
+    setEntityOf(root, entityId);
+    setEntityRoot(entityId, root);
+}
+
+/* Every set the transaction touched gets it once, with the sum of what it moved for the wallets of the set */
+void EntityStore::addTransaction(const walletflow_t* begin, const walletflow_t* end, uint32_t height){
+    touchedRoots.clear();
+    for(const walletflow_t* flow = begin; flow != end; flow++){
+        grow(flow->wallet);
+        touchedRoots.push_back({find(flow->wallet), flow->received, flow->sent});
+    }
+    std::sort(touchedRoots.begin(), touchedRoots.end(), [](const walletflow_t& a, const walletflow_t& b){ return a.wallet < b.wallet; });
+    for(size_t i = 0; i < touchedRoots.size();){
+        uint32_t root = touchedRoots[i].wallet;
+        int64_t moreReceived = 0, moreSent = 0;
+        for(; i < touchedRoots.size() && touchedRoots[i].wallet == root; i++) moreReceived += touchedRoots[i].received, moreSent += touchedRoots[i].sent;
+        addTotals(root, moreReceived, moreSent, 1, height + 1, height + 1);
+    }
+}
+
+bool EntityStore::getTotals(uint64_t entityId, valuetotals_t& totals){
+    uint32_t root = rootOf(entityId);
+    if(root == storeundo_t::absent) return false;
+    totals.received = received[root];
+    totals.sent = sent[root];
+    totals.transactions = transactions[root];
+    totals.firstHeight = firstHeight[root] - 1;
+    totals.lastHeight = lastHeight[root] - 1;
+    return true;
+}
+
+void EntityStore::setTotals(uint32_t wallet, const valuetotals_t& totals){
+    grow(wallet);
+    uint32_t root = find(wallet);
+    received[root] = totals.received;
+    sent[root] = totals.sent;
+    transactions[root] = totals.transactions;
+    firstHeight[root] = totals.firstHeight + 1;
+    lastHeight[root] = totals.lastHeight + 1;
+}
+
+uint32_t EntityStore::walletsIn(uint64_t entityId){
+    uint32_t root = rootOf(entityId);
+    return root == storeundo_t::absent ? 0 : size[root];
+}
+
+std::vector<uint32_t> EntityStore::getWallets(uint64_t entityId){
+    std::vector<uint32_t> wallets;
+    uint32_t root = rootOf(entityId);
+    if(root == storeundo_t::absent) return wallets;
+    wallets.reserve(size[root]);
+    uint32_t current = root;
+    do{
+        wallets.push_back(current);
+        current = next[current];
+    } while(current != root);
+    return wallets;
+}
+
+Entity EntityStore::getEntityView(uint64_t entityId){
+    Entity entity(entityId);
+    for(uint32_t wallet : getWallets(entityId)) entity.addWallet(addressTable.name(wallet));
+    return entity;
+}
+
+/* Calls back with every wallet that belongs to an entity */
+void EntityStore::forEachWallet(std::function<void(uint32_t, uint64_t)> callback){
+    for(uint32_t i = 0; i < parent.size(); i++){
+        uint64_t entityId = entityOf[find(i)];
+        if(entityId != 0) callback(i, entityId);
+    }
+}
+
+std::unordered_map<std::string,uint64_t> EntityStore::materializeWalletToEntity(){
+    std::unordered_map<std::string,uint64_t> walletToEntity;
+    walletToEntity.reserve(parent.size());
+    forEachWallet([&walletToEntity](uint32_t wallet, uint64_t entityId){ walletToEntity[addressTable.name(wallet)] = entityId; });
+    return walletToEntity;
+}
+
+std::unordered_map<uint64_t,Entity> EntityStore::materializeEntities(){
+    std::unordered_map<uint64_t,Entity> entities;
+    for(uint64_t entityId = 0; entityId < entityRoot.size(); entityId++){
+        if(entityRoot[entityId] != storeundo_t::absent) entities.insert({entityId, getEntityView(entityId)});
+    }
+    return entities;
+}
+
+size_t EntityStore::walletCount(){
+    return parent.size();
+}
+
+uint32_t EntityStore::largestSet(){
+    return largest;
+}
+
+size_t EntityStore::entityCount(){
+    return entities;
+}
+
+size_t EntityStore::memoryUsage(){
+    return parent.memoryUsage() + size.memoryUsage() + next.memoryUsage() + entityOf.memoryUsage() + entityRoot.memoryUsage()
+        + received.memoryUsage() + sent.memoryUsage() + transactions.memoryUsage() + firstHeight.memoryUsage() + lastHeight.memoryUsage();
+}
+
+void EntityStore::mapTo(const std::string& directory){
+    parent.mapTo(directory, maxItems);
+    size.mapTo(directory, maxItems);
+    next.mapTo(directory, maxItems);
+    entityOf.mapTo(directory, maxItems);
+    entityRoot.mapTo(directory, maxItems);
+    received.mapTo(directory, maxItems);
+    sent.mapTo(directory, maxItems);
+    transactions.mapTo(directory, maxItems);
+    firstHeight.mapTo(directory, maxItems);
+    lastHeight.mapTo(directory, maxItems);
+}
+
+bool EntityStore::isMapped(){
+    return parent.mapped();
+}
+
+void EntityStore::prefetch(const std::vector<uint32_t>& wallets){
+    parent.prefetch(wallets);
+    size.prefetch(wallets);
+    next.prefetch(wallets);
+    entityOf.prefetch(wallets);
+    received.prefetch(wallets);
+    sent.prefetch(wallets);
+    transactions.prefetch(wallets);
+    firstHeight.prefetch(wallets);
+    lastHeight.prefetch(wallets);
+}
+
+size_t EntityStore::mappedBytes(){
+    return parent.mappedBytes() + size.mappedBytes() + next.mappedBytes() + entityOf.mappedBytes() + entityRoot.mappedBytes()
+        + received.mappedBytes() + sent.mappedBytes() + transactions.mappedBytes() + firstHeight.mappedBytes() + lastHeight.mappedBytes();
+}
+
+/* Sizes the arrays for a bulk load */
+void EntityStore::reserve(uint32_t wallets){
+    if(wallets > 0) grow(wallets - 1);
+}
+
+void EntityStore::trackChanges(bool enabled){
+    tracking = enabled;
+}
+
+/* Records every wallet of the set by walking its circular list */
+void EntityStore::markSet(uint32_t root){
+    uint32_t current = root;
+    do{
+        changedWallets.push_back(current);
+        current = next[current];
+    } while(current != root);
+}
+
+void EntityStore::takeChanges(std::vector<uint32_t>& wallets, std::vector<std::pair<uint64_t,uint64_t> >& entityRemaps){
+    wallets.swap(changedWallets);
+    entityRemaps.swap(remaps);
+    changedWallets.clear();
+    remaps.clear();
+}
+
+void EntityStore::setUndoDepth(size_t blocks){
+    undoDepth = blocks;
+    while(journals.size() > undoDepth) journals.pop_front();
+}
+
+void EntityStore::beginBlock(){
+    if(undoDepth == 0) return;
+    if(journals.size() == undoDepth){
+        /* The oldest journal is recycled for the new block, its memory is kept */
+        std::vector<storeundo_t> recycled;
+        recycled.swap(journals.front());
+        journals.pop_front();
+        recycled.clear();
+        journals.push_back(std::move(recycled));
+    }
+    else journals.push_back(std::vector<storeundo_t>());
+}
+
+/* Puts back every value the latest block changed, newest first. The wallets of the sets that were linked or given an entity get marked again once the sets are back apart, so the next checkpoint rewrites them with the entity they are back to */
+bool EntityStore::undoBlock(){
+    if(journals.empty()) return false;
+    std::vector<storeundo_t> journal;
+    journal.swap(journals.back());
+    journals.pop_back();
+    std::vector<uint32_t> roots;
+    for(auto it = journal.rbegin(); it != journal.rend(); it++){
+        switch(it->kind){
+            case storeundo_t::parentOf: parent[it->index] = it->value; break;
+            case storeundo_t::sizeOf: size[it->index] = it->value; break;
+            case storeundo_t::nextOf: next[it->index] = it->value; break;
+            case storeundo_t::entityOfRoot: entityOf[it->index] = it->value; break;
+            case storeundo_t::rootOfEntity: putRoot(it->value, it->index); break;
+            case storeundo_t::grown:
+                /* The wallets that are dropped may have been written with an entity already */
+                if(tracking) for(uint32_t wallet = it->index; wallet < parent.size(); wallet++) changedWallets.push_back(wallet);
+                parent.resize(it->index);
+                size.resize(it->index);
+                next.resize(it->index);
+                entityOf.resize(it->index);
+                received.resize(it->index);
+                sent.resize(it->index);
+                transactions.resize(it->index);
+                firstHeight.resize(it->index);
+                lastHeight.resize(it->index);
+                break;
+            case storeundo_t::linked: roots.push_back(it->index); roots.push_back(it->value); break;
+            case storeundo_t::ensured: roots.push_back(it->index); break;
+            case storeundo_t::idFromCounter: Entity::setEntitiesCount(it->value - 1); break;
+            case storeundo_t::idFromFree: Entity::unpopFreeID(it->value); break;
+            case storeundo_t::idFreed: Entity::unpushFreeID(); break;
+            case storeundo_t::receivedOf: received[it->index] = it->value; break;
+            case storeundo_t::sentOf: sent[it->index] = it->value; break;
+            case storeundo_t::transactionsOf: transactions[it->index] = it->value; break;
+            case storeundo_t::heightsOf: firstHeight[it->index] = it->value >> 32, lastHeight[it->index] = (uint32_t) it->value; break;
+        }
+    }
+    if(tracking){
+        for(uint32_t root : roots){
+            if(root < parent.size() && parent[root] == root) markSet(root);
+        }
+    }
+    return true;
+}
+
+size_t EntityStore::undoableBlocks(){
+    return journals.size();
+}
+
+size_t EntityStore::journalMemoryUsage(){
+    size_t bytes = 0;
+    for(auto& journal : journals) bytes += journal.capacity() * sizeof(storeundo_t);
+    return bytes;
+}
+
+void EntityStore::log(uint8_t kind, uint32_t index, uint64_t value){
+    if(!journals.empty()) journals.back().push_back({kind, index, value});
+}
+
+void EntityStore::setParent(uint32_t node, uint32_t value){
+    if(!journals.empty()) journals.back().push_back({storeundo_t::parentOf, node, parent[node]});
+    parent[node] = value;
+}
+
+void EntityStore::setEntityOf(uint32_t root, uint64_t entityId){
+    if(!journals.empty()) journals.back().push_back({storeundo_t::entityOfRoot, root, entityOf[root]});
+    entityOf[root] = entityId;
+}
+
+/* Absent as the root erases the entity */
+void EntityStore::setEntityRoot(uint64_t entityId, uint32_t root){
+    if(!journals.empty()) journals.back().push_back({storeundo_t::rootOfEntity, rootOf(entityId), entityId});
+    putRoot(entityId, root);
+}
+
+uint32_t EntityStore::rootOf(uint64_t entityId){
+    return entityId < entityRoot.size() ? entityRoot[entityId] : storeundo_t::absent;
+}
+
+void EntityStore::putRoot(uint64_t entityId, uint32_t root){
+    if(entityId >= entityRoot.size()){
+        if(root == storeundo_t::absent) return;
+        if(entityId >= maxItems) throw std::runtime_error("EntityStore: entity ID " + std::to_string(entityId) + " is out of range");
+        entityRoot.resize(entityId + 1, (uint32_t) storeundo_t::absent);
+    }
+    uint32_t& slot = entityRoot[entityId];
+    if(slot == storeundo_t::absent && root != storeundo_t::absent) entities++;
+    else if(slot != storeundo_t::absent && root == storeundo_t::absent) entities--;
+    slot = root;
+}
+
+/* The heights come plus one like the columns, 0 leaves them as they are */
+void EntityStore::addTotals(uint32_t root, int64_t moreReceived, int64_t moreSent, uint32_t moreTransactions, uint32_t first, uint32_t last){
+    if(!journals.empty()){
+        log(storeundo_t::receivedOf, root, received[root]);
+        log(storeundo_t::sentOf, root, sent[root]);
+        log(storeundo_t::transactionsOf, root, transactions[root]);
+        log(storeundo_t::heightsOf, root, (uint64_t) firstHeight[root] << 32 | lastHeight[root]);
+    }
+    received[root] += moreReceived;
+    sent[root] += moreSent;
+    transactions[root] += moreTransactions;
+    if(first != 0 && (firstHeight[root] == 0 || first < firstHeight[root])) firstHeight[root] = first;
+    if(last > lastHeight[root]) lastHeight[root] = last;
+}
@@ -0,0 +1,120 @@
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+
+#include <deque>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include "entity.h"
+#include "mappedcolumn.h"
+
+/* What went through a set of wallets or through one address, the values in satoshis. A transaction counts once however many wallets of the set it has, the set being the one they were in after the heuristics of its block, so a transaction that touched two sets merged later counts once in each. The heights are the first and the last block a wallet was seen in, unseen before any */
+struct valuetotals_t{
+    static const uint32_t unseen = UINT32_MAX;
+    int64_t received = 0;
+    int64_t sent = 0;
+    uint32_t transactions = 0;
+    uint32_t firstHeight = unseen;
+    uint32_t lastHeight = unseen;
+};
+
+/* What one transaction moved for one of its wallets, a wallet is listed once per transaction */
+struct walletflow_t{
+    uint32_t wallet;
+    int64_t received;
+    int64_t sent;
+};
+
+/* One change made to the store, undoing it puts the old value back. The index is a wallet, except for the entity root entries where it is the old root of the entity in value (absent when the entity had none) and for grown where it is the old number of wallets */
+struct storeundo_t{
+    enum kind_t : uint8_t { parentOf, sizeOf, nextOf, entityOfRoot, rootOfEntity, grown, linked, ensured, idFromCounter, idFromFree, idFreed, receivedOf, sentOf, transactionsOf, heightsOf };
+    static const uint32_t absent = UINT32_MAX;
+    uint8_t kind;
+    uint32_t index;
+    uint64_t value;
+};
+
+/* Keeps the clustering as a disjoint-set forest over the wallet address IDs, union by size with path halving, so merging two entities is a pointer update instead of copying every wallet of one into the other. The entity ID lives on the root of each set, when two entities meet the smaller ID is kept and the other one goes back to the free IDs. Every set also threads its wallets on a circular list so they can be listed without scanning, the wallet lists and the wallet to entity map are only materialized when they are asked for */
+class EntityStore{
+    public:
+    uint64_t getEntity(uint32_t wallet);
+    /* True when the wallets were in two different sets */
+    bool unite(uint32_t wallet1, uint32_t wallet2);
+    void ensureEntity(uint32_t wallet);
+    void assign(uint32_t wallet, uint64_t entityId);
+    /* Adds a transaction of the block at height to the totals of the sets of its wallets */
+    void addTransaction(const walletflow_t* begin, const walletflow_t* end, uint32_t height);
+    /* The totals of the entity, false when it does not exist */
+    bool getTotals(uint64_t entityId, valuetotals_t& totals);
+    /* Replaces the totals of the set of the wallet, used when the clustering is loaded back */
+    void setTotals(uint32_t wallet, const valuetotals_t& totals);
+    /* Wallets in the entity, 0 when it does not exist */
+    uint32_t walletsIn(uint64_t entityId);
+    std::vector<uint32_t> getWallets(uint64_t entityId);
+    Entity getEntityView(uint64_t entityId);
+    void forEachWallet(std::function<void(uint32_t, uint64_t)> callback);
+    std::unordered_map<std::string,uint64_t> materializeWalletToEntity();
+    std::unordered_map<uint64_t,Entity> materializeEntities();
+    size_t walletCount();
+    size_t entityCount();
+    size_t memoryUsage();
+    /* Wallets in the largest set there has been, an undo does not take it back */
+    uint32_t largestSet();
+    void reserve(uint32_t wallets);
+    /* Keeps the arrays in scratch files of directory instead of the heap, see MappedColumn. Called before the store is filled */
+    void mapTo(const std::string& directory);
+    bool isMapped();
+    size_t mappedBytes();
+    /* Starts reading the pages of the wallets in the arrays of a mapped store, sorted wallets */
+    void prefetch(const std::vector<uint32_t>& wallets);
+    void trackChanges(bool enabled);
+    void takeChanges(std::vector<uint32_t>& wallets, std::vector<std::pair<uint64_t,uint64_t> >& remaps);
+    /* Keeps a journal of the changes of each of the last blocks so they can be taken back when the chain reorganizes, beginBlock starts the journal of a new block and drops the oldest one past the depth */
+    void setUndoDepth(size_t blocks);
+    void beginBlock();
+    bool undoBlock();
+    size_t undoableBlocks();
+    size_t journalMemoryUsage();
+    private:
+    /* The arrays are indexed by the address ID of the wallet */
+    MappedColumn<uint32_t> parent;
+    MappedColumn<uint32_t> size;
+    MappedColumn<uint32_t> next;
+    /* Only meaningful on the roots, 0 means the set has not been given an entity yet */
+    MappedColumn<uint64_t> entityOf;
+    /* The root of every entity indexed by its ID, absent for the IDs that are free or not handed out. The IDs come from one counter and the freed ones are reused, so they stay dense */
+    MappedColumn<uint32_t> entityRoot;
+    /* The totals of every set, only meaningful on the roots and added up when two sets are linked. The heights are kept plus one so that 0 means none */
+    MappedColumn<int64_t> received;
+    MappedColumn<int64_t> sent;
+    MappedColumn<uint32_t> transactions;
+    MappedColumn<uint32_t> firstHeight;
+    MappedColumn<uint32_t> lastHeight;
+    /* The roots a transaction touched with what it moved for each, kept between calls so the memory is reused */
+    std::vector<walletflow_t> touchedRoots;
+    size_t entities = 0;
+    uint32_t largest = 1;
+    /* Changes since the last takeChanges, used to write only what changed: the wallets that joined an entity and the (dropped, kept) pairs of merged entities in the order they happened */
+    bool tracking = false;
+    std::vector<uint32_t> changedWallets;
+    std::vector<std::pair<uint64_t,uint64_t> > remaps;
+
+    /* Every write goes to the journal of the latest block while there is one, the path halving of find included since it may shortcut a link the undo takes back */
+    size_t undoDepth = 0;
+    std::deque<std::vector<storeundo_t> > journals;
+
+    void log(uint8_t kind, uint32_t index, uint64_t value);
+    void setParent(uint32_t node, uint32_t value);
+    void setEntityOf(uint32_t root, uint64_t entityId);
+    void setEntityRoot(uint64_t entityId, uint32_t root);
+    uint32_t rootOf(uint64_t entityId);
+    void putRoot(uint64_t entityId, uint32_t root);
+    void addTotals(uint32_t root, int64_t moreReceived, int64_t moreSent, uint32_t moreTransactions, uint32_t first, uint32_t last);
+    void grow(uint32_t wallet);
+    uint32_t find(uint32_t node);
+    uint32_t link(uint32_t root1, uint32_t root2);
+    void markSet(uint32_t root);
+};
+
+#endif
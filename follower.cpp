@@ -0,0 +1,185 @@
+#include "follower.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+#include <thread>
+#include <stdexcept>
+
+static double secondsSince(std::chrono::steady_clock::time_point since){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+ChainFollower::ChainFollower(options_t& options, EntityStore& store, Heuristics& heuristics, MappedColumn<int>& reuseFrequency, AddressActivity& activity, Persistence* persistence, uint64_t& lastHeight, std::string& lastHash)
+: options(options), store(store), heuristics(heuristics), reuseFrequency(reuseFrequency), activity(activity), persistence(persistence), lastHeight(lastHeight), lastHash(lastHash), log(nullptr),
+  api(options.rpcUser, options.rpcPassword, options.rpcHost, options.rpcPort, options.rpcTimeout), stopping(false), startedAt(std::chrono::steady_clock::now())
+{
+    api.setFullTransactions(options.fullTransactions);
+    store.setUndoDepth(options.undoDepth);
+    startTip = stats.tipHeight = api.getblockcount();
+    belowHash = lastHash;
+}
+
+void ChainFollower::setLog(MergeLog* mergeLog){
+    log = mergeLog;
+}
+
+/* Clusters the block in a journal of its own, the store and applied keep the last undoDepth of them. A block far from the tip still starts one, otherwise its changes would go to the journal of the block before and undoing that one would take back both */
+void ChainFollower::apply(fetchedblock_t& block){
+    static Histogram& blockLatency = metrics.histogram("follow_block_latency_seconds", "Time from a block first seen on the daemon to its clustering");
+    if(applied.empty()) belowHash = lastHash;
+    appliedblock_t done;
+    done.height = block.height;
+    done.hash = block.hash;
+    done.undoable = options.undoDepth > 0;
+    if(done.undoable){
+        store.beginBlock();
+        for(getrawtransaction_t& transaction : block.transactions){
+            for(vout_t& out : transaction.vout) if(!out.unspendable) done.outputs.push_back(out.scriptPubKey.addresses[0]);
+        }
+    }
+    heuristics.runHeuristics(store, block.transactions, reuseFrequency);
+    activity.record(block.height, block.transactions, &store, done.undoable ? &done.seen : nullptr);
+    if(persistence) persistence->trackBlock(block.transactions);
+    if(log) log->append(block.height, block.hash, block.transactions, heuristics);
+    lastHeight = block.height;
+    lastHash = block.hash;
+
+    applied.push_back(std::move(done));
+    while(applied.size() > std::max<size_t>(options.undoDepth, 1)){
+        belowHash = applied.front().hash;
+        applied.pop_front();
+    }
+    auto seen = seenAt.find(block.height);
+    if(seen != seenAt.end()){
+        stats.lastLatencySeconds = secondsSince(seen->second);
+        blockLatency.observeSeconds(stats.lastLatencySeconds);
+    }
+    seenAt.erase(seenAt.begin(), seenAt.upper_bound(block.height));
+}
+
+/* Polls the daemon until stop is called, the checkpoint is written after every poll that changed the clustering */
+void ChainFollower::run(uint32_t firstHeight, std::function<void()> blockDone, std::function<void()> checkpoint){
+    /* The reuse prepass only covered the range it was run over, the blocks from now on are new to it */
+    heuristics.setReuseIndex(nullptr);
+    Gauge& tipGauge = metrics.gauge("follow_tip_height", "Height of the tip of the daemon");
+    Gauge& lagBlocksGauge = metrics.gauge("follow_lag_blocks", "Blocks on the daemon not clustered yet");
+    Gauge& lagSecondsGauge = metrics.gauge("follow_lag_seconds", "How long the oldest block not clustered yet has been known");
+    while(!stopping){
+        uint64_t before = stats.rolledBackBlocks, height = lastHeight;
+        bool again = poll(firstHeight, blockDone, checkpoint);
+        followstats_t current = getStats();
+        tipGauge.set(current.tipHeight);
+        lagBlocksGauge.set(current.lagBlocks);
+        lagSecondsGauge.set(current.lagSeconds);
+        if(height != lastHeight || before != stats.rolledBackBlocks){
+            checkpoint();
+            printStats(std::cout);
+        }
+        if(again) continue;
+        /* Slept in small steps so that a stop is not held up by the interval */
+        std::chrono::steady_clock::time_point wake = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.pollInterval);
+        while(!stopping && std::chrono::steady_clock::now() < wake) std::this_thread::sleep_for(std::chrono::milliseconds(std::min(options.pollInterval, 100)));
+    }
+}
+
+void ChainFollower::stop(){
+    stopping = true;
+}
+
+/* Undoes the blocks the daemon no longer has on its chain, then clusters the new blocks up to its tip. A block hash commits to all of the chain before it, so comparing the last block clustered is enough to know whether a reorg reached it. Returns true when it stopped on a block that does not extend the last one, the chain moved while it was read and the next poll has to walk back first */
+bool ChainFollower::poll(uint32_t firstHeight, std::function<void()>& blockDone, std::function<void()>& checkpoint){
+    static Histogram& fetchSeconds = metrics.histogram("block_fetch_seconds", "Download and decoding of one block");
+    static Counter& reorgCount = metrics.counter("follow_reorgs_total", "Reorganizations of the chain followed");
+    uint32_t tip = api.getblockcount();
+    seeTip(tip);
+    /* After a restart nothing is in the journal, the last block clustered is only known by the hash kept with the snapshot and a reorg while the process was down cannot be undone */
+    if(applied.empty() && lastHeight != noHeight && !lastHash.empty() && (lastHeight > tip || api.getblockhash(lastHeight) != lastHash)){
+        throw std::runtime_error("Follow: block " + std::to_string(lastHeight) + " " + lastHash + " is no longer on the daemon's chain, it reorganized while the clustering was stopped and has to be rebuilt from a snapshot older than the reorg");
+    }
+    bool reorganized = false;
+    while(!applied.empty() && (applied.back().height > tip || api.getblockhash(applied.back().height) != applied.back().hash)){
+        rollback();
+        reorganized = true;
+    }
+    /* Every journaled block was undone and the one below left the chain too, the fork is deeper than the journal and the store can not go back that far */
+    if(reorganized && applied.empty() && lastHeight != noHeight && (lastHeight > tip || api.getblockhash(lastHeight) != lastHash)){
+        throw std::runtime_error("Follow: the chain reorganized below block " + std::to_string(lastHeight) + " " + lastHash + ", deeper than the " + std::to_string(options.undoDepth) + " blocks of the undo journal, the clustering has to be rebuilt from a snapshot older than the reorg with a larger --undo-depth");
+    }
+    if(reorganized){
+        stats.reorgs++, reorgCount.add();
+        if(log) checkpoint();
+    }
+    uint32_t height = lastHeight == noHeight ? firstHeight : lastHeight + 1;
+    for(; height <= tip && !stopping; height++){
+        fetchedblock_t block;
+        block.height = height;
+        {
+            StageTimer timer(fetchSeconds, "fetch", height);
+            block.hash = api.getblockhash(height);
+            blockheader_t header = api.getblockheader(block.hash);
+            /* lastHash is the last block applied, or the one of the snapshot when none was applied since the start */
+            if(lastHeight != noHeight && lastHeight + 1 == height && !lastHash.empty() && header.previousblockhash != lastHash) return true;
+            block.reset();
+            api.getblocktransactions(block.hash, block.transactions);
+        }
+        apply(block);
+        blockDone();
+    }
+    return false;
+}
+
+/* Undoes the last block clustered, its heights are waiting to be clustered again from the new branch */
+void ChainFollower::rollback(){
+    static Counter& rolledBackCount = metrics.counter("follow_rolled_back_blocks_total", "Blocks undone by the reorganizations");
+    appliedblock_t& last = applied.back();
+    if(!last.undoable || !store.undoBlock()){
+        throw std::runtime_error("Follow: the chain reorganized at block " + std::to_string(last.height) + " which is past the undo journal, the clustering has to be rebuilt from a snapshot older than the reorg");
+    }
+    for(uint32_t address : last.outputs) reuseFrequency[address]--;
+    activity.undo(last.seen);
+    if(persistence) persistence->trackReuse(last.outputs);
+    std::cout << "Rolled back block " << last.height << " " << last.hash << std::endl;
+    stats.rolledBackBlocks++;
+    rolledBackCount.add();
+    seenAt.insert({last.height, std::chrono::steady_clock::now()});
+    lastHeight = last.height == 0 ? noHeight : last.height - 1;
+    applied.pop_back();
+    lastHash = applied.empty() ? belowHash : applied.back().hash;
+    /* Without the hash of the block below the next poll could not tell whether the fork is further down, and would cluster the new branch on a block that left the chain */
+    if(lastHeight != noHeight && lastHash.empty()){
+        throw std::runtime_error("Follow: the chain reorganized down to block " + std::to_string(lastHeight) + " whose hash is not known, the clustering has to be rebuilt from a snapshot older than the reorg");
+    }
+}
+
+/* Remembers when the heights up to the tip were first seen, for the lag. The blocks that were already there at the start count as seen at the start */
+void ChainFollower::seeTip(uint32_t tip){
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    uint32_t from = std::max<uint64_t>(startTip + 1, lastHeight == noHeight ? 0 : lastHeight + 1);
+    if(!seenAt.empty()) from = std::max(from, seenAt.rbegin()->first + 1);
+    for(uint32_t height = from; height <= tip; height++) seenAt.insert({height, now});
+    stats.tipHeight = tip;
+}
+
+uint32_t ChainFollower::getTipHeight(){
+    return stats.tipHeight;
+}
+
+followstats_t ChainFollower::getStats(){
+    followstats_t current = stats;
+    current.clusteredHeight = lastHeight;
+    uint32_t next = lastHeight == noHeight ? 0 : lastHeight + 1;
+    current.lagBlocks = stats.tipHeight >= next ? stats.tipHeight - next + 1 : 0;
+    auto oldest = seenAt.lower_bound(next);
+    if(current.lagBlocks == 0) current.lagSeconds = 0;
+    else if(next <= startTip) current.lagSeconds = secondsSince(startedAt);
+    else current.lagSeconds = oldest != seenAt.end() ? secondsSince(oldest->second) : 0;
+    return current;
+}
+
+void ChainFollower::printStats(std::ostream& out){
+    followstats_t current = getStats();
+    out << "Follow: tip " << current.tipHeight << ", clustered " << (current.clusteredHeight == noHeight ? std::string("none") : std::to_string(current.clusteredHeight))
+        << ", lag " << current.lagBlocks << " blocks (" << current.lagSeconds << " s), last block clustered " << current.lastLatencySeconds * 1000 << " ms after it was seen, "
+        << current.reorgs << " reorgs (" << current.rolledBackBlocks << " blocks rolled back), undo journal " << store.undoableBlocks() << " blocks "
+        << store.journalMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+}
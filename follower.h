@@ -0,0 +1,77 @@
+#ifndef FOLLOWER_H
+#define FOLLOWER_H
+
+#include <map>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <functional>
+
+#include "api.h"
+#include "options.h"
+#include "activity.h"
+#include "heuristics.h"
+#include "persistence.h"
+#include "blocksource.h"
+#include "mergelog.h"
+
+/* How far the clustering is behind the daemon. The lag in seconds is how long the oldest block that is not clustered yet has been known, the latency is the same for the last block clustered */
+struct followstats_t{
+    uint32_t tipHeight = 0;
+    uint64_t clusteredHeight = 0;
+    uint32_t lagBlocks = 0;
+    double lagSeconds = 0;
+    double lastLatencySeconds = 0;
+    uint64_t reorgs = 0;
+    uint64_t rolledBackBlocks = 0;
+};
+
+/* Keeps the clustering on the tip of the daemon's chain. The new blocks are found by polling, every one is checked to extend the last block clustered and is clustered with a journal of what it changed in the store, in the reuse counts and in the totals of the addresses. When the chain reorganizes the blocks that left it are undone newest first, then the blocks of the new branch are clustered. Only the last undoDepth blocks can be undone, a deeper reorg stops the run. So does a reorg of the last block of the snapshot while the process was stopped, it is found by the hash the snapshot kept */
+class ChainFollower{
+    public:
+    ChainFollower(options_t& options, EntityStore& store, Heuristics& heuristics, MappedColumn<int>& reuseFrequency, AddressActivity& activity, Persistence* persistence, uint64_t& lastHeight, std::string& lastHash);
+    /* Every block clustered is appended to the log. The log cannot undo a block, so a reorg is checkpointed as soon as its blocks are rolled back */
+    void setLog(MergeLog* log);
+    void apply(fetchedblock_t& block);
+    void run(uint32_t firstHeight, std::function<void()> blockDone, std::function<void()> checkpoint);
+    void stop();
+    uint32_t getTipHeight();
+    followstats_t getStats();
+    void printStats(std::ostream& out);
+    private:
+    struct appliedblock_t{
+        uint32_t height;
+        std::string hash;
+        bool undoable;
+        /* Address of every output, their reuse counts go down again when the block is undone */
+        std::vector<uint32_t> outputs;
+        /* Heights of the addresses before the block */
+        std::vector<activityundo_t> seen;
+    };
+    options_t options;
+    EntityStore& store;
+    Heuristics& heuristics;
+    MappedColumn<int>& reuseFrequency;
+    AddressActivity& activity;
+    Persistence* persistence;
+    uint64_t& lastHeight;
+    std::string& lastHash;
+    MergeLog* log;
+    API api;
+    std::atomic<bool> stopping;
+    /* The last blocks clustered, oldest first, and the hash of the block just below the oldest. A reorg that undoes all of them is checked against it, the fork may be further down */
+    std::deque<appliedblock_t> applied;
+    std::string belowHash;
+    /* When each height past the tip at the start and not clustered yet was first seen on the daemon */
+    std::chrono::steady_clock::time_point startedAt;
+    uint32_t startTip;
+    std::map<uint32_t, std::chrono::steady_clock::time_point> seenAt;
+    followstats_t stats;
+
+    bool poll(uint32_t firstHeight, std::function<void()>& blockDone, std::function<void()>& checkpoint);
+    void rollback();
+    void seeTip(uint32_t tip);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "hash.h"
+
+#include <cstring>
+
+static inline uint32_t readBE32(const unsigned char *p){
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static inline void writeBE32(unsigned char *p, uint32_t v){
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline uint32_t readLE32(const unsigned char *p){
+    return (uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 | (uint32_t) p[1] << 8 | p[0];
+}
+
+static inline void writeLE32(unsigned char *p, uint32_t v){
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline uint32_t rotr(uint32_t x, int n){
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t rotl(uint32_t x, int n){
+    return (x << n) | (x >> (32 - n));
+}
+
+/* SHA-256, FIPS 180-4 */
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256Transform(uint32_t state[8], const unsigned char block[64]){
+    uint32_t w[64];
+    for(int i = 0; i < 16; i++) w[i] = readBE32(block + 4 * i);
+    for(int i = 16; i < 64; i++){
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for(int i = 0; i < 64; i++){
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+Sha256::Sha256() : bytes(0)
+{
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    std::memcpy(state, initial, sizeof(state));
+}
+
+Sha256& Sha256::write(const unsigned char *data, size_t len){
+    size_t used = bytes % 64;
+    bytes += len;
+    if(used > 0){
+        size_t take = len < 64 - used ? len : 64 - used;
+        std::memcpy(buffer + used, data, take);
+        data += take;
+        len -= take;
+        if(used + take < 64) return *this;
+        sha256Transform(state, buffer);
+    }
+    for(; len >= 64; data += 64, len -= 64) sha256Transform(state, data);
+    if(len > 0) std::memcpy(buffer, data, len);
+    return *this;
+}
+
+void Sha256::finalize(unsigned char out[32]){
+    static const unsigned char padding[64] = {0x80};
+    unsigned char length[8];
+    uint64_t bits = bytes * 8;
+    writeBE32(length, bits >> 32);
+    writeBE32(length + 4, (uint32_t) bits);
+    write(padding, 1 + ((119 - (bytes % 64)) % 64));
+    write(length, 8);
+    for(int i = 0; i < 8; i++) writeBE32(out + 4 * i, state[i]);
+}
+
+/* RIPEMD-160, the two parallel lines of Dobbertin, Bosselaers and Preneel */
+
+template<int round> static inline uint32_t ripemdF(uint32_t x, uint32_t y, uint32_t z){
+    switch(round){
+        case 0: return x ^ y ^ z;
+        case 1: return (x & y) | (~x & z);
+        case 2: return (x | ~y) ^ z;
+        case 3: return (x & z) | (y & ~z);
+        default: return x ^ (y | ~z);
+    }
+}
+
+/* One round of sixteen steps on both lines, the round is a template argument so that the boolean function is picked at compile time */
+template<int round> static inline void ripemdRound(uint32_t left[5], uint32_t right[5], const uint32_t x[16], const int* leftWord, const int* rightWord, const int* leftShift, const int* rightShift, uint32_t leftK, uint32_t rightK){
+    uint32_t al = left[0], bl = left[1], cl = left[2], dl = left[3], el = left[4];
+    uint32_t ar = right[0], br = right[1], cr = right[2], dr = right[3], er = right[4];
+    for(int j = 16 * round; j < 16 * round + 16; j++){
+        uint32_t t = rotl(al + ripemdF<round>(bl, cl, dl) + x[leftWord[j]] + leftK, leftShift[j]) + el;
+        al = el; el = dl; dl = rotl(cl, 10); cl = bl; bl = t;
+        t = rotl(ar + ripemdF<4 - round>(br, cr, dr) + x[rightWord[j]] + rightK, rightShift[j]) + er;
+        ar = er; er = dr; dr = rotl(cr, 10); cr = br; br = t;
+    }
+    left[0] = al; left[1] = bl; left[2] = cl; left[3] = dl; left[4] = el;
+    right[0] = ar; right[1] = br; right[2] = cr; right[3] = dr; right[4] = er;
+}
+
+static void ripemd160Transform(uint32_t state[5], const unsigned char block[64]){
+    static const int leftWord[80] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8,
+        3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12,
+        1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2,
+        4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13};
+    static const int rightWord[80] = {
+        5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12,
+        6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2,
+        15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13,
+        8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14,
+        12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11};
+    static const int leftShift[80] = {
+        11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8,
+        7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12,
+        11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5,
+        11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12,
+        9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6};
+    static const int rightShift[80] = {
+        8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6,
+        9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11,
+        9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5,
+        15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8,
+        8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11};
+    static const uint32_t leftK[5] = {0x00000000, 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xa953fd4e};
+    static const uint32_t rightK[5] = {0x50a28be6, 0x5c4dd124, 0x6d703ef3, 0x7a6d76e9, 0x00000000};
+
+    uint32_t x[16];
+    for(int i = 0; i < 16; i++) x[i] = readLE32(block + 4 * i);
+    uint32_t l[5] = {state[0], state[1], state[2], state[3], state[4]};
+    uint32_t r[5] = {state[0], state[1], state[2], state[3], state[4]};
+    ripemdRound<0>(l, r, x, leftWord, rightWord, leftShift, rightShift, leftK[0], rightK[0]);
+    ripemdRound<1>(l, r, x, leftWord, rightWord, leftShift, rightShift, leftK[1], rightK[1]);
+    ripemdRound<2>(l, r, x, leftWord, rightWord, leftShift, rightShift, leftK[2], rightK[2]);
+    ripemdRound<3>(l, r, x, leftWord, rightWord, leftShift, rightShift, leftK[3], rightK[3]);
+    ripemdRound<4>(l, r, x, leftWord, rightWord, leftShift, rightShift, leftK[4], rightK[4]);
+    uint32_t t = state[1] + l[2] + r[3];
+    state[1] = state[2] + l[3] + r[4];
+    state[2] = state[3] + l[4] + r[0];
+    state[3] = state[4] + l[0] + r[1];
+    state[4] = state[0] + l[1] + r[2];
+    state[0] = t;
+}
+
+void ripemd160(const unsigned char *data, size_t len, unsigned char out[20]){
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    size_t left = len;
+    for(; left >= 64; data += 64, left -= 64) ripemd160Transform(state, data);
+    /* The tail, the 0x80 marker and the bit length take one or two more blocks */
+    unsigned char tail[128] = {0};
+    std::memcpy(tail, data, left);
+    tail[left] = 0x80;
+    size_t tailLen = left + 9 <= 64 ? 64 : 128;
+    uint64_t bits = (uint64_t) len * 8;
+    writeLE32(tail + tailLen - 8, (uint32_t) bits);
+    writeLE32(tail + tailLen - 4, bits >> 32);
+    ripemd160Transform(state, tail);
+    if(tailLen == 128) ripemd160Transform(state, tail + 64);
+    for(int i = 0; i < 5; i++) writeLE32(out + 4 * i, state[i]);
+}
@@ -0,0 +1,22 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* SHA-256 and RIPEMD-160 written out for the short inputs of the address derivation, everything stays on the stack and there is none of the context allocation and algorithm lookup the OpenSSL EVP interface does on every call */
+
+class Sha256{
+    public:
+    Sha256();
+    Sha256& write(const unsigned char *data, size_t len);
+    void finalize(unsigned char out[32]);
+    private:
+    uint32_t state[8];
+    unsigned char buffer[64];
+    uint64_t bytes;
+};
+
+void ripemd160(const unsigned char *data, size_t len, unsigned char out[20]);
+
+#endif
@@ -1,155 +1,145 @@
 #include <algorithm>
-#include <thread>
-#include <mutex>
+#include <unistd.h>
 
 #include "heuristics.h"
+#include "addresstable.h"
 
+/* Transactions are handed to the workers in chunks of this many, every chunk collects its proposals on its own */
+static const size_t transactionsPerChunk = 64;
 
-std::mutex key;
-
+Heuristics::Heuristics(int workers)
+: pool(workers), evaluator(&evaluateChunk<DefaultHeuristics>), enabled(DefaultHeuristics::mask), blocks(metrics.counter("blocks_total", "Blocks clustered")), transactions(metrics.counter("transactions_total", "Transactions clustered")),
+  inputs(metrics.counter("inputs_total", "Inputs of the transactions clustered")), outputs(metrics.counter("outputs_total", "Outputs of the transactions clustered")),
+  evaluateSeconds(metrics.histogram("heuristics_evaluate_seconds", "Evaluation of the heuristics of a block into proposals")),
+  mergeSeconds(metrics.histogram("heuristics_merge_seconds", "Application of the proposals of a block to the store"))
+{
+    for(int h = 0; h <= 5; h++){
+        std::string label = "heuristic=\"H" + std::to_string(h) + "\"";
+        proposed.push_back(h == 0 ? nullptr : &metrics.counter("proposals_total", "Merges proposed by each heuristic", label));
+        merged.push_back(h == 0 ? nullptr : &metrics.counter("merges_total", "Proposals that joined two sets, by heuristic", label));
+    }
+}
 
-void Heuristics::runHeuristics(std::unordered_map<uint64_t,Entity>& entities, std::vector<getrawtransaction_t>& blockTransactions, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<std::string, int> &reuseFrequency){
+/* The block is clustered in two phases: the heuristics of every transaction are evaluated in parallel into proposals, then the proposals are applied one after the other in transaction order. The store only sees the same sequence of merges whatever the number of threads, so the entities and their IDs are the same in every run */
+void Heuristics::runHeuristics(EntityStore& store, transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency){
+    /* The reuse counts are indexed by address ID, every address of the block is interned by now so one resize covers them all */
+    if(reuseFrequency.size() < addressTable.size()) reuseFrequency.resize(addressTable.size(), 0);
+    if(store.isMapped() || reuseFrequency.mapped()) prefetch(store, blockTransactions, reuseFrequency);
+    /* Iterates through each transaction output and stores the output reused frequency, the whole block is counted before the heuristics read the counts */
     for(getrawtransaction_t& transaction : blockTransactions){
-        /* Iterates through each transaction output and stores the output reused frequency, once this is computed it is used for the heuristic */
         for(vout_t& out : transaction.vout){
-            /* Even though this is a vector it contains only one address, used vector for convention, therefore accessing just addresses[0] */
-            reuseFrequency[out.scriptPubKey.addresses[0]]++;
-        }
-        /*HEURISTICS 5*/
-        /* If the transaction is a coinbase transaction we merge the outputs, since the output is managed by a single miner */
-        if(transaction.vin[0].isCoinbase == true){
-            coinbaseOutput(transaction, entities, walletToEntity);
-            continue;
-        }
-        /*HEURISTICS 1*/
-        commonInputOwnershipHeuritics(transaction, entities, walletToEntity);
-        /* Using threads for the following two functions*/
-        /*HEURISTICS 2 and 4*/
-        std::thread changeAddressThread(&Heuristics::changeAddressHeuristics, this, std::ref(transaction), std::ref(entities), std::ref(walletToEntity), std::ref(reuseFrequency));
-        /*HEURISTICS 3*/
-        std::thread scriptChainThread(&Heuristics::scriptChainMergeHeuristics, this, std::ref(transaction), std::ref(entities), std::ref(walletToEntity), std::ref(reuseFrequency));
-
-        changeAddressThread.join();
-        scriptChainThread.join();
-}
-}
-
-void Heuristics::commonInputOwnershipHeuritics(getrawtransaction_t& transaction, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity){
-    std::vector<uint64_t> entitiesToMerge;
-    std::vector<std::string> walletaddresses;
-    /* Get all the input addresses and check if any of them is part of any other entity, if so then we should merge the current addresses with the already existing entity where it belongs, else we can create a new entity for the inputs*/
-    for(vin_t& in : transaction.vin){
-        std::string walletaddress = in.scriptSig.address;
-        auto it = walletToEntity.find(walletaddress);
-        if (it != walletToEntity.end()) {
-            entitiesToMerge.push_back(it->second);
+            /* Even though this is a vector it contains only one address, used vector for convention, therefore accessing just addresses[0]. A data carrier has none */
+            if(!out.unspendable) reuseFrequency[out.scriptPubKey.addresses[0]]++;
         }
-        walletaddresses.emplace_back(walletaddress); 
     }
-    uint64_t entityIndex; // the entity index, walletToEntity mapping are assigned for the current input wallets
-    /* Updating the mapping in walletToEntity and changing the id in entity, if there are entities to merge */
-    if(entitiesToMerge.size() != 0){
-        /* Getting the first minimum entity id and merging all the addresses into it, the reason we do this is because, the current input addresses can match with multiple various entities and all of these entities must be made into one, we choose the entity with the minimum id as the candidate */
-        std::sort(entitiesToMerge.begin(),entitiesToMerge.end());
-        entityIndex = entitiesToMerge[0];
-        uint64_t entitiesToMergeSize = entitiesToMerge.size();
-        /* add the wallets from the other entities to which the current inputs match with to the minimum entity id and delete the entity */
-        for(uint64_t i = 1; i < entitiesToMergeSize; i++){
-            for(auto wallet: entities[entitiesToMerge[i]].wallets){
-                walletaddresses.emplace_back(wallet);
-            }
-            /* Push the deleted id's to the freeID vector which is used during creation of newer entity*/
-            Entity::pushToFreeID(entitiesToMerge[i]);
-            entities.erase(entitiesToMerge[i]);
-        }
-        /* No new entity is created, added to the existing entity*/
-        for(std::string& s : walletaddresses) {
-            entities[entityIndex].addWallet(s);
-            walletToEntity[s] = entityIndex;
-        }
-    }
-    else{/* If the input wallets do not belong to any other entity then we create a new entity */
-        Entity entity;
-        entityIndex = entity.getId();
-        for(std::string& s : walletaddresses) {
-            entity.addWallet(s);
-            walletToEntity[s] = entityIndex;
-        }
-        entities.insert({entityIndex,entity});
+
+    size_t chunks = evaluateBlock(blockTransactions, reuseFrequency);
+    StageTimer timer(mergeSeconds, "merge");
+    uint64_t mergedBy[6] = {0};
+    for(size_t chunk = 0; chunk < chunks; chunk++){
+        std::vector<proposal_t>& proposals = chunkProposals[chunk];
+        apply(store, proposals.data(), proposals.data() + proposals.size(), mergedBy);
     }
+    for(int h = 1; h <= 5; h++) if(mergedBy[h]) merged[h]->add(mergedBy[h]);
 }
 
-void Heuristics::changeAddressHeuristics(getrawtransaction_t& transaction,std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<std::string, int> &reuseFrequency){
-    /*HEURISTICS 4*/
-    /* If there is only one output then we can just merge this output with the inputs, since its likely that sender is depositing all the funds from his wallets to a new wallet */
-    if(transaction.vout.size() == 1){
-        uint64_t entityId = walletToEntity[transaction.vin[0].scriptSig.address];
-        if(key.try_lock()){
-        entities[entityId].addWallet(transaction.vout[0].scriptPubKey.addresses[0]);
-        walletToEntity[transaction.vout[0].scriptPubKey.addresses[0]] = entityId;
-        key.unlock();
-        }
-        return;
-    }
-    if(transaction.vout.size() != 2) return;
-    /*HEURISTICS 2*/
-    std::string address1 = transaction.vout[0].scriptPubKey.addresses[0];
-    std::string address2 = transaction.vout[1].scriptPubKey.addresses[0];
-    /* Check if one of the two wallets is not reused and the other is reused, if reuseFrequency is 1 then it means this is the only transaction where the wallet is used and therefore not used*/
-    if((reuseFrequency[address1] != 1 && reuseFrequency[address2] < 1) || (reuseFrequency[address1] < 1 && reuseFrequency[address2] != 1)) return;
-    /* If this is the case then merge the input and the change wallet*/
-    std::string inputaddress;
-    inputaddress = transaction.vin[0].scriptSig.address;
-    /* Check if input address is in any of the output addressses, if that is the case then break out since the input address is the change address and our heuristics will likely consider the payment address, if its not reused, as change address leading to false positives*/
-    if(inputaddress == address1 || inputaddress == address2) return;
-    std::string address = reuseFrequency[address1] == 1 ? address1 : address2;
-    uint64_t entityId = walletToEntity[inputaddress];
-    if(key.try_lock()){
-    entities[entityId].addWallet(address);
-    walletToEntity[address] = entityId;
-    key.unlock();
+/* With the state on disk the pages of the block's addresses are asked for all at once in address order, the kernel reads them while the block is evaluated instead of one fault at a time. A state that fits in half the memory stays in the page cache once read, there the sort and the calls would only cost time */
+void Heuristics::prefetch(EntityStore& store, transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency){
+    static const double memoryBytes = (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    if(store.mappedBytes() + reuseFrequency.mappedBytes() < memoryBytes / 2) return;
+    prefetched.clear();
+    for(getrawtransaction_t& transaction : blockTransactions){
+        for(vin_t& in : transaction.vin) prefetched.push_back(in.scriptSig.address);
+        for(vout_t& out : transaction.vout) if(!out.unspendable) prefetched.push_back(out.scriptPubKey.addresses[0]);
     }
+    std::sort(prefetched.begin(), prefetched.end());
+    prefetched.erase(std::unique(prefetched.begin(), prefetched.end()), prefetched.end());
+    store.prefetch(prefetched);
+    reuseFrequency.prefetch(prefetched);
+}
+
+void Heuristics::proposeBlock(transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency, std::vector<proposal_t>& proposals){
+    size_t chunks = evaluateBlock(blockTransactions, reuseFrequency);
+    for(size_t chunk = 0; chunk < chunks; chunk++) proposals.insert(proposals.end(), chunkProposals[chunk].begin(), chunkProposals[chunk].end());
+}
+
+void Heuristics::blockProposals(std::vector<proposal_t>& proposals) const{
+    for(size_t chunk = 0; chunk < blockChunks; chunk++) proposals.insert(proposals.end(), chunkProposals[chunk].begin(), chunkProposals[chunk].end());
+}
+
+void Heuristics::applyProposals(EntityStore& store, const std::vector<proposal_t>& proposals){
+    applyProposals(store, proposals.data(), proposals.data() + proposals.size());
 }
 
-void Heuristics::scriptChainMergeHeuristics(getrawtransaction_t& transaction, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<std::string, int> &reuseFrequency){
-    if(transaction.vin.size() < 2 || transaction.vout.size() != 2) return;
-    /* Process the inputs, that is get the inputs */
-    std::vector<std::string> inputaddresses;
-    for(vin_t& in : transaction.vin){
-        inputaddresses.emplace_back(in.scriptSig.address);
+void Heuristics::applyProposals(EntityStore& store, const proposal_t* begin, const proposal_t* end){
+    StageTimer timer(mergeSeconds, "merge");
+    uint64_t mergedBy[6] = {0};
+    apply(store, begin, end, mergedBy);
+    for(int h = 1; h <= 5; h++) if(mergedBy[h]) merged[h]->add(mergedBy[h]);
+}
+
+/* Evaluates every transaction of the block into chunkProposals and returns the number of chunks used */
+size_t Heuristics::evaluateBlock(transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency){
+    uint64_t inputCount = 0, outputCount = 0;
+    for(getrawtransaction_t& transaction : blockTransactions) inputCount += transaction.vin.size(), outputCount += transaction.vout.size();
+    blocks.add();
+    transactions.add(blockTransactions.size());
+    inputs.add(inputCount);
+    outputs.add(outputCount);
+    size_t chunks = (blockTransactions.size() + transactionsPerChunk - 1) / transactionsPerChunk;
+    if(chunkProposals.size() < chunks) chunkProposals.resize(chunks), chunkFeatures.resize(chunks);
+    {
+        StageTimer timer(evaluateSeconds, "evaluate");
+        evaluation_t evaluation = {&blockTransactions, reuseIndex, &reuseFrequency, enabled};
+        pool.parallelFor(blockTransactions.size(), transactionsPerChunk, [&](size_t chunk, size_t begin, size_t end){
+            std::vector<proposal_t>& proposals = chunkProposals[chunk];
+            proposals.clear();
+            evaluator(evaluation, begin, end, chunkFeatures[chunk], proposals);
+        });
     }
-    /* Process the output, that is find which one is the change and which one is the payment, minimum is the change */
-    std::pair<std::string,std::string> paymentWalletChangeWalletPair;
-    if (transaction.vout[0].value > transaction.vout[1].value) {
-        paymentWalletChangeWalletPair = {transaction.vout[0].scriptPubKey.addresses[0], transaction.vout[1].scriptPubKey.addresses[0]};
-    } 
-    else {
-        paymentWalletChangeWalletPair = {transaction.vout[1].scriptPubKey.addresses[0], transaction.vout[0].scriptPubKey.addresses[0]};
+    uint64_t proposedBy[6] = {0};
+    for(size_t chunk = 0; chunk < chunks; chunk++){
+        for(proposal_t& proposal : chunkProposals[chunk]) if(proposal.wallet2 != proposal_t::ensureOnly) proposedBy[proposal.heuristic]++;
     }
-    /* Now we check if ΣVin- min(Vin) < Vmax, this condition suggests that the user tried to minimize the total value, that is used his combined funds from change wallets to make the transaction*/
-    uint64_t inMin = transaction.vin[0].value , outMax = transaction.vout[0].value;
-    uint64_t inSize = transaction.vin.size(), outSize = transaction.vout.size();
-    long long sum = transaction.vin[0].value;
-    for(uint32_t i = 1; i < inSize; i++)  if(transaction.vin[i].value < inMin) inMin = transaction.vin[i].value, sum += transaction.vin[i].value;
-    for(uint32_t i = 1; i < outSize; i++) if(transaction.vout[i].value > outMax) outMax = transaction.vout[i].value;
-    if(sum - inMin > outMax) return;
-    /* Get the id of any of the input wallets, we consider any because by common input heuristics all the inputs belong to one user */
-    int entityId = walletToEntity[inputaddresses[0]];
-    if(key.try_lock()){
-    entities[entityId].addWallet(paymentWalletChangeWalletPair.second);
-    walletToEntity[paymentWalletChangeWalletPair.second] = entityId;
-    key.unlock();
+    for(int h = 1; h <= 5; h++) if(proposedBy[h]) proposed[h]->add(proposedBy[h]);
+    blockChunks = chunks;
+    return chunks;
+}
+
+void Heuristics::apply(EntityStore& store, const proposal_t* begin, const proposal_t* end, uint64_t* mergedBy){
+    for(const proposal_t* proposal = begin; proposal != end; proposal++){
+        if(proposal->wallet2 == proposal_t::ensureOnly) store.ensureEntity(proposal->wallet1);
+        else if(store.unite(proposal->wallet1, proposal->wallet2)) mergedBy[proposal->heuristic]++;
     }
 }
 
-void Heuristics::coinbaseOutput(getrawtransaction_t &transaction, std::unordered_map<uint64_t, Entity> &entities, std::unordered_map<std::string, uint64_t> &walletToEntity)
-{
-    /* Merge the outputs and create one entity*/
-    Entity entity;
-    uint64_t entityIndex = entity.getId();
-    for(auto& output : transaction.vout){
-        entity.addWallet(output.scriptPubKey.addresses[0]);
-        walletToEntity[output.scriptPubKey.addresses[0]] = entityIndex;
+void Heuristics::setReuseIndex(const ReuseIndex* index){
+    reuseIndex = index;
+}
+
+void Heuristics::setEnabled(uint32_t mask, bool compiled){
+    enabled = mask;
+    evaluator = compiled && mask == DefaultHeuristics::mask ? &evaluateChunk<DefaultHeuristics> : &evaluateChunk<RuntimeHeuristicSet>;
+}
+
+uint32_t Heuristics::getEnabled() const{
+    return enabled;
+}
+
+void Heuristics::useSetOf(const Heuristics& other){
+    evaluator = other.evaluator;
+    enabled = other.enabled;
+}
+
+bool Heuristics::parseSet(const std::string& list, uint32_t& mask){
+    mask = 0;
+    size_t pos = 0;
+    while(pos <= list.size()){
+        size_t end = std::min(list.find(',', pos), list.size());
+        std::string item = list.substr(pos, end - pos);
+        if(item.size() != 1 || item[0] < '1' || item[0] > '5') return false;
+        mask |= 1u << (item[0] - '0');
+        pos = end + 1;
     }
-    entities.insert({entityIndex,entity});
+    return true;
 }
@@ -3,16 +3,60 @@
 
 #include <unordered_map>
 #include "api.h"
-#include "entity.h"
+#include "entitystore.h"
+#include "reuseindex.h"
+#include "workerpool.h"
+#include "metrics.h"
+#include "heuristicset.h"
 
+/* Runs a set of heuristics over the blocks, see heuristicset.h. Every heuristic is on by default and runs from DefaultHeuristics, compiled in. Another set is either compiled in with compose or picked at run time with setEnabled, a mask the default set does not match then runs through RuntimeHeuristicSet */
 class Heuristics{
     public:
-    void runHeuristics(std::unordered_map<uint64_t,Entity>& entities, std::vector<getrawtransaction_t>& blockTransactions, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<std::string, int> &reuseFrequency);
+    Heuristics(int workers = 1);
+    void runHeuristics(EntityStore& store, transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency);
+    /* The two halves of runHeuristics for a caller that applies the proposals later. proposeBlock appends the proposals of the block in transaction order and leaves the reuse counts alone, they must already hold the block or a reuse index must be set */
+    void proposeBlock(transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency, std::vector<proposal_t>& proposals);
+    void applyProposals(EntityStore& store, const std::vector<proposal_t>& proposals);
+    void applyProposals(EntityStore& store, const proposal_t* begin, const proposal_t* end);
+    /* Appends the proposals of the block evaluated last, in the order they were applied, for the write-ahead log */
+    void blockProposals(std::vector<proposal_t>& proposals) const;
+    /* When an index built over the whole range is given, the change heuristic asks it whether an address is ever reused instead of looking at the counts so far */
+    void setReuseIndex(const ReuseIndex* index);
+    /* The heuristics with bit ID set in mask, from the compiled default set when it is all of them unless compiled is false */
+    void setEnabled(uint32_t mask, bool compiled = true);
+    uint32_t getEnabled() const;
+    /* Runs the heuristics given, in that order, with the calls inlined */
+    template<typename... Policies> void compose(){
+        evaluator = &evaluateChunk<HeuristicPipeline<Policies...> >;
+        enabled = HeuristicPipeline<Policies...>::mask;
+    }
+    /* Runs the same set as other */
+    void useSetOf(const Heuristics& other);
+    /* The mask of a list of heuristic IDs such as 1,2,3, false when it is not one */
+    static bool parseSet(const std::string& list, uint32_t& mask);
     private:
-    void commonInputOwnershipHeuritics(getrawtransaction_t& transaction, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity);
-    void changeAddressHeuristics(getrawtransaction_t& transaction, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<std::string, int> &reuseFrequency);
-    void scriptChainMergeHeuristics(getrawtransaction_t& transaction, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<std::string, int> &reuseFrequency);
-    void coinbaseOutput(getrawtransaction_t& transaction, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,uint64_t>& walletToEntity);
+    const ReuseIndex* reuseIndex = nullptr;
+    WorkerPool pool;
+    chunkevaluator_t evaluator;
+    uint32_t enabled;
+    /* The proposals and the features of each chunk of transactions, kept between blocks so their memory is reused */
+    std::vector<std::vector<proposal_t> > chunkProposals;
+    std::vector<FeatureBuilder> chunkFeatures;
+    size_t blockChunks = 0;
+    /* The addresses of the block whose pages are read ahead, kept for the same reason */
+    std::vector<uint32_t> prefetched;
+    /* Counted per block, the merges are the proposals that joined two different sets, by heuristic */
+    Counter& blocks;
+    Counter& transactions;
+    Counter& inputs;
+    Counter& outputs;
+    Histogram& evaluateSeconds;
+    Histogram& mergeSeconds;
+    std::vector<Counter*> proposed;
+    std::vector<Counter*> merged;
+    size_t evaluateBlock(transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency);
+    void prefetch(EntityStore& store, transactions_t& blockTransactions, MappedColumn<int> &reuseFrequency);
+    void apply(EntityStore& store, const proposal_t* begin, const proposal_t* end, uint64_t* mergedBy);
 };
 
-#endif
\ No newline at end of file
+#endif
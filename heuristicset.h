@@ -0,0 +1,214 @@
+#ifndef HEURISTICSET_H
+#define HEURISTICSET_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "api.h"
+#include "reuseindex.h"
+#include "mappedcolumn.h"
+
+/* A merge found by a heuristic, the heuristics only look at the transaction and the reuse counts so they can run on any thread, the proposals are applied to the store afterwards in transaction order. When wallet2 is ensureOnly the proposal only gives the set of wallet1 an entity. The heuristic is its ID, 1 to 5, for the metrics */
+struct proposal_t{
+    static const uint32_t ensureOnly = UINT32_MAX;
+    uint32_t wallet1;
+    uint32_t wallet2;
+    uint8_t heuristic;
+};
+
+/* What the heuristics look at in a transaction, gathered once into flat arrays so that every heuristic reads the same facts instead of walking vin and vout again. A coinbase has no inputs. Every output of the transaction is there so that its shape is the real one, a data carrier has dataCarrier for its address and a reuse of 0, it is never proposed. The reuse of the outputs is 0, 1 or ReuseIndex::many and is only filled when a heuristic of the set asks for it. The arrays belong to the FeatureBuilder that filled them and hold until its next transaction */
+struct txfeatures_t{
+    static const uint32_t dataCarrier = UINT32_MAX;
+    bool coinbase;
+    uint32_t inputCount;
+    uint32_t outputCount;
+    const uint32_t* inputs;
+    const uint32_t* outputs;
+    const int64_t* inputValues;
+    const int64_t* outputValues;
+    const uint8_t* outputReuse;
+};
+
+/* Fills the features of one transaction after the other, the arrays are kept so their memory is reused */
+class FeatureBuilder{
+    public:
+    /* The reuse comes from the index when there is one, from the counts so far otherwise */
+    void build(getrawtransaction_t& transaction, bool withReuse, const ReuseIndex* reuseIndex, MappedColumn<int>& reuseFrequency, txfeatures_t& features){
+        inputs.clear();
+        inputValues.clear();
+        outputs.clear();
+        outputValues.clear();
+        features.coinbase = transaction.vin[0].isCoinbase;
+        if(!features.coinbase){
+            for(vin_t& in : transaction.vin) inputs.push_back(in.scriptSig.address), inputValues.push_back(in.value);
+        }
+        const uint32_t dataCarrier = txfeatures_t::dataCarrier;
+        for(vout_t& out : transaction.vout){
+            if(out.unspendable) outputs.push_back(dataCarrier);
+            else outputs.push_back(out.scriptPubKey.addresses[0]);
+            outputValues.push_back(out.value);
+        }
+        if(withReuse){
+            reuse.resize(outputs.size());
+            for(size_t i = 0; i < outputs.size(); i++){
+                if(outputs[i] == dataCarrier) reuse[i] = 0;
+                else reuse[i] = reuseIndex ? reuseIndex->count(outputs[i]) : std::min(reuseFrequency[outputs[i]], (int) ReuseIndex::many);
+            }
+        }
+        features.inputCount = inputs.size();
+        features.outputCount = outputs.size();
+        features.inputs = inputs.data();
+        features.outputs = outputs.data();
+        features.inputValues = inputValues.data();
+        features.outputValues = outputValues.data();
+        features.outputReuse = withReuse ? reuse.data() : nullptr;
+    }
+    private:
+    std::vector<uint32_t> inputs;
+    std::vector<uint32_t> outputs;
+    std::vector<int64_t> inputValues;
+    std::vector<int64_t> outputValues;
+    std::vector<uint8_t> reuse;
+};
+
+/* The heuristics as policies: an ID, whether it reads the reuse of the outputs and a propose that appends its merges for one transaction. Any struct of that shape can go in a HeuristicPipeline. Every heuristic gives the set it merged into an entity itself, with H1 left out of the set nothing else would and the set would be lost to the snapshot and the database */
+
+/* HEURISTICS 1: all the input addresses are put in the same set, if any of them is already part of an entity the entities are merged along the way and the one with the minimum id is kept, the others go back to the free ids. If none of them belonged to an entity a new one is created for the inputs */
+struct CommonInputHeuristic{
+    static const uint8_t id = 1;
+    static const bool usesReuse = false;
+    static void propose(const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        if(tx.coinbase) return;
+        uint32_t firstaddress = tx.inputs[0];
+        for(uint32_t i = 0; i < tx.inputCount; i++) proposals.push_back({firstaddress, tx.inputs[i], id});
+        proposals.push_back({firstaddress, proposal_t::ensureOnly, id});
+    }
+};
+
+/* HEURISTICS 2: of two outputs, when one of them is used only here and the other is reused, the one used only here is the change and is merged with the inputs. Two reused outputs or two new ones tell nothing */
+struct ChangeAddressHeuristic{
+    static const uint8_t id = 2;
+    static const bool usesReuse = true;
+    static void propose(const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        if(tx.coinbase || tx.outputCount != 2) return;
+        uint32_t address1 = tx.outputs[0], address2 = tx.outputs[1];
+        /* A data carrier is neither the payment nor the change, the other output is not told apart by it */
+        if(address1 == txfeatures_t::dataCarrier || address2 == txfeatures_t::dataCarrier) return;
+        uint8_t reuse1 = tx.outputReuse[0], reuse2 = tx.outputReuse[1];
+        /* Check that exactly one of the two wallets is not reused and the other is reused, if reuseFrequency is 1 then it means this is the only transaction where the wallet is used and therefore not used. Every output is counted by now so no count is below 1 */
+        bool change1 = reuse1 == 1 && reuse2 >= ReuseIndex::many, change2 = reuse2 == 1 && reuse1 >= ReuseIndex::many;
+        if(!change1 && !change2) return;
+        uint32_t inputaddress = tx.inputs[0];
+        /* Check if input address is in any of the output addressses, if that is the case then break out since the input address is the change address and our heuristics will likely consider the payment address, if its not reused, as change address leading to false positives*/
+        if(inputaddress == address1 || inputaddress == address2) return;
+        proposals.push_back({inputaddress, change1 ? address1 : address2, id});
+        proposals.push_back({inputaddress, proposal_t::ensureOnly, id});
+    }
+};
+
+/* HEURISTICS 3: with several inputs and two outputs, when ΣVin - min(Vin) < Vmax the user tried to minimize the total value, that is used his combined funds from change wallets to make the transaction, the smaller output is the change */
+struct ScriptChainHeuristic{
+    static const uint8_t id = 3;
+    static const bool usesReuse = false;
+    static void propose(const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        if(tx.coinbase || tx.inputCount < 2 || tx.outputCount != 2) return;
+        if(tx.outputs[0] == txfeatures_t::dataCarrier || tx.outputs[1] == txfeatures_t::dataCarrier) return;
+        /* Process the output, that is find which one is the change and which one is the payment, minimum is the change */
+        uint32_t changeWallet = tx.outputValues[0] > tx.outputValues[1] ? tx.outputs[1] : tx.outputs[0];
+        uint64_t inMin = tx.inputValues[0], outMax = tx.outputValues[0];
+        long long sum = tx.inputValues[0];
+        for(uint32_t i = 1; i < tx.inputCount; i++) if((uint64_t) tx.inputValues[i] < inMin) inMin = tx.inputValues[i], sum += tx.inputValues[i];
+        for(uint32_t i = 1; i < tx.outputCount; i++) if((uint64_t) tx.outputValues[i] > outMax) outMax = tx.outputValues[i];
+        if(sum - inMin > outMax) return;
+        /* Merge with any of the input wallets, we consider any because by common input heuristics all the inputs belong to one user */
+        proposals.push_back({tx.inputs[0], changeWallet, id});
+        proposals.push_back({tx.inputs[0], proposal_t::ensureOnly, id});
+    }
+};
+
+/* HEURISTICS 4: if there is only one output then we can just merge this output with the inputs, since its likely that sender is depositing all the funds from his wallets to a new wallet */
+struct SingleOutputHeuristic{
+    static const uint8_t id = 4;
+    static const bool usesReuse = false;
+    static void propose(const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        if(tx.coinbase || tx.outputCount != 1 || tx.outputs[0] == txfeatures_t::dataCarrier) return;
+        proposals.push_back({tx.inputs[0], tx.outputs[0], id});
+        proposals.push_back({tx.inputs[0], proposal_t::ensureOnly, id});
+    }
+};
+
+/* HEURISTICS 5: the outputs of a coinbase are merged into one entity since they are managed by a single miner, a new one is created unless one of the outputs already belongs to an entity. Its data carriers are skipped, a coinbase with nothing else gets no entity */
+struct CoinbaseHeuristic{
+    static const uint8_t id = 5;
+    static const bool usesReuse = false;
+    static void propose(const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        if(!tx.coinbase) return;
+        uint32_t firstaddress = txfeatures_t::dataCarrier;
+        for(uint32_t i = 0; i < tx.outputCount; i++){
+            if(tx.outputs[i] == txfeatures_t::dataCarrier) continue;
+            if(firstaddress == txfeatures_t::dataCarrier) firstaddress = tx.outputs[i];
+            proposals.push_back({firstaddress, tx.outputs[i], id});
+        }
+        if(firstaddress != txfeatures_t::dataCarrier) proposals.push_back({firstaddress, proposal_t::ensureOnly, id});
+    }
+};
+
+/* A set of heuristics fixed at compile time, run in the order given. The calls are resolved by the compiler so the heuristics of the set are inlined into the loop over the transactions. The mask has bit id set for every heuristic of the set, the runtime argument is there to share the shape of RuntimeHeuristicSet and is ignored */
+template<typename... Policies> struct HeuristicPipeline;
+
+template<> struct HeuristicPipeline<>{
+    static const uint32_t mask = 0;
+    static const bool reuse = false;
+    static bool usesReuse(uint32_t){ return false; }
+    static void propose(uint32_t, const txfeatures_t&, std::vector<proposal_t>&){}
+};
+
+template<typename First, typename... Rest> struct HeuristicPipeline<First, Rest...>{
+    static const uint32_t mask = (1u << First::id) | HeuristicPipeline<Rest...>::mask;
+    static const bool reuse = First::usesReuse || HeuristicPipeline<Rest...>::reuse;
+    static bool usesReuse(uint32_t){ return reuse; }
+    static void propose(uint32_t, const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        First::propose(tx, proposals);
+        HeuristicPipeline<Rest...>::propose(0, tx, proposals);
+    }
+};
+
+/* Every heuristic in the order they have always been run in, a coinbase only gets heuristic 5 and the outputs of any other transaction get either 4 or 2 */
+typedef HeuristicPipeline<CoinbaseHeuristic, CommonInputHeuristic, SingleOutputHeuristic, ChangeAddressHeuristic, ScriptChainHeuristic> DefaultHeuristics;
+
+/* The fallback for a set chosen at run time, the heuristics of the mask in the order of DefaultHeuristics. It costs a test per heuristic and transaction that a compiled set does not have, the same every time so it is always predicted, next to the FeatureBuilder both share it is lost in the noise */
+struct RuntimeHeuristicSet{
+    static bool usesReuse(uint32_t mask){
+        return (mask & (1u << ChangeAddressHeuristic::id)) != 0;
+    }
+    static void propose(uint32_t mask, const txfeatures_t& tx, std::vector<proposal_t>& proposals){
+        if(mask & (1u << CoinbaseHeuristic::id)) CoinbaseHeuristic::propose(tx, proposals);
+        if(mask & (1u << CommonInputHeuristic::id)) CommonInputHeuristic::propose(tx, proposals);
+        if(mask & (1u << SingleOutputHeuristic::id)) SingleOutputHeuristic::propose(tx, proposals);
+        if(mask & (1u << ChangeAddressHeuristic::id)) ChangeAddressHeuristic::propose(tx, proposals);
+        if(mask & (1u << ScriptChainHeuristic::id)) ScriptChainHeuristic::propose(tx, proposals);
+    }
+};
+
+/* What the transactions of a chunk are evaluated against */
+struct evaluation_t{
+    transactions_t* transactions;
+    const ReuseIndex* reuseIndex;
+    MappedColumn<int>* reuseFrequency;
+    uint32_t mask;
+};
+
+/* Evaluates the transactions begin to end into proposals, one instance per set so that the set is called directly inside the loop */
+typedef void (*chunkevaluator_t)(const evaluation_t& evaluation, size_t begin, size_t end, FeatureBuilder& builder, std::vector<proposal_t>& proposals);
+
+template<typename Set> void evaluateChunk(const evaluation_t& evaluation, size_t begin, size_t end, FeatureBuilder& builder, std::vector<proposal_t>& proposals){
+    bool withReuse = Set::usesReuse(evaluation.mask);
+    txfeatures_t features;
+    for(size_t i = begin; i < end; i++){
+        builder.build((*evaluation.transactions)[i], withReuse, evaluation.reuseIndex, *evaluation.reuseFrequency, features);
+        Set::propose(evaluation.mask, features, proposals);
+    }
+}
+
+#endif
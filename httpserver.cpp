@@ -0,0 +1,190 @@
+#include "httpserver.h"
+
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+HttpServer::HttpServer(std::string host, int port, Handler handler)
+: host(host), port(port), listenfd(-1), handler(handler), running(false), connections(0)
+{
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenfd < 0) throw std::runtime_error("HttpServer: socket failed");
+    int yes = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1){
+        close(listenfd);
+        throw std::runtime_error("HttpServer: invalid host " + host);
+    }
+    if(bind(listenfd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(listenfd, 64) < 0){
+        close(listenfd);
+        throw std::runtime_error("HttpServer: cannot listen on " + host + ":" + std::to_string(port));
+    }
+    /* When port 0 is asked for the kernel picks one, read it back so that getPort reports it */
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (sockaddr*) &addr, &len);
+    this->port = ntohs(addr.sin_port);
+}
+
+HttpServer::~HttpServer(){
+    stop();
+    if(listenfd >= 0) close(listenfd);
+}
+
+/* Serves the requests on a background thread */
+void HttpServer::start(){
+    running = true;
+    acceptThread = std::thread(&HttpServer::run, this);
+}
+
+/* Serves the requests on the calling thread until stop is called */
+void HttpServer::run(){
+    running = true;
+    while(running){
+        int fd = accept(listenfd, nullptr, nullptr);
+        if(fd < 0){
+            if(!running) break;
+            continue;
+        }
+        /* The receive timeout lets idle keep-alive connections notice that the server is stopping */
+        timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        connections++;
+        std::thread(&HttpServer::serveConnection, this, fd).detach();
+    }
+}
+
+void HttpServer::stop(){
+    if(!running.exchange(false)) return;
+    shutdown(listenfd, SHUT_RDWR);
+    if(acceptThread.joinable()) acceptThread.join();
+    /* The connection threads are detached, wait for them since they refer to this object */
+    while(connections > 0) usleep(10000);
+}
+
+int HttpServer::getPort(){
+    return port;
+}
+
+static bool sendAll(int fd, const std::string& data){
+    size_t sent = 0;
+    while(sent < data.size()){
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static const char* statusText(int status){
+    switch(status){
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+void HttpServer::serveConnection(int fd){
+    std::string buffer;
+    char chunk[65536];
+    bool keepAlive = true;
+    while(running && keepAlive){
+        /* Read until the end of the headers */
+        size_t headerEnd;
+        while((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos){
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if(n > 0){
+                buffer.append(chunk, n);
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && running) continue;
+            keepAlive = false;
+            break;
+        }
+        if(!keepAlive) break;
+
+        std::string head = buffer.substr(0, headerEnd);
+        size_t lineEnd = head.find("\r\n");
+        std::string requestLine = head.substr(0, lineEnd);
+        size_t sp1 = requestLine.find(' '), sp2 = requestLine.rfind(' ');
+        if(sp1 == std::string::npos || sp2 == sp1) break;
+        std::string method = requestLine.substr(0, sp1);
+        std::string target = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+        std::string version = requestLine.substr(sp2 + 1);
+
+        /* Only the headers that matter for framing are looked at */
+        size_t contentLength = 0;
+        bool expectContinue = false;
+        keepAlive = version != "HTTP/1.0";
+        size_t pos = lineEnd;
+        while(pos != std::string::npos && pos < head.size()){
+            size_t next = head.find("\r\n", pos + 2);
+            std::string line = head.substr(pos + 2, next == std::string::npos ? std::string::npos : next - pos - 2);
+            size_t colon = line.find(':');
+            if(colon != std::string::npos){
+                std::string name = line.substr(0, colon);
+                std::string value = line.substr(colon + 1);
+                value.erase(0, value.find_first_not_of(' '));
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+                if(name == "content-length") contentLength = std::strtoull(value.c_str(), nullptr, 10);
+                else if(name == "connection") keepAlive = value == "keep-alive" || (keepAlive && value != "close");
+                else if(name == "expect") expectContinue = value == "100-continue";
+            }
+            pos = next;
+        }
+
+        /* Clients such as curl hold back large bodies until they are told to go ahead */
+        size_t needed = headerEnd + 4 + contentLength;
+        if(expectContinue && buffer.size() < needed && !sendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) break;
+        /* Read the rest of the body */
+        while(buffer.size() < needed){
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if(n > 0){
+                buffer.append(chunk, n);
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && running) continue;
+            break;
+        }
+        if(buffer.size() < needed) break;
+        std::string body = buffer.substr(headerEnd + 4, contentLength);
+        buffer.erase(0, needed);
+
+        httpresponse_t response;
+        try{
+            response = handler(method, target, body);
+        }
+        catch(const std::exception& e){
+            response.status = 500;
+            response.contentType = "text/plain";
+            response.body = e.what();
+        }
+        std::string out = "HTTP/1.1 " + std::to_string(response.status) + " " + statusText(response.status) + "\r\n";
+        out += "Content-Type: " + (response.contentType.empty() ? std::string("text/plain") : response.contentType) + "\r\n";
+        out += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+        out += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        out += response.body;
+        if(!sendAll(fd, out)) break;
+    }
+    close(fd);
+    connections--;
+}
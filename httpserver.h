@@ -0,0 +1,36 @@
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+struct httpresponse_t{
+    int status;
+    std::string contentType;
+    std::string body;
+};
+
+/* A minimal blocking HTTP/1.1 server, each connection is served on its own thread and kept alive until the client closes it. It is only meant for local tooling and endpoints, not for the public internet */
+class HttpServer{
+    public:
+    typedef std::function<httpresponse_t(const std::string& method, const std::string& target, const std::string& body)> Handler;
+    HttpServer(std::string host, int port, Handler handler);
+    ~HttpServer();
+    void start();
+    void run();
+    void stop();
+    int getPort();
+    private:
+    std::string host;
+    int port;
+    int listenfd;
+    Handler handler;
+    std::atomic<bool> running;
+    std::atomic<int> connections;
+    std::thread acceptThread;
+    void serveConnection(int fd);
+};
+
+#endif
@@ -1,163 +1,394 @@
 #include <unordered_map>
+#include <algorithm>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
 #include <bsoncxx/json.hpp>
 #include <mongocxx/client.hpp>
 #include <mongocxx/instance.hpp>
-#include <bsoncxx/builder/basic/document.hpp>
 
 #include "api.h"
 #include "entity.h"
+#include "entitystore.h"
+#include "address.h"
+#include "addresstable.h"
+#include "persistence.h"
 #include "heuristics.h"
+#include "options.h"
+#include "pipeline.h"
+#include "blockfile.h"
+#include "arena.h"
+#include "snapshot.h"
+#include "reuseindex.h"
+#include "follower.h"
+#include "backfill.h"
+#include "queryservice.h"
+#include "httpserver.h"
+#include "metrics.h"
+#include "activity.h"
+#include "columnexport.h"
+#include "mergelog.h"
+
+
+
+/* Totals of the block arenas since the last report, filled by the hook of the arena pool */
+static std::mutex arenaLock;
+static arenastats_t arenaTotals;
+static uint64_t arenaBlocks = 0;
+
+void countArena(const arenastats_t& stats){
+    static Counter& allocations = metrics.counter("arena_allocations_total", "Allocations made in the block arenas");
+    static Counter& bytes = metrics.counter("arena_bytes_total", "Bytes allocated in the block arenas");
+    static Counter& chunks = metrics.counter("arena_chunk_allocations_total", "Chunks the block arenas took from the heap");
+    allocations.add(stats.allocations);
+    bytes.add(stats.bytes);
+    chunks.add(stats.chunkAllocations);
+    std::lock_guard<std::mutex> guard(arenaLock);
+    arenaTotals.allocations += stats.allocations;
+    arenaTotals.bytes += stats.bytes;
+    arenaTotals.chunkAllocations += stats.chunkAllocations;
+    arenaTotals.allocatorNanos += stats.allocatorNanos;
+    arenaBlocks++;
+}
 
-using bsoncxx::builder::basic::kvp;
-using bsoncxx::builder::basic::make_document;
-
-
-uint64_t lastEntityID = 0;
-
-
-void iterate_documents(mongocxx::collection& addressCollection, mongocxx::collection& reuseCollection, std::unordered_map<std::string,uint64_t>& walletToEntity, std::unordered_map<uint64_t,Entity>& entities, std::unordered_map<std::string,int>& reuseFrequency) {
-    // Execute a query with an empty filter to get all documents.
-    mongocxx::cursor addresscursor = addressCollection.find({});
-    mongocxx::cursor reusecursor = reuseCollection.find({});
+/* An interrupt stops following the tip and serving queries, what was clustered is checkpointed before exiting */
+static ChainFollower* runningFollower = nullptr;
+static std::atomic<bool> interrupted(false);
 
-    //The ID to Entity Map must be constructed from the previous data in the blockchain, we define a bool map which stores data on whether an entity is created not, if not then we create the entity and push the wallets corresponding to it, else we directly push to the entity in the entities structure
-    std::unordered_map<uint64_t,bool> map;
+void stopRunning(int){
+    interrupted = true;
+    if(runningFollower) runningFollower->stop();
+}
 
-    for (const bsoncxx::document::view& doc : addresscursor) {
-        std::string wallet = doc["wallet"].get_string().value.to_string();
-        uint64_t entityID = std::stoull(doc["entityID"].get_string().value.to_string());
-        walletToEntity[wallet] = entityID;
-        if(map[entityID]){
-            entities[entityID].addWallet(wallet);
-        }
-        else{
-            Entity entity(entityID);
-            entity.addWallet(wallet);
-            entities[entityID] = entity;
-            map[entityID]=true; // adding the ID to the map
-        }
-        lastEntityID = std::max(entityID,lastEntityID);
+/* Prints how much memory the clustering state takes, along with the resident size of the whole process, and what the block arenas did per block since the previous report */
+void printMemoryUsage(EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity){
+    long pages = 0, residentPages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm){
+        if(fscanf(statm, "%ld %ld", &pages, &residentPages) != 2) residentPages = 0;
+        fclose(statm);
     }
-    // Setting the number of entities encountered thus far
-    if(lastEntityID != 0)Entity::setEntitiesCount(lastEntityID);
-
-    for (const bsoncxx::document::view& doc : reusecursor){
-        std::string wallet = doc["wallet"].get_string().value.to_string();
-        int frequency = doc["frequency"].get_int32().value;
-        reuseFrequency[wallet] = frequency;
+    double mb = 1024.0 * 1024.0;
+    metrics.gauge("address_table_bytes", "Memory of the address table").set(addressTable.memoryUsage());
+    metrics.gauge("entity_store_bytes", "Memory of the entity store").set(store.memoryUsage());
+    metrics.gauge("undo_journal_bytes", "Memory of the undo journal").set(store.journalMemoryUsage());
+    metrics.gauge("reuse_counts_bytes", "Memory of the reuse counts").set(reuseFrequency.memoryUsage());
+    metrics.gauge("address_activity_bytes", "Memory of the value totals and heights of the addresses").set(activity.memoryUsage());
+    size_t mapped = addressTable.mappedBytes() + store.mappedBytes() + reuseFrequency.mappedBytes() + activity.mappedBytes();
+    metrics.gauge("state_mapped_bytes", "Bytes of the clustering state kept in files under --state-dir").set(mapped);
+    std::cout << "Memory: addresses " << addressTable.size() << " (" << addressTable.memoryUsage() / mb << " MB), "
+              << "entities " << store.entityCount() << " (" << store.memoryUsage() / mb << " MB), "
+              << "reuse counts " << reuseFrequency.memoryUsage() / mb << " MB, "
+              << "activity " << activity.memoryUsage() / mb << " MB, "
+              << "RSS " << residentPages * sysconf(_SC_PAGESIZE) / mb << " MB";
+    if(mapped > 0) std::cout << ", " << mapped / mb << " MB mapped from the state directory";
+    std::cout << std::endl;
+    /* The filter keeps totals since the start, the counters get what was added since the last report */
+    static addressfilterstats_t reported;
+    addressfilterstats_t filter = addressTable.getFilterStats();
+    metrics.counter("address_filter_lookups_total", "Address lookups that went through the filter of the address table").add(filter.lookups - reported.lookups);
+    metrics.counter("address_filter_skipped_total", "Address lookups the filter answered without probing the maps").add(filter.skipped - reported.skipped);
+    metrics.counter("address_filter_false_positives_total", "New addresses the filter let through to the maps").add(filter.falsePositives - reported.falsePositives);
+    uint64_t lookups = filter.lookups - reported.lookups;
+    if(filter.bytes > 0 && lookups > 0){
+        std::cout << "Address filter: " << filter.bytes / mb << " MB, " << 100.0 * (filter.skipped - reported.skipped) / lookups << "% of the lookups skipped the maps, "
+                  << 100.0 * (filter.falsePositives - reported.falsePositives) / lookups << "% false positives" << std::endl;
     }
+    reported = filter;
+    std::lock_guard<std::mutex> guard(arenaLock);
+    if(arenaBlocks == 0) return;
+    std::cout << "Arenas: " << arenaBlocks << " blocks, per block " << arenaTotals.allocations / arenaBlocks << " allocations, "
+              << arenaTotals.bytes / arenaBlocks / 1024.0 << " KB, " << (double) arenaTotals.chunkAllocations / arenaBlocks << " heap chunks, "
+              << arenaTotals.allocatorNanos / arenaBlocks / 1000.0 << " us in the heap" << std::endl;
+    arenaTotals = arenastats_t();
+    arenaBlocks = 0;
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    std::string username = "bitcoin";
-    std::string password = "password";
-    std::string address = "127.0.0.1";
-    int port = 8332;
+    /* The time to the first block clustered is how long a restart takes */
+    std::chrono::steady_clock::time_point launched = std::chrono::steady_clock::now();
+    options_t options;
+    if(!parseOptions(argc, argv, options)) return 1;
+    arenaPool.setHook(countArena);
+    if(options.addressFilter) addressTable.enablePrefilter();
 
     
-    /* Contains the wallet to Entity ID mapping used for adding related wallets to the same Entity */
-    std::unordered_map<std::string,uint64_t> walletToEntity;
-    /* Used for keeping track of the various entities*/
-    std::unordered_map<uint64_t,Entity> entities;
+    /* Keeps track of the various entities and of the wallet to Entity ID mapping used for adding related wallets to the same Entity */
+    EntityStore store;
     /* From which block to which block the heuristics must be run */
     uint32_t startBlockNumber, endBlockNumber;
-    /* Stores the hashes of the block from the start block till the end block, which are later used to get the actual block data*/
-    std::vector<std::string> blockhashes;
-    /* Contains the transactions of each block*/
-    std::vector<getrawtransaction_t> blockTransactions;
-    /* Contains the number of times the wallet is reused for receiving*/
-    std::unordered_map<std::string, int> reuseFrequency;
+    /* Contains the current block along with its transactions, handed over by the fetch pipeline */
+    fetchedblock_t block;
+    /* Contains the number of times the wallet is reused for receiving, indexed by address ID*/
+    MappedColumn<int> reuseFrequency;
+    /* What each address received and sent, its transactions and the first and last height it was seen at, indexed by address ID */
+    AddressActivity activity;
 
     std::chrono::_V2::system_clock::time_point start;
 
     try{
+        if(!options.tracePath.empty()) tracer.open(options.tracePath);
+        if(!options.stateDir.empty()){
+            addressTable.mapTo(options.stateDir);
+            store.mapTo(options.stateDir);
+            reuseFrequency.mapTo(options.stateDir, (size_t) UINT32_MAX + 1);
+            activity.mapTo(options.stateDir);
+        }
         // Create an instance.
         mongocxx::instance inst{};
-        const auto uri = mongocxx::uri{"mongodb://localhost:27017"};
+        std::unique_ptr<mongocxx::client> conn;
+        /* Left empty when the clustering only lives in the snapshot */
+        std::unique_ptr<Persistence> persistence;
+        if(options.useMongo){
+            const auto uri = mongocxx::uri{options.mongoUri};
+
+            // Set the version of the Stable API on the client.
+            mongocxx::options::client client_options;
+            const auto api = mongocxx::options::server_api{ mongocxx::options::server_api::version::k_version_1 };
+            client_options.server_api_opts(api);
+
+            // Setup the connection and get a handle on the "clustredaddresses" database.
+            conn.reset(new mongocxx::client{ uri, client_options });
+            mongocxx::database db = (*conn)["ClusteredAddresses"];
+            persistence.reset(new Persistence(db));
+        }
 
-        // Set the version of the Stable API on the client.
-        mongocxx::options::client client_options;
-        const auto api = mongocxx::options::server_api{ mongocxx::options::server_api::version::k_version_1 };
-        client_options.server_api_opts(api);
+        /* The snapshot is much faster to load than the documents, MongoDB is only read when there is no snapshot yet */
+        uint64_t lastHeight = noHeight;
+        std::string lastHash;
+        if(!options.snapshotPath.empty() && snapshotExists(options.snapshotPath)){
+            std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+            lastHeight = loadSnapshot(options.snapshotPath, store, reuseFrequency, activity, &lastHash);
+            store.trackChanges(true);
+            std::cout << "Loaded snapshot " << options.snapshotPath << " up to block " << (lastHeight == noHeight ? std::string("none") : std::to_string(lastHeight))
+                      << " in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count() << " s" << std::endl;
+        }
+        else if(persistence){
+            /* This function gets the previous walletToEntity and reuseFrequency Stored in database*/
+            persistence->load(store,reuseFrequency);
+        }
 
-        // Setup the connection and get a handle on the "clustredaddresses" database.
-        mongocxx::client conn{ uri, client_options };
-        mongocxx::database db = conn["ClusteredAddresses"];
-        mongocxx::collection collection = db["WalletToEntity"];
-        mongocxx::collection reuseCollection = db["reuseFrequency"];
+        /* The lookups are answered from an index of the clustering as of the last checkpoint, the ingestion does not wait for them */
+        std::unique_ptr<QueryService> queries;
+        auto publishIndex = [&](){
+            if(queries) queries->publish(std::make_shared<const EntityIndex>(store, activity, lastHeight));
+        };
+        if(options.queryPort != 0){
+            queries.reset(new QueryService(options.queryHost, options.queryPort));
+            publishIndex();
+            queries->start();
+            std::cout << "Answering queries on " << options.queryHost << ":" << queries->getPort() << std::endl;
+        }
 
-        /* This function gets the previous walletToEntity and reuseFrequency Stored in database*/
-        iterate_documents(collection,reuseCollection,walletToEntity,entities,reuseFrequency);
+        /* The metrics are served on their own port so that scraping them never waits behind the queries */
+        std::unique_ptr<HttpServer> metricsServer;
+        if(options.metricsPort != 0){
+            metricsServer.reset(new HttpServer(options.metricsHost, options.metricsPort, [](const std::string& method, const std::string& target, const std::string&){
+                httpresponse_t response;
+                response.status = 200;
+                if(target == "/metrics") response.contentType = "text/plain; version=0.0.4", response.body = metrics.prometheus();
+                else if(target == "/metrics.json") response.contentType = "application/json", response.body = metrics.json() + "\n";
+                else response.status = 404, response.contentType = "text/plain", response.body = "unknown path\n";
+                return response;
+            }));
+            metricsServer->start();
+            std::cout << "Serving metrics on " << options.metricsHost << ":" << metricsServer->getPort() << std::endl;
+        }
+        std::unique_ptr<MetricsLogger> metricsLogger;
+        if(!options.metricsLog.empty()) metricsLogger.reset(new MetricsLogger(options.metricsLog, options.metricsInterval));
+
+        /* The blocks clustered since the snapshot, opened by the replay once the heuristics are there */
+        std::unique_ptr<MergeLog> mergeLog;
+
+        /* Writes what changed since the previous checkpoint to MongoDB and rewrites the snapshot with the last block done */
+        Histogram& checkpointSeconds = metrics.histogram("checkpoint_seconds", "Whole checkpoint, MongoDB, snapshot and query index");
+        Histogram& snapshotSeconds = metrics.histogram("snapshot_write_seconds", "Writing of the snapshot");
+        Histogram& publishSeconds = metrics.histogram("index_publish_seconds", "Building and publishing the index of the query service");
+        auto checkpoint = [&](){
+            StageTimer timer(checkpointSeconds, "checkpoint", lastHeight == noHeight ? -1 : (int64_t) lastHeight);
+            if(persistence) persistence->checkpoint(store, reuseFrequency);
+            if(!options.snapshotPath.empty()){
+                StageTimer timer(snapshotSeconds, "snapshot_write");
+                writeSnapshot(options.snapshotPath, store, reuseFrequency, activity, lastHeight, lastHash);
+            }
+            /* Only once the snapshot holding the logged blocks is on disk */
+            if(mergeLog) mergeLog->reset(lastHeight, lastHash);
+            if(queries){
+                StageTimer timer(publishSeconds, "index_publish");
+                publishIndex();
+            }
+        };
+
+        /* Where the clustering stands, set after every block */
+        Histogram& clusterSeconds = metrics.histogram("cluster_seconds", "Clustering of one block, heuristics and merges");
+        Gauge& clusteredHeight = metrics.gauge("clustered_height", "Last block clustered");
+        Gauge& addressCount = metrics.gauge("addresses", "Addresses known");
+        Gauge& entityCount = metrics.gauge("entities", "Entities in the store");
+        Gauge& largestEntity = metrics.gauge("largest_entity_wallets", "Wallets of the largest entity so far");
+        Gauge& startupSeconds = metrics.gauge("startup_seconds", "Time from the start of the process to its first block clustered");
+        bool clusteredOne = false;
+        auto blockClustered = [&](){
+            if(!clusteredOne){
+                clusteredOne = true;
+                startupSeconds.set(std::chrono::duration<double>(std::chrono::steady_clock::now() - launched).count());
+                std::cout << "First block clustered " << startupSeconds.get() << " s after the start" << std::endl;
+            }
+            clusteredHeight.set(lastHeight);
+            addressCount.set(addressTable.size());
+            entityCount.set(store.entityCount());
+            largestEntity.set(store.largestSet());
+        };
 
         try
         {
-            /* Constructor to connect to the bitcoin daemon */
-            API btc(username, password, address, port,10000000);
+            Heuristics heuristic(options.workers);
+            heuristic.setEnabled(options.heuristics);
+
+            /* The blocks logged after the snapshot are applied again, the process that logged them died before its next checkpoint */
+            if(!options.snapshotPath.empty()){
+                mergeLog.reset(new MergeLog(options.snapshotPath + ".wal", options.walSync));
+                std::vector<uint32_t> replayedOutputs;
+                mergelogreplay_t replayed = mergeLog->replay(lastHeight, lastHash, store, heuristic, reuseFrequency, activity, persistence ? &replayedOutputs : nullptr);
+                if(replayed.blocks > 0){
+                    lastHeight = replayed.lastHeight;
+                    lastHash = replayed.lastHash;
+                    if(persistence) persistence->trackReuse(replayedOutputs);
+                    publishIndex();
+                    std::cout << "Replayed " << replayed.blocks << " blocks of " << options.snapshotPath << ".wal up to block " << lastHeight << " in " << replayed.seconds << " s" << std::endl;
+                }
+                if(replayed.tornTail) std::cout << "Cut off the record of a block the log was writing when it stopped" << std::endl;
+            }
+            /* A reorg since the last block clustered cannot be undone any more, the clustering has to be rebuilt from an older snapshot */
+            if(options.resume && lastHeight != noHeight && !lastHash.empty() && options.blocksDir.empty()){
+                API api(options.rpcUser, options.rpcPassword, options.rpcHost, options.rpcPort, options.rpcTimeout);
+                std::string daemonHash = api.getblockhash(lastHeight);
+                if(daemonHash != lastHash) throw std::runtime_error("Resume: block " + std::to_string(lastHeight) + " is " + daemonHash + " on the daemon but " + lastHash + " was clustered, the chain reorganized past the snapshot");
+            }
 
-            /* Getting start and end blocks index and retrieving them to store*/
-            std::cout << "Enter start and End Block Index" << std::endl;
-            std::cin >> startBlockNumber >> endBlockNumber;
+            /* When following, the blocks near the tip are clustered with an undo journal and the range ends at the tip unless it is given */
+            std::unique_ptr<ChainFollower> follower;
+            if(options.follow){
+                follower.reset(new ChainFollower(options, store, heuristic, reuseFrequency, activity, persistence.get(), lastHeight, lastHash));
+                follower->setLog(mergeLog.get());
+            }
+
+            /* Getting start and end blocks index and retrieving them to store, a run with a snapshot carries on after the last block in it, a resumed run always does */
+            if(options.resume && lastHeight != noHeight) startBlockNumber = lastHeight + 1;
+            else if(options.haveStart) startBlockNumber = options.startBlock;
+            else if(lastHeight != noHeight) startBlockNumber = lastHeight + 1;
+            else if(options.resume) startBlockNumber = 0;
+            if(options.haveEnd) endBlockNumber = options.endBlock;
+            else if(follower) endBlockNumber = follower->getTipHeight();
+            bool askStart = !options.haveStart && lastHeight == noHeight && !options.resume, askEnd = !options.haveEnd && !follower;
+            if(askStart && askEnd) std::cout << "Enter start and End Block Index" << std::endl;
+            else if(askStart) std::cout << "Enter start Block Index" << std::endl;
+            else if(askEnd) std::cout << "Enter End Block Index" << std::endl;
+            if(askStart) std::cin >> startBlockNumber;
+            if(askEnd) std::cin >> endBlockNumber;
 
             start = std::chrono::system_clock::now();
             
-            Heuristics heuristic;
             int count = 0;
 
-            for(int i = startBlockNumber; i <= endBlockNumber; i++){
-                std::string blockhash = btc.getblockhash(i);
-                blockinfo_t currentBlock = btc.getblock(blockhash);
-                for(std::string& tx : currentBlock.tx){
-                    getrawtransaction_t transaction = btc.getrawtransaction(tx);
-                    blockTransactions.emplace_back(transaction);
+            /* The fetchers connect to the bitcoin daemon and download the blocks ahead while the current one is clustered, or the blocks are read from the node's block files */
+            std::unique_ptr<BlockSource> source;
+            auto openSource = [&](){
+                if(options.blocksDir.empty()) source.reset(new BlockPipeline(options, startBlockNumber, endBlockNumber));
+                else source.reset(new BlockFileReader(options.blocksDir, startBlockNumber, endBlockNumber, options.fullTransactions));
+            };
+
+            /* The reuse of the whole range is counted first, then the blocks are read again for the clustering */
+            ReuseIndex reuseIndex;
+            std::unique_ptr<ShardedBackfill> backfill;
+            if(options.shards > 1){
+                backfill.reset(new ShardedBackfill(options.shards, startBlockNumber, endBlockNumber, [&](uint32_t first, uint32_t last){
+                    return std::unique_ptr<BlockSource>(new BlockPipeline(options, first, last));
+                }));
+                std::vector<uint32_t> counted;
+                backfill->countReuse(reuseFrequency, reuseIndex, counted);
+                if(persistence) persistence->trackReuse(counted);
+                std::cout << "Reuse prepass: " << reuseIndex.size() << " addresses, " << reuseIndex.memoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+                /* The pieces are merged in height order, the checkpoints fall on the first piece boundary past every interval */
+                int sinceCheckpoint = 0;
+                backfill->cluster(store, heuristic, reuseFrequency, reuseIndex, activity, lastHeight, lastHash, [&](uint32_t blocks){
+                    blockClustered();
+                    std::cout << "Done " << lastHeight << std::endl;
+                    count += blocks;
+                    sinceCheckpoint += blocks;
+                    if(sinceCheckpoint >= options.checkpointInterval){
+                        checkpoint();
+                        printMemoryUsage(store, reuseFrequency, activity);
+                        sinceCheckpoint = 0;
+                    }
+                });
+            }
+            else if(options.reusePrepass){
+                openSource();
+                reuseIndex.build(*source, reuseFrequency);
+                heuristic.setReuseIndex(&reuseIndex);
+                std::cout << "Reuse prepass: " << reuseIndex.size() << " addresses, " << reuseIndex.memoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+            }
+            if(!backfill) openSource();
+
+            while(source && source->next(block)){
+                uint32_t i = block.height;
+                {
+                    StageTimer timer(clusterSeconds, "cluster", i);
+                    if(follower) follower->apply(block);
+                    else{
+                        heuristic.runHeuristics(store,block.transactions,reuseFrequency);
+                        activity.record(i, block.transactions, &store);
+                        if(persistence) persistence->trackBlock(block.transactions);
+                        if(mergeLog) mergeLog->append(i, block.hash, block.transactions, heuristic);
+                        lastHeight = i;
+                        lastHash = block.hash;
+                    }
                 }
-                heuristic.runHeuristics(entities,blockTransactions,walletToEntity,reuseFrequency);
-                blockTransactions.clear();
+                blockClustered();
 
                 std::cout << "Done " << i << std::endl;
 
-                /* Only for testing remove later */
+                /* Only the changes since the previous checkpoint are written to MongoDB */
                 count++;
-                if((count) % 50 == 0){
-                    collection.drop();
-                    reuseCollection.drop();
-                    std::vector<bsoncxx::document::value> documents;
-                    for(const auto& a : walletToEntity){
-                        std::string entityID = std::to_string(a.second);
-                        documents.emplace_back(make_document(kvp("wallet",a.first),kvp("entityID",entityID)));
-                    }
-
-                    collection.insert_many(documents);
-                    documents.clear();
-
-                    for(const auto& a : reuseFrequency){
-                        documents.emplace_back(make_document(kvp("wallet",a.first),kvp("frequency",a.second)));
-                    }
-                    reuseCollection.insert_many(documents);
+                if(count % options.checkpointInterval == 0){
+                    checkpoint();
+                    printMemoryUsage(store, reuseFrequency, activity);
                 }
 
             }
 
-            /*Delete the previous entries in the collection and update with new mappings*/
-            collection.drop();
-            reuseCollection.drop();
-            std::vector<bsoncxx::document::value> documents;
-            for(const auto& a : walletToEntity){
-                std::string entityID = std::to_string(a.second);
-                documents.emplace_back(make_document(kvp("wallet",a.first),kvp("entityID",entityID)));
-            }
+            /* Write what is left since the last checkpoint */
+            checkpoint();
 
-            collection.insert_many(documents);
-            documents.clear();
-
-            for(const auto& a : reuseFrequency){
-                documents.emplace_back(make_document(kvp("wallet",a.first),kvp("frequency",a.second)));
+            /* From here on the new blocks are clustered as they come, until the process is interrupted */
+            if(follower || queries){
+                std::signal(SIGINT, stopRunning);
+                std::signal(SIGTERM, stopRunning);
+            }
+            if(follower && !interrupted){
+                runningFollower = follower.get();
+                std::cout << "Following the tip from block " << follower->getTipHeight() << std::endl;
+                follower->run(startBlockNumber, [&](){
+                    blockClustered();
+                    std::cout << "Done " << lastHeight << std::endl;
+                    if(++count % options.checkpointInterval == 0) printMemoryUsage(store, reuseFrequency, activity);
+                }, checkpoint);
+                runningFollower = nullptr;
+                follower->printStats(std::cout);
+            }
+            if(queries){
+                std::cout << "Done with the blocks, still answering queries until interrupted" << std::endl;
+                while(!interrupted) usleep(100000);
+                queries->stop();
             }
-            reuseCollection.insert_many(documents);
 
             /* To print the entities along with the wallets*/
-            // for(auto &a : entities){
+            // for(auto &a : store.materializeEntities()){
             //     a.second.listWallets();
             // }
 
@@ -168,6 +399,18 @@ int main()
 
             std::cout << "Elapsed Time: " << time.count() << std::endl;
 
+            /* Exported once the range is done and the following stopped, the clustering of the last checkpoint */
+            if(!options.exportDir.empty()){
+                exportstats_t exported = exportClustering(options.exportDir, store, reuseFrequency, activity, lastHeight, options.haveExportSince ? options.exportSince : noHeight, options.workers);
+                std::cout << "Exported " << exported.addresses << " addresses and " << exported.entities << " entities to " << options.exportDir << ", "
+                          << exported.rawBytes / (1024.0 * 1024.0) << " MB compressed to " << exported.bytes / (1024.0 * 1024.0) << " MB in " << exported.seconds << " s" << std::endl;
+            }
+            printMemoryUsage(store, reuseFrequency, activity);
+            printScriptTypes(std::cout);
+            if(source) source->printThroughput(std::cout);
+            if(backfill) backfill->printThroughput(std::cout);
+            if(metricsServer) metricsServer->stop();
+
         }
         catch(const std::exception& e)
         {
@@ -181,5 +424,6 @@ int main()
         std::cout<< "Exception: " << e.what() << std::endl;
     }
 
+    tracer.close();
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+#include "mappedcolumn.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* The file grows at least this much at a time, and at least doubles */
+static const size_t growthStep = 1 << 20;
+
+MappedRegion::MappedRegion(const std::string& directory, size_t maxBytes) : fd(-1), base(nullptr), fileBytes(0), page(sysconf(_SC_PAGESIZE))
+{
+    reserved = std::max<size_t>((maxBytes + page - 1) / page * page, page);
+    std::string path = directory + "/state-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    fd = mkstemp(&name[0]);
+    if(fd < 0) throw std::runtime_error("MappedRegion: cannot create a file in " + directory + ": " + std::strerror(errno));
+    unlink(&name[0]);
+    /* Only the address range is reserved, the pages past the end of the file are never touched */
+    void* mapped = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if(mapped == MAP_FAILED){
+        close(fd);
+        throw std::runtime_error("MappedRegion: cannot map " + std::to_string(reserved) + " bytes: " + std::strerror(errno));
+    }
+    base = (char*) mapped;
+}
+
+MappedRegion::~MappedRegion(){
+    munmap(base, reserved);
+    close(fd);
+}
+
+void MappedRegion::ensure(size_t bytes){
+    if(bytes <= fileBytes) return;
+    size_t grown = std::min(reserved, std::max(bytes, std::max(fileBytes * 2, growthStep)));
+    grown = std::min(reserved, (grown + page - 1) / page * page);
+    if(bytes > grown) throw std::runtime_error("MappedRegion: " + std::to_string(bytes) + " bytes do not fit in the " + std::to_string(reserved) + " reserved");
+    if(ftruncate(fd, grown) != 0) throw std::runtime_error(std::string("MappedRegion: cannot grow the file: ") + std::strerror(errno));
+    fileBytes = grown;
+}
+
+void MappedRegion::adviseRandom(){
+    madvise(base, reserved, MADV_RANDOM);
+}
+
+/* Only ranges with a page out of memory are advised, the advice walks every page of the range even when all of them are in memory */
+void MappedRegion::willNeed(size_t offset, size_t bytes){
+    offset -= offset % page;
+    if(offset >= fileBytes) return;
+    bytes = std::min(bytes, fileBytes - offset);
+    resident.resize((bytes + page - 1) / page);
+    if(mincore(base + offset, bytes, &resident[0]) == 0 && std::all_of(resident.begin(), resident.end(), [](unsigned char r){ return (r & 1) != 0; })) return;
+    madvise(base + offset, bytes, MADV_WILLNEED);
+}
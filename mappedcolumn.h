@@ -0,0 +1,145 @@
+#ifndef MAPPEDCOLUMN_H
+#define MAPPEDCOLUMN_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+/* A scratch file of a directory mapped at a fixed address for up to maxBytes. It grows by extending the file, the mapping never moves so pointers into it stay valid while it grows. The file is unlinked as soon as it is open, nothing is left behind when the process ends, the snapshot stays the copy of the clustering that survives a restart */
+class MappedRegion{
+    public:
+    MappedRegion(const std::string& directory, size_t maxBytes);
+    ~MappedRegion();
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+    char* data() const{ return base; }
+    /* Bytes of the file, the new bytes of a grown file read as zeros */
+    size_t size() const{ return fileBytes; }
+    void ensure(size_t bytes);
+    /* Turns the read ahead off, for hash tables whose pages are read in no order */
+    void adviseRandom();
+    /* Asks the kernel to start reading the pages of bytes from offset, the call does not wait for them */
+    void willNeed(size_t offset, size_t bytes);
+    size_t pageSize() const{ return page; }
+    private:
+    int fd;
+    char* base;
+    size_t fileBytes;
+    size_t reserved;
+    size_t page;
+    std::vector<unsigned char> resident;
+};
+
+/* The subset of std::vector the clustering state uses, kept either on the heap or in a MappedRegion. On the heap it is a vector, mapped the pages are the kernel's to write back and drop, so the state can be larger than the memory and the page cache keeps the entries in use. Only for types that can be copied as bytes */
+template<class T> class MappedColumn{
+    static_assert(std::is_trivially_copyable<T>::value, "MappedColumn holds plain values");
+    public:
+    MappedColumn() : items(nullptr), count(0), maxCount(0) {}
+    MappedColumn(const MappedColumn&) = delete;
+    MappedColumn& operator=(const MappedColumn&) = delete;
+    MappedColumn(MappedColumn&& other) : heap(std::move(other.heap)), region(std::move(other.region)), items(other.items), count(other.count), maxCount(other.maxCount){
+        other.items = nullptr;
+        other.count = 0;
+    }
+    MappedColumn& operator=(MappedColumn&& other){
+        heap = std::move(other.heap);
+        region = std::move(other.region);
+        items = other.items;
+        count = other.count;
+        maxCount = other.maxCount;
+        other.items = nullptr;
+        other.count = 0;
+        return *this;
+    }
+    /* Moves the column into a scratch file of directory that can hold up to maxItems, the items already there are copied over. The address of the items does not change afterwards */
+    void mapTo(const std::string& directory, size_t maxItems){
+        std::unique_ptr<MappedRegion> mapped(new MappedRegion(directory, maxItems * sizeof(T)));
+        mapped->ensure(count * sizeof(T));
+        if(count > 0) std::copy(items, items + count, (T*) mapped->data());
+        region = std::move(mapped);
+        std::vector<T>().swap(heap);
+        items = (T*) region->data();
+        maxCount = maxItems;
+    }
+    bool mapped() const{ return region != nullptr; }
+    T& operator[](size_t i){ return items[i]; }
+    const T& operator[](size_t i) const{ return items[i]; }
+    T* begin(){ return items; }
+    T* end(){ return items + count; }
+    const T* begin() const{ return items; }
+    const T* end() const{ return items + count; }
+    T& back(){ return items[count - 1]; }
+    size_t size() const{ return count; }
+    bool empty() const{ return count == 0; }
+    size_t capacity() const{ return region ? region->size() / sizeof(T) : heap.capacity(); }
+    void reserve(size_t n){
+        if(region) ensure(n);
+        else{
+            heap.reserve(n);
+            items = heap.data();
+        }
+    }
+    /* A mapped column that shrank keeps the old values in its file, they are overwritten when it grows again */
+    void resize(size_t n, const T& fill = T()){
+        if(region){
+            ensure(n);
+            for(size_t i = count; i < n; i++) items[i] = fill;
+        }
+        else{
+            heap.resize(n, fill);
+            items = heap.data();
+        }
+        count = n;
+    }
+    void push_back(const T& value){
+        if(region){
+            ensure(count + 1);
+            items[count++] = value;
+        }
+        else{
+            heap.push_back(value);
+            items = heap.data();
+            count++;
+        }
+    }
+    void clear(){ resize(0); }
+    /* Bytes on the heap, the pages of a mapped column belong to the page cache */
+    size_t memoryUsage() const{ return region ? 0 : heap.capacity() * sizeof(T); }
+    size_t mappedBytes() const{ return region ? region->size() : 0; }
+    void adviseRandom(){ if(region) region->adviseRandom(); }
+    /* Starts reading the pages of the items in the background, indexes sorted so the pages come in order. Pages a few apart are asked for as one range, a call per page costs more than the reads when the pages are already in memory. Nothing to do on the heap */
+    void prefetch(const std::vector<uint32_t>& indexes){
+        if(!region) return;
+        const size_t gap = 16;
+        size_t first = SIZE_MAX, last = 0;
+        for(uint32_t i : indexes){
+            if(i >= count) break;
+            size_t page = (size_t) i * sizeof(T) / region->pageSize();
+            if(first != SIZE_MAX && page <= last + gap){
+                last = page;
+                continue;
+            }
+            if(first != SIZE_MAX) region->willNeed(first * region->pageSize(), (last - first + 1) * region->pageSize());
+            first = last = page;
+        }
+        if(first != SIZE_MAX) region->willNeed(first * region->pageSize(), (last - first + 1) * region->pageSize());
+    }
+    private:
+    std::vector<T> heap;
+    std::unique_ptr<MappedRegion> region;
+    T* items;
+    size_t count;
+    size_t maxCount;
+
+    void ensure(size_t n){
+        if(n > maxCount) throw std::runtime_error("MappedColumn: more than " + std::to_string(maxCount) + " items");
+        region->ensure(n * sizeof(T));
+    }
+};
+
+#endif
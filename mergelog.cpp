@@ -0,0 +1,282 @@
+#include "mergelog.h"
+#include "address.h"
+#include "addresstable.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const char mergeLogMagic[8] = {'C', 'B', 'A', 'W', 'A', 'L', '\0', '\0'};
+static const uint32_t mergeLogVersion = 1;
+
+static void put32(std::vector<unsigned char>& out, uint32_t value){
+    out.insert(out.end(), (const unsigned char*) &value, (const unsigned char*) &value + sizeof(value));
+}
+
+static void put64(std::vector<unsigned char>& out, uint64_t value){
+    out.insert(out.end(), (const unsigned char*) &value, (const unsigned char*) &value + sizeof(value));
+}
+
+/* The hash as displayed, zeros when it is not known */
+static void hashBytes(const std::string& hash, unsigned char out[32]){
+    size_t len = 0;
+    if(!fromHex(hash, out, 32, len) || len != 32) std::memset(out, 0, 32);
+}
+
+static std::string hashText(const unsigned char* bytes){
+    for(int i = 0; i < 32; i++) if(bytes[i] != 0) return toHex(bytes, 32);
+    return "";
+}
+
+/* Reads the payload of a record, every read is checked against its end, a record that passed its CRC but does not parse is a bug rather than a crash */
+struct logcursor_t{
+    const unsigned char* p;
+    const unsigned char* end;
+
+    const unsigned char* take(size_t len){
+        if((size_t) (end - p) < len) throw std::runtime_error("MergeLog: record ends early");
+        const unsigned char* at = p;
+        p += len;
+        return at;
+    }
+    uint32_t u32(){
+        uint32_t value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+    int64_t i64(){
+        int64_t value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+};
+
+static void writeAll(int fd, const unsigned char* data, size_t len, const std::string& path){
+    while(len > 0){
+        ssize_t written = ::write(fd, data, len);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) throw std::runtime_error("MergeLog: cannot write " + path);
+        data += written;
+        len -= written;
+    }
+}
+
+MergeLog::MergeLog(const std::string& path, bool sync) : path(path), sync(sync), fd(-1), bytes(0)
+{
+}
+
+MergeLog::~MergeLog(){
+    if(fd >= 0) close(fd);
+}
+
+void MergeLog::openAt(uint64_t length){
+    if(fd < 0) fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0) throw std::runtime_error("MergeLog: cannot open " + path);
+    if(ftruncate(fd, length) != 0 || lseek(fd, length, SEEK_SET) < 0) throw std::runtime_error("MergeLog: cannot cut " + path);
+    bytes = length;
+}
+
+mergelogreplay_t MergeLog::replay(uint64_t snapshotHeight, const std::string& snapshotHash, EntityStore& store, Heuristics& heuristics, MappedColumn<int>& reuseFrequency, AddressActivity& activity, std::vector<uint32_t>* outputs){
+    mergelogreplay_t result;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> data;
+    int in = ::open(path.c_str(), O_RDONLY);
+    if(in < 0 && errno != ENOENT) throw std::runtime_error("MergeLog: cannot open " + path);
+    if(in >= 0){
+        unsigned char buffer[1 << 16];
+        ssize_t got;
+        while((got = ::read(in, buffer, sizeof(buffer))) != 0){
+            if(got < 0 && errno == EINTR) continue;
+            if(got < 0){
+                close(in);
+                throw std::runtime_error("MergeLog: cannot read " + path);
+            }
+            data.insert(data.end(), buffer, buffer + got);
+        }
+        close(in);
+    }
+    /* No log, or one whose header was cut short while a checkpoint started it over, has nothing past the snapshot */
+    if(data.size() < sizeof(mergelogheader_t)){
+        reset(snapshotHeight, snapshotHash);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+    mergelogheader_t header;
+    std::memcpy(&header, &data[0], sizeof(header));
+    if(std::memcmp(header.magic, mergeLogMagic, sizeof(mergeLogMagic)) != 0) throw std::runtime_error("MergeLog: " + path + " is not a write-ahead log");
+    if(header.version != mergeLogVersion) throw std::runtime_error("MergeLog: unsupported version " + std::to_string(header.version));
+    /* noHeight plus one wraps to block 0 */
+    if(header.baseHeight + 1 > snapshotHeight + 1){
+        throw std::runtime_error("MergeLog: " + path + " starts after block " + std::to_string(header.baseHeight) + " but the snapshot ends " + (snapshotHeight == noHeight ? std::string("before the first block") : "at block " + std::to_string(snapshotHeight)));
+    }
+    /* Same height but another block, the log was started after a snapshot of another branch or of another run and its merges were made on a different clustering */
+    std::string baseHash = hashText(header.baseHash);
+    if(header.baseHeight == snapshotHeight && snapshotHeight != noHeight && !baseHash.empty() && !snapshotHash.empty() && baseHash != snapshotHash){
+        throw std::runtime_error("MergeLog: " + path + " starts after block " + std::to_string(header.baseHeight) + " " + baseHash + " but the snapshot ends at block " + std::to_string(snapshotHeight) + " " + snapshotHash);
+    }
+
+    uint64_t valid = sizeof(header), last = snapshotHeight;
+    std::vector<uint32_t> ids;
+    while(valid + 8 <= data.size()){
+        uint32_t length, crc;
+        std::memcpy(&length, &data[valid], 4);
+        std::memcpy(&crc, &data[valid + 4], 4);
+        if(data.size() - valid - 8 < length || crc32(crc32(0, Z_NULL, 0), &data[valid + 8], length) != crc) break;
+        logcursor_t c;
+        c.p = &data[valid + 8];
+        c.end = c.p + length;
+        uint32_t height = c.u32();
+        const unsigned char* hash = c.take(32);
+        valid += 8 + length;
+        if(snapshotHeight != noHeight && height <= snapshotHeight){
+            result.skipped++;
+            continue;
+        }
+        /* A run given a --start past the snapshot leaves a gap, the blocks only have to go up */
+        if(last != noHeight && height <= last) throw std::runtime_error("MergeLog: block " + std::to_string(height) + " follows block " + std::to_string(last) + " in " + path);
+
+        ids.resize(c.u32());
+        for(uint32_t& id : ids){
+            uint32_t len = c.u32();
+            const char* name = (const char*) c.take(len);
+            id = addressTable.intern(std::string(name, len));
+        }
+        if(reuseFrequency.size() < addressTable.size()) reuseFrequency.resize(addressTable.size(), 0);
+        auto idOf = [&](uint32_t local){
+            if(local >= ids.size()) throw std::runtime_error("MergeLog: address out of range in block " + std::to_string(height));
+            return ids[local];
+        };
+        uint32_t outputCount = c.u32();
+        for(uint32_t i = 0; i < outputCount; i++){
+            uint32_t id = idOf(c.u32());
+            reuseFrequency[id]++;
+            if(outputs) outputs->push_back(id);
+        }
+        proposals.resize(c.u32());
+        for(proposal_t& proposal : proposals){
+            proposal.wallet1 = idOf(c.u32());
+            uint32_t wallet2 = c.u32();
+            proposal.wallet2 = wallet2 == proposal_t::ensureOnly ? wallet2 : idOf(wallet2);
+            proposal.heuristic = c.u32();
+        }
+        heuristics.applyProposals(store, proposals);
+        std::vector<uint32_t> flowEnds(c.u32());
+        for(uint32_t& end : flowEnds) end = c.u32();
+        flows.resize(c.u32());
+        for(walletflow_t& flow : flows){
+            flow.wallet = idOf(c.u32());
+            flow.received = c.i64();
+            flow.sent = c.i64();
+        }
+        uint32_t begin = 0;
+        for(uint32_t end : flowEnds){
+            if(end < begin || end > flows.size()) throw std::runtime_error("MergeLog: transaction out of range in block " + std::to_string(height));
+            activity.recordTransaction(height, flows.data() + begin, flows.data() + end, &store);
+            begin = end;
+        }
+        last = height;
+        result.blocks++;
+        result.lastHeight = height;
+        result.lastHash = hashText(hash);
+    }
+    result.tornTail = valid < data.size();
+    openAt(valid);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void MergeLog::append(uint32_t height, const std::string& hash, transactions_t& transactions, const Heuristics& heuristics){
+    static Counter& records = metrics.counter("wal_records_total", "Blocks appended to the write-ahead log");
+    static Counter& recordBytes = metrics.counter("wal_bytes_total", "Bytes appended to the write-ahead log");
+    static Histogram& appendSeconds = metrics.histogram("wal_append_seconds", "Writing of the record of one block to the write-ahead log");
+    if(fd < 0) throw std::runtime_error("MergeLog: " + path + " is not open, it is opened by replay or reset");
+    StageTimer timer(appendSeconds, "wal_append", height);
+
+    /* The addresses of the record, an input or an output of the block is all a proposal or a flow can refer to */
+    addresses.clear();
+    localOf.clear();
+    auto localFor = [&](uint32_t id){
+        auto inserted = localOf.insert({id, (uint32_t) addresses.size()});
+        if(inserted.second) addresses.push_back(id);
+        return inserted.first->second;
+    };
+    for(getrawtransaction_t& transaction : transactions){
+        for(vin_t& in : transaction.vin) if(!in.isCoinbase) localFor(in.scriptSig.address);
+        for(vout_t& out : transaction.vout) if(!out.unspendable) localFor(out.scriptPubKey.addresses[0]);
+    }
+
+    record.assign(8, 0);
+    put32(record, height);
+    unsigned char hashed[32];
+    hashBytes(hash, hashed);
+    record.insert(record.end(), hashed, hashed + 32);
+    put32(record, addresses.size());
+    for(uint32_t id : addresses){
+        const std::string& name = addressTable.name(id);
+        put32(record, name.size());
+        record.insert(record.end(), name.begin(), name.end());
+    }
+    uint32_t outputCount = 0;
+    for(getrawtransaction_t& transaction : transactions){
+        for(vout_t& out : transaction.vout) if(!out.unspendable) outputCount++;
+    }
+    put32(record, outputCount);
+    for(getrawtransaction_t& transaction : transactions){
+        for(vout_t& out : transaction.vout) if(!out.unspendable) put32(record, localOf[out.scriptPubKey.addresses[0]]);
+    }
+    proposals.clear();
+    heuristics.blockProposals(proposals);
+    put32(record, proposals.size());
+    for(proposal_t& proposal : proposals){
+        put32(record, localOf.at(proposal.wallet1));
+        put32(record, proposal.wallet2 == proposal_t::ensureOnly ? proposal_t::ensureOnly : localOf.at(proposal.wallet2));
+        put32(record, proposal.heuristic);
+    }
+    /* The flows are summed per transaction the same way AddressActivity::record does, the ends first and the flows after */
+    blockFlows.clear();
+    put32(record, transactions.size());
+    for(getrawtransaction_t& transaction : transactions){
+        AddressActivity::flowsOf(transaction, flows);
+        blockFlows.insert(blockFlows.end(), flows.begin(), flows.end());
+        put32(record, blockFlows.size());
+    }
+    put32(record, blockFlows.size());
+    for(walletflow_t& flow : blockFlows){
+        put32(record, localOf[flow.wallet]);
+        put64(record, flow.received);
+        put64(record, flow.sent);
+    }
+
+    uint32_t length = record.size() - 8, crc = crc32(crc32(0, Z_NULL, 0), &record[8], length);
+    std::memcpy(&record[0], &length, 4);
+    std::memcpy(&record[4], &crc, 4);
+    writeAll(fd, &record[0], record.size(), path);
+    if(sync && fdatasync(fd) != 0) throw std::runtime_error("MergeLog: cannot sync " + path);
+    bytes += record.size();
+    records.add();
+    recordBytes.add(record.size());
+}
+
+/* The header is rewritten in place, a crash before it is complete leaves a log too short to have a header, which replays as empty */
+void MergeLog::reset(uint64_t height, const std::string& hash){
+    openAt(0);
+    mergelogheader_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, mergeLogMagic, sizeof(header.magic));
+    header.version = mergeLogVersion;
+    header.baseHeight = height;
+    hashBytes(hash, header.baseHash);
+    writeAll(fd, (const unsigned char*) &header, sizeof(header), path);
+    if(fdatasync(fd) != 0) throw std::runtime_error("MergeLog: cannot sync " + path);
+    bytes = sizeof(header);
+}
+
+uint64_t MergeLog::size() const{
+    return bytes;
+}
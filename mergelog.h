@@ -0,0 +1,85 @@
+#ifndef MERGELOG_H
+#define MERGELOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "definition.h"
+#include "activity.h"
+#include "heuristics.h"
+#include "entitystore.h"
+#include "mappedcolumn.h"
+
+/* Write-ahead log of the blocks clustered since the last snapshot, kept next to it in FILE.wal. Every block clustered appends one record with what it did to the clustering, so a process that dies between two checkpoints only loses the block it was in: a restart loads the snapshot and replays the log instead of fetching the blocks again. A checkpoint starts the log over once the snapshot is on disk.
+
+   All integers are little endian:
+     header     64 bytes, see mergelogheader_t, baseHeight is the last block of the snapshot the log was started after
+     records    u32 length, u32 CRC-32 of the payload, then the payload:
+                  u32 height, u8[32] block hash, zeros when unknown
+                  u32 addressCount, then the addresses the block touched, each a u32 length and the string
+                  u32 outputCount, u32 outputs[], the address of every output that has one, whose reuse count goes up by one
+                  u32 proposalCount, mergelogproposal_t proposals[], the merges of the heuristics in the order they were applied
+                  u32 transactionCount, u32 flowEnds[], where the flows of each transaction end
+                  u32 flowCount, then what each transaction moved for each of its addresses, each a u32 address, i64 received and i64 sent
+                The addresses of the outputs, proposals and flows are indexes into the addresses of the record, the IDs of the address table are not the same after a restart.
+   A record cut short or with the wrong CRC ends the log, it is the block the process died in. */
+
+struct mergelogheader_t{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t baseHeight;
+    unsigned char baseHash[32];
+    uint64_t reserved;
+};
+
+struct mergelogproposal_t{
+    uint32_t wallet1;
+    uint32_t wallet2;
+    uint32_t heuristic;
+};
+
+/* What a replay found and did, lastHeight is noHeight when no block was replayed */
+struct mergelogreplay_t{
+    uint64_t blocks = 0;
+    uint64_t skipped = 0;
+    uint64_t lastHeight = UINT64_MAX;
+    std::string lastHash;
+    bool tornTail = false;
+    double seconds = 0;
+};
+
+class MergeLog{
+    public:
+    /* With sync every record is on disk before the next block, otherwise it is handed to the kernel, which is enough to survive the process but not the machine */
+    MergeLog(const std::string& path, bool sync = false);
+    ~MergeLog();
+    MergeLog(const MergeLog&) = delete;
+    MergeLog& operator=(const MergeLog&) = delete;
+    /* Applies the blocks of the log past the snapshot ending at snapshotHeight, the ones the snapshot already covers are skipped since a checkpoint can die between the snapshot and the start of the new log. A log started after a block of the same height as the snapshot but with another hash is refused. The addresses whose reuse count moved are appended to outputs when it is given. The log is then kept open to append to, a torn record at the end is cut off */
+    mergelogreplay_t replay(uint64_t snapshotHeight, const std::string& snapshotHash, EntityStore& store, Heuristics& heuristics, MappedColumn<int>& reuseFrequency, AddressActivity& activity, std::vector<uint32_t>* outputs = nullptr);
+    /* Records the block just clustered, it must be higher than the previous block of the log */
+    void append(uint32_t height, const std::string& hash, transactions_t& transactions, const Heuristics& heuristics);
+    /* Empties the log after a checkpoint whose snapshot covers up to height */
+    void reset(uint64_t height, const std::string& hash);
+    uint64_t size() const;
+    private:
+    std::string path;
+    bool sync;
+    int fd;
+    uint64_t bytes;
+    /* Kept between blocks so their memory is reused */
+    std::vector<unsigned char> record;
+    std::vector<proposal_t> proposals;
+    std::vector<walletflow_t> flows;
+    std::vector<walletflow_t> blockFlows;
+    std::vector<uint32_t> addresses;
+    std::unordered_map<uint32_t, uint32_t> localOf;
+
+    /* Opens the log to append after its first length bytes, the rest is cut off */
+    void openAt(uint64_t length);
+};
+
+#endif
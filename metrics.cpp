@@ -0,0 +1,264 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <unistd.h>
+#include <jsoncpp/json/json.h>
+
+Metrics metrics;
+Tracer tracer;
+
+Histogram::Histogram() : observations(0), sumNanos(0)
+{
+    for(int i = 0; i <= bucketCount; i++) buckets[i].store(0, std::memory_order_relaxed);
+}
+
+double Histogram::bound(int i){
+    return std::ldexp(1e-6, i);
+}
+
+void Histogram::observe(std::chrono::steady_clock::duration elapsed){
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    /* Bucket i holds up to 2^i microseconds, found from the position of the highest bit */
+    uint64_t micros = nanos / 1000;
+    int i = 0;
+    while(i < bucketCount && (micros >> i) != 0) i++;
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    observations.fetch_add(1, std::memory_order_relaxed);
+    sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+void Histogram::observeSeconds(double seconds){
+    observe(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+
+uint64_t Histogram::count() const{
+    return observations.load(std::memory_order_relaxed);
+}
+
+double Histogram::sumSeconds() const{
+    return sumNanos.load(std::memory_order_relaxed) / 1e9;
+}
+
+uint64_t Histogram::bucket(int i) const{
+    return buckets[i].load(std::memory_order_relaxed);
+}
+
+double Histogram::quantile(double q) const{
+    uint64_t total = 0;
+    for(int i = 0; i <= bucketCount; i++) total += bucket(i);
+    if(total == 0) return 0;
+    uint64_t seen = 0;
+    for(int i = 0; i < bucketCount; i++){
+        seen += bucket(i);
+        if(seen >= q * total) return bound(i);
+    }
+    return bound(bucketCount);
+}
+
+/* Called with the lock held */
+Metrics::entry_t& Metrics::find(const std::string& name, const std::string& help, const std::string& labels, kind_t kind){
+    std::string key = labels.empty() ? name : name + "{" + labels + "}";
+    auto it = entries.find(key);
+    if(it != entries.end()){
+        if(it->second.kind != kind) throw std::logic_error("Metrics: " + key + " is registered with another type");
+        return it->second;
+    }
+    entry_t entry = {name, labels, help, kind, 0};
+    if(kind == counterKind) entry.index = counters.size(), counters.emplace_back();
+    else if(kind == gaugeKind) entry.index = gauges.size(), gauges.emplace_back();
+    else entry.index = histograms.size(), histograms.emplace_back();
+    return entries.insert(std::make_pair(key, entry)).first->second;
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels){
+    std::lock_guard<std::mutex> guard(lock);
+    entry_t& entry = find(name, help, labels, counterKind);
+    return counters[entry.index];
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels){
+    std::lock_guard<std::mutex> guard(lock);
+    entry_t& entry = find(name, help, labels, gaugeKind);
+    return gauges[entry.index];
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels){
+    std::lock_guard<std::mutex> guard(lock);
+    entry_t& entry = find(name, help, labels, histogramKind);
+    return histograms[entry.index];
+}
+
+static std::string number(double value){
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.10g", value);
+    return buf;
+}
+
+/* The resident size is read when the metrics are rendered rather than kept up to date, before taking the lock since registering the gauge takes it too */
+void Metrics::sampleProcess(){
+    long pages = 0, residentPages = 0;
+    std::FILE* statm = std::fopen("/proc/self/statm", "r");
+    if(!statm) return;
+    if(std::fscanf(statm, "%ld %ld", &pages, &residentPages) != 2) residentPages = 0;
+    std::fclose(statm);
+    gauge("process_resident_bytes", "Resident size of the process").set((double) residentPages * sysconf(_SC_PAGESIZE));
+}
+
+/* The entries are sorted by name so the labelled series of a family follow each other under one HELP and TYPE */
+std::string Metrics::prometheus(){
+    sampleProcess();
+    std::lock_guard<std::mutex> guard(lock);
+    std::string out, family;
+    static const char* types[] = {"counter", "gauge", "histogram"};
+    for(auto& it : entries){
+        entry_t& entry = it.second;
+        if(entry.name != family){
+            family = entry.name;
+            out += "# HELP " + entry.name + " " + entry.help + "\n# TYPE " + entry.name + " " + types[entry.kind] + "\n";
+        }
+        std::string labels = entry.labels.empty() ? std::string() : "{" + entry.labels + "}";
+        if(entry.kind == counterKind) out += entry.name + labels + " " + std::to_string(counters[entry.index].get()) + "\n";
+        else if(entry.kind == gaugeKind) out += entry.name + labels + " " + number(gauges[entry.index].get()) + "\n";
+        else{
+            Histogram& histogram = histograms[entry.index];
+            std::string prefix = entry.labels.empty() ? std::string() : entry.labels + ",";
+            uint64_t cumulative = 0;
+            for(int i = 0; i < Histogram::bucketCount; i++){
+                cumulative += histogram.bucket(i);
+                out += entry.name + "_bucket{" + prefix + "le=\"" + number(Histogram::bound(i)) + "\"} " + std::to_string(cumulative) + "\n";
+            }
+            cumulative += histogram.bucket(Histogram::bucketCount);
+            out += entry.name + "_bucket{" + prefix + "le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+            out += entry.name + "_sum" + labels + " " + number(histogram.sumSeconds()) + "\n";
+            out += entry.name + "_count" + labels + " " + std::to_string(histogram.count()) + "\n";
+        }
+    }
+    return out;
+}
+
+std::string Metrics::json(std::map<std::string, uint64_t>* previous, double seconds){
+    sampleProcess();
+    Json::Value out;
+    out["time_ms"] = (Json::Int64) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for(auto& it : entries){
+            entry_t& entry = it.second;
+            if(entry.kind == counterKind){
+                uint64_t value = counters[entry.index].get();
+                out["counters"][it.first] = (Json::UInt64) value;
+                if(previous){
+                    if(seconds > 0) out["rates"][it.first] = (value - (*previous)[it.first]) / seconds;
+                    (*previous)[it.first] = value;
+                }
+            }
+            else if(entry.kind == gaugeKind) out["gauges"][it.first] = gauges[entry.index].get();
+            else{
+                Histogram& histogram = histograms[entry.index];
+                Json::Value& summary = out["histograms"][it.first];
+                summary["count"] = (Json::UInt64) histogram.count();
+                summary["sum"] = histogram.sumSeconds();
+                summary["p50"] = histogram.quantile(0.5);
+                summary["p99"] = histogram.quantile(0.99);
+            }
+        }
+    }
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    writer["precision"] = 10;
+    return Json::writeString(writer, out);
+}
+
+MetricsLogger::MetricsLogger(const std::string& path, int intervalSeconds)
+: file(path == "-" ? stdout : std::fopen(path.c_str(), "a")), intervalSeconds(intervalSeconds), stopping(false), last(std::chrono::steady_clock::now())
+{
+    if(!file) throw std::runtime_error("MetricsLogger: cannot open " + path);
+    /* The first line sets the base of the rates */
+    metrics.json(&previous, 0);
+    writer = std::thread(&MetricsLogger::run, this);
+}
+
+MetricsLogger::~MetricsLogger(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    writeLine();
+    if(file != stdout) std::fclose(file);
+}
+
+void MetricsLogger::run(){
+    std::unique_lock<std::mutex> guard(lock);
+    while(!wake.wait_for(guard, std::chrono::seconds(intervalSeconds), [this]{ return stopping; })){
+        guard.unlock();
+        writeLine();
+        guard.lock();
+    }
+}
+
+void MetricsLogger::writeLine(){
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::string line = metrics.json(&previous, std::chrono::duration<double>(now - last).count());
+    last = now;
+    std::fprintf(file, "%s\n", line.c_str());
+    std::fflush(file);
+}
+
+Tracer::Tracer() : active(false), file(nullptr), first(true)
+{
+}
+
+Tracer::~Tracer(){
+    close();
+}
+
+void Tracer::open(const std::string& path){
+    std::lock_guard<std::mutex> guard(lock);
+    file = std::fopen(path.c_str(), "w");
+    if(!file) throw std::runtime_error("Tracer: cannot create " + path);
+    std::fputs("[\n", file);
+    first = true;
+    origin = std::chrono::steady_clock::now();
+    active = true;
+}
+
+void Tracer::close(){
+    std::lock_guard<std::mutex> guard(lock);
+    if(!file) return;
+    active = false;
+    std::fputs("\n]\n", file);
+    std::fclose(file);
+    file = nullptr;
+}
+
+/* Small thread numbers read better in the viewer than the system ones */
+static int traceThread(){
+    static std::atomic<int> threads(0);
+    static thread_local int id = ++threads;
+    return id;
+}
+
+void Tracer::span(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end, int64_t height){
+    int tid = traceThread();
+    std::lock_guard<std::mutex> guard(lock);
+    if(!file) return;
+    double ts = std::chrono::duration<double, std::micro>(begin - origin).count();
+    double dur = std::chrono::duration<double, std::micro>(end - begin).count();
+    std::fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", first ? "" : ",\n", name, tid, ts, dur);
+    if(height >= 0) std::fprintf(file, ",\"args\":{\"height\":%lld}", (long long) height);
+    std::fputs("}", file);
+    first = false;
+}
+
+StageTimer::StageTimer(Histogram& histogram, const char* name, int64_t height) : histogram(histogram), name(name), height(height), begin(std::chrono::steady_clock::now())
+{
+}
+
+StageTimer::~StageTimer(){
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    histogram.observe(end - begin);
+    if(tracer.enabled()) tracer.span(name, begin, end, height);
+}
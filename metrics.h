@@ -0,0 +1,139 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+/* The instruments are updated with relaxed atomics and never lock, they are cheap enough to stay on in every run. They are registered once in the Metrics registry and kept by reference at the places they are updated */
+
+class Counter{
+    public:
+    Counter() : value(0) {}
+    void add(uint64_t n = 1){ value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const{ return value.load(std::memory_order_relaxed); }
+    private:
+    std::atomic<uint64_t> value;
+};
+
+/* Set by the thread that owns what it measures, typically the ingestion thread after each block */
+class Gauge{
+    public:
+    Gauge() : value(0) {}
+    void set(double v){ value.store(v, std::memory_order_relaxed); }
+    double get() const{ return value.load(std::memory_order_relaxed); }
+    private:
+    std::atomic<double> value;
+};
+
+/* Durations in buckets that double from 1 microsecond to about 2 minutes, the last bucket takes everything longer */
+class Histogram{
+    public:
+    static const int bucketCount = 28;
+    Histogram();
+    void observe(std::chrono::steady_clock::duration elapsed);
+    void observeSeconds(double seconds);
+    uint64_t count() const;
+    double sumSeconds() const;
+    /* Upper bound in seconds of bucket i */
+    static double bound(int i);
+    uint64_t bucket(int i) const;
+    /* The upper bound of the bucket holding the q quantile, 0 when nothing was observed */
+    double quantile(double q) const;
+    private:
+    std::atomic<uint64_t> buckets[bucketCount + 1];
+    std::atomic<uint64_t> observations;
+    std::atomic<uint64_t> sumNanos;
+};
+
+/* Names every instrument, with optional labels in the Prometheus syntax (method="getblock"), and renders them all as Prometheus text or as one JSON object. Asking for a name that is already there returns the same instrument */
+class Metrics{
+    public:
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+    std::string prometheus();
+    /* With previous given the counters also get their rate per second over the seconds since the values it holds, which are then replaced */
+    std::string json(std::map<std::string, uint64_t>* previous = nullptr, double seconds = 0);
+    private:
+    enum kind_t { counterKind, gaugeKind, histogramKind };
+    struct entry_t{
+        std::string name;
+        std::string labels;
+        std::string help;
+        kind_t kind;
+        size_t index;
+    };
+    std::mutex lock;
+    /* Deques so that the instruments never move once handed out */
+    std::deque<Counter> counters;
+    std::deque<Gauge> gauges;
+    std::deque<Histogram> histograms;
+    std::map<std::string, entry_t> entries;
+
+    entry_t& find(const std::string& name, const std::string& help, const std::string& labels, kind_t kind);
+    void sampleProcess();
+};
+
+extern Metrics metrics;
+
+/* Appends a line of metrics.json to a file, - being the standard output, at every interval and once more when it is destroyed so the end of a run is always in the log */
+class MetricsLogger{
+    public:
+    MetricsLogger(const std::string& path, int intervalSeconds);
+    ~MetricsLogger();
+    private:
+    std::FILE* file;
+    int intervalSeconds;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::map<std::string, uint64_t> previous;
+    std::chrono::steady_clock::time_point last;
+    std::thread writer;
+
+    void run();
+    void writeLine();
+};
+
+/* Writes spans in the Chrome trace event format, the file opens in chrome://tracing or Perfetto. Spans are only kept while a file is open, the events are written as they end in the array form, which the viewers read even when the process was killed before the closing bracket */
+class Tracer{
+    public:
+    Tracer();
+    ~Tracer();
+    void open(const std::string& path);
+    void close();
+    bool enabled() const{ return active.load(std::memory_order_relaxed); }
+    /* A span of the calling thread, height is added to the arguments unless it is negative */
+    void span(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end, int64_t height);
+    private:
+    std::atomic<bool> active;
+    std::mutex lock;
+    std::FILE* file;
+    bool first;
+    std::chrono::steady_clock::time_point origin;
+};
+
+extern Tracer tracer;
+
+/* Times the scope into a histogram and, when tracing, into a span named after the stage */
+class StageTimer{
+    public:
+    StageTimer(Histogram& histogram, const char* name, int64_t height = -1);
+    ~StageTimer();
+    private:
+    Histogram& histogram;
+    const char* name;
+    int64_t height;
+    std::chrono::steady_clock::time_point begin;
+};
+
+#endif
@@ -0,0 +1,279 @@
+/* A stand-in for bitcoind that serves a deterministic synthetic chain over JSON-RPC, it is used to measure how many requests and how much time the ingestion takes per block without a real node. It answers getblockhash, getblockcount, getbestblockhash, getblockheader, getblock (verbosity 1 and 3), getrawtransaction (verbosity 2), batches of these, and stop which prints the request counts and exits. The chain can also grow while it runs and reorganize its last blocks every so often, to exercise following the tip */
+
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <jsoncpp/json/json.h>
+
+#include "httpserver.h"
+
+int blocks = 1000;
+int txPerBlock = 200;
+/* A new block every growMillis when it is not 0, up to growLimit new blocks when that is not 0, and every reorgEvery new blocks the last reorgDepth blocks are replaced by a fork */
+int growMillis = 0;
+int growLimit = 0;
+int reorgEvery = 0;
+int reorgDepth = 2;
+
+/* The branch of every height of the current chain, a fork gives the blocks it replaces a new branch number which goes in their hashes, txids and addresses. Branch 0 is the original chain */
+std::mutex chainLock;
+std::vector<int> branches;
+int reorgs = 0;
+/* The branch of the parent of each block made while running, keyed by height and branch, so that a block forked away still has the same content and parent. The blocks of the initial chain are all on branch 0 */
+std::map<std::pair<int,int>, int> parentBranches;
+
+int tipHeight(){
+    std::lock_guard<std::mutex> guard(chainLock);
+    return blocks - 1;
+}
+
+int branchOf(int height){
+    std::lock_guard<std::mutex> guard(chainLock);
+    return height >= 0 && height < (int) branches.size() ? branches[height] : 0;
+}
+
+int parentBranchOf(int height, int branch){
+    std::lock_guard<std::mutex> guard(chainLock);
+    auto it = parentBranches.find(std::make_pair(height, branch));
+    return it == parentBranches.end() ? 0 : it->second;
+}
+
+std::mutex statsLock;
+std::map<std::string, uint64_t> callsPerMethod;
+std::atomic<uint64_t> roundTrips(0);
+std::atomic<bool> stopRequested(false);
+
+/* The hashes and txids carry the branch, height and index in them so that they can be decoded back without keeping any state */
+std::string blockhash(int height, int branch){
+    char buf[65];
+    std::snprintf(buf, sizeof(buf), "%08x%056x", branch, height);
+    return buf;
+}
+
+std::string blockhash(int height){
+    return blockhash(height, branchOf(height));
+}
+
+std::string txid(int height, int branch, int index){
+    char buf[65];
+    std::snprintf(buf, sizeof(buf), "%08x%024x%032x", branch, height, index);
+    return buf;
+}
+
+std::string address(int height, int branch, int index, int n){
+    std::string name = "mock" + std::to_string(height) + "x" + std::to_string(index) + "x" + std::to_string(n);
+    return branch == 0 ? name : name + "b" + std::to_string(branch);
+}
+
+Json::Value scriptPubKey(const std::string& addr){
+    Json::Value script;
+    script["asm"] = "OP_DUP OP_HASH160 " + addr + " OP_EQUALVERIFY OP_CHECKSIG";
+    script["hex"] = "76a914" + addr + "88ac";
+    script["type"] = "pubkeyhash";
+    script["address"] = addr;
+    return script;
+}
+
+/* Transaction 0 is the coinbase, every other transaction spends both outputs of the transaction with the same index in the previous block and some of them also spend the coinbase, outputs are a payment and a change, and every tenth payment goes back to an address already used so that reuse shows up */
+Json::Value transaction(int height, int branch, int index){
+    Json::Value tx;
+    tx["txid"] = txid(height, branch, index);
+    tx["hash"] = tx["txid"];
+    tx["version"] = 2;
+    tx["vin"] = Json::Value(Json::arrayValue);
+    tx["vout"] = Json::Value(Json::arrayValue);
+    if(index == 0){
+        Json::Value in;
+        in["coinbase"] = "03" + txid(height, branch, 0).substr(0, 8);
+        in["sequence"] = 4294967295u;
+        tx["vin"].append(in);
+        Json::Value out;
+        out["value"] = 50.0;
+        out["n"] = 0;
+        out["scriptPubKey"] = scriptPubKey(address(height, branch, 0, 0));
+        tx["vout"].append(out);
+        return tx;
+    }
+    int inputs = (index % 3 == 0 && height > 0) ? 3 : 2;
+    int prevBranch = parentBranchOf(height, branch);
+    for(int n = 0; n < inputs; n++){
+        Json::Value in;
+        int prevHeight = height > 0 ? height - 1 : 0;
+        int prevIndex = n < 2 ? index : 0;
+        in["txid"] = txid(prevHeight, prevBranch, prevIndex);
+        in["vout"] = n < 2 ? n : 0;
+        in["scriptSig"]["asm"] = "";
+        in["scriptSig"]["hex"] = "";
+        in["prevout"]["generated"] = prevIndex == 0;
+        in["prevout"]["height"] = prevHeight;
+        in["prevout"]["value"] = n < 2 ? 0.5 : 50.0;
+        in["prevout"]["scriptPubKey"] = scriptPubKey(address(prevHeight, prevBranch, prevIndex, n < 2 ? n : 0));
+        in["sequence"] = 4294967295u;
+        tx["vin"].append(in);
+    }
+    for(int n = 0; n < 2; n++){
+        Json::Value out;
+        out["value"] = n == 0 ? 0.7 : 0.3;
+        out["n"] = n;
+        bool reused = n == 0 && index % 10 == 0 && height > 0;
+        out["scriptPubKey"] = scriptPubKey(reused ? address(height - 1, prevBranch, index, 0) : address(height, branch, index, n));
+        tx["vout"].append(out);
+    }
+    return tx;
+}
+
+int heightOf(const std::string& hash){
+    return (int) std::strtol(hash.substr(8).c_str(), nullptr, 16);
+}
+
+int branchOf(const std::string& hash){
+    return (int) std::strtol(hash.substr(0, 8).c_str(), nullptr, 16);
+}
+
+/* A block that was forked away is still served, like a node keeps stale blocks, but it has -1 confirmations */
+Json::Value header(const std::string& hash){
+    int height = heightOf(hash), branch = branchOf(hash), tip = tipHeight();
+    if(height > tip) throw std::runtime_error("Block not found");
+    Json::Value block;
+    block["hash"] = blockhash(height, branch);
+    block["height"] = height;
+    block["confirmations"] = branchOf(height) == branch ? tip - height + 1 : -1;
+    block["time"] = 1231006505 + height * 600;
+    if(height > 0) block["previousblockhash"] = blockhash(height - 1, parentBranchOf(height, branch));
+    return block;
+}
+
+Json::Value call(const std::string& method, const Json::Value& params){
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        callsPerMethod[method]++;
+    }
+    if(method == "getblockcount") return tipHeight();
+    if(method == "getblockhash"){
+        int height = params[0].asInt();
+        if(height < 0 || height > tipHeight()) throw std::runtime_error("Block height out of range");
+        return blockhash(height);
+    }
+    if(method == "getbestblockhash") return blockhash(tipHeight());
+    if(method == "getblockheader") return header(params[0].asString());
+    if(method == "getblock"){
+        std::string hash = params[0].asString();
+        int height = heightOf(hash), branch = branchOf(hash);
+        int verbosity = params.size() > 1 ? params[1].asInt() : 1;
+        Json::Value block = header(hash);
+        block["tx"] = Json::Value(Json::arrayValue);
+        for(int i = 0; i < txPerBlock; i++){
+            if(verbosity >= 2) block["tx"].append(transaction(height, branch, i));
+            else block["tx"].append(txid(height, branch, i));
+        }
+        return block;
+    }
+    if(method == "getrawtransaction"){
+        std::string id = params[0].asString();
+        Json::Value tx = transaction((int) std::strtol(id.substr(8, 24).c_str(), nullptr, 16), (int) std::strtol(id.substr(0, 8).c_str(), nullptr, 16), (int) std::strtol(id.substr(32).c_str(), nullptr, 16));
+        return tx;
+    }
+    if(method == "stop"){
+        stopRequested = true;
+        return "Mock RPC server stopping";
+    }
+    throw std::runtime_error("Method not found");
+}
+
+Json::Value reply(const Json::Value& request){
+    Json::Value response;
+    response["id"] = request["id"];
+    try{
+        response["result"] = call(request["method"].asString(), request["params"]);
+        response["error"] = Json::Value();
+    }
+    catch(const std::exception& e){
+        response["result"] = Json::Value();
+        response["error"]["code"] = -1;
+        response["error"]["message"] = e.what();
+    }
+    return response;
+}
+
+httpresponse_t handle(const std::string& method, const std::string& target, const std::string& body){
+    httpresponse_t response;
+    response.contentType = "application/json";
+    roundTrips++;
+    Json::Value request, result;
+    Json::CharReaderBuilder reader;
+    std::string errors;
+    std::istringstream stream(body);
+    /* Like the daemon the calls are answered at the root, or at a wallet path */
+    if(target != "/" && target.compare(0, 8, "/wallet/") != 0){
+        response.status = 404;
+        response.body = "";
+        return response;
+    }
+    if(method != "POST" || !Json::parseFromStream(reader, stream, &request, &errors)){
+        response.status = 400;
+        response.body = "{\"result\":null,\"error\":{\"code\":-32700,\"message\":\"Parse error\"},\"id\":null}";
+        return response;
+    }
+    if(request.isArray()){
+        result = Json::Value(Json::arrayValue);
+        for(Json::ValueIterator it = request.begin(); it != request.end(); it++) result.append(reply(*it));
+    }
+    else result = reply(request);
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    response.status = 200;
+    response.body = Json::writeString(writer, result) + "\n";
+    return response;
+}
+
+int main(int argc, char** argv){
+    int port = 18332;
+    for(int i = 1; i + 1 < argc; i += 2){
+        std::string arg = argv[i];
+        if(arg == "--port") port = std::atoi(argv[i + 1]);
+        else if(arg == "--blocks") blocks = std::atoi(argv[i + 1]);
+        else if(arg == "--txs") txPerBlock = std::atoi(argv[i + 1]);
+        else if(arg == "--grow-ms") growMillis = std::atoi(argv[i + 1]);
+        else if(arg == "--grow-limit") growLimit = std::atoi(argv[i + 1]);
+        else if(arg == "--reorg-every") reorgEvery = std::atoi(argv[i + 1]);
+        else if(arg == "--reorg-depth") reorgDepth = std::atoi(argv[i + 1]);
+        else{
+            std::cerr << "Usage: mockrpc [--port 18332] [--blocks 1000] [--txs 200] [--grow-ms 0] [--grow-limit 0] [--reorg-every 0] [--reorg-depth 2]" << std::endl;
+            return 1;
+        }
+    }
+    branches.assign(blocks, 0);
+    HttpServer server("127.0.0.1", port, handle);
+    server.start();
+    std::cout << "Mock RPC server on port " << server.getPort() << " with " << blocks << " blocks of " << txPerBlock << " transactions" << std::endl;
+    int grown = 0;
+    while(!stopRequested){
+        usleep(growMillis > 0 ? growMillis * 1000 : 100000);
+        if(growMillis <= 0 || (growLimit > 0 && grown >= growLimit)) continue;
+        std::lock_guard<std::mutex> guard(chainLock);
+        parentBranches[std::make_pair(blocks, 0)] = branches[blocks - 1];
+        blocks++;
+        branches.push_back(0);
+        grown++;
+        if(reorgEvery > 0 && grown % reorgEvery == 0){
+            reorgs++;
+            int first = std::max(1, blocks - reorgDepth);
+            for(int height = first; height < blocks; height++){
+                parentBranches[std::make_pair(height, reorgs)] = height == first ? branches[height - 1] : reorgs;
+                branches[height] = reorgs;
+            }
+            std::cout << "Reorganized the last " << reorgDepth << " blocks, tip " << blocks - 1 << std::endl;
+        }
+    }
+    server.stop();
+
+    std::cout << "HTTP requests: " << roundTrips << std::endl;
+    for(auto& a : callsPerMethod) std::cout << a.first << ": " << a.second << std::endl;
+}
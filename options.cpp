@@ -0,0 +1,153 @@
+#include "options.h"
+#include "heuristics.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+
+void printUsage(const char* program){
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --rpc-user USER        bitcoind RPC user (default bitcoin)\n"
+              << "  --rpc-password PASS    bitcoind RPC password (default password)\n"
+              << "  --rpc-host HOST        bitcoind RPC host (default 127.0.0.1)\n"
+              << "  --rpc-port PORT        bitcoind RPC port (default 8332)\n"
+              << "  --mongo-uri URI        MongoDB connection string (default mongodb://localhost:27017)\n"
+              << "  --start HEIGHT         first block to process, read from stdin when not given\n"
+              << "  --end HEIGHT           last block to process, read from stdin when not given\n"
+              << "  --fetchers N           threads downloading blocks (default 4)\n"
+              << "  --prefetch N           blocks that may be downloaded ahead of the clustering (default 16)\n"
+              << "  --blocks-dir DIR       read the blk*.dat files in DIR instead of using RPC, the blocks before\n"
+              << "                         --start are replayed to build the outpoint index\n"
+              << "  --checkpoint-interval N  blocks between two writes to MongoDB (default 50)\n"
+              << "  --snapshot FILE        load the clustering from FILE when it exists and write it there at every\n"
+              << "                         checkpoint, without --start the run resumes after the last block in it. The\n"
+              << "                         blocks clustered since are logged to FILE.wal and replayed at the next start\n"
+              << "  --wal-sync yes|no      sync the log to disk after every block, to survive a crash of the machine and\n"
+              << "                         not only of the process (default no)\n"
+              << "  --resume yes|no        restart after a crash: continue after the last block in the snapshot and its\n"
+              << "                         log, --start is only used when there is none yet, nothing is read from stdin\n"
+              << "  --mongo yes|no         read and write the clustering in MongoDB (default yes)\n"
+              << "  --reuse-prepass yes|no count the address reuse over the whole range before clustering it, the\n"
+              << "                         blocks are read twice (default no)\n"
+              << "  --workers N            threads evaluating the heuristics of a block (default one per core)\n"
+              << "  --heuristics LIST      the heuristics to run, IDs 1 to 5 separated by commas, a set other than all five\n"
+              << "                         runs without the compiled pipeline (default 1,2,3,4,5)\n"
+              << "  --shards N             backfill the range with N shards at once, each with its own --fetchers, the\n"
+              << "                         reuse is counted over the whole range first like --reuse-prepass (default 1)\n"
+              << "  --state-dir DIR        keep the addresses, the entities and the reuse counts in scratch files in DIR\n"
+              << "                         instead of the memory, for more addresses than fit in it (default off)\n"
+              << "  --address-filter yes|no  check a Bloom filter of the known addresses before the address table, new\n"
+              << "                         addresses then skip the table lookup (default no)\n"
+              << "  --full-transactions yes|no  keep the asm and hex of the scripts, for debugging (default no)\n"
+              << "  --follow yes|no        once the range is done keep clustering the new blocks of the daemon, without\n"
+              << "                         --end the range goes up to the current tip (default no)\n"
+              << "  --poll-interval MS     how often the daemon is asked for new blocks when following (default 1000)\n"
+              << "  --undo-depth N         blocks that can be rolled back on a reorg when following (default 100)\n"
+              << "  --query-port PORT      answer lookups on the clustering over HTTP on PORT, rebuilt at every checkpoint,\n"
+              << "                         and keep serving once the blocks are done (default off)\n"
+              << "  --query-host HOST      address the query service listens on (default 127.0.0.1)\n"
+              << "  --metrics-port PORT    serve the metrics on PORT, /metrics for Prometheus and /metrics.json (default off)\n"
+              << "  --metrics-host HOST    address the metrics are served on (default 127.0.0.1)\n"
+              << "  --metrics-log FILE     append a JSON line with every metric and the rates of the counters to FILE,\n"
+              << "                         - for the standard output\n"
+              << "  --metrics-interval S   seconds between two lines of --metrics-log (default 10)\n"
+              << "  --trace FILE           write the stages of every block to FILE in the Chrome trace format, it opens\n"
+              << "                         in chrome://tracing or Perfetto\n"
+              << "  --export DIR           once the run is done write the addresses and the entities to compressed column\n"
+              << "                         files in DIR for the analyses, see columnexport.h (default off)\n"
+              << "  --export-since HEIGHT  only export the entities and the addresses active after block HEIGHT, the height\n"
+              << "                         in the manifest.json of the previous export (default everything)\n";
+}
+
+/* Every option takes a value, unknown options or missing values print the usage and fail */
+bool parseOptions(int argc, char** argv, options_t& options){
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--help" || arg == "-h" || i + 1 >= argc){
+            printUsage(argv[0]);
+            return false;
+        }
+        std::string value = argv[++i];
+        if(arg == "--rpc-user") options.rpcUser = value;
+        else if(arg == "--rpc-password") options.rpcPassword = value;
+        else if(arg == "--rpc-host") options.rpcHost = value;
+        else if(arg == "--rpc-port") options.rpcPort = std::atoi(value.c_str());
+        else if(arg == "--mongo-uri") options.mongoUri = value;
+        else if(arg == "--start") options.startBlock = std::strtoul(value.c_str(), nullptr, 10), options.haveStart = true;
+        else if(arg == "--end") options.endBlock = std::strtoul(value.c_str(), nullptr, 10), options.haveEnd = true;
+        else if(arg == "--fetchers") options.fetchers = std::atoi(value.c_str());
+        else if(arg == "--prefetch") options.prefetch = std::atoi(value.c_str());
+        else if(arg == "--blocks-dir") options.blocksDir = value;
+        else if(arg == "--checkpoint-interval") options.checkpointInterval = std::atoi(value.c_str());
+        else if(arg == "--snapshot") options.snapshotPath = value;
+        else if(arg == "--wal-sync") options.walSync = value == "yes";
+        else if(arg == "--resume") options.resume = value == "yes";
+        else if(arg == "--mongo") options.useMongo = value != "no";
+        else if(arg == "--reuse-prepass") options.reusePrepass = value == "yes";
+        else if(arg == "--workers") options.workers = std::atoi(value.c_str());
+        else if(arg == "--heuristics"){
+            if(!Heuristics::parseSet(value, options.heuristics)){
+                std::cerr << "--heuristics takes heuristic IDs from 1 to 5 separated by commas" << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--shards") options.shards = std::atoi(value.c_str());
+        else if(arg == "--state-dir") options.stateDir = value;
+        else if(arg == "--address-filter") options.addressFilter = value == "yes";
+        else if(arg == "--full-transactions") options.fullTransactions = value == "yes";
+        else if(arg == "--follow") options.follow = value == "yes";
+        else if(arg == "--poll-interval") options.pollInterval = std::atoi(value.c_str());
+        else if(arg == "--undo-depth") options.undoDepth = std::atoi(value.c_str());
+        else if(arg == "--query-port") options.queryPort = std::atoi(value.c_str());
+        else if(arg == "--query-host") options.queryHost = value;
+        else if(arg == "--metrics-port") options.metricsPort = std::atoi(value.c_str());
+        else if(arg == "--metrics-host") options.metricsHost = value;
+        else if(arg == "--metrics-log") options.metricsLog = value;
+        else if(arg == "--metrics-interval") options.metricsInterval = std::atoi(value.c_str());
+        else if(arg == "--trace") options.tracePath = value;
+        else if(arg == "--export") options.exportDir = value;
+        else if(arg == "--export-since") options.exportSince = std::strtoul(value.c_str(), nullptr, 10), options.haveExportSince = true;
+        else{
+            std::cerr << "Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if(!options.useMongo && options.snapshotPath.empty()){
+        std::cerr << "--mongo no needs a --snapshot to keep the clustering in" << std::endl;
+        return false;
+    }
+    if(options.fetchers < 1) options.fetchers = 1;
+    if(options.checkpointInterval < 1) options.checkpointInterval = 1;
+    if(options.workers < 1) options.workers = std::max(1u, std::thread::hardware_concurrency());
+    if(options.prefetch < options.fetchers) options.prefetch = options.fetchers;
+    if(options.pollInterval < 1) options.pollInterval = 1;
+    if(options.undoDepth < 0) options.undoDepth = 0;
+    if(options.metricsInterval < 1) options.metricsInterval = 1;
+    if(options.follow && !options.blocksDir.empty()){
+        std::cerr << "--follow needs the daemon, it cannot be used with --blocks-dir" << std::endl;
+        return false;
+    }
+    if(options.shards < 1) options.shards = 1;
+    /* Every shard of the block files would replay the chain before its part for the outpoint index, and a backfill keeps no undo journal for the follower */
+    if(options.shards > 1 && (!options.blocksDir.empty() || options.follow)){
+        std::cerr << "--shards needs the daemon and cannot be used with --blocks-dir or --follow" << std::endl;
+        return false;
+    }
+    if(options.shards > 1) options.reusePrepass = true;
+    if(options.resume && options.snapshotPath.empty()){
+        std::cerr << "--resume needs the --snapshot to resume from" << std::endl;
+        return false;
+    }
+    /* A backfill counts the reuse of its whole range before clustering it, its snapshots already hold the reuse of the blocks after them */
+    if(options.resume && options.shards > 1){
+        std::cerr << "--resume cannot continue a backfill with --shards" << std::endl;
+        return false;
+    }
+    if(options.resume && !options.haveEnd && !options.follow){
+        std::cerr << "--resume reads nothing from stdin, it needs --end or --follow" << std::endl;
+        return false;
+    }
+    return true;
+}
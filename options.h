@@ -0,0 +1,72 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <cstdint>
+
+/* Settings of a run, taken from the command line, everything has a default so that running without arguments behaves as before */
+struct options_t{
+    std::string rpcUser = "bitcoin";
+    std::string rpcPassword = "password";
+    std::string rpcHost = "127.0.0.1";
+    int rpcPort = 8332;
+    int rpcTimeout = 10000000;
+    std::string mongoUri = "mongodb://localhost:27017";
+    /* Whatever part of the range is not given on the command line is read from std::cin, unless the start can be taken from the snapshot */
+    bool haveStart = false;
+    bool haveEnd = false;
+    uint32_t startBlock = 0;
+    uint32_t endBlock = 0;
+    /* Number of threads downloading and decoding blocks and how many blocks they may be ahead of the clustering */
+    int fetchers = 4;
+    int prefetch = 16;
+    /* When set the blocks are read from the blk*.dat files in this directory instead of over RPC */
+    std::string blocksDir;
+    /* Number of blocks between two writes of the clustering to MongoDB */
+    int checkpointInterval = 50;
+    /* Binary snapshot of the clustering, loaded at startup when it exists and rewritten at every checkpoint. The blocks clustered since are in the write-ahead log next to it, see MergeLog, with walSync it is synced after every block */
+    std::string snapshotPath;
+    bool walSync = false;
+    /* Carries on from the snapshot and its log without asking for anything: the range starts after the last block clustered, or at startBlock when there is nothing yet, and the last block is checked against the daemon */
+    bool resume = false;
+    /* When false nothing is read from or written to MongoDB, the snapshot is then the only copy of the clustering */
+    bool useMongo = true;
+    /* Counts the reuse of every address over the whole range in a first pass, so the change heuristic knows whether an address is ever reused */
+    bool reusePrepass = false;
+    /* Backfill the range with this many shards at once, each reading its part of the range with its own fetchers, see ShardedBackfill. 1 clusters the blocks one after the other */
+    int shards = 1;
+    /* When set the address table, the entity store and the reuse counts live in scratch files of this directory instead of the heap, for a clustering larger than the memory. The snapshot is still what a restart resumes from */
+    std::string stateDir;
+    /* Puts a Bloom filter in front of the address table so lookups of new addresses skip it, see AddressTable::enablePrefilter */
+    bool addressFilter = false;
+    /* Threads evaluating the heuristics of a block, 0 means one per core */
+    int workers = 0;
+    /* The heuristics run, bit ID set for each of them, see Heuristics::setEnabled. All five by default */
+    uint32_t heuristics = 62;
+    /* Keep the asm and hex of every script in the decoded transactions, the clustering does not need them */
+    bool fullTransactions = false;
+    /* After the range, keep polling the daemon and cluster the new blocks as they come, the last undoDepth blocks keep a journal so a reorg can be undone */
+    bool follow = false;
+    int pollInterval = 1000;
+    int undoDepth = 100;
+    /* Port of the HTTP query service, 0 leaves it off. When it is on the process keeps serving once the blocks are done, until it is interrupted */
+    std::string queryHost = "127.0.0.1";
+    int queryPort = 0;
+    /* Port serving the metrics for Prometheus at /metrics and as JSON at /metrics.json, 0 leaves it off */
+    std::string metricsHost = "127.0.0.1";
+    int metricsPort = 0;
+    /* When set a line of JSON with every metric is appended there every metricsInterval seconds, - is the standard output */
+    std::string metricsLog;
+    int metricsInterval = 10;
+    /* When set every stage of every block is written there as a span in the Chrome trace format */
+    std::string tracePath;
+    /* When set the clustering is exported to column files in this directory once the run is done, see exportClustering. With haveExportSince only what was active after exportSince */
+    std::string exportDir;
+    bool haveExportSince = false;
+    uint32_t exportSince = 0;
+};
+
+bool parseOptions(int argc, char** argv, options_t& options);
+void printUsage(const char* program);
+
+#endif
@@ -0,0 +1,142 @@
+#include "persistence.h"
+#include "addresstable.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <mongocxx/bulk_write.hpp>
+#include <mongocxx/model/delete_one.hpp>
+#include <mongocxx/model/update_one.hpp>
+#include <mongocxx/model/update_many.hpp>
+#include <mongocxx/options/bulk_write.hpp>
+#include <mongocxx/options/index.hpp>
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+Persistence::Persistence(mongocxx::database& db)
+: addressCollection(db["WalletToEntity"]), reuseCollection(db["reuseFrequency"]), lastFlushMillis(0)
+{
+    /* The upserts look the documents up by wallet and the entity merges by entityID */
+    mongocxx::options::index unique;
+    unique.unique(true);
+    addressCollection.create_index(make_document(kvp("wallet", 1)), unique);
+    addressCollection.create_index(make_document(kvp("entityID", 1)));
+    reuseCollection.create_index(make_document(kvp("wallet", 1)), unique);
+}
+
+/* This function gets the previous walletToEntity and reuseFrequency Stored in database*/
+void Persistence::load(EntityStore& store, MappedColumn<int>& reuseFrequency){
+    uint64_t lastEntityID = 0;
+    // Execute a query with an empty filter to get all documents.
+    mongocxx::cursor addresscursor = addressCollection.find({});
+    mongocxx::cursor reusecursor = reuseCollection.find({});
+
+    //The entities are rebuilt from the previous data in the blockchain, every wallet is put back in the entity it was stored with
+    for (const bsoncxx::document::view& doc : addresscursor) {
+        std::string wallet = doc["wallet"].get_string().value.to_string();
+        uint64_t entityID = std::stoull(doc["entityID"].get_string().value.to_string());
+        store.assign(addressTable.intern(wallet), entityID);
+        lastEntityID = std::max(entityID,lastEntityID);
+    }
+    // Setting the number of entities encountered thus far
+    if(lastEntityID != 0)Entity::setEntitiesCount(lastEntityID);
+
+    for (const bsoncxx::document::view& doc : reusecursor){
+        std::string wallet = doc["wallet"].get_string().value.to_string();
+        int frequency = doc["frequency"].get_int32().value;
+        uint32_t id = addressTable.intern(wallet);
+        if(reuseFrequency.size() <= id) reuseFrequency.resize(id + 1, 0);
+        reuseFrequency[id] = frequency;
+    }
+    /* Only what changes from now on has to be written back */
+    store.trackChanges(true);
+}
+
+/* Every output of the block bumps the reuse count of its address */
+void Persistence::trackBlock(transactions_t& transactions){
+    if(reuseMarked.size() < addressTable.size()) reuseMarked.resize(addressTable.size(), false);
+    for(getrawtransaction_t& transaction : transactions){
+        for(vout_t& out : transaction.vout) if(!out.unspendable) markReuse(out.scriptPubKey.addresses[0]);
+    }
+}
+
+/* The addresses whose count moved some other way, when a block is rolled back or when a sharded backfill counted the whole range up front */
+void Persistence::trackReuse(std::vector<uint32_t>& addresses){
+    if(reuseMarked.size() < addressTable.size()) reuseMarked.resize(addressTable.size(), false);
+    for(uint32_t address : addresses) markReuse(address);
+}
+
+void Persistence::markReuse(uint32_t address){
+    if(reuseMarked[address]) return;
+    reuseMarked[address] = true;
+    dirtyReuse.push_back(address);
+}
+
+void Persistence::checkpoint(EntityStore& store, MappedColumn<int>& reuseFrequency){
+    static Histogram& flushSeconds = metrics.histogram("mongo_flush_seconds", "Writing of the changes of a checkpoint to MongoDB");
+    static Counter& writes = metrics.counter("mongo_writes_total", "Wallets, entity merges and reuse counts written to MongoDB");
+    StageTimer timer(flushSeconds, "mongo_flush");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<uint32_t> wallets;
+    std::vector<std::pair<uint64_t,uint64_t> > remaps;
+    store.takeChanges(wallets, remaps);
+
+    /* The merges are applied in the order they happened since an entity ID that was dropped can be handed out again later */
+    if(!remaps.empty()){
+        mongocxx::options::bulk_write ordered;
+        ordered.ordered(true);
+        mongocxx::bulk_write bulk = addressCollection.create_bulk_write(ordered);
+        for(auto& remap : remaps){
+            mongocxx::model::update_many update(make_document(kvp("entityID", std::to_string(remap.first))),
+                                                make_document(kvp("$set", make_document(kvp("entityID", std::to_string(remap.second))))));
+            bulk.append(update);
+        }
+        bulk.execute();
+    }
+
+    /* The wallets are written with their entity as of now, so a wallet that changed several times is written once. A wallet left without an entity by a rolled back block is removed */
+    mongocxx::options::bulk_write unordered;
+    unordered.ordered(false);
+    if(!wallets.empty()){
+        std::sort(wallets.begin(), wallets.end());
+        wallets.erase(std::unique(wallets.begin(), wallets.end()), wallets.end());
+        mongocxx::bulk_write bulk = addressCollection.create_bulk_write(unordered);
+        for(uint32_t wallet : wallets){
+            uint64_t entityId = store.getEntity(wallet);
+            if(entityId == 0){
+                bulk.append(mongocxx::model::delete_one(make_document(kvp("wallet", addressTable.name(wallet)))));
+                continue;
+            }
+            mongocxx::model::update_one upsert(make_document(kvp("wallet", addressTable.name(wallet))),
+                                               make_document(kvp("$set", make_document(kvp("entityID", std::to_string(entityId))))));
+            upsert.upsert(true);
+            bulk.append(upsert);
+        }
+        bulk.execute();
+    }
+
+    if(!dirtyReuse.empty()){
+        mongocxx::bulk_write bulk = reuseCollection.create_bulk_write(unordered);
+        for(uint32_t address : dirtyReuse){
+            mongocxx::model::update_one upsert(make_document(kvp("wallet", addressTable.name(address))),
+                                               make_document(kvp("$set", make_document(kvp("frequency", reuseFrequency[address])))));
+            upsert.upsert(true);
+            bulk.append(upsert);
+            reuseMarked[address] = false;
+        }
+        bulk.execute();
+    }
+
+    lastFlushMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    writes.add(wallets.size() + remaps.size() + dirtyReuse.size());
+    std::cout << "Checkpoint: " << wallets.size() << " wallets, " << remaps.size() << " entity merges, "
+              << dirtyReuse.size() << " reuse counts in " << lastFlushMillis << " ms" << std::endl;
+    dirtyReuse.clear();
+}
+
+double Persistence::getLastFlushMillis(){
+    return lastFlushMillis;
+}
@@ -0,0 +1,30 @@
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+#include <vector>
+#include <mongocxx/client.hpp>
+
+#include "definition.h"
+#include "entitystore.h"
+
+/* Saves the clustering to MongoDB incrementally. A checkpoint only writes what changed since the previous one: the wallets that joined an entity and the reuse counts that moved are upserted, and a merge of two entities is a single update of every document of the dropped entity. The collections are never dropped so they stay readable during a checkpoint */
+class Persistence{
+    public:
+    Persistence(mongocxx::database& db);
+    void load(EntityStore& store, MappedColumn<int>& reuseFrequency);
+    void trackBlock(transactions_t& transactions);
+    void trackReuse(std::vector<uint32_t>& addresses);
+    void checkpoint(EntityStore& store, MappedColumn<int>& reuseFrequency);
+    double getLastFlushMillis();
+    private:
+    mongocxx::collection addressCollection;
+    mongocxx::collection reuseCollection;
+    /* Addresses whose reuse count changed since the last checkpoint */
+    std::vector<uint32_t> dirtyReuse;
+    std::vector<bool> reuseMarked;
+    double lastFlushMillis;
+
+    void markReuse(uint32_t address);
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "pipeline.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <iomanip>
+
+static uint64_t elapsedNanos(std::chrono::steady_clock::time_point since){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+BlockPipeline::BlockPipeline(options_t& options, uint32_t startBlock, uint32_t endBlock)
+: options(options), startBlock(startBlock), endBlock(endBlock), nextToFetch(startBlock), nextToConsume(startBlock),
+  stopping(false), hashBase(startBlock), fetchBusy(0), fetchedBlocks(0), consumerWait(0), started(std::chrono::steady_clock::now())
+{
+    for(int i = 0; i < options.fetchers; i++){
+        fetchers.push_back(std::thread(&BlockPipeline::fetch, this, i));
+    }
+}
+
+BlockPipeline::~BlockPipeline(){
+    stop();
+}
+
+void BlockPipeline::stop(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    slotFree.notify_all();
+    blockReady.notify_all();
+    for(std::thread& fetcher : fetchers){
+        if(fetcher.joinable()) fetcher.join();
+    }
+}
+
+/* Hands out the next block in height order, waiting for it if it is not downloaded yet. Returns false once the range is done, and rethrows the error of a fetcher if one failed */
+bool BlockPipeline::next(fetchedblock_t& block){
+    static Histogram& waitSeconds = metrics.histogram("fetch_wait_seconds", "Time the clustering waited on the fetchers for the next block");
+    std::unique_lock<std::mutex> guard(lock);
+    if(nextToConsume > endBlock) return false;
+    std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+    blockReady.wait(guard, [this]{ return error || stopping || reorderBuffer.count(nextToConsume); });
+    uint64_t waited = elapsedNanos(waitStart);
+    consumerWait += waited;
+    waitSeconds.observe(std::chrono::nanoseconds(waited));
+    if(error) std::rethrow_exception(error);
+    if(stopping) return false;
+    std::map<uint32_t, fetchedblock_t>::iterator it = reorderBuffer.find(nextToConsume);
+    block = std::move(it->second);
+    reorderBuffer.erase(it);
+    nextToConsume++;
+    guard.unlock();
+    slotFree.notify_all();
+    return true;
+}
+
+void BlockPipeline::fetch(int fetcherId){
+    static Histogram& fetchSeconds = metrics.histogram("block_fetch_seconds", "Download and decoding of one block");
+    /* Per fetcher, an uneven split shows a fetcher held up by slow blocks */
+    Counter& fetcherBlocks = metrics.counter("fetcher_blocks_total", "Blocks downloaded by each fetcher", "fetcher=\"" + std::to_string(fetcherId) + "\"");
+    try{
+        API api(options.rpcUser, options.rpcPassword, options.rpcHost, options.rpcPort, options.rpcTimeout);
+        api.setFullTransactions(options.fullTransactions);
+        while(true){
+            uint32_t height;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                /* A height may only be claimed while it is within prefetch blocks of the consumer, this bounds the memory held by the reorder buffer */
+                slotFree.wait(guard, [this]{ return stopping || error || nextToFetch > endBlock || nextToFetch < nextToConsume + (uint32_t) options.prefetch; });
+                if(stopping || error || nextToFetch > endBlock) return;
+                height = nextToFetch++;
+            }
+            std::chrono::steady_clock::time_point fetchStart = std::chrono::steady_clock::now();
+            fetchedblock_t block;
+            block.height = height;
+            {
+                StageTimer timer(fetchSeconds, "fetch", height);
+                block.hash = hashFor(api, height);
+                block.reset();
+                api.getblocktransactions(block.hash, block.transactions);
+            }
+            fetchBusy += elapsedNanos(fetchStart);
+            fetchedBlocks++;
+            fetcherBlocks.add();
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                reorderBuffer[height] = std::move(block);
+            }
+            blockReady.notify_all();
+        }
+    }
+    catch(...){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(!error) error = std::current_exception();
+        }
+        blockReady.notify_all();
+        slotFree.notify_all();
+    }
+}
+
+std::string BlockPipeline::hashFor(API& api, uint32_t height){
+    const uint32_t batchSize = 1000;
+    std::lock_guard<std::mutex> guard(hashLock);
+    /* Heights are claimed in order and at most prefetch of them are in flight, so anything further back than that is no longer needed */
+    while(!hashes.empty() && height >= hashBase + (uint32_t) options.prefetch){
+        hashes.pop_front();
+        hashBase++;
+    }
+    while(height >= hashBase + hashes.size()){
+        uint32_t first = hashBase + hashes.size();
+        uint32_t last = std::min(endBlock, first + batchSize - 1);
+        std::vector<std::string> batch = api.getblockhashes(first, last, batchSize);
+        hashes.insert(hashes.end(), batch.begin(), batch.end());
+    }
+    return hashes[height - hashBase];
+}
+
+/* Blocks per second of each stage: fetch is measured on the time the fetchers were busy, cluster on the time the consumer spent outside next() */
+void BlockPipeline::printThroughput(std::ostream& out){
+    std::lock_guard<std::mutex> guard(lock);
+    double wall = elapsedNanos(started) / 1e9;
+    double fetchSeconds = fetchBusy / 1e9 / options.fetchers;
+    double clusterSeconds = wall - consumerWait / 1e9;
+    uint64_t consumed = nextToConsume - startBlock;
+    out << std::fixed << std::setprecision(2)
+        << "Fetch: " << (fetchSeconds > 0 ? fetchedBlocks / fetchSeconds : 0) << " blocks/s (" << options.fetchers << " fetchers), "
+        << "Cluster: " << (clusterSeconds > 0 ? consumed / clusterSeconds : 0) << " blocks/s, "
+        << "Overall: " << (wall > 0 ? consumed / wall : 0) << " blocks/s, "
+        << "Waiting on fetch: " << consumerWait / 1e9 << " s" << std::endl;
+    out.unsetf(std::ios_base::floatfield);
+}
@@ -0,0 +1,52 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <condition_variable>
+
+#include "api.h"
+#include "options.h"
+#include "blocksource.h"
+
+/* Downloads and decodes blocks on several threads ahead of the clustering. Every fetcher has its own API connection, the blocks go through a reorder buffer so that next() always hands them out in height order, and at most prefetch blocks are held or in flight at any time */
+class BlockPipeline : public BlockSource{
+    public:
+    BlockPipeline(options_t& options, uint32_t startBlock, uint32_t endBlock);
+    ~BlockPipeline();
+    bool next(fetchedblock_t& block);
+    void stop();
+    void printThroughput(std::ostream& out);
+    private:
+    options_t options;
+    uint32_t startBlock, endBlock;
+    std::vector<std::thread> fetchers;
+
+    std::mutex lock;
+    std::condition_variable blockReady, slotFree;
+    /* Next height to be claimed by a fetcher and next height to be handed to the consumer */
+    uint32_t nextToFetch, nextToConsume;
+    std::map<uint32_t, fetchedblock_t> reorderBuffer;
+    bool stopping;
+    std::exception_ptr error;
+
+    /* Block hashes are requested in batches by whichever fetcher first needs one that is not there yet */
+    std::mutex hashLock;
+    uint32_t hashBase;
+    std::deque<std::string> hashes;
+
+    /* Stage timings in nanoseconds, used for the throughput report */
+    std::atomic<uint64_t> fetchBusy;
+    std::atomic<uint64_t> fetchedBlocks;
+    uint64_t consumerWait;
+    std::chrono::steady_clock::time_point started;
+
+    void fetch(int fetcherId);
+    std::string hashFor(API& api, uint32_t height);
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include "queryservice.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <jsoncpp/json/json.h>
+
+/* Addresses only hold letters and digits, anything else that comes back from a request is escaped */
+static std::string jsonString(const std::string& text){
+    std::string out = "\"";
+    for(char c : text){
+        if(c == '"' || c == '\\') out += '\\', out += c;
+        else if((unsigned char) c < 0x20){
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else out += c;
+    }
+    return out + "\"";
+}
+
+static std::string jsonHeight(uint64_t height){
+    return height == noHeight ? std::string("null") : std::to_string(height);
+}
+
+/* The fields of the totals, to go after the others of an object */
+static std::string jsonTotals(const valuetotals_t& totals){
+    auto height = [](uint32_t h){ return h == valuetotals_t::unseen ? std::string("null") : std::to_string(h); };
+    return ",\"received\":" + std::to_string(totals.received) + ",\"sent\":" + std::to_string(totals.sent) + ",\"transactions\":" + std::to_string(totals.transactions)
+        + ",\"first_height\":" + height(totals.firstHeight) + ",\"last_height\":" + height(totals.lastHeight);
+}
+
+static bool parseNumber(const std::string& text, uint64_t& value){
+    if(text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+    value = std::strtoull(text.c_str(), nullptr, 10);
+    return true;
+}
+
+static uint64_t queryParameter(const std::string& query, const std::string& name, uint64_t otherwise){
+    size_t pos = 0;
+    while(pos < query.size()){
+        size_t end = query.find('&', pos);
+        if(end == std::string::npos) end = query.size();
+        std::string pair = query.substr(pos, end - pos);
+        uint64_t value;
+        if(pair.compare(0, name.size() + 1, name + "=") == 0 && parseNumber(pair.substr(name.size() + 1), value)) return value;
+        pos = end + 1;
+    }
+    return otherwise;
+}
+
+static httpresponse_t reply(int status, const std::string& body){
+    httpresponse_t response;
+    response.status = status;
+    response.contentType = "application/json";
+    response.body = body + "\n";
+    return response;
+}
+
+static httpresponse_t error(int status, const std::string& message){
+    return reply(status, "{\"error\":" + jsonString(message) + "}");
+}
+
+QueryService::QueryService(std::string host, int port)
+: server(host, port, [this](const std::string& method, const std::string& target, const std::string& body){
+    /* Latency of every request whatever its answer, and the requests answered with an error */
+    static Histogram& queryLatency = metrics.histogram("query_latency_seconds", "Requests served by the query service");
+    static Counter& queryErrors = metrics.counter("query_errors_total", "Requests of the query service answered with an error");
+    StageTimer timer(queryLatency, "query");
+    httpresponse_t response = handle(method, target, body);
+    if(response.status >= 400) queryErrors.add();
+    return response;
+})
+{
+}
+
+void QueryService::start(){
+    server.start();
+}
+
+void QueryService::stop(){
+    server.stop();
+}
+
+int QueryService::getPort(){
+    return server.getPort();
+}
+
+void QueryService::publish(std::shared_ptr<const EntityIndex> index){
+    retired = std::atomic_exchange(&current, index);
+}
+
+std::shared_ptr<const EntityIndex> QueryService::snapshot() const{
+    return std::atomic_load(&current);
+}
+
+httpresponse_t QueryService::handle(const std::string& method, const std::string& target, const std::string& body){
+    std::shared_ptr<const EntityIndex> index = snapshot();
+    if(!index) return error(503, "the index is not built yet");
+    size_t question = target.find('?');
+    std::string path = target.substr(0, question);
+    std::string query = question == std::string::npos ? std::string() : target.substr(question + 1);
+    std::string height = jsonHeight(index->getHeight());
+
+    if(path.compare(0, 9, "/address/") == 0){
+        if(method != "GET") return error(405, "use GET");
+        std::string address = path.substr(9);
+        uint64_t entityId = index->entityOf(address);
+        if(entityId == 0) return error(404, "the address is not in any entity");
+        valuetotals_t totals;
+        index->addressTotals(address, totals);
+        return reply(200, "{\"address\":" + jsonString(address) + ",\"entity\":" + std::to_string(entityId) + ",\"size\":"
+                          + std::to_string(index->entitySize(entityId)) + ",\"height\":" + height + jsonTotals(totals) + "}");
+    }
+    if(path.compare(0, 8, "/entity/") == 0){
+        if(method != "GET") return error(405, "use GET");
+        std::string rest = path.substr(8);
+        bool sizeOnly = rest.size() > 5 && rest.compare(rest.size() - 5, 5, "/size") == 0;
+        if(sizeOnly) rest.erase(rest.size() - 5);
+        uint64_t entityId;
+        if(!parseNumber(rest, entityId)) return error(400, "the entity ID is not a number");
+        uint64_t size = index->entitySize(entityId);
+        if(size == 0) return error(404, "no such entity");
+        valuetotals_t totals;
+        index->entityTotals(entityId, totals);
+        std::string out = "{\"entity\":" + std::to_string(entityId) + ",\"size\":" + std::to_string(size) + ",\"height\":" + height + jsonTotals(totals);
+        if(!sizeOnly){
+            /* A page is bounded so that one request cannot hold a thread for long */
+            uint64_t offset = queryParameter(query, "offset", 0);
+            uint64_t limit = std::min<uint64_t>(queryParameter(query, "limit", 100), 10000);
+            out += ",\"offset\":" + std::to_string(offset) + ",\"addresses\":[";
+            std::vector<std::string> addresses = index->addressesOf(entityId, offset, limit);
+            for(size_t i = 0; i < addresses.size(); i++) out += (i ? "," : "") + jsonString(addresses[i]);
+            out += "]";
+        }
+        return reply(200, out + "}");
+    }
+    if(path == "/addresses"){
+        if(method != "POST") return error(405, "use POST with a JSON array of addresses");
+        Json::Value request;
+        Json::CharReaderBuilder reader;
+        std::string errors;
+        std::istringstream stream(body);
+        if(!Json::parseFromStream(reader, stream, &request, &errors) || !request.isArray()) return error(400, "the body must be a JSON array of addresses");
+        std::vector<std::string> addresses;
+        addresses.reserve(request.size());
+        for(Json::ValueIterator it = request.begin(); it != request.end(); it++) addresses.push_back((*it).asString());
+        std::vector<uint64_t> entities = index->entitiesOf(addresses);
+        std::string out = "{\"height\":" + height + ",\"entities\":[";
+        for(size_t i = 0; i < entities.size(); i++) out += (i ? "," : "") + (entities[i] == 0 ? std::string("null") : std::to_string(entities[i]));
+        return reply(200, out + "]}");
+    }
+    if(path == "/status"){
+        return reply(200, "{\"height\":" + height + ",\"addresses\":" + std::to_string(index->addressCount()) + ",\"entities\":"
+                          + std::to_string(index->entityCount()) + ",\"bytes\":" + std::to_string(index->memoryUsage()) + "}");
+    }
+    return error(404, "unknown path");
+}
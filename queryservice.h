@@ -0,0 +1,35 @@
+#ifndef QUERYSERVICE_H
+#define QUERYSERVICE_H
+
+#include <memory>
+#include <string>
+
+#include "entityindex.h"
+#include "httpserver.h"
+
+/* Answers lookups on the clustering over HTTP while the ingestion goes on. The ingestion publishes a new EntityIndex after each checkpoint by swapping the shared pointer, every request takes the index that is current when it starts and keeps it alive until it is done, so a request never sees half of an update and the old index goes away with its last reader.
+   GET  /address/ADDRESS                           entity of the address and its size, with the totals of the address
+   GET  /entity/ID?offset=0&limit=100              the totals of the entity and a page of its addresses
+   GET  /entity/ID/size                            number of addresses in the entity and its totals
+   The totals are received, sent (satoshis), transactions, first_height and last_height, see valuetotals_t
+   POST /addresses  ["ADDRESS", ...]               entity of every address, null when it has none
+   GET  /status                                    height and size of the index
+   The same lookups are available in process through snapshot() */
+class QueryService{
+    public:
+    QueryService(std::string host, int port);
+    void start();
+    void stop();
+    int getPort();
+    void publish(std::shared_ptr<const EntityIndex> index);
+    std::shared_ptr<const EntityIndex> snapshot() const;
+    httpresponse_t handle(const std::string& method, const std::string& target, const std::string& body);
+    private:
+    /* Only read and written through the std::atomic_ functions */
+    std::shared_ptr<const EntityIndex> current;
+    /* The index replaced by the last publish, held by the publishing thread until the next one so that freeing it does not fall on the request that happened to read it last */
+    std::shared_ptr<const EntityIndex> retired;
+    HttpServer server;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "reusecounters.h"
+
+ReuseCounters::ReuseCounters() : chunks(new std::atomic<std::atomic<uint32_t>*>[chunkCount]), limit(0), allocated(0)
+{
+    for(uint32_t i = 0; i < chunkCount; i++) chunks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ReuseCounters::~ReuseCounters(){
+    for(uint32_t i = 0; i < chunkCount; i++) delete[] chunks[i].load(std::memory_order_relaxed);
+    delete[] chunks;
+}
+
+/* The first writer to reach a chunk allocates it, a writer that loses the race frees its copy and uses the winner's */
+std::atomic<uint32_t>* ReuseCounters::chunk(uint32_t index){
+    std::atomic<uint32_t>* current = chunks[index].load(std::memory_order_acquire);
+    if(current) return current;
+    std::atomic<uint32_t>* fresh = new std::atomic<uint32_t>[chunkSize];
+    for(uint32_t i = 0; i < chunkSize; i++) fresh[i].store(0, std::memory_order_relaxed);
+    if(chunks[index].compare_exchange_strong(current, fresh, std::memory_order_acq_rel)){
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return fresh;
+    }
+    delete[] fresh;
+    return current;
+}
+
+void ReuseCounters::add(uint32_t address){
+    chunk(address >> chunkBits)[address & (chunkSize - 1)].fetch_add(1, std::memory_order_relaxed);
+    uint32_t seen = limit.load(std::memory_order_relaxed);
+    while(address >= seen && !limit.compare_exchange_weak(seen, address + 1, std::memory_order_relaxed));
+}
+
+uint32_t ReuseCounters::get(uint32_t address) const{
+    std::atomic<uint32_t>* counters = chunks[address >> chunkBits].load(std::memory_order_acquire);
+    return counters ? counters[address & (chunkSize - 1)].load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t ReuseCounters::size() const{
+    return limit.load(std::memory_order_relaxed);
+}
+
+void ReuseCounters::addTo(MappedColumn<int>& reuseFrequency, std::vector<uint32_t>& changed) const{
+    uint32_t end = size();
+    if(reuseFrequency.size() < end) reuseFrequency.resize(end, 0);
+    for(uint32_t address = 0; address < end; address++){
+        uint32_t count = get(address);
+        if(count == 0) continue;
+        reuseFrequency[address] += count;
+        changed.push_back(address);
+    }
+}
+
+size_t ReuseCounters::memoryUsage() const{
+    return chunkCount * sizeof(void*) + (size_t) allocated.load(std::memory_order_relaxed) * chunkSize * sizeof(uint32_t);
+}
@@ -0,0 +1,36 @@
+#ifndef REUSECOUNTERS_H
+#define REUSECOUNTERS_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "mappedcolumn.h"
+
+/* Output counts per address that any number of threads can bump at once, an atomic counter per address in chunks that never move so the array grows under the writers without a lock. No update is lost, the counts are read once the writers are done */
+class ReuseCounters{
+    public:
+    ReuseCounters();
+    ~ReuseCounters();
+    ReuseCounters(const ReuseCounters&) = delete;
+    ReuseCounters& operator=(const ReuseCounters&) = delete;
+    void add(uint32_t address);
+    uint32_t get(uint32_t address) const;
+    /* One past the highest address counted */
+    uint32_t size() const;
+    /* Adds the counts to reuseFrequency, grown to hold every address, and appends the addresses counted to changed */
+    void addTo(MappedColumn<int>& reuseFrequency, std::vector<uint32_t>& changed) const;
+    size_t memoryUsage() const;
+    private:
+    static const uint32_t chunkBits = 16;
+    static const uint32_t chunkSize = 1u << chunkBits;
+    static const uint32_t chunkCount = 1u << (32 - chunkBits);
+    std::atomic<std::atomic<uint32_t>*>* chunks;
+    std::atomic<uint32_t> limit;
+    std::atomic<uint32_t> allocated;
+
+    std::atomic<uint32_t>* chunk(uint32_t index);
+};
+
+#endif
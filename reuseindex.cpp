@@ -0,0 +1,44 @@
+#include "reuseindex.h"
+
+/* Starts from the counts of the earlier runs and adds every output of the blocks handed out by the source */
+void ReuseIndex::build(BlockSource& source, MappedColumn<int>& reuseFrequency){
+    addCounts(reuseFrequency);
+    fetchedblock_t block;
+    while(source.next(block)){
+        for(getrawtransaction_t& transaction : block.transactions){
+            for(vout_t& out : transaction.vout){
+                for(uint32_t address : out.scriptPubKey.addresses) add(address);
+            }
+        }
+    }
+}
+
+void ReuseIndex::addCounts(const MappedColumn<int>& reuseFrequency){
+    for(uint32_t id = 0; id < reuseFrequency.size(); id++){
+        for(int i = 0; i < reuseFrequency[id] && i < many; i++) add(id);
+    }
+}
+
+void ReuseIndex::add(uint32_t address){
+    if(address >= addresses){
+        addresses = address + 1;
+        counters.resize((addresses + 3) / 4, 0);
+    }
+    uint32_t shift = (address & 3) * 2;
+    uint8_t& slot = counters[address >> 2];
+    if(((slot >> shift) & 3) < many) slot += 1 << shift;
+}
+
+/* The addresses the pass has not seen are never reused */
+uint8_t ReuseIndex::count(uint32_t address) const{
+    if(address >= addresses) return 0;
+    return (counters[address >> 2] >> ((address & 3) * 2)) & 3;
+}
+
+uint32_t ReuseIndex::size() const{
+    return addresses;
+}
+
+size_t ReuseIndex::memoryUsage() const{
+    return counters.capacity();
+}
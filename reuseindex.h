@@ -0,0 +1,26 @@
+#ifndef REUSEINDEX_H
+#define REUSEINDEX_H
+
+#include <vector>
+#include <cstdint>
+
+#include "blocksource.h"
+#include "mappedcolumn.h"
+
+/* Number of times each address receives an output over the whole range, counted in a pass over the blocks before the clustering so that the change heuristic sees whether an address is ever reused and not only whether it was reused so far. The heuristics only care about 0, 1 and more, so the counters are two bits that saturate at 2, four addresses to a byte. Once built the index is not written anymore and can be read from several threads without locking */
+class ReuseIndex{
+    public:
+    static const uint8_t many = 2;
+    void build(BlockSource& source, MappedColumn<int>& reuseFrequency);
+    /* Adds counts already known, from earlier runs or summed from the shards of a backfill */
+    void addCounts(const MappedColumn<int>& reuseFrequency);
+    void add(uint32_t address);
+    uint8_t count(uint32_t address) const;
+    uint32_t size() const;
+    size_t memoryUsage() const;
+    private:
+    std::vector<uint8_t> counters;
+    uint32_t addresses = 0;
+};
+
+#endif
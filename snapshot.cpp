@@ -0,0 +1,354 @@
+#include "snapshot.h"
+#include "address.h"
+#include "addresstable.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+static const char snapshotMagic[8] = {'C', 'B', 'A', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t snapshotVersion = 4;
+
+static uint64_t pad8(uint64_t n){
+    return (n + 7) & ~(uint64_t) 7;
+}
+
+/* zlib takes the length as a 32 bit integer, so big regions go through in pieces */
+static uint32_t crc32Of(uint32_t crc, const unsigned char* data, size_t len){
+    while(len > 0){
+        uInt piece = (uInt) std::min<size_t>(len, 1u << 30);
+        crc = crc32(crc, data, piece);
+        data += piece;
+        len -= piece;
+    }
+    return crc;
+}
+
+/* Buffers the writes and keeps the running checksum of everything written */
+struct snapshotwriter_t{
+    FILE* file;
+    uint32_t crc;
+    uint64_t written;
+    std::vector<unsigned char> buffer;
+
+    void flush(){
+        if(buffer.empty()) return;
+        crc = crc32Of(crc, &buffer[0], buffer.size());
+        if(std::fwrite(&buffer[0], 1, buffer.size(), file) != buffer.size()) throw std::runtime_error("Snapshot: write failed");
+        buffer.clear();
+    }
+    void write(const void* data, size_t len){
+        const unsigned char* bytes = (const unsigned char*) data;
+        buffer.insert(buffer.end(), bytes, bytes + len);
+        written += len;
+        if(buffer.size() >= (1u << 20)) flush();
+    }
+    void u64(uint64_t value){
+        write(&value, sizeof(value));
+    }
+    void pad(){
+        static const unsigned char zeros[8] = {0};
+        write(zeros, pad8(written) - written);
+    }
+};
+
+bool snapshotExists(const std::string& path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+/* The rename is only on disk once the directory is */
+static void syncDirectoryOf(const std::string& path){
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(directory.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("Snapshot: cannot open " + directory);
+    int synced = fsync(fd);
+    close(fd);
+    if(synced != 0) throw std::runtime_error("Snapshot: cannot sync " + directory);
+}
+
+/* The snapshot is written to a temporary file which replaces the previous one only once it is complete and on disk, so a crash leaves either the old or the new snapshot. The height and the hash of the last block are in the same file as the clustering, a restart never sees one without the other */
+void writeSnapshot(const std::string& path, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, uint64_t lastHeight, const std::string& lastHash){
+    /* Only the addresses that are in an entity, have been reused or have been seen carry any information */
+    std::vector<uint32_t> rows;
+    uint32_t addresses = addressTable.size();
+    for(uint32_t id = 0; id < addresses; id++){
+        if(store.getEntity(id) != 0 || (id < reuseFrequency.size() && reuseFrequency[id] != 0) || activity.firstSeen(id) != AddressActivity::unseen) rows.push_back(id);
+    }
+    std::sort(rows.begin(), rows.end(), [](uint32_t a, uint32_t b){ return addressTable.nameLess(a, b); });
+    std::vector<uint64_t> freeIDs = Entity::getFreeIDs();
+
+    snapshotheader_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version = snapshotVersion;
+    header.lastHeight = lastHeight;
+    header.addressCount = rows.size();
+    header.entitiesCount = Entity::getEntitiesCount();
+    header.freeIDCount = freeIDs.size();
+
+    std::string temporary = path + ".tmp";
+    snapshotwriter_t writer;
+    writer.file = std::fopen(temporary.c_str(), "wb");
+    if(!writer.file) throw std::runtime_error("Snapshot: cannot create " + temporary);
+    writer.crc = crc32(0, Z_NULL, 0);
+    writer.written = 0;
+    try{
+        /* The header is written last, once the checksum is known */
+        if(std::fseek(writer.file, sizeof(header), SEEK_SET) != 0) throw std::runtime_error("Snapshot: seek failed");
+        uint64_t offset = 0;
+        for(uint32_t id : rows){
+            writer.u64(offset);
+            offset += addressTable.name(id).size();
+        }
+        writer.u64(offset);
+        header.stringBytes = offset;
+        for(uint32_t id : rows){
+            const std::string& name = addressTable.name(id);
+            writer.write(name.data(), name.size());
+        }
+        writer.pad();
+        for(uint32_t id : rows) writer.u64(store.getEntity(id));
+        for(uint32_t id : rows){
+            uint32_t reuse = id < reuseFrequency.size() ? reuseFrequency[id] : 0;
+            writer.write(&reuse, sizeof(reuse));
+        }
+        writer.pad();
+        for(uint32_t id : rows){
+            uint32_t height = activity.firstSeen(id);
+            writer.write(&height, sizeof(height));
+        }
+        for(uint32_t id : rows){
+            uint32_t height = activity.lastSeen(id);
+            writer.write(&height, sizeof(height));
+        }
+        writer.pad();
+        for(uint32_t id : rows){
+            uint32_t transactions = activity.totals(id).transactions;
+            writer.write(&transactions, sizeof(transactions));
+        }
+        writer.pad();
+        for(uint32_t id : rows) writer.u64(activity.totals(id).received);
+        for(uint32_t id : rows) writer.u64(activity.totals(id).sent);
+        for(uint64_t id : freeIDs) writer.u64(id);
+        /* The IDs that are free or were never handed out have no root and are left out */
+        std::vector<snapshotentitytotals_t> entityTotals;
+        for(uint64_t entity = 1; entity < header.entitiesCount; entity++){
+            valuetotals_t totals;
+            if(!store.getTotals(entity, totals)) continue;
+            entityTotals.push_back({entity, totals.received, totals.sent, totals.transactions, totals.firstHeight, totals.lastHeight, 0});
+        }
+        writer.u64(entityTotals.size());
+        for(const snapshotentitytotals_t& totals : entityTotals) writer.write(&totals, sizeof(totals));
+        unsigned char hash[32] = {0};
+        size_t hashLen = 0;
+        if(!fromHex(lastHash, hash, sizeof(hash), hashLen) || hashLen != sizeof(hash)) std::memset(hash, 0, sizeof(hash));
+        writer.write(hash, sizeof(hash));
+        writer.flush();
+
+        header.checksum = writer.crc;
+        if(std::fseek(writer.file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, writer.file) != 1) throw std::runtime_error("Snapshot: cannot write header");
+        if(std::fflush(writer.file) != 0 || fsync(fileno(writer.file)) != 0) throw std::runtime_error("Snapshot: cannot sync " + temporary);
+    }
+    catch(...){
+        std::fclose(writer.file);
+        std::remove(temporary.c_str());
+        throw;
+    }
+    std::fclose(writer.file);
+    if(std::rename(temporary.c_str(), path.c_str()) != 0) throw std::runtime_error("Snapshot: cannot replace " + path);
+    syncDirectoryOf(path);
+}
+
+/* Rebuilds the address table, the entities, the reuse counts, the totals of the addresses and of the entities and the free entity IDs from the snapshot and returns the last height it covers */
+uint64_t loadSnapshot(const std::string& path, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, std::string* lastHash){
+    SnapshotView view(path);
+    if(lastHash) *lastHash = view.lastHash();
+    uint64_t count = view.size();
+    addressTable.reserve(addressTable.size() + count);
+    store.reserve(addressTable.size() + count);
+    reuseFrequency.resize(addressTable.size() + count, 0);
+    /* A wallet of every entity, to put the totals of the entity on its set once every wallet joined it */
+    std::vector<uint32_t> walletOf(view.header().entitiesCount, (uint32_t) storeundo_t::absent);
+    for(uint64_t i = 0; i < count; i++){
+        uint32_t id = addressTable.intern(view.address(i));
+        uint64_t entity = view.entity(i);
+        if(entity != 0){
+            store.assign(id, entity);
+            if(entity < walletOf.size()) walletOf[entity] = id;
+        }
+        if(reuseFrequency.size() <= id) reuseFrequency.resize(id + 1, 0);
+        reuseFrequency[id] = view.reuse(i);
+        valuetotals_t totals = view.totals(i);
+        if(totals.firstHeight == AddressActivity::unseen) continue;
+        activity.set(id, totals);
+        /* An address in no entity is a set of its own with the same totals */
+        if(entity == 0) store.setTotals(id, totals);
+    }
+    for(uint64_t i = 0; i < view.entityTotalsCount(); i++){
+        const snapshotentitytotals_t& row = view.entityTotals(i);
+        if(row.entity >= walletOf.size() || walletOf[row.entity] == storeundo_t::absent) throw std::runtime_error("Snapshot: totals of entity " + std::to_string(row.entity) + " which has no address");
+        valuetotals_t totals;
+        totals.received = row.received;
+        totals.sent = row.sent;
+        totals.transactions = row.transactions;
+        totals.firstHeight = row.firstHeight;
+        totals.lastHeight = row.lastHeight;
+        store.setTotals(walletOf[row.entity], totals);
+    }
+    Entity::setEntitiesCount(view.header().entitiesCount - 1);
+    for(uint64_t i = 0; i < view.header().freeIDCount; i++) Entity::pushToFreeID(view.freeID(i));
+    return view.header().lastHeight;
+}
+
+SnapshotView::SnapshotView(const std::string& path) : data(nullptr), length(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("Snapshot: cannot open " + path);
+    struct stat st;
+    fstat(fd, &st);
+    length = st.st_size;
+    if(length < sizeof(snapshotheader_t)){
+        close(fd);
+        throw std::runtime_error("Snapshot: " + path + " is truncated");
+    }
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) throw std::runtime_error("Snapshot: cannot map " + path);
+    data = (const unsigned char*) mapped;
+    head = (const snapshotheader_t*) data;
+
+    try{
+        if(std::memcmp(head->magic, snapshotMagic, sizeof(snapshotMagic)) != 0) throw std::runtime_error("Snapshot: " + path + " is not a snapshot");
+        if(head->version < 1 || head->version > snapshotVersion) throw std::runtime_error("Snapshot: unsupported version " + std::to_string(head->version));
+        uint64_t n = head->addressCount;
+        uint64_t offsetsAt = sizeof(snapshotheader_t);
+        uint64_t stringsAt = offsetsAt + (n + 1) * 8;
+        uint64_t entitiesAt = pad8(stringsAt + head->stringBytes);
+        uint64_t reuseAt = entitiesAt + n * 8;
+        uint64_t firstAt = pad8(reuseAt + n * 4);
+        uint64_t lastAt = firstAt + n * 4;
+        uint64_t transactionsAt = pad8(lastAt + n * 4);
+        uint64_t receivedAt = pad8(transactionsAt + n * 4);
+        uint64_t sentAt = receivedAt + n * 8;
+        uint64_t freeAt = head->version == 1 ? firstAt : (head->version == 2 ? transactionsAt : sentAt + n * 8);
+        uint64_t totalsAt = freeAt + head->freeIDCount * 8;
+        entityTotalRowCount = 0;
+        if(head->version >= 3){
+            if(totalsAt + 8 > length) throw std::runtime_error("Snapshot: " + path + " has the wrong size");
+            entityTotalRowCount = *(const uint64_t*) (data + totalsAt);
+            if(entityTotalRowCount > (length - totalsAt - 8) / sizeof(snapshotentitytotals_t)) throw std::runtime_error("Snapshot: " + path + " has the wrong size");
+        }
+        uint64_t hashAt = head->version >= 3 ? totalsAt + 8 + entityTotalRowCount * sizeof(snapshotentitytotals_t) : totalsAt;
+        uint64_t end = head->version >= 4 ? hashAt + 32 : hashAt;
+        if(end != length) throw std::runtime_error("Snapshot: " + path + " has the wrong size");
+        if(crc32Of(crc32(0, Z_NULL, 0), data + sizeof(snapshotheader_t), length - sizeof(snapshotheader_t)) != head->checksum){
+            throw std::runtime_error("Snapshot: checksum mismatch in " + path);
+        }
+        offsets = (const uint64_t*) (data + offsetsAt);
+        strings = (const char*) (data + stringsAt);
+        entities = (const uint64_t*) (data + entitiesAt);
+        reuseCounts = (const uint32_t*) (data + reuseAt);
+        firstHeights = head->version == 1 ? nullptr : (const uint32_t*) (data + firstAt);
+        lastHeights = head->version == 1 ? nullptr : (const uint32_t*) (data + lastAt);
+        transactionCounts = head->version < 3 ? nullptr : (const uint32_t*) (data + transactionsAt);
+        receivedValues = head->version < 3 ? nullptr : (const int64_t*) (data + receivedAt);
+        sentValues = head->version < 3 ? nullptr : (const int64_t*) (data + sentAt);
+        freeIDs = (const uint64_t*) (data + freeAt);
+        entityTotalRows = (const snapshotentitytotals_t*) (data + totalsAt + 8);
+        lastHashBytes = head->version < 4 ? nullptr : data + hashAt;
+    }
+    catch(...){
+        munmap((void*) data, length);
+        throw;
+    }
+    /* The columns are read front to back during a load */
+    madvise((void*) data, length, MADV_SEQUENTIAL);
+}
+
+SnapshotView::~SnapshotView(){
+    if(data) munmap((void*) data, length);
+}
+
+const snapshotheader_t& SnapshotView::header() const{
+    return *head;
+}
+
+uint64_t SnapshotView::size() const{
+    return head->addressCount;
+}
+
+std::string SnapshotView::address(uint64_t index) const{
+    return std::string(strings + offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+uint64_t SnapshotView::entity(uint64_t index) const{
+    return entities[index];
+}
+
+uint32_t SnapshotView::reuse(uint64_t index) const{
+    return reuseCounts[index];
+}
+
+uint32_t SnapshotView::firstSeen(uint64_t index) const{
+    return firstHeights ? firstHeights[index] : AddressActivity::unseen;
+}
+
+uint32_t SnapshotView::lastSeen(uint64_t index) const{
+    return lastHeights ? lastHeights[index] : AddressActivity::unseen;
+}
+
+valuetotals_t SnapshotView::totals(uint64_t index) const{
+    valuetotals_t totals;
+    totals.firstHeight = firstSeen(index);
+    totals.lastHeight = lastSeen(index);
+    if(transactionCounts){
+        totals.transactions = transactionCounts[index];
+        totals.received = receivedValues[index];
+        totals.sent = sentValues[index];
+    }
+    return totals;
+}
+
+uint64_t SnapshotView::freeID(uint64_t index) const{
+    return freeIDs[index];
+}
+
+uint64_t SnapshotView::entityTotalsCount() const{
+    return entityTotalRowCount;
+}
+
+const snapshotentitytotals_t& SnapshotView::entityTotals(uint64_t index) const{
+    return entityTotalRows[index];
+}
+
+std::string SnapshotView::lastHash() const{
+    if(!lastHashBytes) return "";
+    for(int i = 0; i < 32; i++) if(lastHashBytes[i] != 0) return toHex(lastHashBytes, 32);
+    return "";
+}
+
+/* Binary search over the sorted addresses, straight on the mapped strings */
+bool SnapshotView::find(const std::string& address, uint64_t& index) const{
+    uint64_t low = 0, high = head->addressCount;
+    while(low < high){
+        uint64_t mid = low + (high - low) / 2;
+        size_t len = offsets[mid + 1] - offsets[mid];
+        int cmp = std::memcmp(strings + offsets[mid], address.data(), std::min(len, address.size()));
+        if(cmp == 0) cmp = len < address.size() ? -1 : (len > address.size() ? 1 : 0);
+        if(cmp == 0){
+            index = mid;
+            return true;
+        }
+        if(cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+    return false;
+}
@@ -0,0 +1,102 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "activity.h"
+#include "entitystore.h"
+
+/* Binary snapshot of the clustering, written instead of or alongside MongoDB so that a restart does not have to stream every document back.
+
+   All integers are little endian, the sections start on 8 byte boundaries:
+     header     64 bytes, see snapshotheader_t
+     offsets    u64[addressCount + 1], start of each address in the string blob, the addresses are sorted
+     strings    the address strings back to back, padded to 8 bytes
+     entities   u64[addressCount], entity ID of each address, 0 when it has none
+     reuse      u32[addressCount], reuse count of each address, padded to 8 bytes
+     firstSeen  u32[addressCount], first height each address was seen at, UINT32_MAX when unknown
+     lastSeen   u32[addressCount], last height each address was seen at, padded to 8 bytes
+     txCount    u32[addressCount], transactions each address was in, padded to 8 bytes
+     received   i64[addressCount], satoshis each address received
+     sent       i64[addressCount], satoshis each address sent
+     freeIDs    u64[freeIDCount], the entity IDs waiting to be reused, in order
+     totals     u64 count, then count times snapshotentitytotals_t, the totals of every entity in ID order
+     lastHash   u8[32], the hash of block lastHeight as displayed, zeros when it is not known
+   Version 1 has no firstSeen and lastSeen, it is still loaded with the heights unknown. Versions 1 and 2 have no txCount, received, sent and totals, they are loaded with every total at 0. Versions before 4 have no lastHash.
+   The checksum is the CRC-32 of everything after the header. */
+
+struct snapshotheader_t{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t lastHeight;
+    uint64_t addressCount;
+    uint64_t stringBytes;
+    uint64_t entitiesCount;
+    uint64_t freeIDCount;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+struct snapshotentitytotals_t{
+    uint64_t entity;
+    int64_t received;
+    int64_t sent;
+    uint32_t transactions;
+    uint32_t firstHeight;
+    uint32_t lastHeight;
+    uint32_t reserved;
+};
+
+/* Read only view over a snapshot file, the file is memory mapped and nothing is copied, addresses can be looked up with a binary search over the sorted table */
+class SnapshotView{
+    public:
+    SnapshotView(const std::string& path);
+    ~SnapshotView();
+    const snapshotheader_t& header() const;
+    uint64_t size() const;
+    std::string address(uint64_t index) const;
+    uint64_t entity(uint64_t index) const;
+    uint32_t reuse(uint64_t index) const;
+    uint32_t firstSeen(uint64_t index) const;
+    uint32_t lastSeen(uint64_t index) const;
+    /* The heights and the value totals of the address */
+    valuetotals_t totals(uint64_t index) const;
+    uint64_t freeID(uint64_t index) const;
+    uint64_t entityTotalsCount() const;
+    const snapshotentitytotals_t& entityTotals(uint64_t index) const;
+    /* Empty when the snapshot does not know it */
+    std::string lastHash() const;
+    bool find(const std::string& address, uint64_t& index) const;
+    private:
+    const unsigned char* data;
+    size_t length;
+    const snapshotheader_t* head;
+    const uint64_t* offsets;
+    const char* strings;
+    const uint64_t* entities;
+    const uint32_t* reuseCounts;
+    /* Null in a version 1 snapshot */
+    const uint32_t* firstHeights;
+    const uint32_t* lastHeights;
+    /* Null before version 3 */
+    const uint32_t* transactionCounts;
+    const int64_t* receivedValues;
+    const int64_t* sentValues;
+    const uint64_t* freeIDs;
+    const snapshotentitytotals_t* entityTotalRows;
+    uint64_t entityTotalRowCount;
+    /* Null before version 4 */
+    const unsigned char* lastHashBytes;
+};
+
+static const uint64_t noHeight = UINT64_MAX;
+
+void writeSnapshot(const std::string& path, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, uint64_t lastHeight, const std::string& lastHash = "");
+/* Returns the last height the snapshot covers, and the hash of that block in lastHash when it is given */
+uint64_t loadSnapshot(const std::string& path, EntityStore& store, MappedColumn<int>& reuseFrequency, AddressActivity& activity, std::string* lastHash = nullptr);
+bool snapshotExists(const std::string& path);
+
+#endif
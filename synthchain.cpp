@@ -0,0 +1,304 @@
+#include "synthchain.h"
+#include "address.h"
+#include "addresstable.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <jsoncpp/json/json.h>
+
+/* Outputs below this are not worth splitting in two */
+static const int64_t dustLimit = 2000;
+
+SyntheticChain::SyntheticChain(synthshape_t shape, uint64_t seed) : shape(shape), seed(seed), height(0), unspentCount(0)
+{
+}
+
+uint32_t SyntheticChain::getHeight(){
+    return height;
+}
+
+const std::string& SyntheticChain::addressName(uint32_t address){
+    return names[address];
+}
+
+size_t SyntheticChain::addressCount(){
+    return names.size();
+}
+
+uint64_t SyntheticChain::random(){
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 11;
+}
+
+uint32_t SyntheticChain::below(uint64_t n){
+    return random() % n;
+}
+
+std::string SyntheticChain::randomHex(size_t bytes){
+    std::vector<unsigned char> data(bytes);
+    for(unsigned char& b : data) b = random() >> 45;
+    return toHex(&data[0], bytes);
+}
+
+uint32_t SyntheticChain::newOwner(){
+    funds.push_back(std::vector<synthinput_t>());
+    listed.push_back(false);
+    return funds.size() - 1;
+}
+
+uint32_t SyntheticChain::addAddress(uint32_t owner, const std::string& prefix, size_t bytes, const std::string& suffix){
+    std::string type;
+    scripts.push_back(prefix + randomHex(bytes) + suffix);
+    names.push_back(scriptHexToAddress(scripts.back(), type));
+    types.push_back(type);
+    owners.push_back(owner);
+    tableIds.push_back(UINT32_MAX);
+    return names.size() - 1;
+}
+
+/* The early chain pays to keys and to their hashes, afterwards the script types are mixed about the way they are on the chain today */
+uint32_t SyntheticChain::newAddress(uint32_t owner, bool early){
+    if(early) return addAddress(owner, "76a914", 20, "88ac");
+    uint32_t kind = below(100);
+    if(kind < 55) return addAddress(owner, "0014", 20, "");
+    if(kind < 85) return addAddress(owner, "76a914", 20, "88ac");
+    if(kind < 95) return addAddress(owner, "5120", 32, "");
+    return addAddress(owner, "a914", 20, "87");
+}
+
+/* A payment goes to someone new or to a hot address, drawn with a quadratic skew so that the first few of them take most of the reuse */
+uint32_t SyntheticChain::payee(bool early){
+    if(!early && !hot.empty() && below(100) < shape.reusePercent){
+        uint64_t pick = below(hot.size());
+        return hot[pick * pick / hot.size()];
+    }
+    uint32_t address = newAddress(newOwner(), early);
+    if(hot.size() < 4096 && below(50) == 0) hot.push_back(address);
+    return address;
+}
+
+uint32_t SyntheticChain::tableId(uint32_t address){
+    if(tableIds[address] == UINT32_MAX) tableIds[address] = addressTable.intern(names[address]);
+    return tableIds[address];
+}
+
+/* An owner that has something to spend, the owners left without any are dropped from the list on the way */
+uint32_t SyntheticChain::spender(){
+    while(true){
+        size_t pick = below(funded.size());
+        uint32_t owner = funded[pick];
+        if(!funds[owner].empty()) return owner;
+        listed[owner] = false;
+        funded[pick] = funded.back();
+        funded.pop_back();
+    }
+}
+
+synthinput_t SyntheticChain::spend(uint32_t owner){
+    std::vector<synthinput_t>& unspent = funds[owner];
+    size_t pick = below(unspent.size());
+    synthinput_t input = unspent[pick];
+    unspent[pick] = unspent.back();
+    unspent.pop_back();
+    unspentCount--;
+    return input;
+}
+
+/* The outputs can be spent from the next transaction on, so chains of payments inside a block show up too */
+void SyntheticChain::addOutputs(synthtransaction_t& transaction, bool generated){
+    for(uint32_t n = 0; n < transaction.outputs.size(); n++){
+        synthoutput_t& output = transaction.outputs[n];
+        uint32_t owner = owners[output.address];
+        funds[owner].push_back({transaction.txid, n, output.address, output.value, height, generated});
+        unspentCount++;
+        if(!listed[owner]){
+            listed[owner] = true;
+            funded.push_back(owner);
+        }
+    }
+}
+
+void SyntheticChain::nextBlock(std::vector<synthtransaction_t>& block){
+    block.clear();
+    bool early = height < shape.earlyBlocks;
+    synthtransaction_t coinbase;
+    coinbase.txid = randomHex(32);
+    int64_t subsidy = height < 64 * 210000 ? 5000000000LL >> (height / 210000) : 0;
+    /* The pools pay themselves on the same few addresses */
+    coinbase.outputs.push_back({early ? addAddress(newOwner(), "4104", 64, "ac") : payee(false), std::max<int64_t>(subsidy, 1)});
+    addOutputs(coinbase, true);
+    block.push_back(coinbase);
+
+    uint32_t count = early ? (below(3) == 0 ? 1 : 0) : shape.transactionsPerBlock - 1;
+    for(uint32_t t = 0; t < count && unspentCount > 0; t++){
+        synthtransaction_t transaction;
+        transaction.txid = randomHex(32);
+        /* The consolidations are done by the owners of the hot addresses, who collect the most outputs */
+        uint32_t owner = spender();
+        bool consolidation = false;
+        if(!early && !hot.empty() && below(100) < shape.consolidationPercent){
+            uint32_t collector = owners[hot[below(hot.size())]];
+            if(funds[collector].size() >= shape.consolidationInputs / 2){
+                owner = collector;
+                consolidation = true;
+            }
+        }
+        uint32_t inputs;
+        if(consolidation) inputs = shape.consolidationInputs / 2 + below(shape.consolidationInputs + 1);
+        else{
+            uint32_t roll = below(100);
+            inputs = roll < 70 ? 1 : roll < 90 ? 2 : 3;
+        }
+        inputs = std::max<uint32_t>(1, std::min<size_t>(inputs, funds[owner].size()));
+        int64_t total = 0;
+        for(uint32_t i = 0; i < inputs; i++){
+            transaction.inputs.push_back(spend(owner));
+            total += transaction.inputs.back().value;
+        }
+        int64_t fee = std::min<int64_t>(1000 + below(9000), total / 10);
+        int64_t left = total - fee;
+        if(consolidation || left < 2 * dustLimit) transaction.outputs.push_back({newAddress(owner, early), left});
+        else{
+            /* A payment and its change, in either order */
+            int64_t payment = left / 100 * (10 + below(81));
+            synthoutput_t paid = {payee(early), payment}, change = {newAddress(owner, early), left - payment};
+            if(below(2)) std::swap(paid, change);
+            transaction.outputs.push_back(paid);
+            transaction.outputs.push_back(change);
+        }
+        addOutputs(transaction, false);
+        block.push_back(transaction);
+    }
+    height++;
+}
+
+/* Filled the same way the decoder fills them: a coinbase input has no address, which interns the empty name */
+void SyntheticChain::decode(const std::vector<synthtransaction_t>& block, transactions_t& transactions){
+    Arena* arena = transactions.get_allocator().getArena();
+    uint32_t noAddress = addressTable.intern("");
+    for(const synthtransaction_t& transaction : block){
+        transactions.push_back(getrawtransaction_t(arena));
+        getrawtransaction_t& decoded = transactions.back();
+        decoded.txid.assign(transaction.txid.data(), transaction.txid.size());
+        if(transaction.inputs.empty()){
+            decoded.vin.push_back(vin_t(arena));
+            decoded.vin.back().isCoinbase = true;
+            decoded.vin.back().scriptSig.address = noAddress;
+        }
+        for(const synthinput_t& input : transaction.inputs){
+            decoded.vin.push_back(vin_t(arena));
+            vin_t& in = decoded.vin.back();
+            in.txid.assign(input.txid.data(), input.txid.size());
+            in.value = input.value;
+            in.scriptSig.address = tableId(input.address);
+        }
+        for(const synthoutput_t& output : transaction.outputs){
+            decoded.vout.push_back(vout_t(arena));
+            vout_t& out = decoded.vout.back();
+            out.value = output.value;
+            out.scriptPubKey.type.assign(types[output.address].data(), types[output.address].size());
+            out.scriptPubKey.addresses.push_back(tableId(output.address));
+        }
+    }
+}
+
+/* Bitcoind leaves the address out for bare keys */
+void SyntheticChain::writeScript(uint32_t address, Json::Value& script){
+    const std::string& hex = scripts[address];
+    const std::string& type = types[address];
+    if(type == "pubkey") script["asm"] = hex.substr(2, 130) + " OP_CHECKSIG";
+    else if(type == "pubkeyhash") script["asm"] = "OP_DUP OP_HASH160 " + hex.substr(6, 40) + " OP_EQUALVERIFY OP_CHECKSIG";
+    else if(type == "scripthash") script["asm"] = "OP_HASH160 " + hex.substr(4, 40) + " OP_EQUAL";
+    else script["asm"] = (type == "witness_v1_taproot" ? "1 " : "0 ") + hex.substr(4);
+    script["desc"] = type == "pubkey" ? "pk(" + hex.substr(2, 130) + ")#00000000" : "addr(" + names[address] + ")#00000000";
+    script["hex"] = hex;
+    if(type != "pubkey") script["address"] = names[address];
+    script["type"] = type;
+}
+
+/* The signatures and the raw transaction are filler of the usual length, nothing reads them */
+void SyntheticChain::writeTransaction(const synthtransaction_t& transaction, Json::Value& tx){
+    size_t size = 10 + 68 * std::max<size_t>(1, transaction.inputs.size()) + 31 * transaction.outputs.size();
+    tx["txid"] = transaction.txid;
+    tx["hash"] = transaction.txid;
+    tx["version"] = 2;
+    tx["size"] = (Json::UInt64) size;
+    tx["vsize"] = (Json::UInt64) size;
+    tx["weight"] = (Json::UInt64) size * 4;
+    tx["locktime"] = 0;
+    tx["vin"] = Json::Value(Json::arrayValue);
+    tx["vout"] = Json::Value(Json::arrayValue);
+    if(transaction.inputs.empty()){
+        Json::Value in;
+        in["coinbase"] = "03" + transaction.txid.substr(0, 22);
+        in["sequence"] = 4294967295u;
+        tx["vin"].append(in);
+    }
+    int64_t fee = 0;
+    for(const synthinput_t& input : transaction.inputs){
+        Json::Value in;
+        const std::string& type = types[input.address];
+        bool witness = type.compare(0, 7, "witness") == 0;
+        in["txid"] = input.txid;
+        in["vout"] = input.vout;
+        in["scriptSig"]["asm"] = witness ? "" : std::string(143, '3');
+        in["scriptSig"]["hex"] = witness ? "" : std::string(212, '3');
+        if(witness){
+            in["txinwitness"].append(std::string(type == "witness_v1_taproot" ? 128 : 142, '3'));
+            if(type != "witness_v1_taproot") in["txinwitness"].append(std::string(66, '2'));
+        }
+        in["prevout"]["generated"] = input.generated;
+        in["prevout"]["height"] = input.height;
+        in["prevout"]["value"] = input.value / 1e8;
+        writeScript(input.address, in["prevout"]["scriptPubKey"]);
+        in["sequence"] = 4294967293u;
+        tx["vin"].append(in);
+        fee += input.value;
+    }
+    for(uint32_t n = 0; n < transaction.outputs.size(); n++){
+        Json::Value out;
+        out["value"] = transaction.outputs[n].value / 1e8;
+        out["n"] = n;
+        writeScript(transaction.outputs[n].address, out["scriptPubKey"]);
+        tx["vout"].append(out);
+        fee -= transaction.outputs[n].value;
+    }
+    if(!transaction.inputs.empty()) tx["fee"] = fee / 1e8;
+    tx["hex"] = std::string(2 * size, 'a');
+}
+
+static std::string writeResponse(Json::Value& result){
+    Json::Value reply;
+    reply["result"] = result;
+    reply["error"] = Json::Value::null;
+    reply["id"] = 0;
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    return Json::writeString(writer, reply);
+}
+
+std::string SyntheticChain::blockResponse(const std::vector<synthtransaction_t>& block, uint32_t blockHeight){
+    char hash[65], previous[65];
+    std::snprintf(hash, sizeof(hash), "%064x", blockHeight);
+    std::snprintf(previous, sizeof(previous), "%064x", blockHeight - 1);
+    Json::Value result;
+    result["hash"] = hash;
+    result["height"] = blockHeight;
+    result["version"] = 536870912;
+    result["time"] = 1231006505 + 600 * (Json::UInt64) blockHeight;
+    result["nTx"] = (Json::UInt64) block.size();
+    if(blockHeight > 0) result["previousblockhash"] = previous;
+    result["tx"] = Json::Value(Json::arrayValue);
+    for(const synthtransaction_t& transaction : block){
+        Json::Value tx;
+        writeTransaction(transaction, tx);
+        result["tx"].append(tx);
+    }
+    return writeResponse(result);
+}
+
+std::string SyntheticChain::transactionResponse(const synthtransaction_t& transaction){
+    Json::Value result;
+    writeTransaction(transaction, result);
+    return writeResponse(result);
+}
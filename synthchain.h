@@ -0,0 +1,97 @@
+#ifndef SYNTHCHAIN_H
+#define SYNTHCHAIN_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "definition.h"
+
+namespace Json{
+    class Value;
+}
+
+/* Proportions of the synthetic chain, the defaults give roughly the mix of a recent block once the early chain is over */
+struct synthshape_t{
+    /* Transactions of a block after the early chain, coinbase included */
+    uint32_t transactionsPerBlock = 2000;
+    /* The first blocks hold their coinbase and now and then one spend, paid to keys like in 2009 */
+    uint32_t earlyBlocks = 100;
+    /* Share of the transactions that gather many outputs into one, with between half and one and a half times consolidationInputs inputs */
+    uint32_t consolidationPercent = 3;
+    uint32_t consolidationInputs = 50;
+    /* Share of the payments that go to an address already paid before, drawn with a strong skew towards a few hot addresses */
+    uint32_t reusePercent = 30;
+};
+
+/* An input spends an output of an earlier transaction, a transaction without inputs is a coinbase */
+struct synthinput_t{
+    std::string txid;
+    uint32_t vout;
+    uint32_t address;
+    int64_t value;
+    /* Where the output spent was made */
+    uint32_t height;
+    bool generated;
+};
+
+struct synthoutput_t{
+    uint32_t address;
+    int64_t value;
+};
+
+struct synthtransaction_t{
+    std::string txid;
+    std::vector<synthinput_t> inputs;
+    std::vector<synthoutput_t> outputs;
+};
+
+/* Generates a deterministic chain with the shapes the clustering meets on mainnet: coinbase only blocks early on, then two output payments with a change, consolidations of many inputs and heavy reuse of a few addresses. Every address has an owner and a transaction only spends outputs of one owner, paying its change back to that owner, so the common input merges build entities the way they do on the real chain instead of joining everything. The addresses are numbered by the generator and carry a real script and address string, a block can be turned into transactions directly or into the JSON bitcoind would answer */
+class SyntheticChain{
+    public:
+    SyntheticChain(synthshape_t shape = synthshape_t(), uint64_t seed = 1);
+    /* Height of the next block */
+    uint32_t getHeight();
+    void nextBlock(std::vector<synthtransaction_t>& block);
+    /* The block as the pipeline has it after decoding, the addresses are interned in the AddressTable */
+    void decode(const std::vector<synthtransaction_t>& block, transactions_t& transactions);
+    /* The response to getblock with verbosity 3 for the block at height */
+    std::string blockResponse(const std::vector<synthtransaction_t>& block, uint32_t height);
+    /* The response to getrawtransaction with verbosity 2 */
+    std::string transactionResponse(const synthtransaction_t& transaction);
+    const std::string& addressName(uint32_t address);
+    size_t addressCount();
+    private:
+    synthshape_t shape;
+    uint64_t seed;
+    uint32_t height;
+    std::vector<std::string> scripts;
+    std::vector<std::string> types;
+    std::vector<std::string> names;
+    std::vector<uint32_t> owners;
+    /* ID in the AddressTable of each address once it has been interned */
+    std::vector<uint32_t> tableIds;
+    /* Addresses that get paid again and again, like exchanges and pools */
+    std::vector<uint32_t> hot;
+    /* The unspent outputs of each owner, and the owners that may have some */
+    std::vector<std::vector<synthinput_t> > funds;
+    std::vector<uint32_t> funded;
+    std::vector<bool> listed;
+    size_t unspentCount;
+
+    uint64_t random();
+    uint32_t below(uint64_t n);
+    std::string randomHex(size_t bytes);
+    uint32_t newOwner();
+    uint32_t addAddress(uint32_t owner, const std::string& prefix, size_t bytes, const std::string& suffix);
+    uint32_t newAddress(uint32_t owner, bool early);
+    uint32_t payee(bool early);
+    uint32_t tableId(uint32_t address);
+    uint32_t spender();
+    synthinput_t spend(uint32_t owner);
+    void addOutputs(synthtransaction_t& transaction, bool generated);
+    void writeScript(uint32_t address, Json::Value& script);
+    void writeTransaction(const synthtransaction_t& transaction, Json::Value& tx);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "workerpool.h"
+
+#include <algorithm>
+
+/* The calling thread works too, so a pool of n threads starts n - 1 workers */
+WorkerPool::WorkerPool(int threads)
+: stopping(false), generation(0), jobCount(0), jobChunkSize(1), jobChunks(0), nextChunk(0), busy(0)
+{
+    for(int i = 1; i < threads; i++){
+        workers.push_back(std::thread(&WorkerPool::work, this));
+    }
+}
+
+WorkerPool::~WorkerPool(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for(std::thread& worker : workers) worker.join();
+}
+
+int WorkerPool::getThreads(){
+    return workers.size() + 1;
+}
+
+void WorkerPool::runChunks(){
+    while(true){
+        size_t chunk = nextChunk.fetch_add(1);
+        if(chunk >= jobChunks) return;
+        size_t begin = chunk * jobChunkSize;
+        try{
+            job(chunk, begin, std::min(begin + jobChunkSize, jobCount));
+        }
+        catch(...){
+            std::lock_guard<std::mutex> guard(lock);
+            if(!error) error = std::current_exception();
+        }
+    }
+}
+
+void WorkerPool::work(){
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while(true){
+        jobReady.wait(guard, [this, seen]{ return stopping || generation != seen; });
+        if(stopping) return;
+        seen = generation;
+        busy++;
+        guard.unlock();
+        runChunks();
+        guard.lock();
+        if(--busy == 0) jobDone.notify_all();
+    }
+}
+
+void WorkerPool::parallelFor(size_t count, size_t chunkSize, std::function<void(size_t chunk, size_t begin, size_t end)> work){
+    if(count == 0) return;
+    if(chunkSize == 0) chunkSize = 1;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        /* A worker that woke up too late for the previous job may still be looking at it */
+        jobDone.wait(guard, [this]{ return busy == 0; });
+        job = work;
+        jobCount = count;
+        jobChunkSize = chunkSize;
+        jobChunks = (count + chunkSize - 1) / chunkSize;
+        nextChunk = 0;
+        error = nullptr;
+        generation++;
+    }
+    /* A single chunk is not worth waking anyone up for */
+    if(jobChunks > 1) jobReady.notify_all();
+    runChunks();
+    std::unique_lock<std::mutex> guard(lock);
+    /* Once no chunk is left to claim the workers may still be running the ones they took */
+    jobDone.wait(guard, [this]{ return busy == 0; });
+    job = nullptr;
+    if(error) std::rethrow_exception(error);
+}
@@ -0,0 +1,37 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+/* Threads started once and kept for the whole run. parallelFor splits a range into chunks that the workers and the calling thread claim one at a time, and returns once every chunk is done. The first exception thrown by a chunk is rethrown to the caller */
+class WorkerPool{
+    public:
+    WorkerPool(int threads);
+    ~WorkerPool();
+    void parallelFor(size_t count, size_t chunkSize, std::function<void(size_t chunk, size_t begin, size_t end)> work);
+    int getThreads();
+    private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable jobReady, jobDone;
+    bool stopping;
+    /* The job currently being run, generation tells the workers a new one was posted */
+    uint64_t generation;
+    std::function<void(size_t, size_t, size_t)> job;
+    size_t jobCount, jobChunkSize, jobChunks;
+    std::atomic<size_t> nextChunk;
+    int busy;
+    std::exception_ptr error;
+
+    void work();
+    void runChunks();
+};
+
+#endif